@@ -23,13 +23,19 @@
 #include "lv2_work.hxx"
 #include "lv2_state.hxx"
 
+#include <atomic>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
 
 #include "dsp/ports.hxx"
 #include "dsp/fabla2.hxx"
+#include "dsp/library.hxx"
+#include "dsp/telemetry.hxx"
+#include "dsp/capture.hxx"
 
 LV2_Handle FablaLV2::instantiate( const LV2_Descriptor* descriptor,
                                   double samplerate,
@@ -77,10 +83,39 @@ LV2_Handle FablaLV2::instantiate( const LV2_Descriptor* descriptor,
   tmp->unmap    = unmap;
   tmp->schedule = schedule;
   
-  mapUri( &tmp->uris, map );
-  lv2_atom_forge_init( &tmp->forge, map);
+  // FABLA2_CAPTURE is a directory to write a trace of each instance to, for
+  // replaying the session offline. The URIs are mapped through the Capture,
+  // so the trace knows the URIDs in the events it records
+  static std::atomic<int> instances( 0 );
+  const char* captureDir = getenv( "FABLA2_CAPTURE" );
+  char capturePath[1024];
+  if( captureDir )
+  {
+    snprintf( capturePath, sizeof(capturePath), "%s/fabla2-%i-%i.trace",
+              captureDir, (int)getpid(), instances++ );
+    tmp->capture = new Fabla2::Capture( capturePath, samplerate, map );
+    if( !tmp->capture->ok() )
+    {
+      delete tmp->capture;
+      tmp->capture = 0;
+    }
+  }
+  LV2_URID_Map* uriMap = tmp->capture ? tmp->capture->map() : map;
+  
+  mapUri( &tmp->uris, uriMap );
+  lv2_atom_forge_init( &tmp->forge, uriMap );
   lv2_log_logger_init( &tmp->logger, tmp->map, tmp->log);
   
+  if( tmp->capture )
+  {
+    tmp->capture->start();
+    lv2_log_note( &tmp->logger, "Fabla2: capturing to %s\n", capturePath );
+  }
+  else if( captureDir )
+  {
+    lv2_log_error( &tmp->logger, "Fabla2: can't capture to %s\n", capturePath );
+  }
+  
   tmp->dsp = new Fabla2::Fabla2DSP( samplerate, &tmp->uris );
   if( !tmp->dsp )
   {
@@ -99,12 +134,14 @@ LV2_Handle FablaLV2::instantiate( const LV2_Descriptor* descriptor,
 FablaLV2::FablaLV2(int rate)
 {
   sr = rate;
+  capture = 0;
   // it is assumed that buffersize is < samplerate
   auxBusBuffer = new float[rate];
 }
 
 FablaLV2::~FablaLV2()
 {
+  delete capture;
   delete[] auxBusBuffer;
   delete dsp;
 }
@@ -186,6 +223,9 @@ void FablaLV2::run(LV2_Handle instance, uint32_t nframes)
   lv2_atom_forge_set_buffer(&self->forge, (uint8_t*)self->out_port, space);
   lv2_atom_forge_sequence_head(&self->forge, &self->notify_frame, 0);
   
+  // time the MIDI and UI event dispatch
+  self->dsp->telemetry()->blockStart();
+  
   int midiMessagesIn = 0;
   // handle incoming MIDI
   LV2_ATOM_SEQUENCE_FOREACH(self->in_port, ev)
@@ -316,10 +356,17 @@ void FablaLV2::run(LV2_Handle instance, uint32_t nframes)
       lv2_log_trace(&self->logger, "Fabla2DSP: Unknown event type %d\n", self->unmap->unmap( self->unmap->handle, ev->body.type) );
     }
   }
+  self->dsp->telemetry()->stage( Fabla2::Telemetry::STAGE_MIDI );
   
+  if( self->capture )
+    self->capture->block( nframes, self->in_port, self->dsp->controlPorts );
   
   self->dsp->process( nframes );
   
+  if( self->capture )
+    self->capture->blockEnd( nframes, self->dsp->controlPorts,
+                             self->dsp->getLibrary()->fingerprint() );
+  
   return;
 }
 
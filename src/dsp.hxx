@@ -26,6 +26,7 @@
 namespace Fabla2
 {
   class Fabla2DSP;
+  class Capture;
 };
 
 class FablaLV2
@@ -67,6 +68,9 @@ class FablaLV2
     
     /// the actual DSP instance: public for LV2 Work Response, LV2 State Save
     Fabla2::Fabla2DSP* dsp;
+    
+    /// trace of the blocks for fabla2replay, when FABLA2_CAPTURE is set
+    Fabla2::Capture* capture;
   
   private:
     /// Sample rate
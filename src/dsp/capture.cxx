@@ -0,0 +1,352 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "capture.hxx"
+
+#include <string.h>
+#include <unistd.h>
+
+/// the writer thread wakes up this often to write the ring to the file
+#define FABLA2_CAPTURE_WRITE_US 20000
+
+static const char fabla2_capture_magic[8] = { 'F','A','B','L','A','2','T','\0' };
+
+/// bytes of the record that ends a trace: type and END
+static const size_t fabla2_capture_end_size = 2;
+/// bytes of a RECORD_BLOCK_END: type, padding, hash and fingerprint
+static const size_t fabla2_capture_block_end_size = 8 + 8 + 8;
+
+namespace Fabla2
+{
+
+Capture::Capture( const char* path, int rate, LV2_URID_Map* m ) :
+  file( fopen( path, "wb" ) ),
+  sr( rate ),
+  hostMap( m ),
+  responses( 0 ),
+  overflow( false ),
+  ring( FABLA2_CAPTURE_RING ),
+  writeIndex( 0 ),
+  readIndex( 0 ),
+  staged( 0 ),
+  quit( false )
+{
+  map_.handle = this;
+  map_.map    = mapUri;
+}
+
+LV2_URID Capture::mapUri( LV2_URID_Map_Handle h, const char* uri )
+{
+  Capture* self = (Capture*)h;
+  LV2_URID urid = self->hostMap->map( self->hostMap->handle, uri );
+  self->uris[uri] = urid;
+  return urid;
+}
+
+void Capture::start()
+{
+  if( !file )
+    return;
+
+  const uint32_t version = FABLA2_CAPTURE_VERSION;
+  const uint32_t rate    = sr;
+  const uint32_t nUris   = uris.size();
+  fwrite( fabla2_capture_magic, 1, sizeof(fabla2_capture_magic), file );
+  fwrite( &version, sizeof(version), 1, file );
+  fwrite( &rate   , sizeof(rate)   , 1, file );
+  fwrite( &nUris  , sizeof(nUris)  , 1, file );
+
+  for( std::map<std::string, LV2_URID>::iterator it = uris.begin(); it != uris.end(); ++it )
+  {
+    const uint32_t urid = it->second;
+    const uint32_t len  = it->first.size();
+    fwrite( &urid, sizeof(urid), 1, file );
+    fwrite( &len , sizeof(len) , 1, file );
+    fwrite( it->first.c_str(), 1, len, file );
+  }
+  fflush( file );
+
+  writer = std::thread( writerRun, this );
+}
+
+uint64_t Capture::hash( int nframes, const float* L, const float* R )
+{
+  // FNV-1a over the 32 bit words of the samples
+  uint64_t h = 14695981039346656037ULL;
+  const float* chans[2] = { L, R };
+  for(int c = 0; c < 2; c++)
+  {
+    for(int i = 0; i < nframes; i++)
+    {
+      uint32_t w;
+      memcpy( &w, &chans[c][i], sizeof(w) );
+      h = ( h ^ w ) * 1099511628211ULL;
+    }
+  }
+  return h;
+}
+
+bool Capture::reserve( size_t size )
+{
+  const uint64_t used = staged - readIndex.load();
+  return used + size + fabla2_capture_end_size <= ring.size();
+}
+
+void Capture::put( const void* data, size_t size )
+{
+  const uint8_t* d = (const uint8_t*)data;
+  const size_t at    = staged % ring.size();
+  const size_t first = size < ring.size() - at ? size : ring.size() - at;
+  memcpy( &ring[at], d, first );
+  memcpy( &ring[0], d + first, size - first );
+  staged += size;
+}
+
+void Capture::block( int nframes, const LV2_Atom_Sequence* events, float* const* ports )
+{
+  if( !file || overflow )
+    return;
+
+  const uint32_t eventBytes = events ? events->atom.size - sizeof(LV2_Atom_Sequence_Body) : 0;
+  const bool input = ports[RECORD_OVER_LAST_PLAYED_PAD] &&
+                     (int)*ports[RECORD_OVER_LAST_PLAYED_PAD] &&
+                     ports[INPUT_L] && ports[INPUT_R];
+
+  const size_t size = 1 + 1 + 2 + 4 + 4 + sizeof(float) * FABLA2_CAPTURE_CONTROLS +
+                      4 + eventBytes + ( input ? sizeof(float) * nframes * 2 : 0 );
+  if( !reserve( size + fabla2_capture_block_end_size ) )
+  {
+    // the writer can't keep up: end the trace, as it can't be replayed
+    // exactly after a gap
+    overflow = true;
+    const uint8_t end[fabla2_capture_end_size] = { RECORD_END, END_OVERFLOW };
+    put( end, sizeof(end) );
+    commit();
+    return;
+  }
+
+  const uint8_t  head[4] = { RECORD_BLOCK, input, 0, 0 };
+  const uint32_t frames  = nframes;
+  const uint32_t resp    = responses;
+  put( head   , sizeof(head)   );
+  put( &frames, sizeof(frames) );
+  put( &resp  , sizeof(resp)   );
+  for(int i = 0; i < FABLA2_CAPTURE_CONTROLS; i++)
+  {
+    const float v = ports[MASTER_VOL + i] ? *ports[MASTER_VOL + i] : 0.f;
+    put( &v, sizeof(v) );
+  }
+  put( &eventBytes, sizeof(eventBytes) );
+  if( eventBytes )
+    put( events + 1, eventBytes );
+  if( input )
+  {
+    put( ports[INPUT_L], sizeof(float) * nframes );
+    put( ports[INPUT_R], sizeof(float) * nframes );
+  }
+  responses = 0;
+}
+
+void Capture::blockEnd( int nframes, float* const* ports, uint64_t kitFingerprint )
+{
+  if( !file || overflow )
+    return;
+
+  // space was reserved by block()
+  const uint8_t  head[8] = { RECORD_BLOCK_END, 0, 0, 0, 0, 0, 0, 0 };
+  const uint64_t h = hash( nframes, ports[OUTPUT_L], ports[OUTPUT_R] );
+  put( head, sizeof(head) );
+  put( &h, sizeof(h) );
+  put( &kitFingerprint, sizeof(kitFingerprint) );
+  commit();
+}
+
+void Capture::drain()
+{
+  const uint64_t r = readIndex.load();
+  const uint64_t w = writeIndex.load();
+  if( w == r )
+    return;
+
+  const size_t at    = r % ring.size();
+  const size_t size  = w - r;
+  const size_t first = size < ring.size() - at ? size : ring.size() - at;
+  fwrite( &ring[at], 1, first, file );
+  fwrite( &ring[0], 1, size - first, file );
+  fflush( file );
+
+  readIndex.store( w );
+}
+
+void Capture::writerRun( Capture* self )
+{
+  while( !self->quit.load() )
+  {
+    self->drain();
+    usleep( FABLA2_CAPTURE_WRITE_US );
+  }
+}
+
+Capture::~Capture()
+{
+  if( !file )
+    return;
+
+  quit.store( true );
+  if( writer.joinable() )
+    writer.join();
+  drain();
+
+  if( !overflow )
+  {
+    const uint8_t end[fabla2_capture_end_size] = { RECORD_END, END_STOPPED };
+    fwrite( end, 1, sizeof(end), file );
+  }
+  fclose( file );
+}
+
+CaptureReader::CaptureReader() :
+  file( 0 ),
+  first( 0 ),
+  sr( 0 ),
+  end_( -1 )
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+  if( file )
+    fclose( file );
+}
+
+bool CaptureReader::read( void* data, size_t size )
+{
+  return fread( data, 1, size, file ) == size;
+}
+
+bool CaptureReader::open( const char* path )
+{
+  file = fopen( path, "rb" );
+  if( !file )
+  {
+    fprintf( stderr, "Fabla2 capture: can't open %s\n", path );
+    return false;
+  }
+
+  char magic[8];
+  uint32_t version = 0;
+  uint32_t rate    = 0;
+  uint32_t nUris   = 0;
+  if( !read( magic, sizeof(magic) ) || memcmp( magic, fabla2_capture_magic, sizeof(magic) ) ||
+      !read( &version, sizeof(version) ) )
+  {
+    fprintf( stderr, "Fabla2 capture: %s is not a Fabla2 trace\n", path );
+    return false;
+  }
+  if( version != FABLA2_CAPTURE_VERSION )
+  {
+    fprintf( stderr, "Fabla2 capture: %s is version %u, this reads version %i\n",
+             path, version, FABLA2_CAPTURE_VERSION );
+    return false;
+  }
+
+  bool ok = read( &rate, sizeof(rate) ) && read( &nUris, sizeof(nUris) );
+  for(uint32_t i = 0; ok && i < nUris; i++)
+  {
+    uint32_t urid = 0;
+    uint32_t len  = 0;
+    ok = read( &urid, sizeof(urid) ) && read( &len, sizeof(len) ) && len < 4096;
+    if( ok )
+    {
+      std::string uri( len, '\0' );
+      ok = read( &uri[0], len );
+      uris_[uri] = urid;
+    }
+  }
+  if( !ok || rate == 0 )
+  {
+    fprintf( stderr, "Fabla2 capture: %s has a broken header\n", path );
+    return false;
+  }
+
+  sr = rate;
+  first = ftell( file );
+  return true;
+}
+
+void CaptureReader::rewind()
+{
+  if( file )
+    fseek( file, first, SEEK_SET );
+  end_ = -1;
+}
+
+bool CaptureReader::next( Block& b )
+{
+  if( !file )
+    return false;
+
+  uint8_t type = 0;
+  if( !read( &type, 1 ) )
+    return false;
+
+  if( type == Capture::RECORD_END )
+  {
+    uint8_t reason = 0;
+    if( read( &reason, 1 ) )
+      end_ = reason;
+    return false;
+  }
+  if( type != Capture::RECORD_BLOCK )
+    return false;
+
+  uint8_t  head[3];
+  uint32_t frames = 0;
+  uint32_t resp   = 0;
+  uint32_t eventBytes = 0;
+  if( !read( head, sizeof(head) ) || !read( &frames, sizeof(frames) ) ||
+      !read( &resp, sizeof(resp) ) ||
+      !read( b.controls, sizeof(b.controls) ) ||
+      !read( &eventBytes, sizeof(eventBytes) ) )
+    return false;
+
+  b.nframes   = frames;
+  b.responses = resp;
+  b.events.resize( eventBytes );
+  if( eventBytes && !read( &b.events[0], eventBytes ) )
+    return false;
+
+  const bool input = head[0];
+  b.inL.resize( input ? frames : 0 );
+  b.inR.resize( input ? frames : 0 );
+  if( input && frames && ( !read( &b.inL[0], sizeof(float) * frames ) ||
+                           !read( &b.inR[0], sizeof(float) * frames ) ) )
+    return false;
+
+  // a block without its end was cut off when the capture was killed
+  uint8_t end[8];
+  if( !read( end, sizeof(end) ) || end[0] != Capture::RECORD_BLOCK_END ||
+      !read( &b.hash, sizeof(b.hash) ) || !read( &b.kitFingerprint, sizeof(b.kitFingerprint) ) )
+    return false;
+
+  return true;
+}
+
+}; // Fabla2
@@ -0,0 +1,192 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_CAPTURE_HXX
+#define OPENAV_FABLA2_CAPTURE_HXX
+
+#include "ports.hxx"
+
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+#include "lv2/lv2plug.in/ns/ext/urid/urid.h"
+
+#include <map>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdint.h>
+
+/// bytes of blocks that can wait for the writer thread: when the ring is full
+/// the capture stops, and the trace ends there
+#define FABLA2_CAPTURE_RING (4 << 20)
+/// the control ports captured each block, from MASTER_VOL on
+#define FABLA2_CAPTURE_CONTROLS ( PORT_COUNT - MASTER_VOL )
+/// version of the trace format
+#define FABLA2_CAPTURE_VERSION 1
+
+namespace Fabla2
+{
+
+/** Capture
+ * An opt-in trace of everything FablaLV2::run() receives, to replay a session
+ * offline with fabla2replay. Each block records its size, the control ports,
+ * the input Atom sequence as it arrived, how many worker responses the host
+ * delivered before it, and the input audio while recording. After the block,
+ * a hash of the master output and the fingerprint of the kit that played are
+ * recorded, so a replay can tell the block where it stops being exact.
+ *
+ * The RT thread copies blocks into a lock-free ring, and a writer thread
+ * appends them to the file. URIDs are host specific: the header holds the
+ * URIs the plugin mapped through map(), and a replay maps them to the same
+ * URIDs.
+ *
+ * The trace is native endian: it is replayed on the machine it was captured
+ * on, or one like it.
+ */
+class Capture
+{
+  public:
+    /// opens the trace at path, the URIs are mapped by the host map
+    Capture( const char* path, int rate, LV2_URID_Map* hostMap );
+    /// stops the writer thread, and writes the rest of the trace
+    ~Capture();
+
+    /// false when the trace could not be opened
+    bool ok(){return file != 0;}
+
+    /// a URID map that records what is mapped, for the header: the plugin
+    /// maps its URIs through it before start()
+    LV2_URID_Map* map(){return &map_;}
+
+    /// writes the header, and starts the writer thread
+    void start();
+
+    /// records a block before it is processed, from the plugin ports by
+    /// Fabla2Ports index. The input audio is only recorded while the record
+    /// port is on, as nothing else plays it. RT thread only
+    void block( int nframes, const LV2_Atom_Sequence* events, float* const* ports );
+    /// records the master output of the block, and the kit that played it.
+    /// RT thread only
+    void blockEnd( int nframes, float* const* ports, uint64_t kitFingerprint );
+    /// counts a worker response delivered before the next block
+    void response(){responses++;}
+
+    /// hash of a block of stereo audio, to compare a replay with
+    static uint64_t hash( int nframes, const float* L, const float* R );
+
+    /// record types
+    enum RECORD {
+      RECORD_BLOCK = 1,
+      RECORD_BLOCK_END,
+      RECORD_END,
+    };
+    /// how a trace ends
+    enum END {
+      END_STOPPED = 0,
+      END_OVERFLOW,
+    };
+
+  private:
+    FILE* file;
+    int   sr;
+
+    LV2_URID_Map* hostMap;
+    LV2_URID_Map  map_;
+    std::map<std::string, LV2_URID> uris;
+    static LV2_URID mapUri( LV2_URID_Map_Handle h, const char* uri );
+
+    /// the responses delivered since the last block
+    int responses;
+    /// set when the ring was full: nothing is recorded after it
+    bool overflow;
+
+    /// a single producer, single consumer byte ring
+    std::vector<uint8_t> ring;
+    std::atomic<uint64_t> writeIndex;
+    std::atomic<uint64_t> readIndex;
+    /// true when size bytes fit, keeping space for the RECORD_END
+    bool reserve( size_t size );
+    /// writes after the last record, commit() makes it visible to the writer
+    uint64_t staged;
+    void put( const void* data, size_t size );
+    void commit(){writeIndex.store( staged );}
+
+    std::thread writer;
+    std::atomic<bool> quit;
+    static void writerRun( Capture* self );
+    /// writes the ring to the file. Writer thread only
+    void drain();
+};
+
+/** CaptureReader
+ * Reads a trace written by Capture, block by block.
+ */
+class CaptureReader
+{
+  public:
+    CaptureReader();
+    ~CaptureReader();
+
+    /// reads the header, returns false and prints why when it can't
+    bool open( const char* path );
+    /// goes back to the first block
+    void rewind();
+
+    int rate(){return sr;}
+    /// the URIs the plugin mapped, and their URIDs when it was captured
+    const std::map<std::string, LV2_URID>& uris(){return uris_;}
+
+    struct Block
+    {
+      int nframes;
+      /// worker responses delivered before the block
+      int responses;
+      float controls[FABLA2_CAPTURE_CONTROLS];
+      /// the body of the input sequence: LV2_Atom_Events, padded
+      std::vector<uint8_t> events;
+      /// input audio, empty when it was not captured
+      std::vector<float> inL;
+      std::vector<float> inR;
+      /// of the output, and the kit that played it
+      uint64_t hash;
+      uint64_t kitFingerprint;
+    };
+
+    /// reads the next block. Returns false at the end of the trace
+    bool next( Block& b );
+
+    /// how the trace ended: Capture::END, or -1 when it is truncated
+    int end(){return end_;}
+
+  private:
+    FILE* file;
+    long  first;
+    int   sr;
+    int   end_;
+    std::map<std::string, LV2_URID> uris_;
+
+    bool read( void* data, size_t size );
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_CAPTURE_HXX
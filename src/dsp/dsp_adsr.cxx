@@ -96,3 +96,70 @@ void ADSR::setTargetRatioDR(float targetRatio) {
   decayBase = (sustainLevel - targetRatioDR) * (1.0 - decayCoef);
   releaseBase = -targetRatioDR * (1.0 - releaseCoef);
 }
+
+// Renders n values of the envelope, identical to calling process() n times.
+// Each segment runs as a branch-free recurrence clamped at its target, and is
+// only split where the state changes: the clamped value is exactly the value
+// process() snaps to on the transition, so finding the first frame that hit
+// the target gives the frame where the state changes.
+void ADSR::processBlock(float* out, int n) {
+  int i = 0;
+  while (i < n) {
+    switch (state) {
+      case ENV_IDLE:
+      case ENV_SUSTAIN:
+          for (; i < n; i++)
+              out[i] = output;
+          break;
+      case ENV_ATTACK:
+          i += renderRising(out + i, n - i, attackBase, attackCoef, 1.0);
+          if (output >= 1.0)
+              state = ENV_DECAY;
+          break;
+      case ENV_DECAY:
+          i += renderFalling(out + i, n - i, decayBase, decayCoef, sustainLevel);
+          if (output <= sustainLevel)
+              state = ENV_SUSTAIN;
+          break;
+      case ENV_RELEASE:
+          i += renderFalling(out + i, n - i, releaseBase, releaseCoef, 0.0);
+          if (output <= 0.0)
+              state = ENV_IDLE;
+          break;
+    }
+  }
+}
+
+// renders up to n frames of a rising segment, returns the frames rendered
+int ADSR::renderRising(float* out, int n, float base, float coef, float target) {
+  float y = output;
+  for (int i = 0; i < n; i++) {
+    y = fminf(base + y * coef, target);
+    out[i] = y;
+  }
+  for (int i = 0; i < n; i++) {
+    if (out[i] >= target) {
+      output = target;
+      return i + 1;
+    }
+  }
+  output = y;
+  return n;
+}
+
+// renders up to n frames of a falling segment, returns the frames rendered
+int ADSR::renderFalling(float* out, int n, float base, float coef, float target) {
+  float y = output;
+  for (int i = 0; i < n; i++) {
+    y = fmaxf(base + y * coef, target);
+    out[i] = y;
+  }
+  for (int i = 0; i < n; i++) {
+    if (out[i] <= target) {
+      output = target;
+      return i + 1;
+    }
+  }
+  output = y;
+  return n;
+}
@@ -44,6 +44,7 @@ public:
   ADSR();
   ~ADSR();
   float process(void);
+  void processBlock(float* out, int n);
   float getOutput(void);
   int getState(void);
   void gate(int on);
@@ -80,6 +81,8 @@ protected:
   float releaseBase;
 
   float calcCoef(float rate, float targetRatio);
+  int renderRising(float* out, int n, float base, float coef, float target);
+  int renderFalling(float* out, int n, float base, float coef, float target);
 };
 
 inline float ADSR::process() {
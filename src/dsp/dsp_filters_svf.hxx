@@ -35,6 +35,34 @@ namespace Fabla2
 
 using namespace std;
 
+/// semitones in the MIDI note to Hz lookup table
+#define FABLA2_SVF_NOTES 144
+
+/** SVFNoteTable
+ *  MIDI note to Hz lookup, one entry per semitone. Interpolating linearly
+ *  between semitones stays within 0.05% of the exact pow() curve.
+**/
+struct SVFNoteTable
+{
+  float hz[FABLA2_SVF_NOTES];
+  
+  SVFNoteTable()
+  {
+    for(int i = 0; i < FABLA2_SVF_NOTES; i++)
+      hz[i] = 440.0*pow(2.0, (i - 69.0)/12.0);
+  }
+  
+  static float noteToHz( float note )
+  {
+    static const SVFNoteTable table;
+    if ( note < 0 ) note = 0;
+    if ( note > FABLA2_SVF_NOTES - 1.001f ) note = FABLA2_SVF_NOTES - 1.001f;
+    int   n    = note;
+    float frac = note - n;
+    return table.hz[n] + (table.hz[n+1] - table.hz[n]) * frac;
+  }
+};
+
 /** FiltersSVF
  *  This class contains a state-variable-filter implementation allowing faster
  *  modulation of parameters than the original Filters class. It also has added
@@ -48,6 +76,9 @@ class FiltersSVF
     FiltersSVF(int sr) :
       samplerate( sr )
     {
+      value = resonance = resDamping = 0;
+      impFreqTarget = 1;
+      reset();
       init();
       active = false;
       setValue( 1 );
@@ -82,13 +113,23 @@ class FiltersSVF
     float getResonance(){return resonance;}
     float getDrive    (){return drive;    }
     
+    /// clears the filter state, and makes the next parameters set apply
+    /// without ramping: used when a voice starts a new note
+    void reset()
+    {
+      notch = low = high = band = 0.f;
+      snap = true;
+    }
+    
     /// set frequency using float with range from 0 - 1
     void setValue( float v )
     {
-      float midiNote = 24.f + v * 80.f;
-      float tmp = 440.0*pow(2.0, (midiNote - 69.0)/12.0);
+      if ( v == value && !snap )
+        return;
+      value = v;
       
-      setFrequency( tmp );
+      float midiNote = 24.f + v * 80.f;
+      setFrequency( SVFNoteTable::noteToHz( midiNote ) );
     }
     
     void setFrequency(float f)
@@ -98,7 +139,8 @@ class FiltersSVF
       if ( frequency > samplerate / 2 - 200 ) frequency = samplerate / 2 - 200;
       
       // samplerate * 2 because it's double sampled
-      impFreq = 2.0*sin(M_PI*min(0.25f, frequency/(samplerate*2.f)));
+      impFreqTarget = 2.0*sin(M_PI*min(0.25f, frequency/(samplerate*2.f)));
+      updateDamping();
     }
     
     /// set resonance, range 0 - 1
@@ -106,9 +148,12 @@ class FiltersSVF
     {
       if ( r > 1.0 ) r = 1.0;
       if ( r < 0.0 ) r = 0.0;
+      if ( r == resonance && !snap )
+        return;
       resonance = r;
       float tmpRes = r * 0.9;
-      damping = min(2.0*(1.0 - pow(tmpRes, 0.25)), min(1.5, 2.0/impFreq - impFreq*0.5));
+      resDamping = 2.0*(1.0 - pow(tmpRes, 0.25));
+      updateDamping();
     }
     
     /// set drive / distrotion of filter, range 0 - 1
@@ -131,8 +176,20 @@ class FiltersSVF
     
     void process (long count, float* input, float* output)
     {
+      // ramp coefficients to their targets over this block
+      float impFreqStep = 0.f;
+      float dampingStep = 0.f;
+      if ( count > 0 )
+      {
+        impFreqStep = (impFreqTarget - impFreq) / count;
+        dampingStep = (dampingTarget - damping) / count;
+      }
+      
       for (int i=0; i < count; i++)
       {
+        impFreq += impFreqStep;
+        damping += dampingStep;
+        
         float in = input[i];
         float out = 0.f;
         
@@ -154,9 +211,14 @@ class FiltersSVF
         
         output[i] = out;
       }
+      
+      // land exactly on the targets, so a settled filter has no ramp
+      impFreq = impFreqTarget;
+      damping = dampingTarget;
+      snap = false;
     }
   
-  private:
+  protected:
     /// sets the filters frequency
     float frequency;
     
@@ -180,10 +242,19 @@ class FiltersSVF
     
     /// damping factor: not an input, co-efficient only
     float damping;
+    float dampingTarget;
+    /// damping from the resonance, before limiting for stability
+    float resDamping;
+    
+    /// the last setValue(), to skip recalculating unchanged parameters
+    float value;
+    /// when true, the next coefficients are applied without a ramp
+    bool snap;
     
     // implementation variables
     // implementation frequency
     float impFreq;
+    float impFreqTarget;
     float notch;//  = notch output
     float low;//    = low pass output
     float high;//   = high pass output
@@ -192,6 +263,17 @@ class FiltersSVF
     
     const int samplerate;
     
+    /// damping depends on both the resonance and the frequency
+    void updateDamping()
+    {
+      dampingTarget = min(resDamping, (float)min(1.5, 2.0/impFreqTarget - impFreqTarget*0.5));
+      if ( snap )
+      {
+        impFreq = impFreqTarget;
+        damping = dampingTarget;
+      }
+    }
+    
     // sets up initial state:
     // -lowpass at 400 Hz
     // -small bit of resonance
@@ -206,6 +288,105 @@ class FiltersSVF
     }
 };
 
+/** FiltersSVFStereo
+ *  A stereo FiltersSVF: both channels share the coefficients, and the left and
+ *  right filter state is kept together in one SIMD vector, so both channels are
+ *  filtered in a single pass. Output is the same as two FiltersSVF instances.
+**/
+class FiltersSVFStereo : public FiltersSVF
+{
+  public:
+    FiltersSVFStereo(int sr) :
+      FiltersSVF( sr )
+    {
+      reset();
+    }
+    
+    void reset()
+    {
+      FiltersSVF::reset();
+      const v4sf zero = { 0, 0, 0, 0 };
+      notchLR = lowLR = highLR = bandLR = zero;
+    }
+    
+    void process (long count, const float* inL, const float* inR,
+                  float* outL, float* outR)
+    {
+      // ramp coefficients to their targets over this block
+      float impFreqStep = 0.f;
+      float dampingStep = 0.f;
+      if ( count > 0 )
+      {
+        impFreqStep = (impFreqTarget - impFreq) / count;
+        dampingStep = (dampingTarget - damping) / count;
+      }
+      
+      const v4sf half = splat( 0.5f );
+      const v4sf dr   = splat( drive );
+      const v4sf vL   = splat( volLowpass );
+      const v4sf vH   = splat( volHighpass );
+      const v4sf vB   = splat( volBandpass );
+      const v4sf vN   = splat( volNotch );
+      
+      v4sf notch = notchLR;
+      v4sf low   = lowLR;
+      v4sf high  = highLR;
+      v4sf band  = bandLR;
+      
+      for (int i=0; i < count; i++)
+      {
+        impFreq += impFreqStep;
+        damping += dampingStep;
+        const v4sf f = splat( impFreq );
+        const v4sf d = splat( damping );
+        
+        const v4sf in = { inL[i], inR[i], 0, 0 };
+        
+        notch = in - d*band;
+        low   = low + f*band;
+        high  = notch - low;
+        band  = f*high + band - dr*band*band*band;
+        
+        v4sf out = half * ( (low*vL) + (high*vH) + (band*vB) + (notch*vN) );
+        
+        notch = in - d*band;
+        low   = low + f*band;
+        high  = notch - low;
+        band  = f*high + band - dr*band*band*band;
+        
+        out += half * ( (low*vL) + (high*vH) + (band*vB) + (notch*vN) );
+        
+        outL[i] = out[0];
+        outR[i] = out[1];
+      }
+      
+      notchLR = notch;
+      lowLR   = low;
+      highLR  = high;
+      bandLR  = band;
+      
+      // land exactly on the targets, so a settled filter has no ramp
+      impFreq = impFreqTarget;
+      damping = dampingTarget;
+      snap = false;
+    }
+  
+  private:
+    /// GCC vector extension: compiles to SSE or NEON, lanes are L, R, unused
+    typedef float v4sf __attribute__ ((vector_size (16)));
+    
+    static v4sf splat( float v )
+    {
+      const v4sf r = { v, v, v, v };
+      return r;
+    }
+    
+    v4sf notchLR;
+    v4sf lowLR;
+    v4sf highLR;
+    v4sf bandLR;
+};
+
 }; // Fabla2
 
 #endif // OPENAV_DSP_FILTERS_H
@@ -0,0 +1,440 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "dsp_hermite.hxx"
+
+#include <stdio.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#define FABLA2_HERMITE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FABLA2_HERMITE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// NOTE: the vectorized kernels must perform the *exact* same float operations
+// as the scalar reference, in the same order, so output is bit-identical. The
+// build disables FMA contraction for this file to keep it that way.
+
+namespace Fabla2
+{
+
+/// cubic 4-point Hermite-curve interpolation of a single frame
+template<typename T>
+static inline float hermite( const T* audio, float playIndex )
+{
+  int inpos = playIndex;
+  float finpos = playIndex - (int)playIndex;
+  float xm1 = pcm_to_float( audio[inpos    ] );
+  float x0  = pcm_to_float( audio[inpos + 1] );
+  float x1  = pcm_to_float( audio[inpos + 2] );
+  float x2  = pcm_to_float( audio[inpos + 3] );
+  float a = (3 * (x0-x1) - xm1 + x2) / 2;
+  float b = 2*x1 + xm1 - (5*x0 + x2) / 2;
+  float c = (x1 - xm1) / 2;
+  return (((a * finpos) + b) * finpos + c) * finpos + x0;
+}
+
+/// steps the playhead over n frames, storing the read position of each frame.
+/// Positions are accumulated one frame at a time exactly like the scalar
+/// kernel does, so the vectorized kernels read identical positions.
+static inline void hermite_positions( float* index, float delta, int n,
+                                      float* pos )
+{
+  float playIndex = *index;
+  for(int i = 0; i < n; i++)
+  {
+    pos[i] = playIndex;
+    playIndex += delta;
+  }
+  *index = playIndex;
+}
+
+template<typename T>
+static void hermite_mono_scalar( const T* audio,
+                                 float* index, float delta,
+                                 float panL, float panR,
+                                 int nframes, float* L, float* R )
+{
+  float playIndex = *index;
+  for(int i = 0; i < nframes; i++ )
+  {
+    float out = hermite( audio, playIndex );
+    L[i] = out * panL;
+    R[i] = out * panR;
+    playIndex += delta;
+  }
+  *index = playIndex;
+}
+
+template<typename T>
+static void hermite_stereo_scalar( const T* audioL, const T* audioR,
+                                   float* index, float delta,
+                                   float panL, float panR,
+                                   int nframes, float* L, float* R )
+{
+  float playIndex = *index;
+  for(int i = 0; i < nframes; i++ )
+  {
+    L[i] = hermite( audioL, playIndex ) * panL;
+    R[i] = hermite( audioR, playIndex ) * panR;
+    playIndex += delta;
+  }
+  *index = playIndex;
+}
+
+#ifdef FABLA2_HERMITE_X86
+/// SSE2: 4 frames per iteration. Each frame needs 4 consecutive input
+/// samples: load them as a row, and transpose to get xm1, x0, x1, x2 columns.
+__attribute__((target("sse2")))
+static inline __m128 hermite_sse2( const float* audio, const int* inpos,
+                                   __m128 finpos )
+{
+  __m128 xm1 = _mm_loadu_ps( audio + inpos[0] );
+  __m128 x0  = _mm_loadu_ps( audio + inpos[1] );
+  __m128 x1  = _mm_loadu_ps( audio + inpos[2] );
+  __m128 x2  = _mm_loadu_ps( audio + inpos[3] );
+  _MM_TRANSPOSE4_PS( xm1, x0, x1, x2 );
+
+  const __m128 half  = _mm_set1_ps( 0.5f );
+  const __m128 two   = _mm_set1_ps( 2.f );
+  const __m128 three = _mm_set1_ps( 3.f );
+  const __m128 five  = _mm_set1_ps( 5.f );
+
+  __m128 a = _mm_mul_ps( _mm_add_ps( _mm_sub_ps( _mm_mul_ps( three,
+             _mm_sub_ps( x0, x1 ) ), xm1 ), x2 ), half );
+  __m128 b = _mm_sub_ps( _mm_add_ps( _mm_mul_ps( two, x1 ), xm1 ),
+             _mm_mul_ps( _mm_add_ps( _mm_mul_ps( five, x0 ), x2 ), half ) );
+  __m128 c = _mm_mul_ps( _mm_sub_ps( x1, xm1 ), half );
+
+  __m128 out = _mm_add_ps( _mm_mul_ps( a, finpos ), b );
+  out = _mm_add_ps( _mm_mul_ps( out, finpos ), c );
+  return _mm_add_ps( _mm_mul_ps( out, finpos ), x0 );
+}
+
+__attribute__((target("sse2")))
+static inline __m128 hermite_sse2_finpos( const float* pos, int* inpos )
+{
+  __m128  p  = _mm_loadu_ps( pos );
+  __m128i ip = _mm_cvttps_epi32( p );
+  _mm_storeu_si128( (__m128i*)inpos, ip );
+  return _mm_sub_ps( p, _mm_cvtepi32_ps( ip ) );
+}
+
+__attribute__((target("sse2")))
+static void hermite_mono_sse2( const float* audio,
+                               float* index, float delta,
+                               float panL, float panR,
+                               int nframes, float* L, float* R )
+{
+  const __m128 vPanL = _mm_set1_ps( panL );
+  const __m128 vPanR = _mm_set1_ps( panR );
+
+  float pos[4];
+  int inpos[4];
+  int i = 0;
+  for( ; i + 4 <= nframes; i += 4 )
+  {
+    hermite_positions( index, delta, 4, pos );
+
+    __m128 out = hermite_sse2( audio, inpos, hermite_sse2_finpos( pos, inpos ) );
+    _mm_storeu_ps( L + i, _mm_mul_ps( out, vPanL ) );
+    _mm_storeu_ps( R + i, _mm_mul_ps( out, vPanR ) );
+  }
+
+  hermite_mono_scalar( audio, index, delta, panL, panR,
+                       nframes - i, L + i, R + i );
+}
+
+__attribute__((target("sse2")))
+static void hermite_stereo_sse2( const float* audioL, const float* audioR,
+                                 float* index, float delta,
+                                 float panL, float panR,
+                                 int nframes, float* L, float* R )
+{
+  const __m128 vPanL = _mm_set1_ps( panL );
+  const __m128 vPanR = _mm_set1_ps( panR );
+
+  float pos[4];
+  int inpos[4];
+  int i = 0;
+  for( ; i + 4 <= nframes; i += 4 )
+  {
+    hermite_positions( index, delta, 4, pos );
+
+    // read positions are shared by both channels
+    __m128 finpos = hermite_sse2_finpos( pos, inpos );
+    _mm_storeu_ps( L + i, _mm_mul_ps( hermite_sse2( audioL, inpos, finpos ), vPanL ) );
+    _mm_storeu_ps( R + i, _mm_mul_ps( hermite_sse2( audioR, inpos, finpos ), vPanR ) );
+  }
+
+  hermite_stereo_scalar( audioL, audioR, index, delta,
+                         panL, panR, nframes - i, L + i, R + i );
+}
+
+/// AVX2: 8 frames per iteration, using gathers to read the input samples
+__attribute__((target("avx2")))
+static inline __m256 hermite_avx2( const float* audio, __m256i inpos,
+                                   __m256 finpos )
+{
+  __m256 xm1 = _mm256_i32gather_ps( audio    , inpos, 4 );
+  __m256 x0  = _mm256_i32gather_ps( audio + 1, inpos, 4 );
+  __m256 x1  = _mm256_i32gather_ps( audio + 2, inpos, 4 );
+  __m256 x2  = _mm256_i32gather_ps( audio + 3, inpos, 4 );
+
+  const __m256 half  = _mm256_set1_ps( 0.5f );
+  const __m256 two   = _mm256_set1_ps( 2.f );
+  const __m256 three = _mm256_set1_ps( 3.f );
+  const __m256 five  = _mm256_set1_ps( 5.f );
+
+  __m256 a = _mm256_mul_ps( _mm256_add_ps( _mm256_sub_ps( _mm256_mul_ps( three,
+             _mm256_sub_ps( x0, x1 ) ), xm1 ), x2 ), half );
+  __m256 b = _mm256_sub_ps( _mm256_add_ps( _mm256_mul_ps( two, x1 ), xm1 ),
+             _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( five, x0 ), x2 ), half ) );
+  __m256 c = _mm256_mul_ps( _mm256_sub_ps( x1, xm1 ), half );
+
+  __m256 out = _mm256_add_ps( _mm256_mul_ps( a, finpos ), b );
+  out = _mm256_add_ps( _mm256_mul_ps( out, finpos ), c );
+  return _mm256_add_ps( _mm256_mul_ps( out, finpos ), x0 );
+}
+
+__attribute__((target("avx2")))
+static void hermite_mono_avx2( const float* audio,
+                               float* index, float delta,
+                               float panL, float panR,
+                               int nframes, float* L, float* R )
+{
+  const __m256 vPanL = _mm256_set1_ps( panL );
+  const __m256 vPanR = _mm256_set1_ps( panR );
+
+  float pos[8];
+  int i = 0;
+  for( ; i + 8 <= nframes; i += 8 )
+  {
+    hermite_positions( index, delta, 8, pos );
+
+    __m256  p      = _mm256_loadu_ps( pos );
+    __m256i inpos  = _mm256_cvttps_epi32( p );
+    __m256  finpos = _mm256_sub_ps( p, _mm256_cvtepi32_ps( inpos ) );
+
+    __m256 out = hermite_avx2( audio, inpos, finpos );
+    _mm256_storeu_ps( L + i, _mm256_mul_ps( out, vPanL ) );
+    _mm256_storeu_ps( R + i, _mm256_mul_ps( out, vPanR ) );
+  }
+
+  hermite_mono_sse2( audio, index, delta, panL, panR,
+                     nframes - i, L + i, R + i );
+}
+
+__attribute__((target("avx2")))
+static void hermite_stereo_avx2( const float* audioL, const float* audioR,
+                                 float* index, float delta,
+                                 float panL, float panR,
+                                 int nframes, float* L, float* R )
+{
+  const __m256 vPanL = _mm256_set1_ps( panL );
+  const __m256 vPanR = _mm256_set1_ps( panR );
+
+  float pos[8];
+  int i = 0;
+  for( ; i + 8 <= nframes; i += 8 )
+  {
+    hermite_positions( index, delta, 8, pos );
+
+    __m256  p      = _mm256_loadu_ps( pos );
+    __m256i inpos  = _mm256_cvttps_epi32( p );
+    __m256  finpos = _mm256_sub_ps( p, _mm256_cvtepi32_ps( inpos ) );
+
+    _mm256_storeu_ps( L + i, _mm256_mul_ps( hermite_avx2( audioL, inpos, finpos ), vPanL ) );
+    _mm256_storeu_ps( R + i, _mm256_mul_ps( hermite_avx2( audioR, inpos, finpos ), vPanR ) );
+  }
+
+  hermite_stereo_sse2( audioL, audioR, index, delta,
+                       panL, panR, nframes - i, L + i, R + i );
+}
+#endif // FABLA2_HERMITE_X86
+
+#ifdef FABLA2_HERMITE_NEON
+/// NEON: 4 frames per iteration, transposing rows of input like SSE2
+static inline float32x4_t hermite_neon( const float* audio, const int* inpos,
+                                        float32x4_t finpos )
+{
+  float32x4x2_t t01 = vtrnq_f32( vld1q_f32( audio + inpos[0] ),
+                                 vld1q_f32( audio + inpos[1] ) );
+  float32x4x2_t t23 = vtrnq_f32( vld1q_f32( audio + inpos[2] ),
+                                 vld1q_f32( audio + inpos[3] ) );
+  float32x4_t xm1 = vcombine_f32( vget_low_f32 ( t01.val[0] ), vget_low_f32 ( t23.val[0] ) );
+  float32x4_t x0  = vcombine_f32( vget_low_f32 ( t01.val[1] ), vget_low_f32 ( t23.val[1] ) );
+  float32x4_t x1  = vcombine_f32( vget_high_f32( t01.val[0] ), vget_high_f32( t23.val[0] ) );
+  float32x4_t x2  = vcombine_f32( vget_high_f32( t01.val[1] ), vget_high_f32( t23.val[1] ) );
+
+  const float32x4_t half  = vdupq_n_f32( 0.5f );
+  const float32x4_t two   = vdupq_n_f32( 2.f );
+  const float32x4_t three = vdupq_n_f32( 3.f );
+  const float32x4_t five  = vdupq_n_f32( 5.f );
+
+  float32x4_t a = vmulq_f32( vaddq_f32( vsubq_f32( vmulq_f32( three,
+                  vsubq_f32( x0, x1 ) ), xm1 ), x2 ), half );
+  float32x4_t b = vsubq_f32( vaddq_f32( vmulq_f32( two, x1 ), xm1 ),
+                  vmulq_f32( vaddq_f32( vmulq_f32( five, x0 ), x2 ), half ) );
+  float32x4_t c = vmulq_f32( vsubq_f32( x1, xm1 ), half );
+
+  float32x4_t out = vaddq_f32( vmulq_f32( a, finpos ), b );
+  out = vaddq_f32( vmulq_f32( out, finpos ), c );
+  return vaddq_f32( vmulq_f32( out, finpos ), x0 );
+}
+
+static inline float32x4_t hermite_neon_finpos( const float* pos, int* inpos )
+{
+  float32x4_t p  = vld1q_f32( pos );
+  int32x4_t   ip = vcvtq_s32_f32( p );
+  vst1q_s32( inpos, ip );
+  return vsubq_f32( p, vcvtq_f32_s32( ip ) );
+}
+
+static void hermite_mono_neon( const float* audio,
+                               float* index, float delta,
+                               float panL, float panR,
+                               int nframes, float* L, float* R )
+{
+  float pos[4];
+  int inpos[4];
+  int i = 0;
+  for( ; i + 4 <= nframes; i += 4 )
+  {
+    hermite_positions( index, delta, 4, pos );
+
+    float32x4_t out = hermite_neon( audio, inpos, hermite_neon_finpos( pos, inpos ) );
+    vst1q_f32( L + i, vmulq_n_f32( out, panL ) );
+    vst1q_f32( R + i, vmulq_n_f32( out, panR ) );
+  }
+
+  hermite_mono_scalar( audio, index, delta, panL, panR,
+                       nframes - i, L + i, R + i );
+}
+
+static void hermite_stereo_neon( const float* audioL, const float* audioR,
+                                 float* index, float delta,
+                                 float panL, float panR,
+                                 int nframes, float* L, float* R )
+{
+  float pos[4];
+  int inpos[4];
+  int i = 0;
+  for( ; i + 4 <= nframes; i += 4 )
+  {
+    hermite_positions( index, delta, 4, pos );
+
+    float32x4_t finpos = hermite_neon_finpos( pos, inpos );
+    vst1q_f32( L + i, vmulq_n_f32( hermite_neon( audioL, inpos, finpos ), panL ) );
+    vst1q_f32( R + i, vmulq_n_f32( hermite_neon( audioR, inpos, finpos ), panR ) );
+  }
+
+  hermite_stereo_scalar( audioL, audioR, index, delta,
+                         panL, panR, nframes - i, L + i, R + i );
+}
+#endif // FABLA2_HERMITE_NEON
+
+void hermite_mono_s16( const int16_t* audio,
+                       float* index, float delta, float panL, float panR,
+                       int nframes, float* L, float* R )
+{
+  hermite_mono_scalar( audio, index, delta, panL, panR, nframes, L, R );
+}
+
+void hermite_stereo_s16( const int16_t* audioL, const int16_t* audioR,
+                         float* index, float delta, float panL, float panR,
+                         int nframes, float* L, float* R )
+{
+  hermite_stereo_scalar( audioL, audioR, index, delta, panL, panR, nframes, L, R );
+}
+
+void hermite_mono_s24( const PCM24* audio,
+                       float* index, float delta, float panL, float panR,
+                       int nframes, float* L, float* R )
+{
+  hermite_mono_scalar( audio, index, delta, panL, panR, nframes, L, R );
+}
+
+void hermite_stereo_s24( const PCM24* audioL, const PCM24* audioR,
+                         float* index, float delta, float panL, float panR,
+                         int nframes, float* L, float* R )
+{
+  hermite_stereo_scalar( audioL, audioR, index, delta, panL, panR, nframes, L, R );
+}
+
+static const HermiteKernels hermiteKernels[HERMITE_KERNEL_COUNT] =
+{
+  { "scalar", hermite_mono_scalar<float>, hermite_stereo_scalar<float> },
+#ifdef FABLA2_HERMITE_X86
+  { "sse2"  , hermite_mono_sse2  , hermite_stereo_sse2   },
+  { "avx2"  , hermite_mono_avx2  , hermite_stereo_avx2   },
+#else
+  { "sse2"  , 0, 0 },
+  { "avx2"  , 0, 0 },
+#endif
+#ifdef FABLA2_HERMITE_NEON
+  { "neon"  , hermite_mono_neon  , hermite_stereo_neon   },
+#else
+  { "neon"  , 0, 0 },
+#endif
+};
+
+const HermiteKernels* hermite_kernels( int k )
+{
+  if( k < 0 || k >= HERMITE_KERNEL_COUNT || !hermiteKernels[k].mono )
+    return 0;
+
+#ifdef FABLA2_HERMITE_X86
+  __builtin_cpu_init();
+  if( k == HERMITE_SSE2 && !__builtin_cpu_supports("sse2") )
+    return 0;
+  if( k == HERMITE_AVX2 && !__builtin_cpu_supports("avx2") )
+    return 0;
+#endif
+
+  return &hermiteKernels[k];
+}
+
+static const HermiteKernels* hermite_kernels_select()
+{
+  const int order[] = { HERMITE_AVX2, HERMITE_NEON, HERMITE_SSE2 };
+  for(unsigned i = 0; i < sizeof(order) / sizeof(order[0]); i++)
+  {
+    const HermiteKernels* k = hermite_kernels( order[i] );
+    if( k )
+    {
+      printf("Fabla2: using %s sample interpolation\n", k->name );
+      return k;
+    }
+  }
+  return &hermiteKernels[HERMITE_SCALAR];
+}
+
+const HermiteKernels* hermite_kernels_best()
+{
+  static const HermiteKernels* best = hermite_kernels_select();
+  return best;
+}
+
+}; // Fabla2
@@ -0,0 +1,120 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_DSP_HERMITE_HXX
+#define OPENAV_FABLA2_DSP_HERMITE_HXX
+
+#include <stdint.h>
+
+namespace Fabla2
+{
+
+/** Hermite kernels
+ * Cubic 4-point Hermite-curve interpolation, used by the Sampler to render
+ * sample playback at any speed: http://musicdsp.org/showone.php?id=49
+ *
+ * A kernel renders exactly nframes frames into L and R, reading the audio at
+ * *index and advancing *index by delta for each frame. Kernels don't check for
+ * the end of the audio: the caller works out how many frames can be rendered
+ * before the sample runs out, and the Sample keeps zeroed guard frames after
+ * its audio for the interpolator to read into.
+ *
+ * The vectorized kernels render several frames per iteration, and produce
+ * output that is bit-identical to the scalar reference kernel.
+ */
+typedef void (*HermiteMonoFunc)( const float* audio,
+                                 float* index, float delta,
+                                 float panL, float panR,
+                                 int nframes, float* L, float* R );
+
+typedef void (*HermiteStereoFunc)( const float* audioL, const float* audioR,
+                                   float* index, float delta,
+                                   float panL, float panR,
+                                   int nframes, float* L, float* R );
+
+enum HERMITE_KERNEL {
+  HERMITE_SCALAR = 0, /// reference implementation, always available
+  HERMITE_SSE2,
+  HERMITE_AVX2,
+  HERMITE_NEON,
+  HERMITE_KERNEL_COUNT,
+};
+
+struct HermiteKernels
+{
+  const char*       name;
+  HermiteMonoFunc   mono;
+  HermiteStereoFunc stereo;
+};
+
+/// returns the kernels for an instruction set, or 0 if the CPU or build
+/// doesn't support it
+const HermiteKernels* hermite_kernels( int kernel );
+
+/// returns the fastest kernels the CPU supports. The CPU is only checked the
+/// first time this is called, which happens when the plugin is instantiated
+const HermiteKernels* hermite_kernels_best();
+
+/// a packed little-endian 24 bit PCM sample
+struct PCM24
+{
+  uint8_t b[3];
+};
+
+/// kernels for audio stored as integer PCM, see SampleBuffer. They convert the
+/// four input samples of each frame to float inside the interpolator: as the
+/// conversion is exact, the output is bit-identical to the scalar float kernel
+/// reading the same audio converted to float
+void hermite_mono_s16  ( const int16_t* audio,
+                         float* index, float delta, float panL, float panR,
+                         int nframes, float* L, float* R );
+void hermite_stereo_s16( const int16_t* audioL, const int16_t* audioR,
+                         float* index, float delta, float panL, float panR,
+                         int nframes, float* L, float* R );
+void hermite_mono_s24  ( const PCM24* audio,
+                         float* index, float delta, float panL, float panR,
+                         int nframes, float* L, float* R );
+void hermite_stereo_s24( const PCM24* audioL, const PCM24* audioR,
+                         float* index, float delta, float panL, float panR,
+                         int nframes, float* L, float* R );
+
+/// integer PCM to float conversion, as used by the kernels
+static inline float pcm_to_float( int16_t s )
+{
+  return s * ( 1.f / 32768.f );
+}
+
+static inline float pcm_to_float( PCM24 s )
+{
+  // assemble in the top bytes, and shift down to extend the sign
+  int32_t v = (int32_t)( (uint32_t)s.b[0] <<  8 |
+                         (uint32_t)s.b[1] << 16 |
+                         (uint32_t)s.b[2] << 24 ) >> 8;
+  return v * ( 1.f / 8388608.f );
+}
+
+static inline float pcm_to_float( float s )
+{
+  return s;
+}
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_DSP_HERMITE_HXX
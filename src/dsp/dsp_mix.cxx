@@ -0,0 +1,101 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "dsp_mix.hxx"
+
+#if defined(__SSE__)
+#define FABLA2_MIX_SSE 1
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FABLA2_MIX_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace Fabla2
+{
+
+void mix_apply_gain( const float* gain, int nframes, float* L, float* R )
+{
+  int i = 0;
+#if defined(FABLA2_MIX_SSE)
+  for( ; i + 4 <= nframes; i += 4 )
+  {
+    __m128 g = _mm_loadu_ps( gain + i );
+    _mm_storeu_ps( L + i, _mm_mul_ps( _mm_loadu_ps( L + i ), g ) );
+    _mm_storeu_ps( R + i, _mm_mul_ps( _mm_loadu_ps( R + i ), g ) );
+  }
+#elif defined(FABLA2_MIX_NEON)
+  for( ; i + 4 <= nframes; i += 4 )
+  {
+    float32x4_t g = vld1q_f32( gain + i );
+    vst1q_f32( L + i, vmulq_f32( vld1q_f32( L + i ), g ) );
+    vst1q_f32( R + i, vmulq_f32( vld1q_f32( R + i ), g ) );
+  }
+#endif
+  for( ; i < nframes; i++ )
+  {
+    L[i] *= gain[i];
+    R[i] *= gain[i];
+  }
+}
+
+/// accumulates one stereo route: outL += L * gain, outR += R * gain
+static void mix_route( const float* L, const float* R, int nframes,
+                       float gain, float* outL, float* outR )
+{
+  int i = 0;
+#if defined(FABLA2_MIX_SSE)
+  const __m128 g = _mm_set1_ps( gain );
+  for( ; i + 4 <= nframes; i += 4 )
+  {
+    __m128 l = _mm_mul_ps( _mm_loadu_ps( L + i ), g );
+    __m128 r = _mm_mul_ps( _mm_loadu_ps( R + i ), g );
+    _mm_storeu_ps( outL + i, _mm_add_ps( _mm_loadu_ps( outL + i ), l ) );
+    _mm_storeu_ps( outR + i, _mm_add_ps( _mm_loadu_ps( outR + i ), r ) );
+  }
+#elif defined(FABLA2_MIX_NEON)
+  for( ; i + 4 <= nframes; i += 4 )
+  {
+    float32x4_t l = vmulq_n_f32( vld1q_f32( L + i ), gain );
+    float32x4_t r = vmulq_n_f32( vld1q_f32( R + i ), gain );
+    vst1q_f32( outL + i, vaddq_f32( vld1q_f32( outL + i ), l ) );
+    vst1q_f32( outR + i, vaddq_f32( vld1q_f32( outR + i ), r ) );
+  }
+#endif
+  for( ; i < nframes; i++ )
+  {
+    outL[i] += L[i] * gain;
+    outR[i] += R[i] * gain;
+  }
+}
+
+void mix_routes( const float* L, const float* R, int nframes,
+                 const MixRoute* routes, int nRoutes )
+{
+  for(int r = 0; r < nRoutes; r++)
+  {
+    if( routes[r].gain == 0.f )
+      continue;
+    
+    mix_route( L, R, nframes, routes[r].gain, routes[r].L, routes[r].R );
+  }
+}
+
+}; // Fabla2
@@ -0,0 +1,52 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_DSP_MIX_HXX
+#define OPENAV_FABLA2_DSP_MIX_HXX
+
+/// the most buses a voice can be routed to: master, the four aux buses, and
+/// space for more destinations
+#define FABLA2_MIX_ROUTES_MAX 8
+
+namespace Fabla2
+{
+
+/** MixRoute
+ * A destination bus of a voice: the stereo bus buffers, and the gain the voice
+ * is sent to the bus with.
+ */
+struct MixRoute
+{
+  float* L;
+  float* R;
+  float  gain;
+};
+
+/// multiplies the stereo buffers in place by a per-frame gain, eg: the ADSR
+void mix_apply_gain( const float* gain, int nframes, float* L, float* R );
+
+/// accumulates the stereo input into each route, scaled by the route's gain.
+/// Routes with a gain of zero are skipped.
+void mix_routes( const float* L, const float* R, int nframes,
+                 const MixRoute* routes, int nRoutes );
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_DSP_MIX_HXX
@@ -21,6 +21,7 @@
 #include "fabla2.hxx"
 
 #include "../dsp.hxx"
+#include "../lv2_work.hxx"
 
 #ifdef OPENAV_PROFILE
 #include "../profiny.hxx"
@@ -37,6 +38,12 @@
 #include "sample.hxx"
 #include "sampler.hxx"
 #include "library.hxx"
+#include "render_pool.hxx"
+#include "retire_queue.hxx"
+#include "rt_log.hxx"
+#include "telemetry.hxx"
+#include "sample_cache.hxx"
+#include "sample_stream.hxx"
 #include "midi_helper.hxx"
 
 #include "plotter.hxx"
@@ -45,40 +52,568 @@ namespace Fabla2
 {
 
 Fabla2DSP::Fabla2DSP( int rate, URIs* u ) :
+  lv2( 0 ),
   sr( rate ),
   uris( u ),
   useAuxbus( false ),
+  voiceCount_( 0 ),
+  activeHead( 0 ),
+  activeTail( 0 ),
+  stealPolicy_( STEAL_OLDEST ),
+  renderPool( 0 ),
+  renderThreads_( 0 ),
+  renderDeadline( FABLA2_RENDER_DEADLINE ),
+  streamThreshold_( 0 ),
+  streamUnderruns_( 0 ),
+  compactSamples_( false ),
+  sampleRateMode_( SampleBuffer::SAMPLE_RATE_CONVERT ),
+  converterStarted( false ),
+  pendingLibrary( 0 ),
+  retiredLibrary( 0 ),
+  uiRefreshPads( 0 ),
+  retireQueue( new RetireQueue() ),
+  reclaimScheduled( 0 ),
+  retireLeaked_( 0 ),
+  rtLog_( new RtLog() ),
+  logScheduled( 0 ),
+  telemetry_( new Telemetry( rate ) ),
   recordEnable( false ),
   recordBank( 0 ),
-  recordPad( 0 )
+  recordPad( 0 ),
+  recordBusy( false )
 {
   library = new Library( this, rate );
   
   auditionVoice = new Voice( this, rate );
+  auditionStream = new SampleStream();
+  auditionVoice->setStream( auditionStream );
   
-  for( int i = 0; i < 16; i++ )
+  // all voices up front, so polyphony() never allocates
+  for(int i = 0; i < FABLA2_VOICES_MAX; i++)
+  {
+    streams.push_back( new SampleStream() );
     voices.push_back( new Voice( this, rate ) );
+    voices.back()->setStream( streams.back() );
+    voices.back()->index = i;
+  }
+  memset( groupVoices, 0, sizeof(groupVoices) );
+  
+  freeVoices.reserve( FABLA2_VOICES_MAX );
+  renderList.reserve( FABLA2_VOICES_MAX );
+  lateVoices.reserve( FABLA2_VOICES_MAX );
+  polyphony( FABLA2_VOICES_DEFAULT );
   
   recordBuffer.resize( rate * 10 );
   
   memset( controlPorts, 0, sizeof(float*) * PORT_COUNT );
+  memset( auxBusVol, 0, sizeof(auxBusVol) );
+  
+  // for debugging null pointers etc
+  //library->checkAll();
+}
+
+void Fabla2DSP::polyphony( int n )
+{
+  renderSettle();
+  
+  if( n < 1 )
+    n = 1;
+  if( n > FABLA2_VOICES_MAX )
+    n = FABLA2_VOICES_MAX;
   
-  int bankID = 0;
-  for(int i = 0; i < 16 * 4; i++)
+  if( n == voiceCount_ )
+    return;
+  
+  FABLA2_RT_LOG( rtLog_, RT_LOG_NOTE, "Fabla2: polyphony %i voices\n", n );
+  
+  // voices past the count stop at once, the others keep playing
+  uint64_t linked[FABLA2_VOICE_WORDS];
+  memset( linked, 0, sizeof(linked) );
+  
+  // late voices aren't free: they are reclaimed once their render is done
+  for(size_t i = 0; i < lateVoices.size(); i++)
+    linked[lateVoices[i]->index / 64] |= 1ULL << ( lateVoices[i]->index % 64 );
+  
+  for( Voice* v = activeHead; v; )
   {
-    if( i > 0 && i % 16 == 0 )
+    Voice* next = v->activeNext;
+    if( v->index >= n )
     {
-      bankID++;
+      v->finish();
+      voiceUnlink( v );
     }
+    else
+    {
+      linked[v->index / 64] |= 1ULL << ( v->index % 64 );
+    }
+    v = next;
+  }
+  
+  freeVoices.clear();
+  for(int i = 0; i < n; i++)
+  {
+    if( !( linked[i / 64] & ( 1ULL << ( i % 64 ) ) ) )
+      freeVoices.push_back( voices[i] );
+  }
+  voiceCount_ = n;
+}
+
+void Fabla2DSP::stealPolicy( int p )
+{
+  if( p < STEAL_OLDEST || p > STEAL_SAME_PAD_FIRST )
+    p = STEAL_OLDEST;
+  stealPolicy_ = p;
+}
+
+void Fabla2DSP::renderThreads( int n )
+{
+  if( n < 0 )
+    n = 0;
+  if( n > FABLA2_RENDER_THREADS_MAX )
+    n = FABLA2_RENDER_THREADS_MAX;
+  
+  if( n == renderThreads() )
+    return;
+  
+  // joining the helpers finishes the voices they were late with
+  delete renderPool;
+  renderPool = 0;
+  renderSettle();
+  
+  if( n > 0 )
+    renderPool = new RenderPool( n, FABLA2_VOICES_MAX );
+  renderThreads_ = n;
+}
+
+int Fabla2DSP::activeVoices()
+{
+  renderSettle();
+  
+  int n = auditionVoice->active() ? 1 : 0;
+  for( Voice* v = activeHead; v; v = v->activeNext )
+    n++;
+  return n + (int)lateVoices.size();
+}
+
+int Fabla2DSP::renderThreads()
+{
+  return renderThreads_;
+}
+
+void Fabla2DSP::streamThreshold( long frames )
+{
+  if( frames < 0 )
+    frames = 0;
+  streamThreshold_ = frames;
+}
+
+long Fabla2DSP::streamThreshold()
+{
+  if( !lv2 || !lv2->schedule )
+    return 0;
+  return streamThreshold_;
+}
+
+void Fabla2DSP::sampleRateMode( int mode )
+{
+  if( mode < SampleBuffer::SAMPLE_RATE_CONVERT ||
+      mode > SampleBuffer::SAMPLE_RATE_BACKGROUND )
+  {
+    printf("Fabla2: invalid sample rate mode %i\n", mode );
+    return;
+  }
+  
+  if( mode == SampleBuffer::SAMPLE_RATE_BACKGROUND && !converterStarted )
+  {
+    SamplePool::startConverter();
+    converterStarted = true;
+  }
+  sampleRateMode_ = mode;
+}
+
+void Fabla2DSP::sampleCacheSize( long megabytes )
+{
+  SampleCache::limit( megabytes * 1048576 );
+}
+
+long Fabla2DSP::sampleCacheSize()
+{
+  return SampleCache::limit() / 1048576;
+}
+
+void Fabla2DSP::streamService( SampleStream* s )
+{
+  long u = s->takeUnderruns();
+  if( u )
+  {
+    streamUnderruns_ += u;
+    FABLA2_RT_LOG( rtLog_, RT_LOG_WARNING, "Fabla2: disk stream underrun, %li blocks of silence so far\n", streamUnderruns_ );
+  }
+  
+  if( !s->needsRefill() )
+    return;
+  
+  StreamRefill msg;
+  msg.atom.size = sizeof(SampleStream*);
+  msg.atom.type = uris->fabla2_StreamRefill;
+  msg.stream    = s;
+  
+  if( !lv2 || !lv2->schedule ||
+      lv2->schedule->schedule_work( lv2->schedule->handle, sizeof(msg), &msg ) != LV2_WORKER_SUCCESS )
+  {
+    // try again next block
+    s->refillFailed();
+  }
+}
+
+Library* Fabla2DSP::getLatestLibrary()
+{
+  Library* l = pendingLibrary.load();
+  return l ? l : library;
+}
+
+void Fabla2DSP::swapLibrary( Library* l )
+{
+  // the threads of the kit start here, the RT thread only swaps the pool
+  LibrarySettings& s = l->settings();
+  if( s.valid )
+  {
+    if( s.renderThreads > FABLA2_RENDER_THREADS_MAX )
+      s.renderThreads = FABLA2_RENDER_THREADS_MAX;
+    if( s.renderThreads > 0 )
+      s.renderPool = new RenderPool( s.renderThreads, FABLA2_VOICES_MAX );
     
-    Pad* tmpPad = new Pad( this, rate, i % 16 );
-    tmpPad->bank( i / 16 );
+    if( s.sampleRateMode == SampleBuffer::SAMPLE_RATE_BACKGROUND && !converterStarted )
+    {
+      SamplePool::startConverter();
+      converterStarted = true;
+    }
+  }
+  
+  // never played: nothing can reference a Library that is replaced here
+  delete pendingLibrary.exchange( l );
+}
+
+void Fabla2DSP::libraryService()
+{
+  // one old Library at a time: the next swap waits until it is retired
+  if( !retiredLibrary )
+  {
+    Library* l = pendingLibrary.exchange( 0 );
+    if( l )
+    {
+      retiredLibrary = library;
+      library = l;
+      settingsApply( l, retiredLibrary );
+      // the UI is sent the new pads, when the plugin has one
+      uiRefreshPads = lv2 ? 16 * 4 : 0;
+    }
+  }
+  
+  if( retiredLibrary )
+  {
+    // voices that play the old kit ring out, and are released by note-offs
+    // late voices may still read the old pads
+    bool playing = !lateVoices.empty() || ( auditionVoice->active() &&
+                   retiredLibrary->contains( auditionVoice->getPad() ) );
+    for( Voice* v = activeHead; v && !playing; v = v->activeNext )
+      playing = v->active() && retiredLibrary->contains( v->getPad() );
     
-    library->bank( bankID )->pad( tmpPad );
+    // when the RetireQueue is full, try again next block
+    if( !playing && retireQueue->retire( retiredLibrary ) )
+      retiredLibrary = 0;
   }
   
-  // for debugging null pointers etc
-  //library->checkAll();
+  // the new kit's pads are sent to the UI a few per block, so the Atom output
+  // buffer doesn't overflow
+  for(int i = 0; i < 2 && uiRefreshPads > 0; i++)
+  {
+    uiRefreshPads--;
+    int b = uiRefreshPads / 16;
+    int p = uiRefreshPads % 16;
+    padRefreshLayers( b, p );
+    writePadsState( b, p, library->bank( b )->pad( p ) );
+  }
+}
+
+void Fabla2DSP::settingsApply( Library* l, Library* old )
+{
+  LibrarySettings& s = l->settings();
+  if( !s.valid )
+    return;
+  
+  polyphony( s.polyphony );
+  stealPolicy( s.stealPolicy );
+  streamThreshold( s.streamThreshold );
+  compactSamples_ = s.compactSamples;
+  if( s.sampleRateMode >= SampleBuffer::SAMPLE_RATE_CONVERT &&
+      s.sampleRateMode <= SampleBuffer::SAMPLE_RATE_BACKGROUND )
+    sampleRateMode_ = s.sampleRateMode;
+  for(int a = 0; a < 4; a++)
+    auxBusVol[a] = s.auxBusVol[a];
+  
+  // the pool that ran is deleted with the old Library, by the worker
+  old->settings().renderPool = renderPool;
+  renderPool = s.renderPool;
+  s.renderPool = 0;
+  renderThreads_ = renderPool ? renderPool->threads() : 0;
+}
+
+void Fabla2DSP::retire( Sample* s )
+{
+  renderSettle();
+  
+  // tell all voices / samplers that the sample is gone
+  for( Voice* v = activeHead; v; v = v->activeNext )
+    v->stopIfSample( s );
+  auditionVoice->stopIfSample( s );
+  
+  // and the streams: needsRefill() reads the Sample after it is freed. The
+  // stream of a voice a render thread still has is stopped with the voice
+  for(int i = 0; i < (int)streams.size(); i++)
+  {
+    if( streams[i]->getSample() == s &&
+        !voices[i]->rendering.load( std::memory_order_acquire ) )
+      streams[i]->stop();
+  }
+  if( auditionStream->getSample() == s )
+    auditionStream->stop();
+  
+  // never freed on the RT thread: leaked when the queue is full
+  if( !retireQueue->retire( s ) )
+    retireLeaked_++;
+}
+
+void Fabla2DSP::reclaim( uint64_t upto )
+{
+  retireQueue->reclaim( upto );
+}
+
+long Fabla2DSP::retirePending()
+{
+  return retireQueue->pending();
+}
+
+void Fabla2DSP::reclaimService()
+{
+  // late voices may still read samples retired after they were left out
+  const uint64_t upto = retireQueue->queued();
+  if( upto == reclaimScheduled || !lateVoices.empty() )
+    return;
+  
+  if( !lv2 || !lv2->schedule )
+  {
+    // without a worker, loading isn't glitch free anyway
+    retireQueue->reclaim( upto );
+    reclaimScheduled = upto;
+    return;
+  }
+  
+  Reclaim msg;
+  msg.atom.size = sizeof(uint64_t);
+  msg.atom.type = uris->fabla2_Reclaim;
+  msg.upto      = upto;
+  
+  // else try again next block
+  if( lv2->schedule->schedule_work( lv2->schedule->handle, sizeof(msg), &msg ) == LV2_WORKER_SUCCESS )
+    reclaimScheduled = upto;
+}
+
+void Fabla2DSP::logDrain()
+{
+  int  level;
+  char text[FABLA2_RT_LOG_LINE];
+  
+  // without the LV2 log feature, the logger prints to stderr
+  LV2_Log_Logger* logger = lv2 ? &lv2->logger : 0;
+  
+  while( rtLog_->read( level, text, FABLA2_RT_LOG_LINE ) )
+  {
+    if( !logger )
+      fprintf( stderr, "%s", text );
+    else if( level == RT_LOG_ERROR )
+      lv2_log_error( logger, "%s", text );
+    else if( level == RT_LOG_WARNING )
+      lv2_log_warning( logger, "%s", text );
+    else if( level == RT_LOG_NOTE )
+      lv2_log_note( logger, "%s", text );
+    else
+      lv2_log_trace( logger, "%s", text );
+  }
+  
+  long dropped = rtLog_->takeDropped();
+  if( dropped && logger )
+    lv2_log_warning( logger, "Fabla2: %li RT log messages dropped\n", dropped );
+  else if( dropped )
+    fprintf( stderr, "Fabla2: %li RT log messages dropped\n", dropped );
+}
+
+void Fabla2DSP::logService()
+{
+  rtLog_->tick();
+  
+  const uint64_t w = rtLog_->written();
+  if( w == logScheduled )
+    return;
+  
+  // without a worker the messages stay in the ring, which drops new ones
+  // when it is full: printing them here would do it on the RT thread
+  if( !lv2 || !lv2->schedule )
+    return;
+  
+  LV2_Atom msg;
+  msg.size = 0;
+  msg.type = uris->fabla2_LogDrain;
+  
+  // else try again next block
+  if( lv2->schedule->schedule_work( lv2->schedule->handle, sizeof(msg), &msg ) == LV2_WORKER_SUCCESS )
+    logScheduled = w;
+}
+
+void Fabla2DSP::voiceLink( Voice* v )
+{
+  // append: the list stays ordered from oldest to newest voice
+  v->activeNext = 0;
+  v->activePrev = activeTail;
+  if( activeTail )
+    activeTail->activeNext = v;
+  else
+    activeHead = v;
+  activeTail = v;
+}
+
+void Fabla2DSP::voiceUnlink( Voice* v )
+{
+  if( v->activePrev )
+    v->activePrev->activeNext = v->activeNext;
+  else
+    activeHead = v->activeNext;
+  
+  if( v->activeNext )
+    v->activeNext->activePrev = v->activePrev;
+  else
+    activeTail = v->activePrev;
+  
+  v->activeNext = 0;
+  v->activePrev = 0;
+  
+  // the voice is in one bucket at most, clearing all of them is cheaper
+  // than remembering which
+  const uint64_t bit = 1ULL << ( v->index % 64 );
+  for(int g = 0; g < FABLA2_GROUP_BUCKETS; g++)
+    groupVoices[g][v->index / 64] &= ~bit;
+}
+
+void Fabla2DSP::groupAdd( Voice* v, int og )
+{
+  if( og == 0 )
+    return;
+  
+  const int g = (unsigned)og % FABLA2_GROUP_BUCKETS;
+  groupVoices[g][v->index / 64] |= 1ULL << ( v->index % 64 );
+}
+
+void Fabla2DSP::groupChoke( int og )
+{
+  const int g = (unsigned)og % FABLA2_GROUP_BUCKETS;
+  for(int w = 0; w < FABLA2_VOICE_WORDS; w++)
+  {
+    uint64_t bits = groupVoices[g][w];
+    while( bits )
+    {
+      Voice* v = voices[ w * 64 + __builtin_ctzll( bits ) ];
+      bits &= bits - 1;
+      
+      // groups that share the bucket are told apart by the pad
+      if( v->active() && og == v->getPad()->offGroup() )
+      {
+        // note that this triggers ADSR off, so we can *NOT* re-purpose
+        // the voice right away to play the new note.
+        FABLA2_RT_LOG( rtLog_, RT_LOG_TRACE, "note-on muteGroup %i : turning off %i\n", og, og );
+        v->stop();
+      }
+    }
+  }
+}
+
+void Fabla2DSP::groupsRebuild()
+{
+  memset( groupVoices, 0, sizeof(groupVoices) );
+  for( Voice* v = activeHead; v; v = v->activeNext )
+  {
+    // a voice that stopped stays linked, without a pad, until it's mixed
+    if( !v->active() || !v->getPad() )
+      continue;
+    groupAdd( v, v->getPad()->offGroup() );
+  }
+}
+
+Voice* Fabla2DSP::allocVoice( int bank, int pad )
+{
+  Voice* v = 0;
+  
+  if( freeVoices.size() )
+  {
+    v = freeVoices.back();
+    freeVoices.pop_back();
+    voiceLink( v );
+    return v;
+  }
+  
+  // all voices are in use: a voice that finished this block is free to take
+  for( Voice* a = activeHead; a && !v; a = a->activeNext )
+  {
+    if( !a->active() )
+      v = a;
+  }
+  
+  if( !v && stealPolicy_ == STEAL_QUIETEST )
+  {
+    v = activeHead;
+    for( Voice* a = activeHead->activeNext; a; a = a->activeNext )
+    {
+      if( a->level() < v->level() )
+        v = a;
+    }
+  }
+  else if( !v && stealPolicy_ == STEAL_SAME_PAD_FIRST )
+  {
+    for( Voice* a = activeHead; a && !v; a = a->activeNext )
+    {
+      if( a->matches( bank, pad ) )
+        v = a;
+    }
+  }
+  
+  // oldest voice is the head of the list
+  if( !v )
+    v = activeHead;
+  
+  // move the stolen voice to the end of the list, as it is now the newest
+  voiceUnlink( v );
+  voiceLink( v );
+  return v;
+}
+
+void Fabla2DSP::renderSettle()
+{
+  // a late voice is reclaimed once its render thread is done with it. Its
+  // audio was dropped, so it stops at once
+  for(size_t i = 0; i < lateVoices.size(); )
+  {
+    Voice* v = lateVoices[i];
+    if( v->rendering.load( std::memory_order_acquire ) )
+    {
+      i++;
+      continue;
+    }
+    
+    v->discard();
+    if( v->index < voiceCount_ )
+      freeVoices.push_back( v );
+    lateVoices[i] = lateVoices.back();
+    lateVoices.pop_back();
+  }
 }
 
 void Fabla2DSP::process( int nf )
@@ -86,8 +621,15 @@ void Fabla2DSP::process( int nf )
 #ifdef OPENAV_PROFILE
   PROFINY_SCOPE
 #endif
+  renderSettle();
   nframes = nf;
   
+  // the plugin format wrapper starts the block before MIDI dispatch
+  if( !telemetry_->started() )
+    telemetry_->blockStart();
+  
+  libraryService();
+  
   float recordOverLast = *controlPorts[RECORD_OVER_LAST_PLAYED_PAD];
   if( recordEnable != (int)recordOverLast )
   {
@@ -96,7 +638,7 @@ void Fabla2DSP::process( int nf )
     
     if( recordEnable )
     {
-      printf("recording switch! %i\n", recordEnable );
+      FABLA2_RT_LOG( rtLog_, RT_LOG_TRACE, "recording switch! %i\n", recordEnable );
       startRecordToPad( recordBank, recordPad );
     }
     else
@@ -131,7 +673,6 @@ void Fabla2DSP::process( int nf )
   
   if( recordEnable && recordPad != -1 && recordIndex + nframes < sr * 4 )
   {
-    printf("recording...\n" );
     for(int i = 0; i < nframes; i++)
     {
       recordBuffer[recordIndex++] = controlPorts[INPUT_L][i];
@@ -141,22 +682,96 @@ void Fabla2DSP::process( int nf )
   else if( recordEnable && recordPad != -1 )
   {
     recordEnable = false;
-    printf("record stopped: out of space! %li\n", recordIndex );
+    FABLA2_RT_LOG( rtLog_, RT_LOG_WARNING, "record stopped: out of space! %li\n", recordIndex );
+  }
+  
+  telemetry_->stage( Telemetry::STAGE_OTHER );
+  
+  // only playing voices are visited
+  renderList.clear();
+  for( Voice* v = activeHead; v; v = v->activeNext )
+    renderList.push_back( v );
+  
+  const int nActive = renderList.size();
+  if( renderPool && nActive >= FABLA2_RENDER_MIN_VOICES &&
+      nframes >= FABLA2_RENDER_MIN_FRAMES )
+  {
+    uint64_t deadline = UINT64_MAX;
+    if( renderDeadline > 0 )
+      deadline = Telemetry::now() +
+          uint64_t( renderDeadline * 1000000000.0 * nframes / sr );
+    if( !renderPool->render( &renderList[0], nActive, deadline ) )
+    {
+      // voices a render thread is still on are left out of this block, and
+      // out of the active list until the thread is done with them
+      int late = 0;
+      for(int i = 0; i < nActive; i++)
+      {
+        Voice* v = renderList[i];
+        if( !v->rendering.load( std::memory_order_acquire ) )
+          continue;
+        voiceUnlink( v );
+        lateVoices.push_back( v );
+        renderList[i] = 0;
+        late++;
+      }
+      FABLA2_RT_LOG( rtLog_, RT_LOG_WARNING, "render threads missed the deadline, %i voices dropped\n", late );
+    }
+  }
+  else
+  {
+    for(int i = 0; i < nActive; i++)
+      renderList[i]->render();
+  }
+  telemetry_->stage( Telemetry::STAGE_RENDER );
+  
+  // the render threads are done, their filter times can be read
+  uint64_t filterNs = 0;
+  for(int i = 0; i < nActive; i++)
+  {
+    if( renderList[i] )
+      filterNs += renderList[i]->filterTime();
   }
+  telemetry_->add( Telemetry::STAGE_FILTER, filterNs );
   
-  for( int i = 0; i < voices.size(); i++ )
+  // mix in list order, so output doesn't depend on which thread rendered what.
+  // Finished voices move to the free stack
+  for(int i = 0; i < nActive; i++)
   {
-    Voice* v = voices.at(i);
-    if( v->active() )
+    Voice* v = renderList[i];
+    if( !v )
+      continue;
+    v->mix();
+    
+    if( !v->active() )
     {
-      //printf("voice %i playing\n", i);
-      v->process();
+      voiceUnlink( v );
+      freeVoices.push_back( v );
     }
   }
+  telemetry_->stage( Telemetry::STAGE_MIX );
   
   // finally run the audition voice
   auditionVoice->process();
   
+  // voices streaming from disk: the worker can only be scheduled from the
+  // audio thread, so this happens after rendering
+  for(int i = 0; i < nActive; i++)
+  {
+    if( renderList[i] )
+      streamService( renderList[i]->getStream() );
+  }
+  streamService( auditionStream );
+  
+  // after the refills: they are done before the worker frees their samples
+  reclaimService();
+  
+  // last, so messages of this block are printed too
+  logService();
+  
+  telemetry_->stage( Telemetry::STAGE_OTHER );
+  if( telemetry_->blockEnd( nframes, nActive ) && lv2 )
+    tx_telemetry();
 }
 
 void Fabla2DSP::auditionStop()
@@ -180,32 +795,13 @@ void Fabla2DSP::auditionPlay( int bank, int pad, int layer )
   auditionVoice->stop();
   
   auditionVoice->playLayer( p, layer );
-  printf("auditionPlay()\n");
-}
-
-static void fabla2_dsp_getDetailsFromNote( const uint8_t* msg, int& bank, int& pad )
-{
-  // check MIDI note is valid in downwards direction
-  if( msg[1] < 36 )
-    return;
-  
-  // get midi bank (from message, or from MIDI note num?)
-  bank = 0; //(msg[0] & 0x0F);
-  
-  // select pad number from midi note (0-15)
-  pad = (msg[1] - 36) % 16;
-  
-  // convert higher midi notes ( > 36 + 16, aka first bank) to next bank
-  if( msg[1] >= 36 + 16 )
-  {
-    int nMoreBanks = (msg[1] - 36) / 16;
-    //printf( "more banks %i\n", nMoreBanks );
-    bank += nMoreBanks;
-  }
+  FABLA2_RT_LOG( rtLog_, RT_LOG_TRACE, "auditionPlay()\n" );
 }
 
 void Fabla2DSP::midi( int eventTime, const uint8_t* msg )
 {
+  renderSettle();
+  
   //printf("MIDI: %i, %i, %i\n", (int)msg[0], (int)msg[1], (int)msg[2] );
   
   
@@ -213,15 +809,11 @@ void Fabla2DSP::midi( int eventTime, const uint8_t* msg )
   {
     case LV2_MIDI_MSG_NOTE_ON:
         {
-          // check MIDI note is valid in downwards direction
-          if( msg[1] < 36 )
-            return;
-          
+          // the pad of the note, notes without a pad are ignored
           int bank = 0;
           int pad  = 0;
-          fabla2_dsp_getDetailsFromNote( msg, bank, pad );
-          if( bank < 0 || bank >=  4 ) { return; }
-          if( pad  < 0 || pad  >= 16 ) { return; }
+          if( !library->midiMap().lookup( msg[0] & 0x0f, msg[1], bank, pad ) )
+            return;
           
           // update the recording pad
           recordBank = bank;
@@ -230,103 +822,72 @@ void Fabla2DSP::midi( int eventTime, const uint8_t* msg )
           // the pad that's going to be allocated to play
           Pad* p = library->bank( bank )->pad( pad );
           
-          bool allocd = false;
-          for(int i = 0; i < voices.size(); i++)
+          // check mute-groups to stop voices first
+          int mg = p->muteGroup();
+          if( mg != 0 )
+            groupChoke( mg );
+          
+          // play pad, on a free voice or stealing one if all are playing
+          Voice* v = allocVoice( bank, pad );
+          v->play( eventTime, bank, pad, p, msg[2] / 127.f, msg[0] & 0x0f, msg[1] );
+          groupAdd( v, p->offGroup() );
+          
+          // write note on MIDI events to UI, when the plugin has one
+          if( lv2 )
           {
-            // current voice pointer
-            Voice* v = voices.at(i);
+            LV2_Atom_Forge_Frame frame;
+            lv2_atom_forge_frame_time( &lv2->forge, eventTime );
+            lv2_atom_forge_object( &lv2->forge, &frame, 0, uris->fabla2_PadPlay );
             
-            // check mute-group to stop the voice first
-            if( v->active() )
-            {
-              int mg = p->muteGroup();
-              // note-on mute-group is valid && == to current voice off-group
-              if( mg != 0 &&
-                  mg == v->getPad()->offGroup() )
-              {
-                // note that this triggers ADSR off, so we can *NOT* re-purpose
-                // the voice right away to play the new note.
-                printf("note-on muteGroup %i : turning off %i\n", mg, v->getPad()->offGroup() );
-                v->stop();
-              }
-            }
-            else
-            {
-              // only allocate voice if we haven't already done so
-              if( !allocd )
-              {
-                // play pad
-                voices.at(i)->play( eventTime, bank, pad, p, msg[2] / 127.f );
-                
-                // write note on MIDI events to UI
-                LV2_Atom_Forge_Frame frame;
-                lv2_atom_forge_frame_time( &lv2->forge, eventTime );
-                lv2_atom_forge_object( &lv2->forge, &frame, 0, uris->fabla2_PadPlay );
-                
-                lv2_atom_forge_key(&lv2->forge, uris->fabla2_bank);
-                lv2_atom_forge_int(&lv2->forge, bank );
-                lv2_atom_forge_key(&lv2->forge, uris->fabla2_pad);
-                lv2_atom_forge_int(&lv2->forge, pad );
-                lv2_atom_forge_key(&lv2->forge, uris->fabla2_layer);
-                lv2_atom_forge_int(&lv2->forge, p->lastPlayedLayer() );
-                lv2_atom_forge_key(&lv2->forge, uris->fabla2_velocity);
-                lv2_atom_forge_int(&lv2->forge, msg[2] );
-                
-                lv2_atom_forge_pop(&lv2->forge, &frame);
-                
-                allocd = true;
-                // don't return: scan all voices for mute-groups!
-                continue;
-              }
-            }
-          }
-          /// if all voices are full, we steal the first one
-          if( allocd == false )
-          {
-            voices.at( 0 )->play( eventTime, bank, pad, p, msg[2] );
+            lv2_atom_forge_key(&lv2->forge, uris->fabla2_bank);
+            lv2_atom_forge_int(&lv2->forge, bank );
+            lv2_atom_forge_key(&lv2->forge, uris->fabla2_pad);
+            lv2_atom_forge_int(&lv2->forge, pad );
+            lv2_atom_forge_key(&lv2->forge, uris->fabla2_layer);
+            lv2_atom_forge_int(&lv2->forge, p->lastPlayedLayer() );
+            lv2_atom_forge_key(&lv2->forge, uris->fabla2_velocity);
+            lv2_atom_forge_int(&lv2->forge, msg[2] );
+            
+            lv2_atom_forge_pop(&lv2->forge, &frame);
           }
         }
         break;
     
     case LV2_MIDI_MSG_NOTE_OFF:
       {
+        // stop the oldest voice of the note that is still held: it is found
+        // by the note, as the MIDI map may have changed with the kit
+        for( Voice* v = activeHead; v; v = v->activeNext )
+        {
+          if( v->active() && v->matchesNote( msg[0] & 0x0f, msg[1] ) )
+          {
+            v->stop();
+            break;
+          }
+        }
+        
         int bank = 0;
         int pad  = 0;
-        fabla2_dsp_getDetailsFromNote( msg, bank, pad );
-        if( bank < 0 || bank >=  4 ) { return; }
-        if( pad  < 0 || pad  >= 16 ) { return; }
-        
-        // write note on MIDI events to UI
-        LV2_Atom_Forge_Frame frame;
-        lv2_atom_forge_frame_time( &lv2->forge, eventTime );
-        lv2_atom_forge_object( &lv2->forge, &frame, 0, uris->fabla2_PadStop );
-        
-        lv2_atom_forge_key(&lv2->forge, uris->fabla2_bank);
-        lv2_atom_forge_int(&lv2->forge, bank );
-        lv2_atom_forge_key(&lv2->forge, uris->fabla2_pad);
-        lv2_atom_forge_int(&lv2->forge, pad );
-        lv2_atom_forge_key(&lv2->forge, uris->fabla2_layer);
-        lv2_atom_forge_int(&lv2->forge, -1 );
-        lv2_atom_forge_key(&lv2->forge, uris->fabla2_velocity);
-        lv2_atom_forge_int(&lv2->forge, msg[2] );
-        
-        lv2_atom_forge_pop(&lv2->forge, &frame);
+        if( !library->midiMap().lookup( msg[0] & 0x0f, msg[1], bank, pad ) )
+          return;
         
-        for(int i = 0; i < voices.size(); i++)
+        // write note off MIDI events to UI, when the plugin has one
+        if( lv2 )
         {
-          Voice* v = voices.at(i);
+          LV2_Atom_Forge_Frame frame;
+          lv2_atom_forge_frame_time( &lv2->forge, eventTime );
+          lv2_atom_forge_object( &lv2->forge, &frame, 0, uris->fabla2_PadStop );
           
-          if( v->active() )
-          {
-            if( v->matches( bank, pad ) )
-            {
-              // this voice was started by the Pad that now sent corresponding
-              // note off event: so stop() the voice
-              //printf("Voice.matces() NOTE_OFF -> Stop()\n" );
-              v->stop();
-              return;
-            }
-          }
+          lv2_atom_forge_key(&lv2->forge, uris->fabla2_bank);
+          lv2_atom_forge_int(&lv2->forge, bank );
+          lv2_atom_forge_key(&lv2->forge, uris->fabla2_pad);
+          lv2_atom_forge_int(&lv2->forge, pad );
+          lv2_atom_forge_key(&lv2->forge, uris->fabla2_layer);
+          lv2_atom_forge_int(&lv2->forge, -1 );
+          lv2_atom_forge_key(&lv2->forge, uris->fabla2_velocity);
+          lv2_atom_forge_int(&lv2->forge, msg[2] );
+          
+          lv2_atom_forge_pop(&lv2->forge, &frame);
         }
       }
       break;
@@ -533,7 +1094,9 @@ void Fabla2DSP::tx_waveform( int b, int p, int l, const float* data )
   lv2_atom_forge_key(&lv2->forge, uris->fabla2_layer);
   lv2_atom_forge_int(&lv2->forge, l );
   
+#ifdef FABLA2_COMPONENT_TEST
   Plotter::plot( "tx_waveform", FABLA2_UI_WAVEFORM_PX, data );
+#endif
   
   // Add vector of floats 'audioData' property
   lv2_atom_forge_key(&lv2->forge, uris->fabla2_audioData);
@@ -543,23 +1106,64 @@ void Fabla2DSP::tx_waveform( int b, int p, int l, const float* data )
   lv2_atom_forge_pop(&lv2->forge, &frame);
 }
 
+void Fabla2DSP::tx_telemetry()
+{
+  const Telemetry::Summary& t = telemetry_->summary();
+  
+  LV2_Atom_Forge_Frame frame;
+  
+  lv2_atom_forge_frame_time(&lv2->forge, 0);
+  lv2_atom_forge_object(&lv2->forge, &frame, 0, uris->fabla2_Telemetry);
+  
+  lv2_atom_forge_key(&lv2->forge, uris->fabla2_load);
+  lv2_atom_forge_float(&lv2->forge, t.load );
+  
+  lv2_atom_forge_key(&lv2->forge, uris->fabla2_loadWorst);
+  lv2_atom_forge_float(&lv2->forge, t.loadWorst );
+  
+  lv2_atom_forge_key(&lv2->forge, uris->fabla2_overruns);
+  lv2_atom_forge_int(&lv2->forge, t.overruns );
+  
+  lv2_atom_forge_key(&lv2->forge, uris->fabla2_voices);
+  lv2_atom_forge_float(&lv2->forge, t.voices );
+  
+  lv2_atom_forge_key(&lv2->forge, uris->fabla2_voicesMax);
+  lv2_atom_forge_int(&lv2->forge, t.voicesMax );
+  
+  // microseconds per block, indexed by Telemetry::STAGE
+  lv2_atom_forge_key(&lv2->forge, uris->fabla2_stageTime);
+  lv2_atom_forge_vector( &lv2->forge, sizeof(float), uris->atom_Float, Telemetry::STAGE_COUNT, t.stageUs );
+  
+  lv2_atom_forge_key(&lv2->forge, uris->fabla2_stageTimeWorst);
+  lv2_atom_forge_vector( &lv2->forge, sizeof(float), uris->atom_Float, Telemetry::STAGE_COUNT, t.stageWorstUs );
+  
+  lv2_atom_forge_key(&lv2->forge, uris->fabla2_loadHistogram);
+  lv2_atom_forge_vector( &lv2->forge, sizeof(int), uris->atom_Int, FABLA2_TELEMETRY_BUCKETS, t.histogram );
+  
+  lv2_atom_forge_pop(&lv2->forge, &frame);
+}
+
 void Fabla2DSP::panic()
 {
-  for(int i = 0; i < voices.size(); ++i)
+  renderSettle();
+  
+  for( Voice* v = activeHead; v; v = v->activeNext )
   {
-    voices.at(i)->stop();
+    v->stop();
   }
   auditionStop();
 }
 
 void Fabla2DSP::uiMessage(int b, int p, int l, int URI, float v)
 {
+  renderSettle();
+  
   //printf("Fabla2:uiMessage bank %i, pad %i, layer %i: %f\n", b, p, l, v );
   
   /*
   if( URI == uris->fabla2_PadPlay )
   {
-    printf("DSP has note on from UI: %i, %i, %i\n", b, p, l);
+    FABLA2_RT_LOG( rtLog_, RT_LOG_TRACE, "DSP has note on from UI: %i, %i, %i\n", b, p, l );
   }
   */
   Pad* pad = library->bank( b )->pad( p );
@@ -581,21 +1185,15 @@ void Fabla2DSP::uiMessage(int b, int p, int l, int URI, float v)
   if(       URI == uris->fabla2_SampleUnload )
   {
     // remove a sample from the engine
-    printf("Fabla2-DSP *Deleteing* sample %s now!\n", s->getName() );
+    FABLA2_RT_LOG( rtLog_, RT_LOG_NOTE, "Fabla2-DSP removing sample %s\n", s->getName() );
     
-    // tell all voices / pads / samplers that the sample is gone
-    for(int i = 0; i < voices.size(); ++i)
-    {
-      voices.at(i)->stopIfSample( s );
-    }
     pad->remove( s );
-    pad->checkAll();
+    
+    // the worker frees it, once no voice or stream can use it
+    retire( s );
     
     padRefreshLayers( b, p );
     writePadsState( b, p, pad );
-    
-    // TODO - refactor away yasper<ptr> stuff, to manually de-alloc
-    //delete s;
   }
   else if(       URI == uris->fabla2_Panic ) {
     panic();
@@ -661,12 +1259,13 @@ void Fabla2DSP::uiMessage(int b, int p, int l, int URI, float v)
     s->dirty = 1; s->release = v;
   }
   else if(  URI == uris->fabla2_PadMuteGroup ) {
-    printf("setting start point to %f\n", v );
+    FABLA2_RT_LOG( rtLog_, RT_LOG_TRACE, "setting mute group to %f\n", v );
     pad->muteGroup( int(v) );
   }
   else if(  URI == uris->fabla2_PadOffGroup ) {
-    printf("setting start point to %f\n", v );
+    FABLA2_RT_LOG( rtLog_, RT_LOG_TRACE, "setting off group to %f\n", v );
     pad->offGroup( int(v) );
+    groupsRebuild();
   }
   else if(  URI == uris->fabla2_PadSwitchType ) {
     int c = int(v);
@@ -690,11 +1289,18 @@ void Fabla2DSP::uiMessage(int b, int p, int l, int URI, float v)
 void Fabla2DSP::auxBus( int bus, float value )
 {
   auxBusVol[bus] = value;
-  printf("auxBus() %i, %f\n", bus, auxBusVol[bus] ); 
+  FABLA2_RT_LOG( rtLog_, RT_LOG_TRACE, "auxBus() %i, %f\n", bus, auxBusVol[bus] ); 
 }
 
 void Fabla2DSP::startRecordToPad( int b, int p )
 {
+  // the worker still reads the last recording: start next block
+  if( recordBusy.load() )
+  {
+    recordEnable = false;
+    return;
+  }
+  
   recordBank  = b;
   recordPad   = p;
   recordIndex = 0;
@@ -706,27 +1312,88 @@ void Fabla2DSP::stopRecordToPad()
 {
   //printf("record finished, pad # %i\n", recordPad );
   
-  Pad* pad = library->bank( recordBank )->pad( recordPad );
-  
-  printf("%s : NON RT SAFE NEW SAMPLE()\n", __PRETTY_FUNCTION__ );
-  Sample* s = new Sample( this, sr, "Recorded", recordIndex, &recordBuffer[0] );
-  
-  // reset the pad
-  pad->clearAllSamples();
-  pad->add( s );
+  if( lv2 && lv2->schedule )
+  {
+    SampleRecord msg;
+    msg.atom.size = sizeof(SampleRecord) - sizeof(LV2_Atom);
+    msg.atom.type = uris->fabla2_SampleRecord;
+    msg.bank = recordBank;
+    msg.pad  = recordPad;
+    msg.size = recordIndex;
+    
+    // the recordBuffer isn't written until the worker made the Sample
+    recordBusy.store( true );
+    if( lv2->schedule->schedule_work( lv2->schedule->handle, sizeof(msg), &msg ) != LV2_WORKER_SUCCESS )
+      recordBusy.store( false );
+  }
+  else
+  {
+    // without a worker, loading isn't glitch free anyway
+    recorded( recordBank, recordPad, recordedSample( recordIndex ) );
+  }
   
   recordIndex = 0;
   recordEnable = false;
 }
 
+Sample* Fabla2DSP::recordedSample( long size )
+{
+  Sample* s = new Sample( this, sr, "Recorded", size, &recordBuffer[0] );
+  recordBusy.store( false );
+  return s;
+}
+
+void Fabla2DSP::recorded( int bank, int pad, Sample* s )
+{
+  renderSettle();
+  
+  if( bank < 0 || bank >= 4 || pad < 0 || pad >= 16 )
+  {
+    retire( s );
+    return;
+  }
+  
+  Pad* p = library->bank( bank )->pad( pad );
+  
+  // reset the pad
+  while( p->nLayers() > 0 )
+  {
+    Sample* old = p->layer( 0 );
+    p->remove( old );
+    retire( old );
+  }
+  p->add( s );
+}
+
 Fabla2DSP::~Fabla2DSP()
 {
+  // the pools render late voices until they are joined, the pool of the
+  // retired kit too
+  delete renderPool;
+  if( retiredLibrary )
+  {
+    delete retiredLibrary->settings().renderPool;
+    retiredLibrary->settings().renderPool = 0;
+  }
+  
   for(int i = 0; i < voices.size(); i++)
   {
     delete voices.at(i);
   }
   delete library;
+  delete retiredLibrary;
+  delete pendingLibrary.load();
+  delete retireQueue;
   delete auditionVoice;
+  delete rtLog_;
+  delete telemetry_;
+  
+  for(int i = 0; i < streams.size(); i++)
+    delete streams.at(i);
+  delete auditionStream;
+  
+  if( converterStarted )
+    SamplePool::stopConverter();
 }
 
 }; // Fabla2
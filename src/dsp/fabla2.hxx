@@ -27,18 +27,36 @@
 
 #include "midi.hxx"
 
-#include <map>
+#include <atomic>
 #include <vector>
 
 // for accessing forge to write ports
 class FablaLV2;
 
+/// voice pool size limits: the pool is allocated up front, and voices are
+/// stolen when all of them are playing
+#define FABLA2_VOICES_MAX     256
+#define FABLA2_VOICES_DEFAULT 16
+
+/// most frames in a block: the buffers of a Voice are allocated for this many
+#define FABLA2_BLOCK_MAX      1024
+
+/// off groups are tracked in this many buckets of voices, by group modulo
+/// the count: the UI sets groups 1 to 8, so each has a bucket of its own
+#define FABLA2_GROUP_BUCKETS  16
+#define FABLA2_VOICE_WORDS    ( FABLA2_VOICES_MAX / 64 )
+
 namespace Fabla2
 {
 
 class Pad;
 class Voice;
 class Sample;
+class RenderPool;
+class RetireQueue;
+class RtLog;
+class Telemetry;
+class SampleStream;
 class Library;
 
 /** Fabla2DSP
@@ -65,6 +83,82 @@ class Fabla2DSP
     /// turns off all voices, silencing output
     void panic();
     
+    /// policies to pick the voice to steal when all voices are playing
+    enum VOICE_STEAL {
+      STEAL_OLDEST = 0,     ///< the voice that started playing first
+      STEAL_QUIETEST,       ///< the voice with the lowest envelope level
+      STEAL_SAME_PAD_FIRST, ///< a voice playing the same pad, else the oldest
+    };
+    
+    /// sets the number of voices, 1 to FABLA2_VOICES_MAX. The pool holds the
+    /// most voices from the start, so this only stops the voices past the new
+    /// count. RT safe
+    void polyphony( int voices );
+    int  polyphony(){return voiceCount_;}
+    
+    /// voices playing after the last process(), the audition voice included.
+    /// RT thread only
+    int  activeVoices();
+    
+    void stealPolicy( int policy );
+    int  stealPolicy(){return stealPolicy_;}
+    
+    /// sets the number of helper threads that render voices in parallel with
+    /// the audio thread, 0 renders on the audio thread only. Starts or stops
+    /// threads: do *not* call from the RT thread, or while process() runs. A
+    /// restored kit changes them through swapLibrary()
+    void renderThreads( int threads );
+    int  renderThreads();
+    
+    /// samples longer than this many frames are streamed from disk when they
+    /// are loaded, 0 loads all samples into RAM. Streaming needs the LV2
+    /// worker, so this returns 0 when the host doesn't provide it
+    void streamThreshold( long frames );
+    long streamThreshold();
+    /// blocks that played silence as a stream wasn't read from disk in time
+    long streamUnderruns(){return streamUnderruns_;}
+    
+    /// when true, samples that are loaded keep the integer PCM format of their
+    /// file in RAM instead of float: saved per kit in the state
+    void compactSamples( bool c ){compactSamples_ = c;}
+    bool compactSamples(){return compactSamples_;}
+    
+    /// when samples with a rate that differs from the plugin rate are
+    /// resampled: SampleBuffer::SAMPLE_RATE_MODE. Background conversion starts
+    /// the SamplePool converter: do *not* call from the RT thread
+    void sampleRateMode( int mode );
+    int  sampleRateMode(){return sampleRateMode_;}
+    
+    /// size limit of the SampleCache of decoded samples on disk in MB, 0
+    /// disables it. The cache is shared by all instances in the process
+    void sampleCacheSize( long megabytes );
+    long sampleCacheSize();
+    
+    /// stops the voices that play s, and queues it to be freed by the worker,
+    /// after it was removed from its Pad. RT thread only
+    void retire( Sample* s );
+    /// frees the retired objects queued before upto: worker thread only
+    void reclaim( uint64_t upto );
+    /// objects retired and not freed yet, and Samples that could not be freed
+    /// as the queue was full: to check memory stays flat over a session
+    long retirePending();
+    long retireLeaked(){return retireLeaked_;}
+    
+    /// creates the Sample of the last recording, of size floats: called by the
+    /// worker, so the audio thread doesn't allocate
+    Sample* recordedSample( long size );
+    /// replaces the samples on a pad with a recording. RT thread only
+    void recorded( int bank, int pad, Sample* s );
+    
+    /// messages of the RT and render threads, see FABLA2_RT_LOG
+    RtLog* rtLog(){return rtLog_;}
+    /// prints the logged messages to the host log: worker thread only
+    void logDrain();
+    
+    /// timing of the stages of process(): the plugin format wrapper times the
+    /// MIDI dispatch, as it happens before process()
+    Telemetry* telemetry(){return telemetry_;}
+    
     /// audition voice details
     void auditionPlay( int bank, int pad, int layer );
     void auditionStop();
@@ -92,12 +186,33 @@ class Fabla2DSP
     void writePadsState( int b, int p, Pad* pad );
     void writeSampleState( int b, int p, int l, Pad* pad, Sample* );
     void tx_waveform( int bank, int pad, int layer, const float* data );
+    /// sends the Telemetry summary of the last second to the UI
+    void tx_telemetry();
     
+    /// the Library the RT thread plays
     Library* getLibrary(){return library;}
+    /// the newest Library: the one waiting to be swapped in, if there is one.
+    /// For save(), which may run before the RT thread did the swap
+    Library* getLatestLibrary();
+    
+    /// publishes a complete kit built off the RT thread: the next process()
+    /// swaps it in, and applies its LibrarySettings. The old Library is
+    /// deleted by the worker once no voice plays its pads. A Library that
+    /// waits to be swapped in is replaced, and deleted. Safe while process()
+    /// runs, do *not* call from the RT thread
+    void swapLibrary( Library* l );
+    
+    /// true when the host connected the AuxBus audio ports
+    bool auxbusEnabled(){return useAuxbus;}
     
     float auxBusVol[4];
 
   private:
+#ifdef FABLA2_COMPONENT_TEST
+    /// the tests check the voice pool and the off group buckets
+    friend class Fabla2DSPTest;
+#endif
+    
     URIs* uris;
     
     /// when true, AuxBus audio ports can be used
@@ -106,14 +221,89 @@ class Fabla2DSP
     /// used to audition samples, and deal with layer-playing from UI
     Voice* auditionVoice;
     
-    /// voices store all the voices available for use
+    /// voices store all the voices available for use: FABLA2_VOICES_MAX of
+    /// them, the first voiceCount_ play
     std::vector<Voice*> voices;
+    std::atomic<int> voiceCount_;
+    
+    /// playing voices, linked through the Voice, oldest first. A voice that
+    /// stops itself stays linked until process() moves it to freeVoices
+    Voice* activeHead;
+    Voice* activeTail;
+    /// voices not in the active list: a stack, reserved up front
+    std::vector<Voice*> freeVoices;
+    std::atomic<int> stealPolicy_;
+    
+    /// the active voices of each off group bucket, a bit per voice index, so
+    /// a note-on chokes its mute group without walking all voices
+    uint64_t groupVoices[FABLA2_GROUP_BUCKETS][FABLA2_VOICE_WORDS];
+    void groupAdd( Voice* v, int offGroup );
+    /// stops the active voices whose pad is in off group og
+    void groupChoke( int og );
+    /// rebuilds the buckets from the active list, when an off group changed
+    void groupsRebuild();
+    
+    /// parallel voice rendering, 0 when disabled
+    RenderPool* renderPool;
+    /// the threads of renderPool, for other threads than the RT thread
+    std::atomic<int> renderThreads_;
+    /// the active voices of the current block, in active list order
+    std::vector<Voice*> renderList;
+    /// voices the render threads didn't finish by the deadline of their
+    /// block: they weren't mixed, and are out of the active list until their
+    /// thread is done. renderSettle() reclaims the ones that are, without
+    /// waiting for the others
+    std::vector<Voice*> lateVoices;
+    void renderSettle();
+    /// the deadline of the render threads, as a fraction of the block
+    /// period: FABLA2_RENDER_DEADLINE, or 0 for no deadline
+    double renderDeadline;
+    
+    /// disk streams for the voices, by voice index
+    std::vector<SampleStream*> streams;
+    SampleStream* auditionStream;
+    std::atomic<long> streamThreshold_;
+    long streamUnderruns_;
+    std::atomic<bool> compactSamples_;
+    std::atomic<int>  sampleRateMode_;
+    /// true while this instance holds the SamplePool converter
+    bool converterStarted;
+    /// reports underruns, and schedules the worker to refill the stream
+    void streamService( SampleStream* s );
+    
+    /// returns a voice to play a note on: a free one, or one that is stolen
+    Voice* allocVoice( int bank, int pad );
+    void voiceLink( Voice* v );
+    void voiceUnlink( Voice* v );
     
     /// Library stores all data
     Library* library;
+    /// set by swapLibrary(), taken by process()
+    std::atomic<Library*> pendingLibrary;
+    /// the Library swapped out, until no voice plays its pads
+    Library* retiredLibrary;
+    /// swaps in the pending Library, and retires the old one: RT thread only
+    void libraryService();
+    /// applies the LibrarySettings of l, swapped in for old: RT thread only
+    void settingsApply( Library* l, Library* old );
+    /// pads that still need their state sent to the UI after a swap
+    int uiRefreshPads;
+    
+    /// objects the RT thread is done with, freed by the worker
+    RetireQueue* retireQueue;
+    /// the RetireQueue index sent to the worker last
+    uint64_t reclaimScheduled;
+    long retireLeaked_;
+    /// asks the worker to free the objects retired up to now
+    void reclaimService();
+    
+    RtLog* rtLog_;
+    /// the RtLog index sent to the worker last
+    uint64_t logScheduled;
+    /// asks the worker to print the messages logged up to now
+    void logService();
     
-    /// map from MIDI number to pad instance
-    std::map< int, Pad* > midiToPad;
+    Telemetry* telemetry_;
     
     /// record buffer: when a record operation begins, it uses this buffer
     void startRecordToPad(int bank, int pad);
@@ -124,6 +314,8 @@ class Fabla2DSP
     int  recordPad;
     long recordIndex;
     std::vector<float> recordBuffer;
+    /// true while the worker creates a Sample from the recordBuffer
+    std::atomic<bool> recordBusy;
     
     
 };
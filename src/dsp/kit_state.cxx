@@ -0,0 +1,606 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "kit_state.hxx"
+
+#include "../picojson.hxx"
+
+#include <sstream>
+
+#include <stdio.h>
+#include <string.h>
+
+/// "F2KS", and the version of the binary encoding
+#define FABLA2_KIT_MAGIC   0x534b3246
+#define FABLA2_KIT_VERSION 2
+
+namespace Fabla2
+{
+
+LayerState::LayerState() :
+  gain( 0.75 ),
+  pan( 0.5 ),
+  pitch( 0.5 ),
+  time( 0 ),
+  startPoint( 0 ),
+  endPoint( 1 ),
+  filterType( 0 ),
+  filterFrequency( 1 ),
+  filterResonance( 0.4 ),
+  velLow( 0 ),
+  velHigh( 1 ),
+  attack( 0 ),
+  decay( 0.05 ),
+  sustain( 1 ),
+  release( 0 )
+{
+}
+
+PadState::PadState() :
+  valid( false ),
+  muteGroup( 0 ),
+  offGroup( 0 ),
+  triggerMode( 0 ),
+  switchMode( 0 ),
+  volume( 0.75 )
+{
+  for(int i = 0; i < 4; i++)
+    sends[i] = 0;
+}
+
+KitState::KitState() :
+  polyphony( 0 ),
+  stealPolicy( 0 ),
+  renderThreads( 0 ),
+  streamThreshold( 0 ),
+  compactSamples( false ),
+  sampleRateMode( 0 ),
+  sampleCacheMB( 0 )
+{
+  for(int i = 0; i < 4; i++)
+    auxBusVol[i] = 0;
+  for(int i = 0; i < 16; i++)
+    channelBank[i] = -1;
+}
+
+/// appends little-endian fields to the binary encoding
+class KitWriter
+{
+  public:
+    KitWriter( std::vector<uint8_t>& o ) : out( o ) {}
+    
+    void u32( uint32_t v )
+    {
+      for(int i = 0; i < 4; i++)
+        out.push_back( v >> (i * 8) );
+    }
+    void i64( int64_t v )
+    {
+      for(int i = 0; i < 8; i++)
+        out.push_back( (uint64_t)v >> (i * 8) );
+    }
+    void f32( float v )
+    {
+      uint32_t u;
+      memcpy( &u, &v, sizeof(u) );
+      u32( u );
+    }
+    void str( const std::string& s )
+    {
+      u32( s.size() );
+      out.insert( out.end(), s.begin(), s.end() );
+    }
+  
+  private:
+    std::vector<uint8_t>& out;
+};
+
+/// reads the fields written by KitWriter: after reading past the end, ok()
+/// returns false and all reads return 0
+class KitReader
+{
+  public:
+    KitReader( const uint8_t* d, size_t s ) : data( d ), size( s ), pos( 0 ), good( true ) {}
+    
+    bool ok(){return good;}
+    
+    uint32_t u32()
+    {
+      if( !need( 4 ) )
+        return 0;
+      uint32_t v = 0;
+      for(int i = 0; i < 4; i++)
+        v |= (uint32_t)data[pos++] << (i * 8);
+      return v;
+    }
+    int64_t i64()
+    {
+      if( !need( 8 ) )
+        return 0;
+      uint64_t v = 0;
+      for(int i = 0; i < 8; i++)
+        v |= (uint64_t)data[pos++] << (i * 8);
+      return v;
+    }
+    float f32()
+    {
+      uint32_t u = u32();
+      float v;
+      memcpy( &v, &u, sizeof(v) );
+      return v;
+    }
+    void str( std::string& s )
+    {
+      uint32_t n = u32();
+      if( !need( n ) )
+        return;
+      s.assign( (const char*)data + pos, n );
+      pos += n;
+    }
+  
+  private:
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+    bool good;
+    
+    bool need( size_t n )
+    {
+      if( good && n <= size - pos )
+        return true;
+      good = false;
+      return false;
+    }
+};
+
+void KitState::encode( std::vector<uint8_t>& out ) const
+{
+  out.clear();
+  KitWriter w( out );
+  w.u32( FABLA2_KIT_MAGIC );
+  w.u32( FABLA2_KIT_VERSION );
+  
+  w.u32( polyphony );
+  w.u32( stealPolicy );
+  w.u32( renderThreads );
+  w.i64( streamThreshold );
+  w.u32( compactSamples );
+  w.u32( sampleRateMode );
+  w.i64( sampleCacheMB );
+  for(int i = 0; i < 4; i++)
+    w.f32( auxBusVol[i] );
+  for(int i = 0; i < 16; i++)
+    w.u32( channelBank[i] );
+  
+  for(int b = 0; b < FABLA2_KIT_BANKS; b++)
+  {
+    for(int p = 0; p < FABLA2_KIT_PADS; p++)
+    {
+      const PadState& pad = pads[b][p];
+      w.u32( pad.muteGroup );
+      w.u32( pad.offGroup );
+      w.u32( pad.triggerMode );
+      w.u32( pad.switchMode );
+      w.f32( pad.volume );
+      for(int i = 0; i < 4; i++)
+        w.f32( pad.sends[i] );
+      w.u32( pad.notes.size() );
+      for(size_t n = 0; n < pad.notes.size(); n++)
+        w.u32( pad.notes[n] );
+      
+      w.u32( pad.layers.size() );
+      for(size_t l = 0; l < pad.layers.size(); l++)
+      {
+        const LayerState& s = pad.layers[l];
+        w.str( s.filename );
+        w.str( s.name );
+        w.f32( s.gain );
+        w.f32( s.pan );
+        w.f32( s.pitch );
+        w.f32( s.time );
+        w.f32( s.startPoint );
+        w.f32( s.endPoint );
+        w.f32( s.filterType );
+        w.f32( s.filterFrequency );
+        w.f32( s.filterResonance );
+        w.f32( s.velLow );
+        w.f32( s.velHigh );
+        w.f32( s.attack );
+        w.f32( s.decay );
+        w.f32( s.sustain );
+        w.f32( s.release );
+      }
+    }
+  }
+}
+
+bool KitState::decode( const uint8_t* data, size_t size )
+{
+  KitReader r( data, size );
+  if( r.u32() != FABLA2_KIT_MAGIC )
+    return false;
+  // version 1 is version 2 without the MIDI routing
+  uint32_t version = r.u32();
+  if( version < 1 || version > FABLA2_KIT_VERSION )
+  {
+    printf("Fabla2: state version %u is not supported, version %i is\n", version, FABLA2_KIT_VERSION );
+    return false;
+  }
+  
+  polyphony       = r.u32();
+  stealPolicy     = r.u32();
+  renderThreads   = r.u32();
+  streamThreshold = r.i64();
+  compactSamples  = r.u32();
+  sampleRateMode  = r.u32();
+  sampleCacheMB   = r.i64();
+  for(int i = 0; i < 4; i++)
+    auxBusVol[i] = r.f32();
+  for(int i = 0; i < 16; i++)
+    channelBank[i] = version >= 2 ? (int)r.u32() : -1;
+  
+  for(int b = 0; b < FABLA2_KIT_BANKS && r.ok(); b++)
+  {
+    for(int p = 0; p < FABLA2_KIT_PADS && r.ok(); p++)
+    {
+      PadState& pad = pads[b][p];
+      pad.valid       = true;
+      pad.muteGroup   = r.u32();
+      pad.offGroup    = r.u32();
+      pad.triggerMode = r.u32();
+      pad.switchMode  = r.u32();
+      pad.volume      = r.f32();
+      for(int i = 0; i < 4; i++)
+        pad.sends[i] = r.f32();
+      
+      uint32_t nNotes = version >= 2 ? r.u32() : 0;
+      if( nNotes > 128 )
+        return false;
+      pad.notes.resize( nNotes );
+      for(uint32_t n = 0; n < nNotes; n++)
+        pad.notes[n] = r.u32();
+      
+      // each layer uses at least its two string lengths: don't let a corrupt
+      // count allocate more layers than the data can hold
+      uint32_t n = r.u32();
+      if( n > size / 8 )
+        return false;
+      pad.layers.resize( n );
+      for(uint32_t l = 0; l < n && r.ok(); l++)
+      {
+        LayerState& s = pad.layers[l];
+        r.str( s.filename );
+        r.str( s.name );
+        s.gain            = r.f32();
+        s.pan             = r.f32();
+        s.pitch           = r.f32();
+        s.time            = r.f32();
+        s.startPoint      = r.f32();
+        s.endPoint        = r.f32();
+        s.filterType      = r.f32();
+        s.filterFrequency = r.f32();
+        s.filterResonance = r.f32();
+        s.velLow          = r.f32();
+        s.velHigh         = r.f32();
+        s.attack          = r.f32();
+        s.decay           = r.f32();
+        s.sustain         = r.f32();
+        s.release         = r.f32();
+      }
+    }
+  }
+  
+  return r.ok();
+}
+
+std::string KitState::toJson() const
+{
+  picojson::object pjAll;
+  
+  for(int i = 0; i < FABLA2_KIT_BANKS; i++ )
+  {
+    picojson::object pjBank;
+    
+    /// write Bank specific stuff
+    // Is there any? Keep "bank" concept anyway, for loading banks seperate
+    // from an entire session.
+    
+    pjBank["name"]      = picojson::value( "bank name test" );
+    pjBank["auxbus1vol"]= picojson::value( auxBusVol[0] );
+    pjBank["auxbus2vol"]= picojson::value( auxBusVol[1] );
+    pjBank["auxbus3vol"]= picojson::value( auxBusVol[2] );
+    pjBank["auxbus4vol"]= picojson::value( auxBusVol[3] );
+    
+    for(int p = 0; p < FABLA2_KIT_PADS; p++ )
+    {
+      picojson::object pjPad;
+      const PadState& pad = pads[i][p];
+      
+      /// write Pad specific things
+      pjPad["muteGroup"]     = picojson::value( (double)pad.muteGroup );
+      pjPad["offGroup"]      = picojson::value( (double)pad.offGroup );
+      pjPad["triggerMode"]   = picojson::value( (double)pad.triggerMode );
+      pjPad["switchMode"]    = picojson::value( (double)pad.switchMode );
+      pjPad["volume"]        = picojson::value( (double)pad.volume );
+      
+      pjPad["auxbus1"]        = picojson::value( (double)pad.sends[0] );
+      pjPad["auxbus2"]        = picojson::value( (double)pad.sends[1] );
+      pjPad["auxbus3"]        = picojson::value( (double)pad.sends[2] );
+      pjPad["auxbus4"]        = picojson::value( (double)pad.sends[3] );
+      
+      if( pad.notes.size() )
+      {
+        picojson::array pjNotes;
+        for(size_t n = 0; n < pad.notes.size(); n++)
+          pjNotes.push_back( picojson::value( (double)pad.notes[n] ) );
+        pjPad["notes"] = picojson::value( pjNotes );
+      }
+      
+      pjPad["nLayers"]    = picojson::value( (double)pad.layers.size() );
+      
+      for(size_t l = 0; l < pad.layers.size(); l++ )
+      {
+        picojson::object pjLayer;
+        const LayerState& s = pad.layers[l];
+        
+        /// write Layer / Sample specific things
+        pjLayer["name"            ] = picojson::value( s.name );
+        // the portable <padX_layerY.wav> form of the filename
+        pjLayer["filename"        ] = picojson::value( s.filename );
+        
+        pjLayer["gain"            ] = picojson::value( (double)s.gain );
+        pjLayer["pan"             ] = picojson::value( (double)s.pan );
+        
+        pjLayer["pitch"           ] = picojson::value( (double)s.pitch );
+        pjLayer["time"            ] = picojson::value( (double)s.time );
+        
+        pjLayer["startPoint"      ] = picojson::value( (double)s.startPoint );
+        pjLayer["endPoint"        ] = picojson::value( (double)s.endPoint );
+        
+        pjLayer["filterType"      ] = picojson::value( (double)s.filterType );
+        pjLayer["filterFrequency" ] = picojson::value( (double)s.filterFrequency );
+        pjLayer["filterResonance" ] = picojson::value( (double)s.filterResonance );
+        
+        pjLayer["velLow"          ] = picojson::value( (double)s.velLow );
+        pjLayer["velHigh"         ] = picojson::value( (double)s.velHigh );
+        
+        pjLayer["attack"          ] = picojson::value( (double)s.attack );
+        pjLayer["decay"           ] = picojson::value( (double)s.decay );
+        pjLayer["sustain"         ] = picojson::value( (double)s.sustain );
+        pjLayer["release"         ] = picojson::value( (double)s.release );
+        
+        std::stringstream layer;
+        layer << "layer_" << l;
+        pjPad[ layer.str() ] = picojson::value( pjLayer );
+      } // Layers
+      
+      // finally add the current bank to the whole JSON
+      std::stringstream padStream;
+      padStream << "pad_" << p;
+      pjBank[ padStream.str() ] = picojson::value( pjPad );
+    } // pads
+    
+    // finally add the current bank to the whole JSON
+    std::stringstream bankStr;
+    bankStr << "bank_" << char('A' + i); // hack to bank letters
+    pjAll[ bankStr.str() ] = picojson::value( pjBank );
+  } // banks
+  
+  pjAll["polyphony"  ] = picojson::value( (double)polyphony );
+  pjAll["stealPolicy"] = picojson::value( (double)stealPolicy );
+  pjAll["renderThreads"] = picojson::value( (double)renderThreads );
+  pjAll["streamThreshold"] = picojson::value( (double)streamThreshold );
+  pjAll["compactSamples"] = picojson::value( compactSamples );
+  pjAll["sampleRateMode"] = picojson::value( (double)sampleRateMode );
+  pjAll["sampleCacheMB"] = picojson::value( (double)sampleCacheMB );
+  
+  picojson::array pjChannels;
+  for(int i = 0; i < 16; i++)
+    pjChannels.push_back( picojson::value( (double)channelBank[i] ) );
+  pjAll["channelBanks"] = picojson::value( pjChannels );
+  
+  return picojson::value( pjAll ).serialize();
+}
+
+/// sets v to the number at key of a JSON object, if it has one
+template<typename T>
+static void fabla2_json_get( const picojson::value& o, const char* key, T& v )
+{
+  const picojson::value& n = o.get( key );
+  if( n.is<double>() )
+    v = (T)n.get<double>();
+}
+
+bool KitState::fromJson( const char* json )
+{
+  picojson::value pjAll;
+  std::string err = picojson::parse( pjAll, json, json + strlen(json) );
+  if( err.size() > 0 )
+  {
+    printf( "PicoJSON Parser Error! %s\n", err.c_str() );
+    return false;
+  }
+  
+  // voice pool and streaming: older save files don't have these, keep the defaults
+  fabla2_json_get( pjAll, "polyphony", polyphony );
+  fabla2_json_get( pjAll, "stealPolicy", stealPolicy );
+  fabla2_json_get( pjAll, "renderThreads", renderThreads );
+  fabla2_json_get( pjAll, "streamThreshold", streamThreshold );
+  if( pjAll.get("compactSamples").is<bool>() )
+    compactSamples = pjAll.get("compactSamples").get<bool>();
+  fabla2_json_get( pjAll, "sampleRateMode", sampleRateMode );
+  fabla2_json_get( pjAll, "sampleCacheMB", sampleCacheMB );
+  
+  const picojson::value& pjChannels = pjAll.get( "channelBanks" );
+  if( pjChannels.is<picojson::array>() )
+  {
+    const picojson::array& a = pjChannels.get<picojson::array>();
+    for(size_t i = 0; i < a.size() && i < 16; i++)
+      if( a[i].is<double>() )
+        channelBank[i] = (int)a[i].get<double>();
+  }
+  
+  for(int b = 0; b < FABLA2_KIT_BANKS; b++ )
+  {
+    std::stringstream bankStr;
+    bankStr << "bank_" << char('A' + b);
+    
+    const picojson::value& pjBanks = pjAll.get( bankStr.str() );
+    if( !pjBanks.is<picojson::object>() )
+    {
+      printf( "Fabla2 : Lv2 State Restore() : PjBanks is object not valid.\
+							Corrupt save file? Check letter X in \"bank_X\" of the save file.\n" );
+      continue;
+    }
+    
+    // set auxbus values, zero is ignored - TODO split values to each bank
+    for(int i = 0; i < 4; i++)
+    {
+      float vol = 0;
+      std::stringstream key;
+      key << "auxbus" << i + 1 << "vol";
+      fabla2_json_get( pjBanks, key.str().c_str(), vol );
+      if( vol )
+        auxBusVol[i] = vol;
+    }
+    
+    for(int p = 0; p < FABLA2_KIT_PADS; p++)
+    {
+      PadState& pad = pads[b][p];
+      
+      std::stringstream padStr;
+      padStr << "pad_" << p;
+      const picojson::value& pjPad = pjBanks.get( padStr.str() );
+      if( !pjPad.is<picojson::object>() )
+      {
+        printf( "Fabla2 : Lv2 State Restore() : pjPad is object not valid.\
+								Corrupt save file? Check number X in \"pad_X\" of the save file.\n" );
+        continue;
+      }
+      
+      pad.valid = true;
+      fabla2_json_get( pjPad, "muteGroup", pad.muteGroup );
+      fabla2_json_get( pjPad, "offGroup", pad.offGroup );
+      fabla2_json_get( pjPad, "triggerMode", pad.triggerMode );
+      fabla2_json_get( pjPad, "switchMode", pad.switchMode );
+      fabla2_json_get( pjPad, "volume", pad.volume );
+      fabla2_json_get( pjPad, "auxbus1", pad.sends[0] );
+      fabla2_json_get( pjPad, "auxbus2", pad.sends[1] );
+      fabla2_json_get( pjPad, "auxbus3", pad.sends[2] );
+      fabla2_json_get( pjPad, "auxbus4", pad.sends[3] );
+      
+      const picojson::value& pjNotes = pjPad.get( "notes" );
+      if( pjNotes.is<picojson::array>() )
+      {
+        const picojson::array& a = pjNotes.get<picojson::array>();
+        pad.notes.clear();
+        for(size_t n = 0; n < a.size(); n++)
+          if( a[n].is<double>() )
+            pad.notes.push_back( (int)a[n].get<double>() );
+      }
+      
+      int nLayers = 0;
+      fabla2_json_get( pjPad, "nLayers", nLayers );
+      
+      for(int i = 0; i < nLayers; i++)
+      {
+        std::stringstream layerStr;
+        layerStr << "layer_" << i;
+        const picojson::value& pjLayer = pjPad.get( layerStr.str() );
+        
+        LayerState s;
+        if( pjLayer.get("filename").is<std::string>() )
+        {
+          s.filename = pjLayer.get("filename").get<std::string>();
+        }
+        else
+        {
+          printf("Fabla2UI: Pad %i : Sample %i : no filename in save file, skipping sample.\n", p, i );
+          continue;
+        }
+        
+        if( pjLayer.get("name").is<std::string>() )
+        {
+          s.name = pjLayer.get("name").get<std::string>();
+        }
+        else
+        {
+          std::stringstream padName;
+          padName << "pad" << p << "_layer" << i << ".wav";
+          s.name = padName.str();
+        }
+        
+        fabla2_json_get( pjLayer, "gain", s.gain );
+        fabla2_json_get( pjLayer, "pan", s.pan );
+        fabla2_json_get( pjLayer, "pitch", s.pitch );
+        fabla2_json_get( pjLayer, "time", s.time );
+        fabla2_json_get( pjLayer, "startPoint", s.startPoint );
+        fabla2_json_get( pjLayer, "endPoint", s.endPoint );
+        fabla2_json_get( pjLayer, "filterType", s.filterType );
+        fabla2_json_get( pjLayer, "filterFrequency", s.filterFrequency );
+        fabla2_json_get( pjLayer, "filterResonance", s.filterResonance );
+        fabla2_json_get( pjLayer, "velLow", s.velLow );
+        fabla2_json_get( pjLayer, "velHigh", s.velHigh );
+        
+        // the ADSR was always restored as whole numbers from JSON
+        if( pjLayer.get("attack").is<double>() )
+          s.attack  = (int)pjLayer.get("attack").get<double>();
+        if( pjLayer.get("decay").is<double>() )
+          s.decay   = (int)pjLayer.get("decay").get<double>();
+        if( pjLayer.get("sustain").is<double>() )
+          s.sustain = (int)pjLayer.get("sustain").get<double>();
+        if( pjLayer.get("release").is<double>() )
+          s.release = (int)pjLayer.get("release").get<double>();
+        
+        pad.layers.push_back( s );
+      }
+    }
+  }
+  
+  return true;
+}
+
+uint64_t KitState::fingerprint() const
+{
+  KitState kit( *this );
+  for(int b = 0; b < FABLA2_KIT_BANKS; b++)
+  {
+    for(int p = 0; p < FABLA2_KIT_PADS; p++)
+    {
+      std::vector<LayerState>& layers = kit.pads[b][p].layers;
+      for(size_t l = 0; l < layers.size(); l++)
+      {
+        size_t slash = layers[l].filename.rfind( '/' );
+        if( slash != std::string::npos )
+          layers[l].filename = layers[l].filename.substr( slash + 1 );
+      }
+    }
+  }
+  
+  // FNV-1a of the binary encoding
+  std::vector<uint8_t> data;
+  kit.encode( data );
+  uint64_t h = 14695981039346656037ULL;
+  for(size_t i = 0; i < data.size(); i++)
+    h = ( h ^ data[i] ) * 1099511628211ULL;
+  return h;
+}
+
+}; // Fabla2
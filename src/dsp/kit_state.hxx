@@ -0,0 +1,122 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_KIT_STATE_HXX
+#define OPENAV_FABLA2_KIT_STATE_HXX
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+/// banks in a kit, and pads in each bank
+#define FABLA2_KIT_BANKS 4
+#define FABLA2_KIT_PADS  16
+
+namespace Fabla2
+{
+
+/// the saved settings of a Sample, defaults as Sample::init()
+struct LayerState
+{
+  LayerState();
+  
+  /// the file as stored in the state, and the name of the Sample
+  std::string filename;
+  std::string name;
+  
+  float gain;
+  float pan;
+  float pitch;
+  float time;
+  float startPoint;
+  float endPoint;
+  float filterType;
+  float filterFrequency;
+  float filterResonance;
+  float velLow;
+  float velHigh;
+  float attack;
+  float decay;
+  float sustain;
+  float release;
+};
+
+/// the saved settings of a Pad and its layers
+struct PadState
+{
+  PadState();
+  
+  /// false if the state had no settings for this pad: it is restored empty
+  bool  valid;
+  int   muteGroup;
+  int   offGroup;
+  int   triggerMode;
+  int   switchMode;
+  float volume;
+  float sends[4];
+  /// the MIDI notes of the pad, empty for its default note: see MidiMap
+  std::vector<int> notes;
+  std::vector<LayerState> layers;
+};
+
+/** KitState
+ * The saved state of a whole kit: the plugin settings, and the pads and layers
+ * of each bank. The LV2 state is stored in two encodings of a KitState: a
+ * versioned binary one with a fixed schema, that is read in a single pass,
+ * and the JSON one that older versions of Fabla2 read.
+ */
+struct KitState
+{
+  KitState();
+  
+  int   polyphony;
+  int   stealPolicy;
+  int   renderThreads;
+  long  streamThreshold;
+  bool  compactSamples;
+  int   sampleRateMode;
+  long  sampleCacheMB;
+  
+  float auxBusVol[4];
+  /// the bank each MIDI channel plays, -1 for all banks: see MidiMap
+  int   channelBank[16];
+  PadState pads[FABLA2_KIT_BANKS][FABLA2_KIT_PADS];
+  
+  /// binary encoding: fixed size little-endian fields, strings with their
+  /// length before them. decode() returns false for data that is not a
+  /// KitState, truncated, or from a newer version
+  void encode( std::vector<uint8_t>& out ) const;
+  bool decode( const uint8_t* data, size_t size );
+  
+  /// JSON encoding, as saved by all versions of Fabla2. Settings that older
+  /// versions didn't save keep the value they had before fromJson()
+  std::string toJson() const;
+  bool fromJson( const char* json );
+  
+  /// a hash of the settings and samples of the kit. Only the file name of a
+  /// sample counts, not its directory: a kit moved to another machine has
+  /// the same fingerprint
+  uint64_t fingerprint() const;
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_KIT_STATE_HXX
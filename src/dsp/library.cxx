@@ -21,20 +21,51 @@
 #include "library.hxx"
 
 #include "bank.hxx"
+#include "pad.hxx"
+#include "render_pool.hxx"
 #include <assert.h>
 #include <stdio.h>
 
 namespace Fabla2
 {
 
+LibrarySettings::LibrarySettings() :
+  valid( false ),
+  polyphony( 0 ),
+  stealPolicy( 0 ),
+  renderThreads( 0 ),
+  streamThreshold( 0 ),
+  compactSamples( false ),
+  sampleRateMode( 0 ),
+  renderPool( 0 )
+{
+  for(int i = 0; i < 4; i++)
+    auxBusVol[i] = 0;
+}
+
 Library::Library( Fabla2DSP* d, int rate ) :
-  dsp( d )
+  dsp( d ),
+  fingerprint_( 0 )
 {
   // add the 4 initial banks
   bank( new Bank( d, rate, 0, "A" ) );
   bank( new Bank( d, rate, 1, "B" ) );
   bank( new Bank( d, rate, 2, "C" ) );
   bank( new Bank( d, rate, 3, "D" ) );
+  
+  for(int i = 0; i < 16 * 4; i++)
+  {
+    Pad* tmpPad = new Pad( d, rate, i % 16 );
+    tmpPad->bank( i / 16 );
+    
+    bank( i / 16 )->pad( tmpPad );
+  }
+}
+
+bool Library::contains( Pad* p )
+{
+  Bank* b = bank( p->bank() );
+  return b && b->pad( p->ID() ) == p;
 }
 
 void Library::bank( Bank* b )
@@ -78,8 +109,14 @@ Library::~Library()
 {
   for( int i = 0; i < banks.size(); i++)
   {
+    // the Samples are owned by the Library, not the Pad
+    for(int p = 0; banks.at(i)->pad( p ); p++)
+      banks.at(i)->pad( p )->clearAllSamples();
+    
     delete banks.at(i);
   }
+  
+  delete settings_.renderPool;
 }
 
 }; // Fabla2
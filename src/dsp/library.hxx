@@ -21,22 +21,55 @@
 #ifndef OPENAV_FABLA2_LIBRARY_HXX
 #define OPENAV_FABLA2_LIBRARY_HXX
 
+#include "midi_map.hxx"
+
 #include <vector>
 
+#include <stdint.h>
+
 namespace Fabla2
 {
 
+class Pad;
 class Bank;
 class Fabla2DSP;
+class RenderPool;
+
+/// the engine settings a restored kit brings along: the RT thread applies them
+/// when it swaps the Library in, so a kit changes while the plugin runs
+struct LibrarySettings
+{
+  LibrarySettings();
+  
+  /// false for a Library that wasn't restored: it keeps the settings in use
+  bool  valid;
+  int   polyphony;
+  int   stealPolicy;
+  int   renderThreads;
+  long  streamThreshold;
+  bool  compactSamples;
+  int   sampleRateMode;
+  float auxBusVol[4];
+  
+  /// the helper threads for renderThreads, started by swapLibrary(). At the
+  /// swap the Library takes the pool that ran before, and deletes it with
+  /// itself on the worker
+  RenderPool* renderPool;
+};
 
 /** Library
  * The Library class holds all resources. When a Voice gets a play() event, the
  * appropriate resources are linked from the Library. This avoids multiple loading
  * of sample files, and allows voices to play back any sample.
+ *
+ * A Library owns its Banks, their Pads and the Samples on them. A whole kit is
+ * changed by building a new Library off the RT thread, and swapping it with
+ * the one that plays: see Fabla2DSP::swapLibrary().
  */
 class Library
 {
   public:
+    /// creates the 4 banks of 16 empty pads
     Library( Fabla2DSP* dsp, int rate );
     ~Library();
     
@@ -44,11 +77,28 @@ class Library
     void bank( Bank* b );
     Bank* bank( int ID );
     
+    /// true when the pad is one of the pads of this Library. RT safe
+    bool contains( Pad* p );
+    
     /// testing function, to see if there are null pointers in the system
     void checkAll();
     
+    /// KitState::fingerprint() of the kit restored into this Library, 0
+    /// when it wasn't restored from a state
+    void fingerprint( uint64_t f ){fingerprint_ = f;}
+    uint64_t fingerprint(){return fingerprint_;}
+    
+    /// the routing of MIDI notes to the pads of this Library
+    MidiMap& midiMap(){return midiMap_;}
+    
+    /// the engine settings of the kit, see LibrarySettings
+    LibrarySettings& settings(){return settings_;}
+    
   private:
     Fabla2DSP* dsp;
+    uint64_t fingerprint_;
+    MidiMap midiMap_;
+    LibrarySettings settings_;
     std::vector<Bank*> banks;
 };
 
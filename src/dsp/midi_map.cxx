@@ -0,0 +1,92 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "midi_map.hxx"
+
+#include <string.h>
+
+namespace Fabla2
+{
+
+MidiMap::MidiMap()
+{
+  build( KitState() );
+}
+
+void MidiMap::route( int channel, int note, int bank, int pad )
+{
+  if( note >= 0 && note < FABLA2_MIDI_NOTES )
+    table[channel][note] = bank * FABLA2_KIT_PADS + pad;
+}
+
+void MidiMap::build( const KitState& kit )
+{
+  memset( table, -1, sizeof(table) );
+  
+  for(int c = 0; c < FABLA2_MIDI_CHANNELS; c++)
+  {
+    channelBank[c] = kit.channelBank[c];
+    if( channelBank[c] >= FABLA2_KIT_BANKS )
+      channelBank[c] = -1;
+  }
+  for(int b = 0; b < FABLA2_KIT_BANKS; b++)
+  {
+    for(int p = 0; p < FABLA2_KIT_PADS; p++)
+      notes[b][p] = kit.pads[b][p].notes;
+  }
+  
+  for(int c = 0; c < FABLA2_MIDI_CHANNELS; c++)
+  {
+    const int first = channelBank[c] < 0 ? 0 : channelBank[c];
+    const int last  = channelBank[c] < 0 ? FABLA2_KIT_BANKS : channelBank[c] + 1;
+    
+    // the default notes first, so the notes given to pads replace them
+    for(int b = first; b < last; b++)
+    {
+      const int base = FABLA2_MIDI_BASE_NOTE + ( channelBank[c] < 0 ? b * FABLA2_KIT_PADS : 0 );
+      for(int p = 0; p < FABLA2_KIT_PADS; p++)
+      {
+        if( notes[b][p].empty() )
+          route( c, base + p, b, p );
+      }
+    }
+    for(int b = first; b < last; b++)
+    {
+      for(int p = 0; p < FABLA2_KIT_PADS; p++)
+      {
+        for(size_t n = 0; n < notes[b][p].size(); n++)
+          route( c, notes[b][p][n], b, p );
+      }
+    }
+  }
+}
+
+void MidiMap::store( KitState& kit ) const
+{
+  for(int c = 0; c < FABLA2_MIDI_CHANNELS; c++)
+    kit.channelBank[c] = channelBank[c];
+  for(int b = 0; b < FABLA2_KIT_BANKS; b++)
+  {
+    for(int p = 0; p < FABLA2_KIT_PADS; p++)
+      kit.pads[b][p].notes = notes[b][p];
+  }
+}
+
+}; // Fabla2
@@ -0,0 +1,85 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_MIDI_MAP_HXX
+#define OPENAV_FABLA2_MIDI_MAP_HXX
+
+#include "kit_state.hxx"
+
+#include <vector>
+
+#include <stdint.h>
+
+/// MIDI channels, and notes on each channel
+#define FABLA2_MIDI_CHANNELS 16
+#define FABLA2_MIDI_NOTES    128
+/// the note of pad 0 of bank A, the default routing has 16 notes per bank
+#define FABLA2_MIDI_BASE_NOTE 36
+
+namespace Fabla2
+{
+
+/** MidiMap
+ * Routes MIDI notes to pads: a table of the pad each note of each channel
+ * plays, so dispatching a note is a single lookup.
+ *
+ * A channel either plays all banks, the notes of each bank following the one
+ * before from FABLA2_MIDI_BASE_NOTE, or a single bank with its pads from
+ * FABLA2_MIDI_BASE_NOTE. A pad can be given notes of its own, which replace
+ * its default note, and take the note from a pad that has it by default.
+ *
+ * The table is built with the Library of the kit, off the RT thread, and is
+ * swapped in with it.
+ */
+class MidiMap
+{
+  public:
+    /// the default routing: all channels play all banks
+    MidiMap();
+    
+    /// builds the table from the routing in a kit
+    void build( const KitState& kit );
+    /// writes the routing to a kit, to save it
+    void store( KitState& kit ) const;
+    
+    /// the pad of a note on a channel, false when the note plays no pad. RT safe
+    bool lookup( int channel, int note, int& bank, int& pad ) const
+    {
+      const int8_t e = table[channel & 0x0f][note & 0x7f];
+      if( e < 0 )
+        return false;
+      bank = e / FABLA2_KIT_PADS;
+      pad  = e % FABLA2_KIT_PADS;
+      return true;
+    }
+    
+  private:
+    /// KitState::channelBank, and the notes of each pad
+    int channelBank[FABLA2_MIDI_CHANNELS];
+    std::vector<int> notes[FABLA2_KIT_BANKS][FABLA2_KIT_PADS];
+    
+    /// bank * FABLA2_KIT_PADS + pad, or -1
+    int8_t table[FABLA2_MIDI_CHANNELS][FABLA2_MIDI_NOTES];
+    void route( int channel, int note, int bank, int pad );
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_MIDI_MAP_HXX
@@ -68,10 +68,7 @@ void Pad::remove( Sample* s )
     if( samples.at(i) == s )
     {
       samples.erase( samples.begin() + i );
-      // TODO - RT safety - don't delete the sample here - but send it away to
-      // the worker thread for dealloc
       //printf("Pad remove() sample at %i : sample name %s\n", i, s->getName() );
-      delete s;
     }
   }
 }
@@ -93,7 +90,7 @@ void Pad::setName( const char* n )
   dsp->writePadsState( bank_, ID_, this );
 }
 
-void Pad::add( Sample* s )
+void Pad::load( Sample* s )
 {
   assert( s );
   
@@ -102,6 +99,11 @@ void Pad::add( Sample* s )
   //printf("%s, b %i, p %i, s = %i\n", __PRETTY_FUNCTION__, bank_, ID_, s );
   //printf( "Pad::add() %s, total #samples on pad = %i\n", s->getName(), samples.size() );
   samples.push_back( s );
+}
+
+void Pad::add( Sample* s )
+{
+  load( s );
   
   // request DSP to refresh UI layers for this pad
   if( dsp )
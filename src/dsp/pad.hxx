@@ -61,7 +61,12 @@ class Pad
     
     /// library functions
     void add( Sample* );
+    /// removes a sample from the pad, without freeing it: RT safe. The caller
+    /// frees it, see Fabla2DSP::retire()
     void remove( Sample* s );
+    /// adds a sample without updating the UI: for the Pads of a Library that
+    /// is built off the RT thread, before it is swapped in
+    void load( Sample* );
     
     void clearAllSamples();
     bool loaded(){return loaded_;}
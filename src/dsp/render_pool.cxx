@@ -0,0 +1,215 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "render_pool.hxx"
+
+#include "voice.hxx"
+#include "telemetry.hxx"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace Fabla2
+{
+
+RenderPool::RenderPool( int threads, int maxVoices ) :
+  nThreads( 0 ),
+  quit( false ),
+  ticket( 0 ),
+  generation( 0 ),
+  voices( maxVoices ),
+  audioPriority( -1 ),
+  audioCpu( -1 )
+{
+  if( threads > FABLA2_RENDER_THREADS_MAX )
+    threads = FABLA2_RENDER_THREADS_MAX;
+  
+  sem_init( &start, 0, 0 );
+  
+  cpus = sysconf( _SC_NPROCESSORS_ONLN );
+  if( cpus < 1 )
+    cpus = 1;
+  
+  // helpers inherit the scheduling of the thread creating them, and follow
+  // the audio thread from the first job on
+  for(int i = 0; i < threads; i++)
+  {
+    pthread_t t;
+    int ret = pthread_create( &t, 0, run, this );
+    if( ret != 0 )
+    {
+      printf("Fabla2: failed to start render thread %i: %s\n", i, strerror( ret ) );
+      break;
+    }
+    
+    workers.push_back( t );
+    nThreads++;
+  }
+  
+  printf("Fabla2: rendering voices with %i helper threads\n", nThreads );
+}
+
+void RenderPool::follow( int& priority, int& cpu )
+{
+  const int p = audioPriority.load( std::memory_order_relaxed );
+  if( p >= 0 && p != priority )
+  {
+    // one below the audio thread, so a helper never delays it
+    struct sched_param param;
+    memset( &param, 0, sizeof(param) );
+    int policy = SCHED_OTHER;
+    if( p > 0 )
+    {
+      policy = SCHED_FIFO;
+      param.sched_priority = p > sched_get_priority_min( SCHED_FIFO ) ? p - 1 : p;
+    }
+    int ret = pthread_setschedparam( pthread_self(), policy, &param );
+    if( ret != 0 && priority < 0 )
+      printf("Fabla2: render thread without real-time priority: %s\n", strerror( ret ) );
+    priority = p;
+  }
+  
+  // all CPUs but the one of the audio thread: a helper that takes a voice
+  // there would wait for the audio thread, while the audio thread waits for it
+  const int c = audioCpu.load( std::memory_order_relaxed );
+  if( c >= 0 && c != cpu && cpus > 1 )
+  {
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for(int i = 0; i < cpus && i < CPU_SETSIZE; i++)
+    {
+      if( i != c )
+        CPU_SET( i, &set );
+    }
+    pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+    cpu = c;
+  }
+}
+
+void* RenderPool::run( void* self )
+{
+  RenderPool* pool = (RenderPool*)self;
+  int priority = -1;
+  int cpu      = -1;
+  while( true )
+  {
+    sem_wait( &pool->start );
+    if( pool->quit.load() )
+      break;
+    
+    pool->follow( priority, cpu );
+    pool->work();
+  }
+  return 0;
+}
+
+void RenderPool::work()
+{
+  while( true )
+  {
+    // a ticket of an older job fails the exchange, as the job was replaced.
+    // The count is in the ticket, so it is always the count of its own job
+    uint64_t t = ticket.load( std::memory_order_acquire );
+    const uint32_t i =   t         & 0xffff;
+    const uint32_t n = ( t >> 16 ) & 0xffff;
+    if( i >= n )
+      return;
+    
+    // the voice is read before the exchange: when the exchange succeeds, the
+    // job was still current, and the voice is its own
+    Voice* v = voices[i].load( std::memory_order_relaxed );
+    if( !ticket.compare_exchange_weak( t, t + 1, std::memory_order_acq_rel ) )
+      continue;
+    
+    v->render();
+    v->rendering.store( false, std::memory_order_release );
+  }
+}
+
+bool RenderPool::render( Voice** v, int c, uint64_t deadline )
+{
+  assert( c <= (int)voices.size() && c <= 0xffff );
+  
+  // the scheduling of the audio thread is read once, the CPU each job
+  if( audioPriority.load( std::memory_order_relaxed ) < 0 )
+  {
+    int policy = SCHED_OTHER;
+    struct sched_param param;
+    memset( &param, 0, sizeof(param) );
+    pthread_getschedparam( pthread_self(), &policy, &param );
+    const bool rt = policy == SCHED_FIFO || policy == SCHED_RR;
+    audioPriority.store( rt ? param.sched_priority : 0, std::memory_order_relaxed );
+  }
+  audioCpu.store( sched_getcpu(), std::memory_order_relaxed );
+  
+  // the job is published by the ticket, with the next generation. A helper
+  // still holding a ticket of the last job fails its exchange, whatever it
+  // sees of the stores before the ticket
+  for(int i = 0; i < c; i++)
+  {
+    v[i]->rendering.store( true, std::memory_order_relaxed );
+    voices[i].store( v[i], std::memory_order_relaxed );
+  }
+  generation++;
+  ticket.store( ( (uint64_t)generation << 32 ) | ( (uint64_t)c << 16 ),
+                std::memory_order_release );
+  
+  // helpers that didn't wake for the last job still have their post
+  int posted = 0;
+  sem_getvalue( &start, &posted );
+  for(int i = posted; i < nThreads; i++)
+    sem_post( &start );
+  
+  work();
+  
+  // every voice was claimed: wait for the ones helpers are still rendering,
+  // until the deadline
+  int next = 0;
+  for(int n = 0; ; n++)
+  {
+    while( next < c && !v[next]->rendering.load( std::memory_order_acquire ) )
+      next++;
+    if( next == c )
+      return true;
+    
+    if( n < FABLA2_RENDER_SPINS )
+      continue;
+    if( Telemetry::now() >= deadline )
+      return false;
+    sched_yield();
+  }
+}
+
+RenderPool::~RenderPool()
+{
+  quit.store( true );
+  for(int i = 0; i < nThreads; i++)
+    sem_post( &start );
+  
+  for(int i = 0; i < nThreads; i++)
+    pthread_join( workers.at(i), 0 );
+  
+  sem_destroy( &start );
+}
+
+}; // Fabla2
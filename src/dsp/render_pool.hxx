@@ -0,0 +1,118 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_RENDER_POOL_HXX
+#define OPENAV_FABLA2_RENDER_POOL_HXX
+
+#include <atomic>
+#include <vector>
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+
+/// most helper threads a RenderPool can be created with
+#define FABLA2_RENDER_THREADS_MAX 8
+
+/// blocks with fewer active voices or frames than this render on the audio
+/// thread only: waking the helpers would cost more than it saves
+#define FABLA2_RENDER_MIN_VOICES  4
+#define FABLA2_RENDER_MIN_FRAMES  64
+
+/// waiting for voices that render on helpers: the audio thread spins this many
+/// times, then yields until they are done or the deadline passed. It never
+/// sleeps, and a helper that was preempted can't hang the audio thread
+#define FABLA2_RENDER_SPINS       2000
+
+/// the deadline of render(), as a fraction of the block period from the
+/// start of rendering: the rest of the block still has to be mixed
+#define FABLA2_RENDER_DEADLINE    0.5
+
+namespace Fabla2
+{
+
+class Voice;
+
+/** RenderPool
+ * Helper threads that render voices in parallel with the audio thread. Voices
+ * are claimed from an atomic ticket, so each thread takes the next voice when
+ * it finishes one, without locks. The ticket holds the generation of the job,
+ * its voice count and the next voice, so a single exchange checks all three:
+ * a helper that wakes late can't claim a voice of a job that already ended.
+ *
+ * The audio thread claims voices too, and render() returns when every voice is
+ * rendered: it only waits for the voices helpers started, not for helpers that
+ * didn't wake up, and not past its deadline. Voices a helper still renders then
+ * are left to it: Voice::rendering is set until it is done, and the caller
+ * leaves the voice alone until then, without waiting for it.
+ *
+ * Only Voice::render() runs in parallel: the voices are mixed afterwards by the
+ * audio thread, in a fixed order, so the output is identical to rendering all
+ * voices on one thread.
+ */
+class RenderPool
+{
+  public:
+    /// starts the helper threads. They follow the audio thread: one real-time
+    /// priority below it when the system permits it, and never on its CPU.
+    /// A render() is given at most maxVoices voices
+    RenderPool( int threads, int maxVoices );
+    ~RenderPool();
+    
+    int threads(){return nThreads;}
+    
+    /// renders count voices, called by the audio thread. Returns false when
+    /// helpers were still rendering voices at deadline, in Telemetry::now()
+    /// time: the Voice::rendering of those is still set
+    bool render( Voice** voices, int count, uint64_t deadline );
+  
+  private:
+    int nThreads;
+    std::vector<pthread_t> workers;
+    
+    /// posted for the helpers that are asleep, on each render() call
+    sem_t start;
+    std::atomic<bool> quit;
+    
+    /// the current job: the generation in the high 32 bits, the voice count
+    /// in the next 16, and the next voice to claim in the low 16 bits
+    std::atomic<uint64_t> ticket;
+    uint32_t generation;
+    /// the voices of the current job. A helper reads its voice before it
+    /// claims it, so the voices can be replaced while late helpers render
+    std::vector< std::atomic<Voice*> > voices;
+    
+    /// priority of the audio thread, 0 when it isn't real-time, -1 before
+    /// the first render(), and the CPU it ran the last job on
+    std::atomic<int> audioPriority;
+    std::atomic<int> audioCpu;
+    int cpus;
+    
+    static void* run( void* self );
+    /// renders voices until there are none left to claim
+    void work();
+    /// moves the calling helper off the CPU of the audio thread, and below
+    /// its priority. Helper threads only
+    void follow( int& priority, int& cpu );
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_RENDER_POOL_HXX
@@ -0,0 +1,87 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "retire_queue.hxx"
+
+#include "sample.hxx"
+#include "library.hxx"
+
+namespace Fabla2
+{
+
+RetireQueue::RetireQueue() :
+  writeIndex( 0 ),
+  readIndex( 0 )
+{
+}
+
+bool RetireQueue::push( int type, void* object )
+{
+  const uint64_t w = writeIndex.load();
+  if( w - readIndex.load() >= FABLA2_RETIRE_QUEUE_SIZE )
+    return false;
+  
+  Entry& e = ring[ w % FABLA2_RETIRE_QUEUE_SIZE ];
+  e.type   = type;
+  e.object = object;
+  writeIndex.store( w + 1 );
+  return true;
+}
+
+bool RetireQueue::retire( Sample* s )
+{
+  return push( RETIRE_SAMPLE, s );
+}
+
+bool RetireQueue::retire( Library* l )
+{
+  return push( RETIRE_LIBRARY, l );
+}
+
+void RetireQueue::reclaim( uint64_t upto )
+{
+  uint64_t r = readIndex.load();
+  if( upto > writeIndex.load() )
+    upto = writeIndex.load();
+  
+  for( ; r < upto; r++ )
+  {
+    Entry& e = ring[ r % FABLA2_RETIRE_QUEUE_SIZE ];
+    if( e.type == RETIRE_SAMPLE )
+      delete (Sample*)e.object;
+    else
+      delete (Library*)e.object;
+    
+    // the slot can be reused by the RT thread once the object is freed
+    readIndex.store( r + 1 );
+  }
+}
+
+long RetireQueue::pending()
+{
+  return writeIndex.load() - readIndex.load();
+}
+
+RetireQueue::~RetireQueue()
+{
+  reclaim( writeIndex.load() );
+}
+
+}; // Fabla2
@@ -0,0 +1,88 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_RETIRE_QUEUE_HXX
+#define OPENAV_FABLA2_RETIRE_QUEUE_HXX
+
+#include <atomic>
+
+#include <stdint.h>
+
+/// objects that can wait to be freed at once, a power of two
+#define FABLA2_RETIRE_QUEUE_SIZE 1024
+
+namespace Fabla2
+{
+
+class Sample;
+class Library;
+
+/** RetireQueue
+ * Objects the RT thread is done with, waiting for the worker to free them. The
+ * RT thread is the only writer, and the worker the only reader, so the queue
+ * is a lock-free ring of fixed size.
+ *
+ * The worker frees objects up to an index the RT thread sends it with the
+ * worker message: as the worker handles its messages in order, stream refills
+ * scheduled before an object was retired are finished before it is freed.
+ */
+class RetireQueue
+{
+  public:
+    RetireQueue();
+    /// frees the objects that are still queued
+    ~RetireQueue();
+    
+    /// queues an object to be freed. Returns false when the queue is full:
+    /// the caller keeps the object. RT safe
+    bool retire( Sample* s );
+    bool retire( Library* l );
+    
+    /// the index after the last object queued. RT thread only
+    uint64_t queued(){return writeIndex.load();}
+    
+    /// frees the objects queued before index upto. Worker thread only
+    void reclaim( uint64_t upto );
+    
+    /// objects queued and not freed yet
+    long pending();
+  
+  private:
+    enum RETIRE_TYPE {
+      RETIRE_SAMPLE = 0,
+      RETIRE_LIBRARY,
+    };
+    
+    struct Entry
+    {
+      int   type;
+      void* object;
+    };
+    
+    Entry ring[FABLA2_RETIRE_QUEUE_SIZE];
+    std::atomic<uint64_t> writeIndex;
+    std::atomic<uint64_t> readIndex;
+    
+    bool push( int type, void* object );
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_RETIRE_QUEUE_HXX
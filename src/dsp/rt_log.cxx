@@ -0,0 +1,103 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "rt_log.hxx"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+namespace Fabla2
+{
+
+RtLog::RtLog() :
+  writeIndex( 0 ),
+  readIndex( 0 ),
+  blocks( 0 ),
+  dropped( 0 )
+{
+  for(int i = 0; i < FABLA2_RT_LOG_SIZE; i++)
+    ring[i].seq.store( 0 );
+}
+
+bool RtLog::write( RtLogSite& site, int level, const char* fmt, ... )
+{
+  // rate limit per call site: a voice that clicks every block would fill the
+  // ring before the worker gets to print it
+  const uint64_t window = blocks.load() / FABLA2_RT_LOG_WINDOW;
+  if( site.window.exchange( window ) != window )
+    site.count.store( 0 );
+  if( site.count.fetch_add( 1 ) >= FABLA2_RT_LOG_BURST )
+  {
+    site.suppressed.fetch_add( 1 );
+    return false;
+  }
+
+  // claim a slot
+  uint64_t w = writeIndex.load();
+  do
+  {
+    if( w - readIndex.load() >= FABLA2_RT_LOG_SIZE )
+    {
+      dropped.fetch_add( 1 );
+      return false;
+    }
+  }
+  while( !writeIndex.compare_exchange_weak( w, w + 1 ) );
+
+  Entry& e = ring[ w % FABLA2_RT_LOG_SIZE ];
+  e.level = level;
+
+  // vsnprintf into a buffer doesn't lock or allocate for the plain
+  // conversions used here
+  int len = 0;
+  const long s = site.suppressed.exchange( 0 );
+  if( s )
+    len = snprintf( e.text, FABLA2_RT_LOG_LINE, "(%li similar suppressed) ", s );
+
+  va_list args;
+  va_start( args, fmt );
+  vsnprintf( e.text + len, FABLA2_RT_LOG_LINE - len, fmt, args );
+  va_end( args );
+
+  // publish the message to the reader
+  e.seq.store( w + 1 );
+  return true;
+}
+
+bool RtLog::read( int& level, char* text, int size )
+{
+  const uint64_t r = readIndex.load();
+  Entry& e = ring[ r % FABLA2_RT_LOG_SIZE ];
+
+  // empty, or the slot is claimed but still being written
+  if( e.seq.load() != r + 1 )
+    return false;
+
+  level = e.level;
+  strncpy( text, e.text, size - 1 );
+  text[size-1] = '\0';
+
+  // the slot can be reused by the writers once it is copied
+  readIndex.store( r + 1 );
+  return true;
+}
+
+}; // Fabla2
@@ -0,0 +1,121 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_RT_LOG_HXX
+#define OPENAV_FABLA2_RT_LOG_HXX
+
+#include <atomic>
+
+#include <stdint.h>
+
+/// messages that can wait to be printed at once, a power of two
+#define FABLA2_RT_LOG_SIZE   64
+/// length of a message, including the terminating zero
+#define FABLA2_RT_LOG_LINE   128
+/// messages each call site can log per window of FABLA2_RT_LOG_WINDOW blocks,
+/// the others are counted and reported with the next message of the window after
+#define FABLA2_RT_LOG_BURST  4
+#define FABLA2_RT_LOG_WINDOW 256
+
+namespace Fabla2
+{
+
+/// message severity, in the order of the LV2 log levels
+enum RT_LOG_LEVEL {
+  RT_LOG_ERROR = 0,
+  RT_LOG_WARNING,
+  RT_LOG_NOTE,
+  RT_LOG_TRACE,
+};
+
+/// rate limiting state of a single call site, see FABLA2_RT_LOG
+struct RtLogSite
+{
+  RtLogSite() : window( 0 ), count( 0 ), suppressed( 0 ) {}
+  std::atomic<uint64_t> window;
+  std::atomic<int>      count;
+  std::atomic<long>     suppressed;
+};
+
+/** RtLog
+ * Log messages from the RT thread and the render threads. Messages are
+ * formatted into a slot of a lock-free ring of fixed size when they are
+ * written, and the worker prints them to the host log later: nothing on the
+ * audio path does a syscall or takes a lock.
+ *
+ * Use the FABLA2_RT_LOG macro to write: it compiles to nothing when Fabla2 is
+ * built without FABLA2_DEBUG_PRINTS.
+ */
+class RtLog
+{
+  public:
+    RtLog();
+
+    /// formats a message into the ring. Returns false when the message was
+    /// rate limited, or dropped as the ring is full. RT safe
+    bool write( RtLogSite& site, int level, const char* fmt, ... )
+        __attribute__ (( format( printf, 4, 5 ) ));
+
+    /// advances the rate limiting windows by one block. RT thread only
+    void tick(){blocks.store( blocks.load() + 1 );}
+
+    /// the index after the last message written. RT thread only
+    uint64_t written(){return writeIndex.load();}
+
+    /// copies the oldest message out of the ring. Returns false when there is
+    /// none. Worker thread only
+    bool read( int& level, char* text, int size );
+
+    /// the messages dropped as the ring was full since the last call
+    long takeDropped(){return dropped.exchange( 0 );}
+
+  private:
+    struct Entry
+    {
+      /// index + 1 of the message in the slot, once it is fully written
+      std::atomic<uint64_t> seq;
+      int  level;
+      char text[FABLA2_RT_LOG_LINE];
+    };
+
+    Entry ring[FABLA2_RT_LOG_SIZE];
+    // the render threads write too, so slots are claimed with a CAS
+    std::atomic<uint64_t> writeIndex;
+    std::atomic<uint64_t> readIndex;
+    std::atomic<uint64_t> blocks;
+    std::atomic<long>     dropped;
+};
+
+}; // Fabla2
+
+#ifdef FABLA2_DEBUG
+/// writes a printf style message to the RtLog log, which may be null
+#define FABLA2_RT_LOG( log, level, ... )                                       \
+  do {                                                                         \
+    static Fabla2::RtLogSite fabla2_rt_log_site;                               \
+    Fabla2::RtLog* fabla2_rt_log = (log);                                      \
+    if( fabla2_rt_log )                                                        \
+      fabla2_rt_log->write( fabla2_rt_log_site, level, __VA_ARGS__ );          \
+  } while( 0 )
+#else
+#define FABLA2_RT_LOG( log, level, ... ) do {} while( 0 )
+#endif // FABLA2_DEBUG
+
+#endif // OPENAV_FABLA2_RT_LOG_HXX
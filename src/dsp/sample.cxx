@@ -32,11 +32,14 @@
 #include "pad.hxx"
 #include "plotter.hxx"
 
+#include <atomic>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include <sndfile.h>
 #include <sndfile.hh>
 
-#include <samplerate.h>
-
 #ifdef FABLA2_COMPONENT_TEST
 #include "tests/qunit.hxx"
 extern QUnit::UnitTest qunit;
@@ -45,22 +48,14 @@ extern QUnit::UnitTest qunit;
 namespace Fabla2
 {
 
-static void fabla2_deinterleave( int size, const float* all, std::vector<float>& L, std::vector<float>& R )
+/// the last Sample generation handed out
+static std::atomic<uint64_t> fabla2_sample_generation( 0 );
+/// Samples created and not deleted yet
+static std::atomic<long> fabla2_sample_count( 0 );
+
+long Sample::count()
 {
-  L.resize( size / 2 );
-  R.resize( size / 2 );
-  
-  float* l = &L[0];
-  float* r = &R[0];
-#ifdef FABLA2_COMPONENT_TEST
-  printf("deinterlacing... size = %i\n", size );
-#endif
-  // de-interleave samples
-  for( int i = 0; i + 1 < size / 2; i++ )
-  {
-    *l++ = *all++;
-    *r++ = *all++;
-  }
+  return fabla2_sample_count.load();
 }
 
 const float* Sample::getWaveform()
@@ -107,11 +102,11 @@ void Sample::recacheWaveform()
   
   for( int f = 0; f < frames; f++ )
   {
-    float tmp = audioMono[f];
+    float tmp = getAudio(0)[f];
     
     if ( channels == 2 )
     {
-      tmp += audioStereoRight[f];
+      tmp += getAudio(1)[f];
       f++;
     }
     
@@ -153,45 +148,6 @@ void Sample::recacheWaveform()
 }
 
 
-void Sample::resample( int fromSr, std::vector<float>& buf )
-{
-  /// resample audio
-  //printf("Resampling from %i to %i\n", fromSr, sr);
-  
-  float resampleRatio = float( sr ) / fromSr;
-  std::vector<float> resampled( buf.size() * resampleRatio );
-  
-  SRC_DATA data;
-  data.data_in  = &buf[0];
-  data.data_out = &resampled[0];
-  
-  data.input_frames = buf.size();
-  data.output_frames = buf.size() * resampleRatio;
-  
-  data.end_of_input = 0;
-  data.src_ratio = resampleRatio;
-  
-  int q = SRC_SINC_FASTEST;
-  /*
-  switch( resampleQuality )
-  {
-    case 0: q = SRC_LINEAR;             break;
-    case 1: q = SRC_SINC_FASTEST;       break;
-    case 2: q = SRC_SINC_BEST_QUALITY;  break;
-  }
-  */
-  // resample quality taken from config file, 
-  int ret = src_simple ( &data, q, 1 );
-  if ( ret == 0 )
-    printf("%s%i%s%i", "Resampling finished, from ", data.input_frames_used, " to ", data.output_frames_gen );
-  else
-    printf("%s%i%s%i", "Resampling finished, from ", data.input_frames_used, " to ", data.output_frames_gen );
-  
-  /// exchange buffers, so buf contains the resampled audio
-  buf.swap( resampled );
-}
-
-
 void Sample::init()
 {
   gain  = 0.75;
@@ -226,6 +182,9 @@ Sample::Sample( Fabla2DSP* d, int rate, const char* nme, int size, float* data )
   name( nme ),
   channels( 2 ),
   frames( size / 2 ),
+  streaming( false ),
+  headFrames( size / 2 ),
+  generation( ++fabla2_sample_generation ),
   velLow( 0 ),
   velHigh( 1 ),
   pitch( 0 ),
@@ -237,28 +196,35 @@ Sample::Sample( Fabla2DSP* d, int rate, const char* nme, int size, float* data )
 #endif
   
   init();
+  fabla2_sample_count++;
   
-  fabla2_deinterleave( size, data, audioMono, audioStereoRight );
+  // recorded audio is not in the SamplePool, as it has no file yet
+  buffer.reset( new SampleBuffer( rate, size, data ) );
 }
 
-Sample::Sample( Fabla2DSP* d, int rate, std::string n, std::string path  ) :
+Sample::Sample( Fabla2DSP* d, int rate, std::string n, std::string path,
+                long streamFrames, bool compact, int rateMode ) :
   dsp( d ),
   sr(rate),
   name( n ),
+  filePath( path ),
   channels( 0 ),
   frames( 0 ),
+  streaming( false ),
+  headFrames( 0 ),
+  generation( ++fabla2_sample_generation ),
   velLow( 0 ),
   velHigh( 127 ),
   pitch( 0 ),
   gain ( 0.5 ),
   pan  ( 0.5 )
 {
-  SF_INFO info;
-  memset( &info, 0, sizeof( SF_INFO ) );
-  SNDFILE* const sndfile = sf_open( path.c_str(), SFM_READ, &info);
-  if ( !sndfile )
+  fabla2_sample_count++;
+  
+  buffer = SamplePool::load( path, rate, streamFrames, compact, rateMode );
+  if( !buffer )
   {
-    printf("Failed to open sample '%s'\n", path.c_str() );
+    // the pool printed the error: frames == 0 tells the caller
     return;
   }
   
@@ -266,85 +232,17 @@ Sample::Sample( Fabla2DSP* d, int rate, std::string n, std::string path  ) :
   name = basename( tmp );
   free( tmp );
   
-  channels = info.channels;
-  frames   = info.frames;
-  
-  if( frames == 0 )
-  {
-    // bad file path?
-    printf("Error loading sample %s, frames == 0\n", path.c_str() );
-    return;
-  }
-  
-  if( frames < 200 )
-  {
-    printf("Fabla2: Refusing to load sample with %i frames - too short\n", frames );
-  }
-  
-  
-  printf("Loading sample with %i frames\n", frames );
-  
-  if( channels > 2 || channels <= 0 )
-  {
-    printf("Error loading sample %s, channels > 2 || <= 0\n", path.c_str() );
-    return;
-  }
-  
-  // tmp buffer for loading
-  std::vector<float> audio;
-  
-  // used to load into from disk. If mono, load directly into this buffer
-  // if stereo, load into audio buffer, and then de-interleave samples into
-  // the two buffers
-  float* loadBuffer = 0;
+  channels   = buffer->getChannels();
+  frames     = buffer->getFrames();
+  streaming  = buffer->isStreaming();
+  headFrames = buffer->getHeadFrames();
   
-  if( channels == 1 )
-  {
-    audioMono.resize( frames );
-    loadBuffer = &audioMono.at(0);
-  }
-  else if( channels == 2 )
-  {
-    audio.resize( frames * channels );
-    loadBuffer = &audio.at(0);
-  }
-  
-  // read from disk
-  sf_seek(sndfile, 0ul, SEEK_SET);
-  int samplRead = sf_read_float( sndfile, loadBuffer, info.frames * channels );
-  sf_close(sndfile);
-  
-  if( channels == 2 )
-  {
-    audioMono.resize( frames );
-    audioStereoRight.resize( frames );
-    fabla2_deinterleave( frames, loadBuffer, audioMono, audioStereoRight );
-  }
-  
-  if( sr != info.samplerate )
-  {
-    resample( info.samplerate, audioMono );
-    
-    if( channels == 2 )
-    {
-      resample( info.samplerate, audioStereoRight );
-    }
-    
-    // since we've resampled, the size will have changed!
-    frames = audioMono.size();
-  }
+  // a save can link to the file while it is unchanged, if it holds the
+  // same audio as a write() would
+  if( buffer->isExactFile() )
+    source.stamp( path, generation );
   
   init();
-  
-#ifdef FABLA2_COMPONENT_TEST
-  if( false )
-  {
-    Plotter::plot( path, frames * channels, loadBuffer );
-    printf("Sample %s loaded OK: Channels = %i, Frames = %i\n", path.c_str(), channels, frames );
-  }
-  QUNIT_IS_TRUE( info.frames > 0 );
-  QUNIT_IS_TRUE( samplRead == info.frames * info.channels );
-#endif
 }
 
 void Sample::velocityLow( float low )
@@ -360,37 +258,117 @@ void Sample::velocityHigh( float high )
 
 const float* Sample::getAudio( int chnl )
 {
-  if( channels == 2 && chnl == 1 && audioStereoRight.size() > 0 )
-  {
-    return &audioStereoRight[0];
-  }
-  return &audioMono[0];
+  return buffer->getAudio( chnl );
 }
 
 bool Sample::write( const char* filename )
 {
-  printf("%s Start: %s : %s\n", __PRETTY_FUNCTION__, __TIME__, filename );
+  // the rate of the audio: samples may be kept at the rate of their file
+  SndfileHandle outfile( filename, SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_FLOAT, channels, buffer->getRate() );
+  if( !outfile )
+    return false;
   
-  SndfileHandle outfile( filename, SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_FLOAT, channels, dsp->sr );
-  if( channels == 1 )
+  if( streaming )
   {
-    int written = outfile.write( &audioMono[0], frames );
-    //printf(" wrote %i frames!\n", written );
+    // only the head is in RAM: copy the audio from the file being streamed,
+    // which must still hold all of it
+    SndfileHandle infile( filePath.c_str() );
+    if( !infile || infile.channels() != channels )
+      return false;
+    
+    std::vector<float> tmp( 4096 * channels );
+    sf_count_t n = 0;
+    sf_count_t total = 0;
+    while( (n = infile.readf( &tmp[0], 4096 )) > 0 )
+    {
+      if( outfile.writef( &tmp[0], n ) != n )
+        return false;
+      total += n;
+    }
+    return total == frames;
   }
-  else
+  
+  // convert to float from the storage format, and interleave the channels
+  std::vector<float> chan( frames );
+  std::vector<float> tmp( frames * channels );
+  for(int c = 0; c < channels; c++)
   {
-    // hack to write stereo interleaved channels
-    std::vector<float> tmp;
+    buffer->getFloat( c, 0, frames, &chan[0] );
     for(int i = 0; i < frames; i++)
-    {
-      tmp.push_back( audioMono[i] );
-      tmp.push_back( audioStereoRight[i] );
-    }
-    int wrtn = outfile.write( &tmp[0], frames * channels );
-    printf("Stere: wrote %i frames!\n", wrtn );
+      tmp[i * channels + c] = chan[i];
+  }
+  const sf_count_t items = (sf_count_t)frames * channels;
+  return outfile.write( &tmp[0], items ) == items;
+}
+
+int Sample::save( const char* filename )
+{
+  FileStamp target;
+  target.stamp( filename, 0 );
+  
+  // the file holds this audio already: written by the last save, or the
+  // file the audio was loaded from
+  const bool savedOk  = saved.unchanged( generation );
+  const bool sourceOk = source.unchanged( generation );
+  if( ( savedOk && target.same( saved ) ) || ( sourceOk && target.same( source ) ) )
+  {
+    saved.stamp( filename, generation );
+    return SAVE_UNCHANGED;
   }
   
-  printf("%s Done: %s\n", __PRETTY_FUNCTION__, __TIME__ );
+  // the new file is made next to the target, and renamed over it: a failed
+  // save leaves the old file whole, and a file linked to it isn't written
+  // through
+  const std::string tmp = std::string( filename ) + ".tmp";
+  unlink( tmp.c_str() );
+  
+  int result = SAVE_WRITTEN;
+  if( ( savedOk  && link( saved.path.c_str(),  tmp.c_str() ) == 0 ) ||
+      ( sourceOk && link( source.path.c_str(), tmp.c_str() ) == 0 ) )
+    result = SAVE_LINKED;
+  else if( !write( tmp.c_str() ) )
+    result = SAVE_FAILED;
+  
+  if( result == SAVE_FAILED || rename( tmp.c_str(), filename ) != 0 )
+  {
+    unlink( tmp.c_str() );
+    return SAVE_FAILED;
+  }
+  
+  saved.stamp( filename, generation );
+  return result;
+}
+
+bool Sample::FileStamp::stamp( const std::string& p, uint64_t gen )
+{
+  struct stat st;
+  if( stat( p.c_str(), &st ) != 0 )
+  {
+    path.clear();
+    return false;
+  }
+  
+  path = p;
+  dev  = st.st_dev;
+  ino  = st.st_ino;
+  size = st.st_size;
+  sec  = st.st_mtim.tv_sec;
+  nsec = st.st_mtim.tv_nsec;
+  generation = gen;
+  return true;
+}
+
+bool Sample::FileStamp::unchanged( uint64_t gen ) const
+{
+  FileStamp now;
+  return !path.empty() && generation == gen && now.stamp( path, gen ) &&
+         now.same( *this ) && now.size == size && now.sec == sec &&
+         now.nsec == nsec;
+}
+
+bool Sample::FileStamp::same( const FileStamp& o ) const
+{
+  return !path.empty() && !o.path.empty() && dev == o.dev && ino == o.ino;
 }
 
 bool Sample::velocity( float vel )
@@ -408,6 +386,8 @@ bool Sample::velocity( float vel )
 
 Sample::~Sample()
 {
+  fabla2_sample_count--;
+  
 #ifdef FABLA2_COMPONENT_TEST
   printf("%s\n", __PRETTY_FUNCTION__ );
 #endif
@@ -23,8 +23,10 @@
 
 #include "../shared.hxx"
 
+#include "sample_pool.hxx"
+
+#include <memory>
 #include <string>
-#include <vector>
 
 namespace Fabla2
 {
@@ -38,26 +40,67 @@ class Fabla2DSP;
 class Sample
 {
   public:
-    /// normal constructor: loads an audio sample from disk using sndfile
-    Sample( Fabla2DSP* dsp, int rate, std::string name, std::string filePathToLoad );
+    /// normal constructor: loads an audio sample from disk using sndfile, or
+    /// shares the audio with other Samples of the same file: see SamplePool.
+    /// Files longer than streamFrames are streamed from disk, and only their
+    /// head is loaded: 0 loads all files into RAM. Compact keeps the integer
+    /// PCM format of the file in RAM, and rateMode chooses when files are
+    /// resampled to the plugin rate: see SampleBuffer
+    Sample( Fabla2DSP* dsp, int rate, std::string name, std::string filePathToLoad,
+            long streamFrames = 0, bool compact = false,
+            int rateMode = SampleBuffer::SAMPLE_RATE_CONVERT );
     
     /// record constructor: creates a Sample based on live-recorded audio data
     Sample( Fabla2DSP* dsp, int rate, const char* name, int size, float* data );
     
     ~Sample();
     
-    /// writes this sample to disk: used by LV2 State save()
+    /// writes this sample to disk
     bool write( const char* filename );
     
+    /// results of save()
+    enum SAVE_RESULT {
+      SAVE_UNCHANGED = 0, ///< filename already holds this audio
+      SAVE_LINKED,        ///< hard linked to a file that holds this audio
+      SAVE_WRITTEN,
+      SAVE_FAILED,
+    };
+    /// stores the audio at filename for LV2 State save(): the file is only
+    /// written when no file this Sample saved or loaded holds the same audio
+    int save( const char* filename );
+    
+    /// changes whenever the audio of this Sample changes. Audio is never
+    /// modified in place, so it is taken from a global counter when a Sample
+    /// is created
+    uint64_t getGeneration(){return generation;}
+    
+    /// Samples alive in the process: a leak counter, that stays flat over a
+    /// session when every Sample that is removed gets freed
+    static long count();
+    
     /// gives the name of the sample
     const char*   getName()     {return name.c_str();}
     
     /// data get functions
     const int     getChannels() {return channels    ;}
     const long    getFrames()   {return (endPoint - startPoint)*frames;}
-    /// returns the buffer for the provided channel
+    /// returns the buffer for the provided channel, 0 if not stored as float
     const float*  getAudio(int channel);
+    /// the storage format, and the rate of the audio in RAM
+    int           getFormat(){return buffer->getFormat();}
+    int           getRate()  {return buffer->getRate();}
+    /// the audio data: the Sampler plays SampleBuffer::playBuffer() of it
+    const SampleBuffer* getBuffer(){return buffer.get();}
     const int     getStartPoint(){return startPoint*frames;}
+    const long    getEndPoint()  {return endPoint*frames;}
+    /// frames in the whole file, including those that are not in RAM
+    const long    getTotalFrames(){return frames;}
+    
+    /// streamed samples keep only getHeadFrames() frames in RAM, the voice
+    /// SampleStream reads the rest from the file at getPath()
+    bool          isStreaming()  {return streaming;}
+    const long    getHeadFrames(){return headFrames;}
+    const char*   getPath()      {return filePath.c_str();}
     
     /// returns the waveform buffer, a mono-mixdown resampled to fit the window
     const float* getWaveform();
@@ -98,16 +141,38 @@ class Sample
     /// convienience for setting defaults after constructor
     void init();
     
-    /// resamples to a new samplerate
-    void resample( int fromSr, std::vector<float>& inBuffer );
-    
     std::string name;
+    std::string filePath;
     
     /// audio variables
     int channels;
     long frames;
-    std::vector<float> audioMono;
-    std::vector<float> audioStereoRight;
+    bool streaming;
+    long headFrames;
+    /// the audio data, which may be shared with other Samples
+    std::shared_ptr<const SampleBuffer> buffer;
+    uint64_t generation;
+    
+    /// identifies a file and its state on disk, to detect it was changed
+    struct FileStamp
+    {
+      FileStamp() : dev(0), ino(0), size(0), sec(0), nsec(0), generation(0) {}
+      std::string path;
+      uint64_t dev, ino;
+      long size, sec, nsec;
+      /// the Sample generation the file holds
+      uint64_t generation;
+      
+      /// records path as it is now, returns false if it doesn't exist
+      bool stamp( const std::string& path, uint64_t generation );
+      /// true if the recorded file still exists unchanged, and holds gen
+      bool unchanged( uint64_t gen ) const;
+      /// true if both stamps are the same file on disk
+      bool same( const FileStamp& o ) const;
+    };
+    /// the file the audio was loaded from, and the file written by save()
+    FileStamp source;
+    FileStamp saved;
     
     /// a low-resolution re-sample of the audio data in this Sample
     void recacheWaveform();
@@ -0,0 +1,399 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "sample_cache.hxx"
+
+#include "sample_pool.hxx"
+#include "dsp_hermite.hxx"
+
+#include <algorithm>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/// bump when the entry layout changes, so old entries are not read
+#define FABLA2_CACHE_VERSION 1
+#define FABLA2_CACHE_SUFFIX  ".f2cache"
+/// the audio of each channel starts at a multiple of this many bytes
+#define FABLA2_CACHE_ALIGN   64
+
+namespace Fabla2
+{
+
+/// the start of each entry, followed by the audio of each channel
+struct SampleCacheHeader
+{
+  char     magic[8];
+  uint32_t version;
+  int32_t  rate;
+  int32_t  channels;
+  int32_t  format;
+  int32_t  streaming;
+  int32_t  exactFile;
+  int64_t  frames;
+  int64_t  headFrames;
+  int64_t  dataFrames;
+  /// the source file when the entry was written
+  int64_t  sourceSize;
+  int64_t  sourceSec;
+  int64_t  sourceNsec;
+};
+
+static const char fabla2_cache_magic[8] = { 'F','A','B','L','A','2','C','\0' };
+
+static long fabla2_cache_align( long bytes )
+{
+  return ( bytes + FABLA2_CACHE_ALIGN - 1 ) / FABLA2_CACHE_ALIGN * FABLA2_CACHE_ALIGN;
+}
+
+/// bytes per frame of a SampleBuffer::SAMPLE_FORMAT
+static int fabla2_cache_frame_bytes( int format )
+{
+  if( format == SampleBuffer::SAMPLE_S16 )
+    return sizeof(int16_t);
+  if( format == SampleBuffer::SAMPLE_S24 )
+    return sizeof(PCM24);
+  return sizeof(float);
+}
+
+std::mutex  SampleCache::mutex;
+std::string SampleCache::dir;
+long        SampleCache::bytes = 0;
+
+void SampleCache::directory( const std::string& d )
+{
+  std::lock_guard<std::mutex> lock( mutex );
+  dir = d;
+}
+
+std::string SampleCache::directory()
+{
+  std::lock_guard<std::mutex> lock( mutex );
+  if( !dir.empty() )
+    return dir;
+  
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  if( xdg && xdg[0] )
+    return std::string( xdg ) + "/fabla2";
+  const char* home = getenv("HOME");
+  return std::string( home ? home : "/tmp" ) + "/.cache/fabla2";
+}
+
+void SampleCache::limit( long b )
+{
+  std::lock_guard<std::mutex> lock( mutex );
+  bytes = b < 0 ? 0 : b;
+}
+
+long SampleCache::limit()
+{
+  std::lock_guard<std::mutex> lock( mutex );
+  return bytes;
+}
+
+std::string SampleCache::entry( const std::string& path, int rate,
+                                long streamFrames, bool compact, int quality )
+{
+  if( !limit() )
+    return std::string();
+  
+  struct stat st;
+  if( stat( path.c_str(), &st ) != 0 )
+    return std::string();
+  
+  char settings[256];
+  snprintf( settings, sizeof(settings), "\n%ld %ld %ld %i %ld %i %i %i",
+            (long)st.st_size, (long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec,
+            rate, streamFrames, compact ? 1 : 0, quality, FABLA2_CACHE_VERSION );
+  
+  // FNV-1a of the path and the settings
+  const std::string key = path + settings;
+  uint64_t hash = 14695981039346656037ull;
+  for(size_t i = 0; i < key.size(); i++)
+  {
+    hash ^= (uint8_t)key[i];
+    hash *= 1099511628211ull;
+  }
+  
+  char name[64];
+  snprintf( name, sizeof(name), "/%016llx" FABLA2_CACHE_SUFFIX, (unsigned long long)hash );
+  return directory() + name;
+}
+
+bool SampleCache::read( const std::string& entry, SampleBuffer* b )
+{
+  int fd = open( entry.c_str(), O_RDONLY );
+  if( fd < 0 )
+    return false;
+  
+  struct stat st;
+  if( fstat( fd, &st ) != 0 || st.st_size < (off_t)sizeof(SampleCacheHeader) )
+  {
+    close( fd );
+    return false;
+  }
+  
+  // fault the whole entry in now
+  int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+  flags |= MAP_POPULATE;
+#endif
+  void* m = mmap( 0, st.st_size, PROT_READ, flags, fd, 0 );
+  close( fd );
+  if( m == MAP_FAILED )
+    return false;
+  
+  // an entry from another version, a hash collision with another file, or a
+  // damaged entry: its sizes are checked before they are multiplied
+  const SampleCacheHeader* h = (const SampleCacheHeader*)m;
+  const long headerBytes = fabla2_cache_align( sizeof(SampleCacheHeader) );
+  const int frameBytes = fabla2_cache_frame_bytes( h->format );
+  struct stat src;
+  bool valid = memcmp( h->magic, fabla2_cache_magic, sizeof(h->magic) ) == 0 &&
+               h->version == FABLA2_CACHE_VERSION &&
+               h->rate > 0 &&
+               ( h->channels == 1 || h->channels == 2 ) &&
+               h->format >= SampleBuffer::SAMPLE_FLOAT &&
+               h->format <= SampleBuffer::SAMPLE_S24 &&
+               h->dataFrames >= h->headFrames && h->headFrames > 0 &&
+               h->dataFrames <= st.st_size / frameBytes &&
+               ( h->streaming || ( h->frames >= 0 &&
+                 h->frames + FABLA2_SAMPLE_GUARD_FRAMES <= h->dataFrames ) );
+  const long chanBytes = valid ? fabla2_cache_align( h->dataFrames * frameBytes ) : 0;
+  valid = valid &&
+          headerBytes + chanBytes * h->channels <= st.st_size &&
+          stat( b->path.c_str(), &src ) == 0 &&
+          h->sourceSize == src.st_size &&
+          h->sourceSec  == src.st_mtim.tv_sec &&
+          h->sourceNsec == src.st_mtim.tv_nsec;
+  if( !valid )
+  {
+    printf("Fabla2: ignoring invalid cache entry %s\n", entry.c_str() );
+    munmap( m, st.st_size );
+    return false;
+  }
+  
+  b->rate       = h->rate;
+  b->channels   = h->channels;
+  b->frames     = h->frames;
+  b->streaming  = h->streaming;
+  b->exactFile  = h->exactFile;
+  b->headFrames = h->headFrames;
+  b->format     = h->format;
+  b->dataFrames = h->dataFrames;
+  b->cached     = true;
+  
+  // the page cache drops clean file pages under memory pressure, and the RT
+  // thread would fault them back in from disk: the mapping is used only when
+  // it is locked in RAM, otherwise the audio is copied like a decoded one
+  if( mlock( m, st.st_size ) == 0 )
+  {
+    b->data[0]  = (const uint8_t*)m + headerBytes;
+    b->data[1]  = h->channels == 2 ? (const uint8_t*)b->data[0] + chanBytes : b->data[0];
+    b->map      = m;
+    b->mapBytes = st.st_size;
+  }
+  else
+  {
+    const long bytes = h->dataFrames * frameBytes;
+    for(int c = 0; c < h->channels; c++)
+    {
+      const uint8_t* in = (const uint8_t*)m + headerBytes + c * chanBytes;
+      if( h->format == SampleBuffer::SAMPLE_FLOAT )
+      {
+        std::vector<float>& out = c == 0 ? b->audioMono : b->audioStereoRight;
+        out.resize( h->dataFrames );
+        memcpy( &out[0], in, bytes );
+      }
+      else
+      {
+        std::vector<uint8_t>& out = c == 0 ? b->pcmLeft : b->pcmRight;
+        out.assign( in, in + bytes );
+      }
+    }
+    munmap( m, st.st_size );
+    b->bindData();
+  }
+  
+  // the modification time of an entry is when it was last used
+  utimes( entry.c_str(), 0 );
+  return true;
+}
+
+/// creates a directory and its parents
+static bool fabla2_cache_mkdir( const std::string& d )
+{
+  for(size_t i = 1; i <= d.size(); i++)
+  {
+    if( i == d.size() || d[i] == '/' )
+    {
+      if( mkdir( d.substr( 0, i ).c_str(), 0755 ) != 0 && errno != EEXIST )
+        return false;
+    }
+  }
+  return true;
+}
+
+void SampleCache::write( const std::string& entry, const SampleBuffer* b )
+{
+  struct stat src;
+  if( stat( b->path.c_str(), &src ) != 0 )
+    return;
+  
+  const long headerBytes = fabla2_cache_align( sizeof(SampleCacheHeader) );
+  const long dataBytes = b->dataFrames * fabla2_cache_frame_bytes( b->format );
+  const long chanBytes = fabla2_cache_align( dataBytes );
+  const long total = headerBytes + chanBytes * b->channels;
+  const long max = limit();
+  if( total > max )
+    return;
+  
+  std::vector<uint8_t> header( headerBytes, 0 );
+  SampleCacheHeader* h = (SampleCacheHeader*)&header[0];
+  memcpy( h->magic, fabla2_cache_magic, sizeof(h->magic) );
+  h->version    = FABLA2_CACHE_VERSION;
+  h->rate       = b->rate;
+  h->channels   = b->channels;
+  h->format     = b->format;
+  h->streaming  = b->streaming;
+  h->exactFile  = b->exactFile;
+  h->frames     = b->frames;
+  h->headFrames = b->headFrames;
+  h->dataFrames = b->dataFrames;
+  h->sourceSize = src.st_size;
+  h->sourceSec  = src.st_mtim.tv_sec;
+  h->sourceNsec = src.st_mtim.tv_nsec;
+  
+  if( !fabla2_cache_mkdir( directory() ) )
+  {
+    printf("Fabla2: can't create sample cache directory %s\n", directory().c_str() );
+    return;
+  }
+  
+  // write to a temporary file and rename it, so a reader never sees a part
+  std::string tmp = entry + ".XXXXXX";
+  std::vector<char> tmpName( tmp.begin(), tmp.end() );
+  tmpName.push_back( 0 );
+  int fd = mkstemp( &tmpName[0] );
+  if( fd < 0 )
+    return;
+  
+  FILE* f = fdopen( fd, "wb" );
+  std::vector<uint8_t> padding( chanBytes - dataBytes, 0 );
+  bool ok = f && fwrite( &header[0], 1, headerBytes, f ) == (size_t)headerBytes;
+  for(int c = 0; ok && c < b->channels; c++)
+  {
+    ok = fwrite( b->data[c], 1, dataBytes, f ) == (size_t)dataBytes &&
+         fwrite( &padding[0], 1, padding.size(), f ) == padding.size();
+  }
+  if( f )
+    ok = fclose( f ) == 0 && ok;
+  else
+    close( fd );
+  
+  if( !ok || rename( &tmpName[0], entry.c_str() ) != 0 )
+  {
+    printf("Fabla2: failed to write sample cache entry %s\n", entry.c_str() );
+    unlink( &tmpName[0] );
+    return;
+  }
+  
+  trim( max );
+}
+
+/// an entry in the cache directory: last use, size and path
+struct SampleCacheFile
+{
+  struct timespec used;
+  long size;
+  std::string path;
+  
+  bool operator<( const SampleCacheFile& o ) const
+  {
+    if( used.tv_sec != o.used.tv_sec )
+      return used.tv_sec < o.used.tv_sec;
+    return used.tv_nsec < o.used.tv_nsec;
+  }
+};
+
+static long fabla2_cache_list( const std::string& d, std::vector<SampleCacheFile>& files )
+{
+  long total = 0;
+  DIR* dp = opendir( d.c_str() );
+  if( !dp )
+    return 0;
+  
+  const size_t suffix = strlen( FABLA2_CACHE_SUFFIX );
+  while( struct dirent* e = readdir( dp ) )
+  {
+    std::string name = e->d_name;
+    if( name.size() <= suffix ||
+        name.compare( name.size() - suffix, suffix, FABLA2_CACHE_SUFFIX ) != 0 )
+      continue;
+    
+    SampleCacheFile f;
+    f.path = d + "/" + name;
+    struct stat st;
+    if( stat( f.path.c_str(), &st ) != 0 )
+      continue;
+    f.used = st.st_mtim;
+    f.size = st.st_size;
+    files.push_back( f );
+    total += f.size;
+  }
+  closedir( dp );
+  return total;
+}
+
+void SampleCache::trim( long max )
+{
+  std::vector<SampleCacheFile> files;
+  long total = fabla2_cache_list( directory(), files );
+  
+  // oldest first: entries mapped by a SampleBuffer stay valid when deleted
+  std::sort( files.begin(), files.end() );
+  for(size_t i = 0; i < files.size() && total > max; i++)
+  {
+    if( unlink( files[i].path.c_str() ) == 0 )
+      total -= files[i].size;
+  }
+}
+
+long SampleCache::usage()
+{
+  std::vector<SampleCacheFile> files;
+  return fabla2_cache_list( directory(), files );
+}
+
+void SampleCache::clear()
+{
+  trim( 0 );
+}
+
+}; // Fabla2
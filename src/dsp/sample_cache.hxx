@@ -0,0 +1,87 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_SAMPLE_CACHE_HXX
+#define OPENAV_FABLA2_SAMPLE_CACHE_HXX
+
+#include <mutex>
+#include <string>
+
+namespace Fabla2
+{
+
+class SampleBuffer;
+
+/** SampleCache
+ * A directory of decoded and resampled audio, so a kit loads without running
+ * sndfile and libsamplerate again. Each entry holds one SampleBuffer in its
+ * storage format, and is mapped with a single mmap() when it is read. The
+ * mapping is locked in RAM, or copied when it can't be, so playing a cached
+ * buffer never waits for the disk.
+ *
+ * Entries are named by a hash of the source file path, size and modification
+ * time, the target rate, streaming threshold, compact storage and resampler
+ * quality: a source file that changes on disk gets a new entry, and the old
+ * one is evicted like any other unused entry. Reading an entry marks it used,
+ * and writing one evicts the least recently used entries until the cache fits
+ * its size limit.
+ *
+ * The cache is process-wide, and disabled until a size limit is set.
+ */
+class SampleCache
+{
+  public:
+    /// sets the cache directory: an empty string uses $XDG_CACHE_HOME/fabla2
+    /// or ~/.cache/fabla2
+    static void directory( const std::string& dir );
+    static std::string directory();
+    
+    /// sets the size limit of the cache in bytes, 0 disables the cache
+    static void limit( long bytes );
+    static long limit();
+    
+    /// bytes used by the entries in the cache directory
+    static long usage();
+    /// deletes all entries
+    static void clear();
+    
+    /// returns the entry path for a buffer loaded from path with these
+    /// settings, or an empty string if the cache is disabled or the source
+    /// file doesn't exist. quality is the libsamplerate converter type
+    static std::string entry( const std::string& path, int rate,
+                              long streamFrames, bool compact, int quality );
+    
+    /// reads an entry into b, returns false if it doesn't exist or is invalid
+    static bool read( const std::string& entry, SampleBuffer* b );
+    /// writes the audio of b to an entry, and evicts entries over the limit
+    static void write( const std::string& entry, const SampleBuffer* b );
+  
+  private:
+    /// deletes the least recently used entries until usage is below limit
+    static void trim( long limit );
+    
+    static std::mutex mutex;
+    static std::string dir;
+    static long bytes;
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_SAMPLE_CACHE_HXX
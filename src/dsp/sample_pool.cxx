@@ -0,0 +1,632 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "sample_pool.hxx"
+
+#include "plotter.hxx"
+#include "sample_cache.hxx"
+#include "sample_stream.hxx"
+#include "dsp_hermite.hxx"
+
+#include <math.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <sndfile.h>
+#include <samplerate.h>
+
+#ifdef FABLA2_COMPONENT_TEST
+#include "tests/qunit.hxx"
+extern QUnit::UnitTest qunit;
+#endif 
+
+namespace Fabla2
+{
+
+std::mutex SamplePool::mutex;
+std::map< SamplePool::Key, std::weak_ptr<const SampleBuffer> > SamplePool::buffers;
+
+std::mutex SamplePool::converterLifetime;
+std::mutex SamplePool::converterMutex;
+std::condition_variable SamplePool::converterWake;
+std::deque<SamplePool::Job> SamplePool::converterJobs;
+std::thread SamplePool::converterThread;
+int  SamplePool::converterUsers = 0;
+bool SamplePool::converterQuit = false;
+bool SamplePool::converterBusy = false;
+
+std::shared_ptr<const SampleBuffer> SamplePool::load( const std::string& path,
+                                                      int rate,
+                                                      long streamFrames,
+                                                      bool compact,
+                                                      int rateMode )
+{
+  struct stat st;
+  if( stat( path.c_str(), &st ) != 0 )
+  {
+    printf("Failed to open sample '%s'\n", path.c_str() );
+    return std::shared_ptr<const SampleBuffer>();
+  }
+  
+  // audio at the rate of the file doesn't depend on the plugin rate
+  const bool native = rateMode != SampleBuffer::SAMPLE_RATE_CONVERT;
+  Key key( path, st.st_mtim.tv_sec, st.st_mtim.tv_nsec, st.st_size,
+           native ? 0 : rate, streamFrames, compact );
+  
+  std::shared_ptr<const SampleBuffer> b;
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    b = find( key );
+  }
+  
+  if( !b )
+  {
+    // load without holding the lock, so other instances can look up samples
+    b.reset( new SampleBuffer( path, rate, streamFrames, compact, rateMode ) );
+    if( !b->getFrames() )
+      return std::shared_ptr<const SampleBuffer>();
+    
+    std::lock_guard<std::mutex> lock( mutex );
+    
+    // another instance may have loaded the same file meanwhile: use one copy
+    std::shared_ptr<const SampleBuffer> other = find( key );
+    if( other )
+      b = other;
+    else
+      buffers[key] = b;
+    
+    // drop the entries of buffers that are no longer used
+    for( std::map< Key, std::weak_ptr<const SampleBuffer> >::iterator it = buffers.begin(); it != buffers.end(); )
+    {
+      if( it->second.expired() )
+        buffers.erase( it++ );
+      else
+        ++it;
+    }
+  }
+  
+  if( rateMode == SampleBuffer::SAMPLE_RATE_BACKGROUND )
+    convertLater( b, rate );
+  
+  return b;
+}
+
+void SamplePool::convertLater( const std::shared_ptr<const SampleBuffer>& b, int rate )
+{
+  // streamed buffers can't be converted, only their head is in RAM
+  if( b->isStreaming() || b->getRate() == rate || b->playBuffer( rate ) != b.get() )
+    return;
+  
+  std::lock_guard<std::mutex> lock( converterMutex );
+  if( !converterUsers )
+    return;
+  converterJobs.push_back( Job( b, rate ) );
+  converterWake.notify_one();
+}
+
+void SamplePool::converterRun()
+{
+  std::unique_lock<std::mutex> lock( converterMutex );
+  while( true )
+  {
+    while( !converterQuit && converterJobs.empty() )
+      converterWake.wait( lock );
+    if( converterQuit )
+      return;
+    
+    Job job = converterJobs.front();
+    converterJobs.pop_front();
+    converterBusy = true;
+    lock.unlock();
+    
+    // the buffer may have been freed while the job was queued
+    std::shared_ptr<const SampleBuffer> b = job.first.lock();
+    if( b )
+      b->convert( job.second );
+    b.reset();
+    
+    lock.lock();
+    converterBusy = false;
+  }
+}
+
+void SamplePool::startConverter()
+{
+  std::lock_guard<std::mutex> lifetime( converterLifetime );
+  std::lock_guard<std::mutex> lock( converterMutex );
+  if( converterUsers++ == 0 )
+  {
+    converterQuit = false;
+    converterThread = std::thread( converterRun );
+  }
+}
+
+void SamplePool::stopConverter()
+{
+  std::lock_guard<std::mutex> lifetime( converterLifetime );
+  {
+    std::lock_guard<std::mutex> lock( converterMutex );
+    if( converterUsers == 0 || --converterUsers > 0 )
+      return;
+    converterQuit = true;
+    converterJobs.clear();
+    converterWake.notify_one();
+  }
+  // a conversion in progress is finished first
+  converterThread.join();
+}
+
+int SamplePool::converterQueue()
+{
+  std::lock_guard<std::mutex> lock( converterMutex );
+  return converterJobs.size() + ( converterBusy ? 1 : 0 );
+}
+
+std::shared_ptr<const SampleBuffer> SamplePool::find( const Key& key )
+{
+  std::map< Key, std::weak_ptr<const SampleBuffer> >::iterator it = buffers.find( key );
+  if( it == buffers.end() )
+    return std::shared_ptr<const SampleBuffer>();
+  return it->second.lock();
+}
+
+void SamplePool::report()
+{
+  std::lock_guard<std::mutex> lock( mutex );
+  long bytes = 0;
+  long floatBytes = 0;
+  for( std::map< Key, std::weak_ptr<const SampleBuffer> >::iterator it = buffers.begin(); it != buffers.end(); ++it )
+  {
+    std::shared_ptr<const SampleBuffer> b = it->second.lock();
+    if( b )
+    {
+      bytes      += b->getBytes();
+      floatBytes += b->getFloatBytes();
+    }
+  }
+  printf("Fabla2: samples use %.1f MB of RAM, %.1f MB saved by compact storage\n",
+         bytes / 1048576.f, (floatBytes - bytes) / 1048576.f );
+}
+
+int SamplePool::size()
+{
+  std::lock_guard<std::mutex> lock( mutex );
+  int n = 0;
+  for( std::map< Key, std::weak_ptr<const SampleBuffer> >::iterator it = buffers.begin(); it != buffers.end(); ++it )
+  {
+    if( !it->second.expired() )
+      n++;
+  }
+  return n;
+}
+
+static void fabla2_deinterleave( int size, const float* all, std::vector<float>& L, std::vector<float>& R )
+{
+  L.resize( size / 2 );
+  R.resize( size / 2 );
+  
+  float* l = &L[0];
+  float* r = &R[0];
+#ifdef FABLA2_COMPONENT_TEST
+  printf("deinterlacing... size = %i\n", size );
+#endif
+  // de-interleave samples
+  for( int i = 0; i < size / 2; i++ )
+  {
+    *l++ = *all++;
+    *r++ = *all++;
+  }
+}
+
+void SampleBuffer::resample( int fromSr, std::vector<float>& buf, int q )
+{
+  /// resample audio
+  //printf("Resampling from %i to %i\n", fromSr, rate);
+  
+  float resampleRatio = float( rate ) / fromSr;
+  std::vector<float> resampled( buf.size() * resampleRatio );
+  
+  SRC_DATA data;
+  data.data_in  = &buf[0];
+  data.data_out = &resampled[0];
+  
+  data.input_frames = buf.size();
+  data.output_frames = buf.size() * resampleRatio;
+  
+  data.end_of_input = 0;
+  data.src_ratio = resampleRatio;
+  
+  int ret = src_simple ( &data, q, 1 );
+  if ( ret == 0 )
+    printf("%s%i%s%i", "Resampling finished, from ", data.input_frames_used, " to ", data.output_frames_gen );
+  else
+    printf("%s%i%s%i", "Resampling finished, from ", data.input_frames_used, " to ", data.output_frames_gen );
+  
+  /// exchange buffers, so buf contains the resampled audio
+  buf.swap( resampled );
+}
+
+
+void SampleBuffer::addGuardFrames()
+{
+  // zeroed frames after the end of the audio: the Sampler renders whole
+  // blocks without checking the playhead, and the interpolator may read a
+  // few frames beyond the end while finishing the last block. A streamed
+  // buffer doesn't need them, the Sampler reads its end from the stream
+  if( streaming )
+    return;
+  audioMono.resize( frames + FABLA2_SAMPLE_GUARD_FRAMES, 0.f );
+  if( channels == 2 )
+    audioStereoRight.resize( frames + FABLA2_SAMPLE_GUARD_FRAMES, 0.f );
+}
+
+SampleBuffer::SampleBuffer( int r, int size, const float* interleaved ) :
+  rate( r ),
+  channels( 2 ),
+  frames( size / 2 ),
+  streaming( false ),
+  headFrames( size / 2 ),
+  format( SAMPLE_FLOAT ),
+  exactFile( false ),
+  dataFrames( 0 ),
+  map( 0 ),
+  mapBytes( 0 ),
+  cached( false ),
+  converted( 0 )
+{
+  fabla2_deinterleave( size, interleaved, audioMono, audioStereoRight );
+  addGuardFrames();
+  bindData();
+}
+
+SampleBuffer::SampleBuffer( const std::string& p, int r, long streamFrames,
+                            bool compactStorage, int rateMode ) :
+  path( p ),
+  rate( r ),
+  channels( 0 ),
+  frames( 0 ),
+  streaming( false ),
+  headFrames( 0 ),
+  format( SAMPLE_FLOAT ),
+  exactFile( false ),
+  dataFrames( 0 ),
+  map( 0 ),
+  mapBytes( 0 ),
+  cached( false ),
+  converted( 0 )
+{
+  data[0] = data[1] = 0;
+  
+  // decoding and resampling is skipped when the result is in the cache
+  const std::string entry = SampleCache::entry( path,
+      rateMode == SAMPLE_RATE_CONVERT ? r : 0, streamFrames, compactStorage,
+      SRC_SINC_FASTEST );
+  if( !entry.empty() && SampleCache::read( entry, this ) )
+    return;
+  
+  SF_INFO info;
+  memset( &info, 0, sizeof( SF_INFO ) );
+  SNDFILE* const sndfile = sf_open( path.c_str(), SFM_READ, &info);
+  if ( !sndfile )
+  {
+    printf("Failed to open sample '%s'\n", path.c_str() );
+    return;
+  }
+  
+  channels = info.channels;
+  frames   = info.frames;
+  
+  // keep the rate of the file: the Sampler compensates while playing
+  if( rateMode != SAMPLE_RATE_CONVERT )
+    rate = info.samplerate;
+  
+  if( frames == 0 )
+  {
+    // bad file path?
+    printf("Error loading sample %s, frames == 0\n", path.c_str() );
+    sf_close( sndfile );
+    return;
+  }
+  
+  if( frames < 200 )
+  {
+    printf("Fabla2: Refusing to load sample with %i frames - too short\n", frames );
+  }
+  
+  
+  printf("Loading sample with %i frames\n", frames );
+  
+  if( channels > 2 || channels <= 0 )
+  {
+    printf("Error loading sample %s, channels > 2 || <= 0\n", path.c_str() );
+    frames = 0;
+    sf_close( sndfile );
+    return;
+  }
+  
+  // long files are streamed from disk, only their head is loaded here. Files
+  // that are resampled while loading are always loaded, as the stream reads
+  // the file as-is
+  streaming = streamFrames > 0 && frames > streamFrames &&
+              frames > FABLA2_STREAM_HEAD_FRAMES && info.samplerate == rate;
+  headFrames = streaming ? FABLA2_STREAM_HEAD_FRAMES : frames;
+  if( streaming )
+  {
+    printf("Streaming sample from disk, %i frames in RAM\n", headFrames );
+  }
+  
+  // tmp buffer for loading
+  std::vector<float> audio;
+  
+  // used to load into from disk. If mono, load directly into this buffer
+  // if stereo, load into audio buffer, and then de-interleave samples into
+  // the two buffers
+  float* loadBuffer = 0;
+  
+  if( channels == 1 )
+  {
+    audioMono.resize( headFrames );
+    loadBuffer = &audioMono.at(0);
+  }
+  else if( channels == 2 )
+  {
+    audio.resize( headFrames * channels );
+    loadBuffer = &audio.at(0);
+  }
+  
+  // read from disk
+  sf_seek(sndfile, 0ul, SEEK_SET);
+  int samplRead = sf_read_float( sndfile, loadBuffer, headFrames * channels );
+  sf_close(sndfile);
+  
+  if( channels == 2 )
+  {
+    fabla2_deinterleave( headFrames * channels, loadBuffer, audioMono, audioStereoRight );
+  }
+  
+  if( rate != info.samplerate )
+  {
+    resample( info.samplerate, audioMono, SRC_SINC_FASTEST );
+    
+    if( channels == 2 )
+    {
+      resample( info.samplerate, audioStereoRight, SRC_SINC_FASTEST );
+    }
+    
+    // since we've resampled, the size will have changed!
+    frames = audioMono.size();
+    headFrames = frames;
+  }
+  
+  addGuardFrames();
+  
+  if( compactStorage )
+  {
+    // keep the bit depth of the file: higher resolution files stay float
+    switch( info.format & SF_FORMAT_SUBMASK )
+    {
+      case SF_FORMAT_PCM_S8:
+      case SF_FORMAT_PCM_U8:
+      case SF_FORMAT_PCM_16: compact( SAMPLE_S16 ); break;
+      case SF_FORMAT_PCM_24: compact( SAMPLE_S24 ); break;
+      default: break;
+    }
+  }
+  
+  exactFile = format == SAMPLE_FLOAT && rate == info.samplerate &&
+              ( info.format & SF_FORMAT_SUBMASK ) == SF_FORMAT_FLOAT;
+  
+  bindData();
+  if( !entry.empty() )
+    SampleCache::write( entry, this );
+  
+#ifdef FABLA2_COMPONENT_TEST
+  if( false )
+  {
+    Plotter::plot( path, frames * channels, loadBuffer );
+    printf("Sample %s loaded OK: Channels = %i, Frames = %i\n", path.c_str(), channels, frames );
+  }
+  QUNIT_IS_TRUE( info.frames > 0 );
+  QUNIT_IS_TRUE( samplRead == (streaming ? FABLA2_STREAM_HEAD_FRAMES : info.frames) * info.channels );
+#endif
+}
+
+SampleBuffer::SampleBuffer( const SampleBuffer* native, int r ) :
+  path( native->path ),
+  rate( r ),
+  channels( native->channels ),
+  frames( 0 ),
+  streaming( false ),
+  headFrames( 0 ),
+  format( SAMPLE_FLOAT ),
+  exactFile( false ),
+  dataFrames( 0 ),
+  map( 0 ),
+  mapBytes( 0 ),
+  cached( false ),
+  converted( 0 )
+{
+  data[0] = data[1] = 0;
+  
+  const std::string entry = SampleCache::entry( path, r, 0,
+      native->format != SAMPLE_FLOAT, SRC_SINC_BEST_QUALITY );
+  if( !entry.empty() && SampleCache::read( entry, this ) )
+    return;
+  
+  for(int c = 0; c < channels; c++)
+  {
+    std::vector<float>& buf = c == 0 ? audioMono : audioStereoRight;
+    buf.resize( native->frames );
+    native->getFloat( c, 0, native->frames, &buf[0] );
+    resample( native->rate, buf, SRC_SINC_BEST_QUALITY );
+  }
+  
+  frames     = audioMono.size();
+  headFrames = frames;
+  addGuardFrames();
+  
+  // keep the storage format of the native audio
+  if( native->format != SAMPLE_FLOAT )
+    compact( native->format );
+  
+  bindData();
+  if( !entry.empty() )
+    SampleCache::write( entry, this );
+}
+
+void SampleBuffer::convert( int r ) const
+{
+  if( streaming || r == rate || converted.load() )
+    return;
+  
+  printf("Fabla2: converting sample from %i to %i in the background\n", rate, r );
+  const SampleBuffer* c = new SampleBuffer( this, r );
+  
+  // publish the copy: the Sampler picks it up when the next note starts
+  const SampleBuffer* none = 0;
+  if( !converted.compare_exchange_strong( none, c ) )
+    delete c;
+}
+
+const SampleBuffer* SampleBuffer::playBuffer( int r ) const
+{
+  const SampleBuffer* c = converted.load();
+  if( c && c->rate == r )
+    return c;
+  return this;
+}
+
+/// float to integer PCM, the inverse of pcm_to_float()
+static inline int32_t fabla2_quantize( float f, float scale, int32_t max )
+{
+  long v = lrintf( f * scale );
+  if( v >  max     ) v =  max;
+  if( v < -max - 1 ) v = -max - 1;
+  return v;
+}
+
+void SampleBuffer::compact( int fmt )
+{
+  const int bytes = fmt == SAMPLE_S16 ? sizeof(int16_t) : sizeof(PCM24);
+  
+  for(int c = 0; c < channels; c++)
+  {
+    std::vector<float>&   in  = c == 0 ? audioMono : audioStereoRight;
+    std::vector<uint8_t>& out = c == 0 ? pcmLeft   : pcmRight;
+    out.resize( in.size() * bytes );
+    
+    for(size_t i = 0; i < in.size(); i++)
+    {
+      if( fmt == SAMPLE_S16 )
+      {
+        int16_t v = fabla2_quantize( in[i], 32768.f, 32767 );
+        memcpy( &out[i * bytes], &v, bytes );
+      }
+      else
+      {
+        int32_t v = fabla2_quantize( in[i], 8388608.f, 8388607 );
+        out[i * bytes    ] = v;
+        out[i * bytes + 1] = v >> 8;
+        out[i * bytes + 2] = v >> 16;
+      }
+    }
+    
+    // free the float audio
+    std::vector<float>().swap( in );
+  }
+  
+  format = fmt;
+}
+
+void SampleBuffer::bindData()
+{
+  if( format == SAMPLE_FLOAT )
+  {
+    data[0]    = &audioMono[0];
+    data[1]    = channels == 2 ? &audioStereoRight[0] : data[0];
+    dataFrames = audioMono.size();
+  }
+  else
+  {
+    const int bytes = format == SAMPLE_S16 ? sizeof(int16_t) : sizeof(PCM24);
+    data[0]    = &pcmLeft[0];
+    data[1]    = channels == 2 ? &pcmRight[0] : data[0];
+    dataFrames = pcmLeft.size() / bytes;
+  }
+}
+
+const float* SampleBuffer::getAudio( int chnl ) const
+{
+  if( format != SAMPLE_FLOAT )
+    return 0;
+  
+  return (const float*)data[chnl == 1 ? 1 : 0];
+}
+
+const void* SampleBuffer::getData( int chnl, long frame ) const
+{
+  const void* d = data[chnl == 1 ? 1 : 0];
+  if( format == SAMPLE_S16 )
+    return (const int16_t*)d + frame;
+  if( format == SAMPLE_S24 )
+    return (const PCM24*)d + frame;
+  return (const float*)d + frame;
+}
+
+void SampleBuffer::getFloat( int chnl, long frame, long n, float* out ) const
+{
+  const void* data = getData( chnl, frame );
+  for(long i = 0; i < n; i++)
+  {
+    if( format == SAMPLE_S16 )
+      out[i] = pcm_to_float( ((const int16_t*)data)[i] );
+    else if( format == SAMPLE_S24 )
+      out[i] = pcm_to_float( ((const PCM24*)data)[i] );
+    else
+      out[i] = ((const float*)data)[i];
+  }
+}
+
+SampleBuffer::~SampleBuffer()
+{
+  delete converted.load();
+  if( map )
+    munmap( map, mapBytes );
+}
+
+long SampleBuffer::getBytes() const
+{
+  const SampleBuffer* c = converted.load();
+  return ( audioMono.size() + audioStereoRight.size() ) * sizeof(float) +
+           pcmLeft.size() + pcmRight.size() + mapBytes +
+           ( c ? c->getBytes() : 0 );
+}
+
+long SampleBuffer::getFloatBytes() const
+{
+  const SampleBuffer* c = converted.load();
+  long n = ( headFrames + ( streaming ? 0 : FABLA2_SAMPLE_GUARD_FRAMES ) );
+  return n * channels * sizeof(float) + ( c ? c->getFloatBytes() : 0 );
+}
+
+}; // Fabla2
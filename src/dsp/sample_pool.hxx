@@ -0,0 +1,242 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_SAMPLE_POOL_HXX
+#define OPENAV_FABLA2_SAMPLE_POOL_HXX
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tuple>
+#include <condition_variable>
+
+#include <stdint.h>
+
+/// silent frames kept after the end of the audio data, so interpolation can
+/// read past the end of the sample without bounds checks
+#define FABLA2_SAMPLE_GUARD_FRAMES 64
+
+namespace Fabla2
+{
+
+/** SampleBuffer
+ * The audio data of a Sample, resampled to the plugin rate or kept at the rate
+ * of the file. A SampleBuffer is never changed after it is created, so the
+ * Samples of every plugin instance that load the same file share one
+ * SampleBuffer through the SamplePool.
+ *
+ * Audio is stored as float, or in compact mode as the integer PCM format of
+ * the file: 16 bit, or packed 24 bit. The Sampler converts integer PCM to
+ * float while interpolating.
+ *
+ * A buffer at the rate of the file can get a converted copy at the plugin rate
+ * later, from the SamplePool converter thread: see playBuffer().
+ *
+ * Decoded audio can be kept in the SampleCache on disk: a buffer read from the
+ * cache maps the cache entry instead of holding its audio in vectors.
+ */
+class SampleBuffer
+{
+  public:
+    /// storage formats of the audio data
+    enum SAMPLE_FORMAT {
+      SAMPLE_FLOAT = 0,
+      SAMPLE_S16,     ///< int16_t
+      SAMPLE_S24,     ///< PCM24, packed little-endian
+    };
+    
+    /// how files with a rate that differs from the plugin rate are loaded
+    enum SAMPLE_RATE_MODE {
+      SAMPLE_RATE_CONVERT = 0,  ///< resampled while loading, fast sinc
+      SAMPLE_RATE_NATIVE,       ///< kept at the file rate, the Sampler plays
+                                ///< them faster or slower to compensate
+      SAMPLE_RATE_BACKGROUND,   ///< native, until the converter thread made a
+                                ///< best quality copy at the plugin rate
+    };
+    
+    /// loads an audio file using sndfile. Files longer than streamFrames keep
+    /// only their head in RAM, see SampleStream. When compact is true, 8, 16
+    /// and 24 bit files are stored as integer PCM. Unless rateMode is
+    /// SAMPLE_RATE_CONVERT, the audio stays at the rate of the file
+    SampleBuffer( const std::string& path, int rate, long streamFrames,
+                  bool compact, int rateMode = SAMPLE_RATE_CONVERT );
+
+    /// wraps live-recorded interleaved stereo audio
+    SampleBuffer( int rate, int size, const float* data );
+    
+    ~SampleBuffer();
+
+    /// the rate of the audio data
+    int   getRate()      const {return rate;}
+    int   getChannels()  const {return channels;}
+    long  getFrames()    const {return frames;}
+    bool  isStreaming()  const {return streaming;}
+    long  getHeadFrames()const {return headFrames;}
+
+    int   getFormat()    const {return format;}
+    /// true when the audio was read from a SampleCache entry: it is mapped
+    /// from the entry when the mapping could be locked in RAM
+    bool  isCached()     const {return cached;}
+    /// true when the audio is the float samples of the file at its own rate,
+    /// so the file holds the same audio a Sample::write() would
+    bool  isExactFile()  const {return exactFile;}
+    
+    /// returns the buffer for the provided channel, or 0 if the audio isn't
+    /// stored as float
+    const float* getAudio( int channel ) const;
+    /// returns the audio of a channel from frame, in the storage format
+    const void*  getData( int channel, long frame ) const;
+    /// converts n frames of a channel from frame to float
+    void getFloat( int channel, long frame, long n, float* out ) const;
+    
+    /// bytes used by the audio data and its converted copy, and the bytes
+    /// they would use as float
+    long  getBytes()     const;
+    long  getFloatBytes()const;
+    
+    /// returns the buffer to play at rate: the converted copy once it is made
+    /// for that rate, otherwise this buffer. RT safe
+    const SampleBuffer* playBuffer( int rate ) const;
+    
+    /// makes the converted copy at rate, with the best quality resampler. Not
+    /// RT safe: called by the SamplePool converter thread
+    void convert( int rate ) const;
+
+  private:
+    friend class SampleCache;
+    
+    /// creates a copy of native, resampled to rate
+    SampleBuffer( const SampleBuffer* native, int rate );
+    
+    /// the file the audio was loaded from, empty for recorded audio
+    std::string path;
+    int rate;
+    int channels;
+    long frames;
+    bool streaming;
+    long headFrames;
+    int format;
+    bool exactFile;
+    std::vector<float> audioMono;
+    std::vector<float> audioStereoRight;
+    /// integer PCM audio, used instead of the float buffers
+    std::vector<uint8_t> pcmLeft;
+    std::vector<uint8_t> pcmRight;
+    
+    /// the audio of each channel in the storage format, and the frames it
+    /// holds including guard frames: points into the vectors, or the map
+    const void* data[2];
+    long dataFrames;
+    /// the SampleCache entry mapped with mmap, 0 when not mapped
+    void*  map;
+    size_t mapBytes;
+    bool   cached;
+    
+    /// points data at the vectors, once the audio is in its final format
+    void bindData();
+    
+    /// converts the float buffers to the integer PCM format, and frees them
+    void compact( int format );
+
+    /// pads the audio buffers with FABLA2_SAMPLE_GUARD_FRAMES of silence
+    void addGuardFrames();
+
+    /// the copy made by convert(), owned by this buffer
+    mutable std::atomic<const SampleBuffer*> converted;
+
+    /// resamples to a new samplerate, with a libsamplerate converter type
+    void resample( int fromSr, std::vector<float>& inBuffer, int quality );
+};
+
+/** SamplePool
+ * A process-wide cache of SampleBuffers, so plugin instances that load the
+ * same kit share its audio data. Buffers are looked up by file path, file
+ * modification time and size, sample rate and streaming threshold: a file
+ * that changed on disk is loaded again. Buffers kept at the rate of their file
+ * are shared by instances running at any rate.
+ *
+ * The pool only holds weak references: a buffer is freed when the last Sample
+ * that uses it is deleted, and its entry is dropped at the next load().
+ *
+ * While a plugin instance holds the converter, a background thread makes the
+ * best quality copies of buffers loaded with SAMPLE_RATE_BACKGROUND.
+ */
+class SamplePool
+{
+  public:
+    /// returns the buffer for a file, loading it if no Sample uses it yet.
+    /// Returns an empty pointer if the file can't be loaded. Not RT safe:
+    /// call from the worker thread or state restore
+    static std::shared_ptr<const SampleBuffer> load( const std::string& path,
+                                                     int rate,
+                                                     long streamFrames,
+                                                     bool compact,
+                                                     int rateMode = SampleBuffer::SAMPLE_RATE_CONVERT );
+    
+    /// starts the converter thread for the first caller, and stops it when
+    /// the last caller stopped: call from instantiate and cleanup
+    static void startConverter();
+    static void stopConverter();
+    /// number of buffers waiting for, or being converted by the converter
+    static int  converterQueue();
+
+    /// number of buffers that are in use
+    static int size();
+    
+    /// prints the memory used by all buffers in use, and how much compact
+    /// storage saves
+    static void report();
+
+  private:
+    /// path, mtime seconds, mtime nanoseconds, file size, rate (0 for buffers
+    /// at the rate of the file), streamFrames, compact
+    typedef std::tuple<std::string, long, long, long, int, long, bool> Key;
+
+    /// returns the buffer for key if it is still in use, mutex must be held
+    static std::shared_ptr<const SampleBuffer> find( const Key& key );
+
+    static std::mutex mutex;
+    static std::map< Key, std::weak_ptr<const SampleBuffer> > buffers;
+    
+    /// converter jobs: the buffer, and the rate to convert it to
+    typedef std::pair< std::weak_ptr<const SampleBuffer>, int > Job;
+    /// queues a buffer for the converter, if it needs converting to rate
+    static void convertLater( const std::shared_ptr<const SampleBuffer>& b,
+                              int rate );
+    static void converterRun();
+    /// held by startConverter() and stopConverter() while they run
+    static std::mutex converterLifetime;
+    static std::mutex converterMutex;
+    static std::condition_variable converterWake;
+    static std::deque<Job> converterJobs;
+    static std::thread converterThread;
+    static int converterUsers;
+    static bool converterQuit;
+    static bool converterBusy;
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_SAMPLE_POOL_HXX
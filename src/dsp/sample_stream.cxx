@@ -0,0 +1,217 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "sample_stream.hxx"
+
+#include "sample.hxx"
+
+#include <stdio.h>
+#include <string.h>
+
+/// the fill position uses the low bits of the state, the generation the rest
+#define FABLA2_STREAM_GEN_SHIFT  40
+#define FABLA2_STREAM_FILL_MASK  ((uint64_t(1) << FABLA2_STREAM_GEN_SHIFT) - 1)
+
+/// frames read from disk by each sf_readf_float() call in refill()
+#define FABLA2_STREAM_CHUNK_FRAMES 4096
+
+namespace Fabla2
+{
+
+SampleStream::SampleStream() :
+  sample( 0 ),
+  state( 0 ),
+  readPos( 0 ),
+  refillPending( false ),
+  underruns( 0 ),
+  file( 0 ),
+  fileGen( 0 ),
+  fileChannels( 0 )
+{
+}
+
+void SampleStream::start( Sample* s, long startFrame )
+{
+  // the head covers the first frames, the ring the ones after: it starts a
+  // guard before the end of the head, as a block that reads past the head
+  // reads all of its frames from the ring
+  long from = s->getHeadFrames() - FABLA2_STREAM_GUARD_FRAMES;
+  if( from < startFrame )
+    from = startFrame;
+  if( from < 0 )
+    from = 0;
+
+  uint64_t gen = ( state.load() >> FABLA2_STREAM_GEN_SHIFT ) + 1;
+
+  // the worker loads the state before the sample: store in reverse order, so
+  // seeing the new generation implies seeing the new sample
+  sample.store( s );
+  readPos.store( from );
+  state.store( (gen << FABLA2_STREAM_GEN_SHIFT) | from );
+}
+
+void SampleStream::stop()
+{
+  if( !sample.load() )
+    return;
+
+  uint64_t gen = ( state.load() >> FABLA2_STREAM_GEN_SHIFT ) + 1;
+  sample.store( 0 );
+  state.store( gen << FABLA2_STREAM_GEN_SHIFT );
+}
+
+bool SampleStream::read( long first, long last, const float** L, const float** R )
+{
+  // publish the playhead first: the worker never overwrites frames after it
+  readPos.store( first );
+
+  const long filled = state.load() & FABLA2_STREAM_FILL_MASK;
+  if( last >= filled ||
+      first < filled - FABLA2_STREAM_RING_FRAMES ||
+      last - first >= FABLA2_STREAM_GUARD_FRAMES )
+  {
+    return false;
+  }
+
+  const int slot = first % FABLA2_STREAM_RING_FRAMES;
+  *L = &ringL[slot];
+  *R = &ringR[slot];
+  return true;
+}
+
+bool SampleStream::needsRefill()
+{
+  Sample* s = sample.load();
+  if( !s || refillPending.load() )
+    return false;
+
+  const long filled = state.load() & FABLA2_STREAM_FILL_MASK;
+  if( filled >= s->getTotalFrames() + FABLA2_SAMPLE_GUARD_FRAMES )
+    return false;
+  if( filled - readPos.load() > FABLA2_STREAM_RING_FRAMES / 2 )
+    return false;
+
+  refillPending.store( true );
+  return true;
+}
+
+void SampleStream::refillFailed()
+{
+  refillPending.store( false );
+}
+
+long SampleStream::takeUnderruns()
+{
+  long u = underruns;
+  underruns = 0;
+  return u;
+}
+
+void SampleStream::refill()
+{
+  uint64_t st = state.load();
+  Sample*  s  = sample.load();
+
+  const uint64_t gen = st >> FABLA2_STREAM_GEN_SHIFT;
+  long filled = st & FABLA2_STREAM_FILL_MASK;
+
+  if( s && ( !file || gen != fileGen ) )
+  {
+    if( file )
+      sf_close( file );
+
+    SF_INFO info;
+    memset( &info, 0, sizeof( SF_INFO ) );
+    file = sf_open( s->getPath(), SFM_READ, &info );
+    fileGen = gen;
+    fileChannels = info.channels;
+    if( !file )
+      printf("Fabla2: failed to open '%s' for streaming\n", s->getPath() );
+  }
+
+  if( !s || !file )
+  {
+    refillPending.store( false );
+    return;
+  }
+
+  if( ringL.empty() )
+  {
+    ringL.resize( FABLA2_STREAM_RING_FRAMES + FABLA2_STREAM_GUARD_FRAMES );
+    ringR.resize( FABLA2_STREAM_RING_FRAMES + FABLA2_STREAM_GUARD_FRAMES );
+  }
+  chunk.resize( FABLA2_STREAM_CHUNK_FRAMES * fileChannels );
+
+  // fill the ring up to where it reaches the playhead, and zero the guard
+  // frames the Sampler may read after the end of the file
+  const long frames = s->getTotalFrames();
+  long target = readPos.load() + FABLA2_STREAM_RING_FRAMES;
+  if( target > frames + FABLA2_SAMPLE_GUARD_FRAMES )
+    target = frames + FABLA2_SAMPLE_GUARD_FRAMES;
+
+  if( filled < frames )
+    sf_seek( file, filled, SEEK_SET );
+
+  for( long f = filled; f < target; )
+  {
+    int n = target - f;
+    if( n > FABLA2_STREAM_CHUNK_FRAMES )
+      n = FABLA2_STREAM_CHUNK_FRAMES;
+
+    sf_count_t got = 0;
+    if( f < frames )
+      got = sf_readf_float( file, &chunk[0], n );
+    if( got < 0 )
+      got = 0;
+
+    for(int i = 0; i < n; i++, f++)
+    {
+      float l = 0.f;
+      float r = 0.f;
+      if( i < got )
+      {
+        l = chunk[i * fileChannels];
+        r = fileChannels == 2 ? chunk[i * fileChannels + 1] : l;
+      }
+
+      int slot = f % FABLA2_STREAM_RING_FRAMES;
+      ringL[slot] = l;
+      ringR[slot] = r;
+      if( slot < FABLA2_STREAM_GUARD_FRAMES )
+      {
+        ringL[slot + FABLA2_STREAM_RING_FRAMES] = l;
+        ringR[slot + FABLA2_STREAM_RING_FRAMES] = r;
+      }
+    }
+  }
+
+  // publish the new frames, unless a start() or stop() happened meanwhile
+  uint64_t next = (gen << FABLA2_STREAM_GEN_SHIFT) | target;
+  state.compare_exchange_strong( st, next );
+  refillPending.store( false );
+}
+
+SampleStream::~SampleStream()
+{
+  if( file )
+    sf_close( file );
+}
+
+}; // Fabla2
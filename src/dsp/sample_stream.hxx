@@ -0,0 +1,118 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_SAMPLE_STREAM_HXX
+#define OPENAV_FABLA2_SAMPLE_STREAM_HXX
+
+#include <atomic>
+#include <vector>
+
+#include <stdint.h>
+#include <sndfile.h>
+
+/// frames of a streamed sample that are kept in RAM: playback starts from
+/// this head, while the worker thread fills the voice ring buffer
+#define FABLA2_STREAM_HEAD_FRAMES  65536
+
+/// frames in each voice ring buffer: a refill is requested when less than
+/// half of it is left ahead of the playhead
+#define FABLA2_STREAM_RING_FRAMES  16384
+
+/// the start of the ring is mirrored after its end, so up to this many frames
+/// can be read as one contiguous block across the wrap-around
+#define FABLA2_STREAM_GUARD_FRAMES 2048
+
+/// the Sampler renders streamed samples in blocks of at most this many frames,
+/// so a block never reads more frames than the guard holds. Blocks that move
+/// the playhead by more than a frame per frame are shorter
+#define FABLA2_STREAM_BLOCK_FRAMES 256
+
+namespace Fabla2
+{
+
+class Sample;
+
+/** SampleStream
+ * Streams a Sample from disk for a single voice. The Sample keeps only the
+ * head of the file in RAM, and the ring buffer of the SampleStream holds the
+ * frames that follow the playhead: the LV2 worker thread reads them from disk
+ * in refill(), so the audio thread never waits for I/O.
+ *
+ * The audio thread and the worker share only atomics: the frame the playhead
+ * is at, and how far the ring is filled. Each start() bumps a generation that
+ * is stored with the fill position, so a refill that was in progress for a
+ * previous note is discarded instead of being read by the new one.
+ */
+class SampleStream
+{
+  public:
+    SampleStream();
+    ~SampleStream();
+
+    /// starts streaming a Sample, with playback starting at startFrame.
+    /// Called from the RT thread
+    void start( Sample* s, long startFrame );
+    void stop();
+    /// the Sample being streamed, 0 when stopped
+    Sample* getSample(){return sample.load();}
+
+    /// gets contiguous pointers to frames first to last of the Sample, called
+    /// from the RT thread. Returns false if they aren't read from disk yet
+    bool read( long first, long last, const float** L, const float** R );
+
+    /// returns true once when a refill should be scheduled on the worker
+    bool needsRefill();
+    /// called from the RT thread when a refill could not be scheduled
+    void refillFailed();
+
+    /// counts blocks that played silence, as the ring wasn't filled in time
+    void underrun(){underruns++;}
+    /// returns the underruns since the last call, and resets the count
+    long takeUnderruns();
+
+    /// reads frames from disk ahead of the playhead: worker thread only
+    void refill();
+
+  private:
+    /// the Sample being streamed, 0 when stopped
+    std::atomic<Sample*> sample;
+    /// the generation in the top bits, and the frame the ring is filled to
+    std::atomic<uint64_t> state;
+    /// the first frame the playhead still needs
+    std::atomic<long> readPos;
+    /// true from needsRefill() until the worker finished the refill
+    std::atomic<bool> refillPending;
+
+    long underruns;
+
+    /// ring buffers, allocated by the worker on the first refill
+    std::vector<float> ringL;
+    std::vector<float> ringR;
+
+    /// worker thread only: the file open for the current generation
+    SNDFILE* file;
+    uint64_t fileGen;
+    int fileChannels;
+    std::vector<float> chunk;
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_SAMPLE_STREAM_HXX
@@ -22,25 +22,38 @@
 
 #include "pad.hxx"
 #include "fabla2.hxx"
+#include "rt_log.hxx"
 #include "ports.hxx"
 #include "sample.hxx"
+#include "dsp_hermite.hxx"
+#include "sample_stream.hxx"
 
 #include <math.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 namespace Fabla2
 {
 
 Sampler::Sampler( Fabla2DSP* d, int rate ) :
   dsp( d ),
+  rtLog( d ? d->rtLog() : 0 ),
   sr(rate),
   
   pad( 0 ),
   sample( 0 ),
+  buffer( 0 ),
   
   playheadDelta(1),
-  playIndex(0)
+  rateRatio(1),
+  playBase(0),
+  playIndex(0),
+  
+  stream( 0 ),
+  streaming( false ),
+  
+  hermite( hermite_kernels_best() )
   
   //,frames( 0 )
 {
@@ -53,15 +66,51 @@ void Sampler::playLayer( Pad* p, int layer )
 {
   assert( p );
   
+  playBase  = 0;
   playIndex = 0;
   //frames = 0;
   
   pad = p;
   
   padVol = pad->volume;
-  printf("sampler playLayer with vol %f\n", padVol );
+  FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "sampler playLayer with vol %f\n", padVol );
   
   sample = pad->layer( layer );
+  
+  if( sample )
+  {
+    startSample( 0 );
+  }
+  else
+  {
+    stop();
+  }
+}
+
+void Sampler::stop()
+{
+  streaming = false;
+  if( stream )
+    stream->stop();
+}
+
+void Sampler::startSample( float startPoint )
+{
+  // new notes play the copy converted to the plugin rate, once there is one.
+  // Audio at another rate plays faster or slower by the ratio of the rates
+  buffer    = sample->getBuffer()->playBuffer( sr );
+  rateRatio = buffer->getRate() / (float)sr;
+  
+  playBase  = startPoint * buffer->getFrames();
+  playIndex = 0;
+  
+  // streamed samples with a start point after the head underrun until the
+  // worker read the first frames from disk
+  streaming = sample->isStreaming() && stream;
+  if( streaming )
+    stream->start( sample, playBase );
+  else if( stream )
+    stream->stop();
 }
 
 void Sampler::play( Pad* p, float velocity )
@@ -88,14 +137,15 @@ void Sampler::play( Pad* p, float velocity )
   }
   
   // trigger audio playback here
-  playIndex = sample->getStartPoint();
-  printf("playing sample with start point of %li\n", playIndex );
+  startSample( sample->startPoint );
+  FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "playing sample with start point of %li\n", playBase );
 }
 
 long Sampler::getRemainingFrames()
 {
-  // getFrames() returns playable number of frames
-  long totalPlayFrames = sample->getFrames()  - playIndex;
+  // the frame where playback stops, in frames of the plugin rate
+  long end = sample->endPoint * buffer->getFrames();
+  long totalPlayFrames = ( end - playBase - playIndex ) / rateRatio;
   return totalPlayFrames;
 }
 
@@ -109,16 +159,17 @@ int Sampler::process(int nframes, float* L, float* R)
     // no sample loaded on the Pad that this Sampler represents
     return 1;
   }
-  const int    chans = sample->getChannels();
+  const int    chans = buffer->getChannels();
   
-  int frames = sample->getFrames();
+  // the end, relative to the playhead
+  const long end = (long)(sample->endPoint * buffer->getFrames()) - playBase;
   
   // return immidiatly if we are finished playing the sample
   // (keeping within interpolation limits)
   
-  if( playIndex + 4 >= frames || playIndex < 0 )
+  if( playIndex + 4 >= end || playBase < 0 )
   {
-    printf("%s : ERROR : Sampler click stop, ran out of frames!\n", __PRETTY_FUNCTION__ );
+    FABLA2_RT_LOG( rtLog, RT_LOG_ERROR, "%s : ERROR : Sampler click stop, ran out of frames!\n", __PRETTY_FUNCTION__ );
     return 1;
   }
   
@@ -131,6 +182,7 @@ int Sampler::process(int nframes, float* L, float* R)
   float pd = playheadDelta + mstr / 24.f; // 1 -> 2 range (double pitch)
   if( mstr < 0.000 )
     pd = playheadDelta + mstr / 48.f; // 1 -> 0.5 range (half pitch)
+  pd *= rateRatio;
 
 //#define DB_CO(g) ((g) > -90.0f ? powf(10.0f, (g) * 0.05f) : 0.0f)
   //const float volMultiply = DB_CO(sample->gain);
@@ -144,91 +196,131 @@ int Sampler::process(int nframes, float* L, float* R)
   
   //printf("%f, %f, volMultiply = %f\n", panL, panR, volMultiply );
   
-  if( chans == 1 )
-  {
-    const float* audio = sample->getAudio(0);
-    for(int i = 0; i < nframes; i++ )
-    {
-      // cubic 4-point Hermite-curve interpolation:
-      // http://musicdsp.org/showone.php?id=49
-      
-      int inpos = playIndex;
-      float finpos = playIndex - (int)playIndex;
-      float xm1 = audio[inpos    ];
-      float x0  = audio[inpos + 1];
-      float x1  = audio[inpos + 2];
-      float x2  = audio[inpos + 3];
-      float a = (3 * (x0-x1) - xm1 + x2) / 2;
-      float b = 2*x1 + xm1 - (5*x0 + x2) / 2;
-      float c = (x1 - xm1) / 2;
-      float out = (((a * finpos) + b) * finpos + c) * finpos + x0;
-      
-      *L++ = out * panL;
-      *R++ = out * panR;
-      playIndex += pd;
-      
-      if( playIndex + 4 >= frames )
-      {
-        printf("%s : ERROR : Sampler click stop, ran out of frames!\n", __PRETTY_FUNCTION__ );
-        return 1;
-      }
-    }
-  }
-  else if( chans == 2 )
-  {
-    const float* audioL = sample->getAudio(0);
-    const float* audioR = sample->getAudio(1);
-    
-    for(int i = 0; i < nframes; i++ )
-    {
-      // cubic 4-point Hermite-curve interpolation:
-      // http://musicdsp.org/showone.php?id=49
-      {
-        int inpos = playIndex;
-        float finpos = playIndex - (int)playIndex;
-        float xm1 = audioL[inpos    ];
-        float x0  = audioL[inpos + 1];
-        float x1  = audioL[inpos + 2];
-        float x2  = audioL[inpos + 3];
-        float a = (3 * (x0-x1) - xm1 + x2) / 2;
-        float b = 2*x1 + xm1 - (5*x0 + x2) / 2;
-        float c = (x1 - xm1) / 2;
-        *L++ = ((((a * finpos) + b) * finpos + c) * finpos + x0) * panL;
-      }
-      {
-        int inpos = playIndex;
-        float finpos = playIndex - (int)playIndex;
-        float xm1 = audioR[inpos    ];
-        float x0  = audioR[inpos + 1];
-        float x1  = audioR[inpos + 2];
-        float x2  = audioR[inpos + 3];
-        float a = (3 * (x0-x1) - xm1 + x2) / 2;
-        float b = 2*x1 + xm1 - (5*x0 + x2) / 2;
-        float c = (x1 - xm1) / 2;
-        *R++ = ((((a * finpos) + b) * finpos + c) * finpos + x0) * panR;
-      }
-      
-      playIndex += pd;
-      
-      if( playIndex + 4 >= frames )
-      {
-        printf("%s : ERROR : Sampler click stop, ran out of frames!\n", __PRETTY_FUNCTION__ );
-        return 1;
-      }
-      
-    }
+  // work out how many frames can be rendered before the sample runs out, so
+  // the interpolation kernels don't check the playhead for every frame. The
+  // last frame rendered is the one that moves the playhead to within 4 frames
+  // of the end. The playhead gains up to half a float ulp of rounding error
+  // per frame, so stop early by that much: the guard frames cover the rest.
+  float span  = playIndex + nframes * pd;
+  float drift = nframes * 0.5f * ( nextafterf( span, span * 2.f ) - span );
+  
+  int  done   = 0;
+  int  render = nframes;
+  long budget = ceilf( (end - 4 - playIndex - drift) / pd );
+  if( budget < 0 )
+    budget = 0;
+  if( budget <= nframes )
+  {
+    render = budget;
+    done   = 1;
   }
-  else
+  
+  if( chans != 1 && chans != 2 )
   {
     // return if we don't know how to deal with this channel count
     return 1;
   }
   
+  // streamed samples render in short blocks, that fit in the stream guard.
+  // A block reads pd frames of the file per frame it renders, so files at a
+  // higher rate than the plugin render in shorter blocks
+  int blockSize = render;
+  if( streaming )
+  {
+    blockSize = ( FABLA2_STREAM_GUARD_FRAMES - 8 ) / (int)ceilf( pd );
+    if( blockSize > FABLA2_STREAM_BLOCK_FRAMES )
+      blockSize = FABLA2_STREAM_BLOCK_FRAMES;
+    if( blockSize < 1 )
+      blockSize = 1;
+  }
+  for(int i = 0; i < render; i += blockSize)
+  {
+    int n = render - i < blockSize ? render - i : blockSize;
+    renderBlock( pd, panL, panR, n, &L[i], &R[i] );
+  }
+  
+  if( done )
+  {
+    stop();
+    
+    // silence the rest of the block after the sample ends
+    memset( &L[render], 0, sizeof(float) * (nframes - render) );
+    memset( &R[render], 0, sizeof(float) * (nframes - render) );
+  }
+  
   // send playhead to UI
   
   
-  // normal return path: not done, keep calling this
-  return 0;
+  // normal return path: 0 keeps calling this, 1 when the sample finished
+  return done;
+}
+
+void Sampler::renderBlock( float pd, float panL, float panR, int nframes, float* L, float* R )
+{
+  const int chans = buffer->getChannels();
+  
+  int format = buffer->getFormat();
+  const void* audioL = 0;
+  const void* audioR = 0;
+  bool ready = true;
+  
+  // the last frame the interpolation reads: when it's past the head in RAM,
+  // read the block from the stream
+  long last = playBase + (long)(playIndex + nframes * pd) + 4;
+  if( streaming && last >= buffer->getHeadFrames() )
+  {
+    const float* ringL = 0;
+    const float* ringR = 0;
+    ready  = stream->read( playBase, last, &ringL, &ringR );
+    audioL = ringL;
+    audioR = ringR;
+    format = SampleBuffer::SAMPLE_FLOAT;
+  }
+  else
+  {
+    audioL = buffer->getData( 0, playBase );
+    audioR = buffer->getData( 1, playBase );
+  }
+  
+  if( !ready )
+  {
+    // the worker didn't read these frames from disk in time: play silence,
+    // and keep the playhead moving
+    stream->underrun();
+    memset( L, 0, sizeof(float) * nframes );
+    memset( R, 0, sizeof(float) * nframes );
+    playIndex += nframes * pd;
+  }
+  else if( format == SampleBuffer::SAMPLE_S16 )
+  {
+    if( chans == 1 )
+      hermite_mono_s16( (const int16_t*)audioL, &playIndex, pd, panL, panR, nframes, L, R );
+    else
+      hermite_stereo_s16( (const int16_t*)audioL, (const int16_t*)audioR,
+                          &playIndex, pd, panL, panR, nframes, L, R );
+  }
+  else if( format == SampleBuffer::SAMPLE_S24 )
+  {
+    if( chans == 1 )
+      hermite_mono_s24( (const PCM24*)audioL, &playIndex, pd, panL, panR, nframes, L, R );
+    else
+      hermite_stereo_s24( (const PCM24*)audioL, (const PCM24*)audioR,
+                          &playIndex, pd, panL, panR, nframes, L, R );
+  }
+  else if( chans == 1 )
+  {
+    hermite->mono( (const float*)audioL, &playIndex, pd, panL, panR, nframes, L, R );
+  }
+  else
+  {
+    hermite->stereo( (const float*)audioL, (const float*)audioR,
+                     &playIndex, pd, panL, panR, nframes, L, R );
+  }
+  
+  // move the whole frames into playBase
+  long whole = (long)playIndex;
+  playBase  += whole;
+  playIndex -= whole;
 }
 
 Sampler::~Sampler()
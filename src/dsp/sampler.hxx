@@ -27,6 +27,10 @@ namespace Fabla2
 class Pad;
 class Sample;
 class Fabla2DSP;
+class RtLog;
+class SampleBuffer;
+class SampleStream;
+struct HermiteKernels;
 
 /** Sampler
  * The Sampler class handles sample file playback. Its main functionality is to
@@ -47,15 +51,25 @@ class Sampler
     /// for auditioning from UI
     void playLayer( Pad*, int layer );
     
+    /// stops streaming, when the voice stops before the sample ended: the
+    /// stream must not point at a Sample that can be freed
+    void stop();
+    
     /// process function, passing in the voice buffers for FX
     int process(int nframes, float* L, float* R);
     
     long    getRemainingFrames();
     Pad*    getPad()    {return pad   ;}
     Sample* getSample() {return sample;}
+    
+    /// the stream used to play samples that are streamed from disk: without a
+    /// stream, only their head in RAM is played
+    void          setStream( SampleStream* s ){stream = s;}
+    SampleStream* getStream(){return stream;}
   
   private:
     Fabla2DSP* dsp;
+    RtLog* rtLog;
     int sr;
     
     /// Pad pointer, which contains the audio data and triggering types that are
@@ -67,12 +81,32 @@ class Sampler
     
     /// Sample pointer, retrieved from Pad when the note started playing
     Sample* sample;
+    /// the audio of the Sample that plays, chosen when the note started
+    const SampleBuffer* buffer;
     
     /// playback-speed: 2x is a double in pitch, 0.5 is half the pitch
     float playheadDelta;
+    /// the rate of the audio over the plugin rate, multiplies playheadDelta
+    float rateRatio;
     
-    /// audio playback variables
+    /// audio playback variables: the playhead is at frame playBase plus the
+    /// fraction playIndex, which is kept small so it stays precise in long
+    /// samples
+    long  playBase;
     float playIndex;
+    
+    /// streams the sample from disk, if it is a streamed sample
+    SampleStream* stream;
+    bool streaming;
+    
+    /// picks the audio to play for sample, and starts from startPoint 0->1
+    void startSample( float startPoint );
+    
+    /// renders nframes with the playhead at playBase, from RAM or the stream
+    void renderBlock( float pd, float panL, float panR, int nframes, float* L, float* R );
+    
+    /// interpolation kernels, chosen for the CPU in use at instantiate time
+    const HermiteKernels* hermite;
 };
 
 };
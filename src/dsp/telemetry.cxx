@@ -0,0 +1,141 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "telemetry.hxx"
+
+#include <time.h>
+#include <string.h>
+
+namespace Fabla2
+{
+
+Telemetry::Telemetry( int rate ) :
+  sr( rate ),
+  started_( false ),
+  blockBegin( 0 ),
+  mark( 0 )
+{
+  memset( &summary_, 0, sizeof(Summary) );
+  for(int i = 0; i < FABLA2_TELEMETRY_BUCKETS; i++)
+    histogram_[i].store( 0 );
+  reset();
+}
+
+uint64_t Telemetry::now()
+{
+  // the vDSO makes this a few ns, without a syscall
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void Telemetry::reset()
+{
+  frames    = 0;
+  blocks    = 0;
+  load      = 0;
+  loadWorst = 0;
+  overruns  = 0;
+  voices    = 0;
+  voicesMax = 0;
+  memset( stageSum  , 0, sizeof(stageSum)   );
+  memset( stageWorst, 0, sizeof(stageWorst) );
+  memset( buckets   , 0, sizeof(buckets)    );
+}
+
+void Telemetry::blockStart()
+{
+  memset( stageNs, 0, sizeof(stageNs) );
+  blockBegin = now();
+  mark = blockBegin;
+  started_ = true;
+}
+
+void Telemetry::stage( int s )
+{
+  const uint64_t t = now();
+  stageNs[s] += t - mark;
+  mark = t;
+}
+
+void Telemetry::add( int s, uint64_t ns )
+{
+  stageNs[s] += ns;
+}
+
+bool Telemetry::blockEnd( int nframes, int v )
+{
+  if( !started_ || nframes <= 0 )
+    return false;
+  started_ = false;
+
+  stageNs[STAGE_BLOCK] = now() - blockBegin;
+
+  for(int i = 0; i < STAGE_COUNT; i++)
+  {
+    stageSum[i] += stageNs[i];
+    if( stageNs[i] > stageWorst[i] )
+      stageWorst[i] = stageNs[i];
+  }
+
+  // the time this block's frames last in real time
+  const double budget = nframes * 1000000000. / sr;
+  const float  l = stageNs[STAGE_BLOCK] / budget;
+  load += l;
+  if( l > loadWorst )
+    loadWorst = l;
+  if( l > 1 )
+    overruns++;
+
+  int b = l * (FABLA2_TELEMETRY_BUCKETS - 1);
+  if( b > FABLA2_TELEMETRY_BUCKETS - 1 )
+    b = FABLA2_TELEMETRY_BUCKETS - 1;
+  buckets[b]++;
+  histogram_[b].store( histogram_[b].load() + 1 );
+
+  voices += v;
+  if( v > voicesMax )
+    voicesMax = v;
+
+  blocks++;
+  frames += nframes;
+  if( frames < sr )
+    return false;
+
+  // a second is complete
+  summary_.blocks    = blocks;
+  summary_.load      = load / blocks;
+  summary_.loadWorst = loadWorst;
+  summary_.overruns  = overruns;
+  summary_.voices    = float(voices) / blocks;
+  summary_.voicesMax = voicesMax;
+  for(int i = 0; i < STAGE_COUNT; i++)
+  {
+    summary_.stageUs     [i] = stageSum[i] / 1000. / blocks;
+    summary_.stageWorstUs[i] = stageWorst[i] / 1000.;
+  }
+  for(int i = 0; i < FABLA2_TELEMETRY_BUCKETS; i++)
+    summary_.histogram[i] = buckets[i];
+
+  reset();
+  return true;
+}
+
+}; // Fabla2
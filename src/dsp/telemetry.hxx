@@ -0,0 +1,125 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_TELEMETRY_HXX
+#define OPENAV_FABLA2_TELEMETRY_HXX
+
+#include <atomic>
+
+#include <stdint.h>
+
+/// buckets of the block load histogram, each 10% of the block budget wide: the
+/// last one counts the blocks that took longer than their budget
+#define FABLA2_TELEMETRY_BUCKETS 11
+
+namespace Fabla2
+{
+
+/** Telemetry
+ * Times the stages of each block with clock_gettime(), and sums them up into
+ * a summary of the DSP load once per second of audio, which Fabla2DSP sends
+ * to the UI. The RT thread owns the timers and the summary: the load
+ * histogram is kept in atomics, so it can be read from other threads too.
+ */
+class Telemetry
+{
+  public:
+    Telemetry( int rate );
+
+    enum STAGE {
+      STAGE_MIDI = 0, ///< MIDI and UI event dispatch
+      STAGE_RENDER,   ///< rendering the voices, including their filters
+      STAGE_FILTER,   ///< the voice filters, summed over all voices
+      STAGE_MIX,      ///< mixing the voices into the buses
+      STAGE_OTHER,    ///< the rest: clearing buffers, recording, services
+      STAGE_BLOCK,    ///< the whole block
+      STAGE_COUNT,
+    };
+
+    /// what happened over a second of audio
+    struct Summary
+    {
+      long  blocks;
+      /// block time as a fraction of the block budget
+      float load;
+      float loadWorst;
+      /// blocks that took longer than their budget
+      int   overruns;
+      /// playing voices per block
+      float voices;
+      int   voicesMax;
+      /// microseconds per block, for each STAGE
+      float stageUs[STAGE_COUNT];
+      float stageWorstUs[STAGE_COUNT];
+      /// blocks in each load bucket
+      int   histogram[FABLA2_TELEMETRY_BUCKETS];
+    };
+
+    /// monotonic time in nanoseconds
+    static uint64_t now();
+
+    /// starts timing a block. RT thread only
+    void blockStart();
+    /// true between blockStart() and blockEnd()
+    bool started(){return started_;}
+    /// adds the time since the previous mark to a stage. RT thread only
+    void stage( int s );
+    /// adds time measured elsewhere to a stage, eg by the render threads
+    void add( int s, uint64_t ns );
+    /// ends the block, returns true when a second is complete and summary()
+    /// has been updated. RT thread only
+    bool blockEnd( int nframes, int voices );
+
+    const Summary& summary(){return summary_;}
+
+    /// blocks in a load bucket since the plugin started. Any thread
+    long histogram( int bucket ){return histogram_[bucket].load();}
+
+  private:
+    int sr;
+
+    bool     started_;
+    uint64_t blockBegin;
+    uint64_t mark;
+
+    /// the current block
+    uint64_t stageNs[STAGE_COUNT];
+
+    /// the current second
+    long     frames;
+    long     blocks;
+    double   load;
+    float    loadWorst;
+    int      overruns;
+    long     voices;
+    int      voicesMax;
+    uint64_t stageSum[STAGE_COUNT];
+    uint64_t stageWorst[STAGE_COUNT];
+    int      buckets[FABLA2_TELEMETRY_BUCKETS];
+
+    Summary summary_;
+    std::atomic<long> histogram_[FABLA2_TELEMETRY_BUCKETS];
+
+    void reset();
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_TELEMETRY_HXX
@@ -1,56 +1,1833 @@
-
 /// This file tests the Sampler class
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <samplerate.h>
 #include "qunit.hxx"
 
 QUnit::UnitTest qunit = QUnit::UnitTest( QUnit::normal, true );
 
-#include "plotter.h"
+#include "../plotter.hxx"
 
 #include "../sampler.hxx"
 #include "../pad.hxx"
 #include "../sample.hxx"
-#include "../yasper.hxx"
 #include "../voice.hxx"
+#include "../dsp_hermite.hxx"
+#include "../dsp_adsr.hxx"
+#include "../dsp_mix.hxx"
+#include "../dsp_filters_svf.hxx"
+#include "../sample_stream.hxx"
+#include "../sample_pool.hxx"
+#include "../sample_cache.hxx"
+#include "../kit_state.hxx"
+#include "../library.hxx"
+#include "../bank.hxx"
+#include "../retire_queue.hxx"
+#include "../render_pool.hxx"
+#include "../rt_log.hxx"
+#include "../telemetry.hxx"
+#include "../capture.hxx"
+#include "../midi_map.hxx"
+#include "../fabla2.hxx"
+
+#include "lv2/lv2plug.in/ns/ext/atom/util.h"
+#include "lv2/lv2plug.in/ns/ext/midi/midi.h"
 
 using namespace Fabla2;
 
-int main()
+#define FABLA2_TEST_BUF_SIZE 44100
+
+/// checks each vectorized Hermite kernel is bit-identical to the scalar one
+static void test_hermite_kernels()
 {
-  printf("Fabla Testing Suite: %s\n", FABLA2_VERSION_STRING );
+  const int frames = 4096;
+  std::vector<float> audioL( frames );
+  std::vector<float> audioR( frames );
+  srand( 0 );
+  for(int i = 0; i < frames; i++)
+  {
+    audioL[i] = rand() / (float)RAND_MAX * 2 - 1;
+    audioR[i] = rand() / (float)RAND_MAX * 2 - 1;
+  }
+
+  const HermiteKernels* ref = hermite_kernels( HERMITE_SCALAR );
+  QUNIT_IS_TRUE( ref != 0 );
+
+  // pitch-down, unity, pitch-up, and odd block sizes to exercise the tails
+  const float deltas[] = { 0.5f, 0.7331f, 1.0f, 1.2517f, 2.0f };
+  const int   blocks[] = { 1, 3, 64, 125, 256 };
+
+  std::vector<float> refL( 256 ), refR( 256 ), outL( 256 ), outR( 256 );
+
+  for(int k = HERMITE_SCALAR + 1; k < HERMITE_KERNEL_COUNT; k++)
+  {
+    const HermiteKernels* kern = hermite_kernels( k );
+    if( !kern )
+      continue;
+    printf("Testing %s Hermite kernels\n", kern->name );
+
+    for(int d = 0; d < 5; d++)
+    {
+      for(int b = 0; b < 5; b++)
+      {
+        for(int stereo = 0; stereo < 2; stereo++)
+        {
+          // play most of the buffer, in blocks that stay within the audio
+          float refIndex = 0.25f;
+          float index    = 0.25f;
+          bool identical = true;
+          while( refIndex + 4 + blocks[b] * deltas[d] < frames )
+          {
+            if( stereo )
+            {
+              ref ->stereo( &audioL[0], &audioR[0], &refIndex, deltas[d],
+                            0.3f, 0.7f, blocks[b], &refL[0], &refR[0] );
+              kern->stereo( &audioL[0], &audioR[0], &index, deltas[d],
+                            0.3f, 0.7f, blocks[b], &outL[0], &outR[0] );
+            }
+            else
+            {
+              ref ->mono( &audioL[0], &refIndex, deltas[d],
+                          0.3f, 0.7f, blocks[b], &refL[0], &refR[0] );
+              kern->mono( &audioL[0], &index, deltas[d],
+                          0.3f, 0.7f, blocks[b], &outL[0], &outR[0] );
+            }
+            
+            if( refIndex != index ||
+                memcmp( &refL[0], &outL[0], sizeof(float) * blocks[b] ) ||
+                memcmp( &refR[0], &outR[0], sizeof(float) * blocks[b] ) )
+            {
+              identical = false;
+              break;
+            }
+          }
+          QUNIT_IS_TRUE( identical );
+        }
+      }
+    }
+  }
+}
+
+/// checks the integer PCM kernels are bit-identical to the scalar float kernel
+/// reading the same audio converted to float
+static void test_hermite_pcm()
+{
+  const int frames = 4096;
+  std::vector<int16_t> s16L( frames ), s16R( frames );
+  std::vector<PCM24>   s24L( frames ), s24R( frames );
+  std::vector<float>   f16L( frames ), f16R( frames );
+  std::vector<float>   f24L( frames ), f24R( frames );
+  srand( 1 );
+  for(int i = 0; i < frames; i++)
+  {
+    s16L[i] = rand() % 65536 - 32768;
+    s16R[i] = rand() % 65536 - 32768;
+    int32_t l = rand() % 16777216 - 8388608;
+    int32_t r = rand() % 16777216 - 8388608;
+    for(int b = 0; b < 3; b++)
+    {
+      s24L[i].b[b] = l >> (b * 8);
+      s24R[i].b[b] = r >> (b * 8);
+    }
+    f16L[i] = pcm_to_float( s16L[i] );
+    f16R[i] = pcm_to_float( s16R[i] );
+    f24L[i] = pcm_to_float( s24L[i] );
+    f24R[i] = pcm_to_float( s24R[i] );
+  }
+  QUNIT_IS_EQUAL( pcm_to_float( (int16_t)-32768 ), -1.f );
+  PCM24 min = { { 0x00, 0x00, 0x80 } };
+  QUNIT_IS_EQUAL( pcm_to_float( min ), -1.f );
   
-  Sample* samp = new Sample( 0, 44100, "Test", "test.wav");
+  const HermiteKernels* ref = hermite_kernels( HERMITE_SCALAR );
+  const int n = 125;
+  std::vector<float> refL( n ), refR( n ), outL( n ), outR( n );
+  
+  for(int stereo = 0; stereo < 2; stereo++)
+  {
+    for(int bits = 16; bits <= 24; bits += 8)
+    {
+      const float* fL = bits == 16 ? &f16L[0] : &f24L[0];
+      const float* fR = bits == 16 ? &f16R[0] : &f24R[0];
+      float refIndex = 0.25f;
+      float index    = 0.25f;
+      bool identical = true;
+      while( refIndex + 4 + n * 1.2517f < frames )
+      {
+        if( stereo )
+          ref->stereo( fL, fR, &refIndex, 1.2517f, 0.3f, 0.7f, n, &refL[0], &refR[0] );
+        else
+          ref->mono( fL, &refIndex, 1.2517f, 0.3f, 0.7f, n, &refL[0], &refR[0] );
+        
+        if( bits == 16 && stereo )
+          hermite_stereo_s16( &s16L[0], &s16R[0], &index, 1.2517f, 0.3f, 0.7f, n, &outL[0], &outR[0] );
+        else if( bits == 16 )
+          hermite_mono_s16( &s16L[0], &index, 1.2517f, 0.3f, 0.7f, n, &outL[0], &outR[0] );
+        else if( stereo )
+          hermite_stereo_s24( &s24L[0], &s24R[0], &index, 1.2517f, 0.3f, 0.7f, n, &outL[0], &outR[0] );
+        else
+          hermite_mono_s24( &s24L[0], &index, 1.2517f, 0.3f, 0.7f, n, &outL[0], &outR[0] );
+        
+        if( refIndex != index ||
+            memcmp( &refL[0], &outL[0], sizeof(float) * n ) ||
+            memcmp( &refR[0], &outR[0], sizeof(float) * n ) )
+        {
+          identical = false;
+          break;
+        }
+      }
+      QUNIT_IS_TRUE( identical );
+    }
+  }
+}
+
+/// checks ADSR::processBlock() is identical to calling ADSR::process() per frame
+static void test_adsr_block()
+{
+  ADSR ref;
+  ADSR blk;
+  
+  // short segments, so transitions happen inside blocks
+  ADSR* envs[] = { &ref, &blk };
+  for(int e = 0; e < 2; e++)
+  {
+    envs[e]->setAttackRate  ( 0.001 * 44100 );
+    envs[e]->setDecayRate   ( 0.01 * 44100 );
+    envs[e]->setSustainLevel( 0.5 );
+    envs[e]->setReleaseRate ( 0.02 * 44100 );
+    envs[e]->reset();
+    envs[e]->gate( true );
+  }
+  
+  std::vector<float> refOut( 256 ), blkOut( 256 );
+  const int blocks[] = { 1, 7, 64, 125, 256 };
+  
+  bool identical = true;
+  for(int i = 0; i < 200; i++)
+  {
+    // release half way through, and re-trigger during the release
+    if( i == 100 || i == 150 )
+    {
+      ref.gate( false );
+      blk.gate( false );
+    }
+    if( i == 120 )
+    {
+      ref.gate( true );
+      blk.gate( true );
+    }
+    
+    int n = blocks[i % 5];
+    for(int j = 0; j < n; j++)
+      refOut[j] = ref.process();
+    blk.processBlock( &blkOut[0], n );
+    
+    if( memcmp( &refOut[0], &blkOut[0], sizeof(float) * n ) ||
+        ref.getState() != blk.getState() )
+    {
+      identical = false;
+      break;
+    }
+  }
+  QUNIT_IS_TRUE( identical );
+  QUNIT_IS_TRUE( blk.getState() == ADSR::ENV_IDLE );
+}
+
+/// checks the mix kernels match a plain loop, and zero-gain routes are skipped
+static void test_mix_routes()
+{
+  const int nframes = 125;
+  std::vector<float> L( nframes ), R( nframes ), env( nframes );
+  std::vector<float> outL( nframes, 0.25f ), outR( nframes, 0.25f );
+  std::vector<float> auxL( nframes, 0.5f  ), auxR( nframes, 0.5f  );
+  for(int i = 0; i < nframes; i++)
+  {
+    L[i] = rand() / (float)RAND_MAX * 2 - 1;
+    R[i] = rand() / (float)RAND_MAX * 2 - 1;
+    env[i] = i / float(nframes);
+  }
+  
+  std::vector<float> refL( outL ), refR( outR );
+  for(int i = 0; i < nframes; i++)
+  {
+    refL[i] += (L[i] * env[i]) * 0.7f;
+    refR[i] += (R[i] * env[i]) * 0.7f;
+  }
   
+  MixRoute routes[2] = {
+    { &outL[0], &outR[0], 0.7f },
+    { &auxL[0], &auxR[0], 0.f  },
+  };
+  mix_apply_gain( &env[0], nframes, &L[0], &R[0] );
+  mix_routes( &L[0], &R[0], nframes, routes, 2 );
+  
+  QUNIT_IS_TRUE( memcmp( &refL[0], &outL[0], sizeof(float) * nframes ) == 0 );
+  QUNIT_IS_TRUE( memcmp( &refR[0], &outR[0], sizeof(float) * nframes ) == 0 );
+  QUNIT_IS_EQUAL( auxL[nframes-1], 0.5f );
+  QUNIT_IS_EQUAL( auxR[0], 0.5f );
+}
+
+/// checks the SVF note lookup, and that setting unchanged parameters each
+/// block doesn't change the filter output
+static void test_filter_svf()
+{
+  float maxError = 0;
+  for(float note = 24; note < 128; note += 0.173f)
+  {
+    float exact = 440.0*pow(2.0, (note - 69.0)/12.0);
+    float error = fabsf( SVFNoteTable::noteToHz( note ) - exact ) / exact;
+    if( error > maxError )
+      maxError = error;
+  }
+  QUNIT_IS_TRUE( maxError < 0.0005f );
+  
+  FiltersSVF once( 44100 );
+  FiltersSVF each( 44100 );
+  once.reset();
+  each.reset();
+  once.setResonance( 0.6 );
+  once.setValue( 0.5 );
+  
+  const int nframes = 128;
+  std::vector<float> in( nframes ), outOnce( nframes ), outEach( nframes );
+  bool identical = true;
+  for(int b = 0; b < 16; b++)
+  {
+    for(int i = 0; i < nframes; i++)
+      in[i] = rand() / (float)RAND_MAX * 2 - 1;
+    
+    each.setResonance( 0.6 );
+    each.setValue( 0.5 );
+    once.process( nframes, &in[0], &outOnce[0] );
+    each.process( nframes, &in[0], &outEach[0] );
+    if( memcmp( &outOnce[0], &outEach[0], sizeof(float) * nframes ) )
+      identical = false;
+  }
+  QUNIT_IS_TRUE( identical );
+}
+
+/// checks the stereo SVF matches two mono SVFs, including parameter ramps
+static void test_filter_svf_stereo()
+{
+  const int nframes = 125;
+  std::vector<float> inL( nframes ), inR( nframes );
+  std::vector<float> monoL( nframes ), monoR( nframes );
+  std::vector<float> outL( nframes ), outR( nframes );
+  
+  for(int type = 0; type < 4; type++)
+  {
+    FiltersSVF       filterL( 44100 );
+    FiltersSVF       filterR( 44100 );
+    FiltersSVFStereo stereo ( 44100 );
+    
+    FiltersSVF* filters[] = { &filterL, &filterR, &stereo };
+    for(int f = 0; f < 3; f++)
+    {
+      filters[f]->setType( type );
+      filters[f]->setDrive( 0.01 );
+    }
+    
+    float maxError = 0;
+    for(int b = 0; b < 32; b++)
+    {
+      for(int i = 0; i < nframes; i++)
+      {
+        inL[i] = rand() / (float)RAND_MAX * 2 - 1;
+        inR[i] = rand() / (float)RAND_MAX * 2 - 1;
+      }
+      
+      // sweep the parameters, so coefficients ramp during some blocks
+      for(int f = 0; f < 3; f++)
+      {
+        filters[f]->setResonance( (b / 8) * 0.25 );
+        filters[f]->setValue( (b / 4) * 0.125 );
+      }
+      
+      filterL.process( nframes, &inL[0], &monoL[0] );
+      filterR.process( nframes, &inR[0], &monoR[0] );
+      stereo .process( nframes, &inL[0], &inR[0], &outL[0], &outR[0] );
+      
+      for(int i = 0; i < nframes; i++)
+      {
+        maxError = fmaxf( maxError, fabsf( outL[i] - monoL[i] ) );
+        maxError = fmaxf( maxError, fabsf( outR[i] - monoR[i] ) );
+      }
+    }
+    QUNIT_IS_TRUE( maxError < 1e-5f );
+  }
+}
+
+static void test_sampler()
+{
+  Sample* samp = new Sample( 0, 44100, "Test", "test.wav");
+
   samp->attack  = 0;
   samp->decay   = 0;
   samp->sustain = 0;
   samp->release = 0;
-  
+
   Pad* p = new Pad( 0, 44100, 0);
   p->add( samp );
-  
+
   Sampler* s = new Sampler( 0, 44100 );
-  
+
   Voice* v = new Voice( 0, 44100 );
-  
+
   v->play( 0, 0, 0, p, 1 );
-  
-#define FABLA2_TEST_BUF_SIZE 44100
+
+  s->play( p, 1 );
+
   float audioL[FABLA2_TEST_BUF_SIZE];
   float audioR[FABLA2_TEST_BUF_SIZE];
   // -fsanitze=address test
   //audioL[FABLA2_TEST_BUF_SIZE] = 0;
-  
+
   for(int i = 0; i < 1; i++ )
   {
     s->process( FABLA2_TEST_BUF_SIZE, audioL, audioR );
   }
+
+  Plotter::plot( "out", FABLA2_TEST_BUF_SIZE, audioL );
+
+  delete v;
+  delete s;
+  delete p;
+}
+
+/// checks the Sampler finishes in the block where the sample runs out, and
+/// silences the rest of that block
+static void test_sampler_budget()
+{
+  Sample* samp = new Sample( 0, 44100, "Test", "test.wav");
+  Pad* p = new Pad( 0, 44100, 0);
+  p->add( samp );
+  
+  const long frames = samp->getFrames();
+  QUNIT_IS_TRUE( frames > 0 );
+  
+  const int nframes = 125;
+  float audioL[nframes];
+  float audioR[nframes];
+  
+  for(int run = 0; run < 2; run++)
+  {
+    // 0.5 pitch plays at normal speed, 1.0 is pitched up by 12 semitones
+    samp->pitch = run ? 1.0f : 0.5f;
+    const float pd = run ? 1.5f : 1.0f;
+    
+    Sampler* s = new Sampler( 0, 44100 );
+    s->play( p, 1 );
+    
+    long rendered = 0;
+    int done = 0;
+    while( !done && rendered < frames * 2 )
+    {
+      audioL[nframes-1] = audioR[nframes-1] = 1;
+      done = s->process( nframes, audioL, audioR );
+      rendered += nframes;
+    }
+    QUNIT_IS_TRUE( done == 1 );
+    
+    // the sample ends within the last block that was processed
+    long expected = ceilf( (frames - 4) / pd );
+    QUNIT_IS_TRUE( rendered - nframes <= expected );
+    QUNIT_IS_TRUE( rendered + 1 >= expected );
+    if( rendered > expected )
+    {
+      QUNIT_IS_EQUAL( audioL[nframes-1], 0 );
+      QUNIT_IS_EQUAL( audioR[nframes-1], 0 );
+    }
+    
+    delete s;
+  }
   
-  plotter_write( "out.dat", FABLA2_TEST_BUF_SIZE, audioL );
+  delete p;
+}
+
+/// checks a streamed sample plays the same audio as one loaded into RAM, with
+/// the test acting as the worker thread. Without refills, the stream plays
+/// silence after the head and counts the underruns
+static void test_sampler_stream()
+{
+  Sample* ram = new Sample( 0, 44100, "Test", "test.wav" );
+  Sample* disk = new Sample( 0, 44100, "Test", "test.wav", 1000 );
+  QUNIT_IS_TRUE( !ram->isStreaming() );
+  QUNIT_IS_TRUE( disk->isStreaming() );
+  QUNIT_IS_TRUE( disk->getHeadFrames() < disk->getTotalFrames() );
+  QUNIT_IS_EQUAL( disk->getTotalFrames(), ram->getTotalFrames() );
   
-  delete s;
+  Pad* padRam = new Pad( 0, 44100, 0 );
+  Pad* padDisk = new Pad( 0, 44100, 1 );
+  padRam->add( ram );
+  padDisk->add( disk );
+  
+  const int nframes = 128;
+  float ramL[nframes];
+  float ramR[nframes];
+  float diskL[nframes];
+  float diskR[nframes];
+  
+  for(int refill = 1; refill >= 0; refill--)
+  {
+    SampleStream* stream = new SampleStream();
+    Sampler* sRam = new Sampler( 0, 44100 );
+    Sampler* sDisk = new Sampler( 0, 44100 );
+    sDisk->setStream( stream );
+    sRam->play( padRam, 1 );
+    sDisk->play( padDisk, 1 );
+    
+    int same = 1;
+    int silent = 1;
+    int blocks = 0;
+    int doneRam = 0;
+    int doneDisk = 0;
+    while( !doneRam && blocks < 1000 )
+    {
+      if( refill && stream->needsRefill() )
+        stream->refill();
+      
+      doneRam  = sRam->process( nframes, ramL, ramR );
+      doneDisk = sDisk->process( nframes, diskL, diskR );
+      same = same && memcmp( ramL, diskL, sizeof(ramL) ) == 0 &&
+                     memcmp( ramR, diskR, sizeof(ramR) ) == 0;
+      
+      // past the head, the stream without refills outputs silence
+      if( (blocks - 1) * nframes > disk->getHeadFrames() )
+      {
+        for(int i = 0; i < nframes; i++)
+          silent = silent && diskL[i] == 0 && diskR[i] == 0;
+      }
+      blocks++;
+    }
+    
+    QUNIT_IS_TRUE( doneRam == 1 );
+    QUNIT_IS_TRUE( doneDisk == 1 );
+    if( refill )
+    {
+      QUNIT_IS_TRUE( same == 1 );
+      QUNIT_IS_EQUAL( stream->takeUnderruns(), 0 );
+    }
+    else
+    {
+      QUNIT_IS_TRUE( silent == 1 );
+      QUNIT_IS_TRUE( stream->takeUnderruns() > 0 );
+    }
+    
+    delete sRam;
+    delete sDisk;
+    delete stream;
+  }
+  
+  delete padRam;
+  delete padDisk;
+  
+  // a file at almost nine times the plugin rate: a block of 256 frames moves
+  // the playhead past the stream guard, so the stream renders shorter blocks
+  {
+    const int native = SampleBuffer::SAMPLE_RATE_NATIVE;
+    const int rate = 5000;
+    Sample* hiRam = new Sample( 0, rate, "Test", "test.wav", 0, false, native );
+    Sample* hiDisk = new Sample( 0, rate, "Test", "test.wav", 1000, false, native );
+    QUNIT_IS_TRUE( hiDisk->isStreaming() );
+    
+    Pad* padHiRam = new Pad( 0, rate, 0 );
+    Pad* padHiDisk = new Pad( 0, rate, 1 );
+    padHiRam->add( hiRam );
+    padHiDisk->add( hiDisk );
+    
+    SampleStream* stream = new SampleStream();
+    Sampler* sRam = new Sampler( 0, rate );
+    Sampler* sDisk = new Sampler( 0, rate );
+    sDisk->setStream( stream );
+    sRam->play( padHiRam, 1 );
+    sDisk->play( padHiDisk, 1 );
+    
+    const int n = 256;
+    float rL[n], rR[n], dL[n], dR[n];
+    float diff = 0;
+    int blocks = 0;
+    int doneRam = 0;
+    int doneDisk = 0;
+    while( !doneRam && blocks < 1000 )
+    {
+      if( stream->needsRefill() )
+        stream->refill();
+      
+      doneRam  = sRam->process( n, rL, rR );
+      doneDisk = sDisk->process( n, dL, dR );
+      for(int i = 0; i < n; i++)
+        diff = fmaxf( diff, fmaxf( fabsf( rL[i] - dL[i] ), fabsf( rR[i] - dR[i] ) ) );
+      blocks++;
+    }
+    
+    // the playhead is rebased at other frames, which rounds it differently
+    QUNIT_IS_TRUE( doneRam == 1 );
+    QUNIT_IS_TRUE( doneDisk == 1 );
+    QUNIT_IS_TRUE( diff < 1e-4f );
+    QUNIT_IS_EQUAL( stream->takeUnderruns(), 0 );
+    
+    delete sRam;
+    delete sDisk;
+    delete stream;
+    delete padHiRam;
+    delete padHiDisk;
+  }
+}
+
+/// checks Samples of the same file and rate share one buffer, and that the
+/// buffer is freed with the last Sample using it
+static void test_sample_pool()
+{
+  // rates no other test uses, as some tests keep their Samples
+  const int before = SamplePool::size();
+  
+  Sample* a = new Sample( 0, 22050, "Test", "test.wav" );
+  Sample* b = new Sample( 0, 22050, "Test", "test.wav" );
+  Sample* c = new Sample( 0, 48000, "Test", "test.wav" );
+  Sample* d = new Sample( 0, 22050, "Test", "test.wav", 1000 );
+  
+  QUNIT_IS_TRUE( a->getAudio(0) == b->getAudio(0) );
+  QUNIT_IS_TRUE( a->getAudio(1) == b->getAudio(1) );
+  QUNIT_IS_TRUE( a->getAudio(0) != c->getAudio(0) );
+  QUNIT_IS_TRUE( a->getAudio(0) != d->getAudio(0) );
+  QUNIT_IS_EQUAL( SamplePool::size(), before + 3 );
+  
+  delete a;
+  QUNIT_IS_EQUAL( SamplePool::size(), before + 3 );
+  delete b;
+  delete c;
+  delete d;
+  QUNIT_IS_EQUAL( SamplePool::size(), before );
+  
+  Sample* missing = new Sample( 0, 44100, "Test", "missing.wav" );
+  QUNIT_IS_EQUAL( missing->getFrames(), 0 );
+  delete missing;
+}
+
+/// checks a 16 bit file in compact storage uses half the RAM, and plays the
+/// same audio as when it is stored as float
+static void test_sample_compact()
+{
+  Sample* f = new Sample( 0, 44100, "Test", "test.wav" );
+  Sample* c = new Sample( 0, 44100, "Test", "test.wav", 0, true );
+  QUNIT_IS_EQUAL( f->getFormat(), SampleBuffer::SAMPLE_FLOAT );
+  QUNIT_IS_EQUAL( c->getFormat(), SampleBuffer::SAMPLE_S16 );
+  QUNIT_IS_TRUE( c->getAudio(0) == 0 );
+  QUNIT_IS_EQUAL( c->getFrames(), f->getFrames() );
+  
+  SampleBuffer compact( "test.wav", 44100, 0, true );
+  QUNIT_IS_EQUAL( compact.getBytes() * 2, compact.getFloatBytes() );
+  
+  Pad* pf = new Pad( 0, 44100, 0 );
+  Pad* pc = new Pad( 0, 44100, 1 );
+  pf->add( f );
+  pc->add( c );
+  
+  const int nframes = 128;
+  float fL[nframes], fR[nframes], cL[nframes], cR[nframes];
+  Sampler* sf = new Sampler( 0, 44100 );
+  Sampler* sc = new Sampler( 0, 44100 );
+  sf->play( pf, 1 );
+  sc->play( pc, 1 );
+  
+  int same = 1;
+  int done = 0;
+  for(int i = 0; i < 1000 && !done; i++)
+  {
+    done = sf->process( nframes, fL, fR );
+    sc->process( nframes, cL, cR );
+    same = same && memcmp( fL, cL, sizeof(fL) ) == 0 &&
+                   memcmp( fR, cR, sizeof(fR) ) == 0;
+  }
+  QUNIT_IS_TRUE( done == 1 );
+  QUNIT_IS_TRUE( same == 1 );
+  
+  delete sf;
+  delete sc;
+  delete pf;
+  delete pc;
+}
+
+/// plays a sample until it finishes, and returns the frames it took
+static long test_play_frames( Sample* s, int rate )
+{
+  Pad* p = new Pad( 0, rate, 0 );
+  p->add( s );
+  Sampler* sampler = new Sampler( 0, rate );
+  sampler->play( p, 1 );
+  
+  const int nframes = 128;
+  float L[nframes], R[nframes];
+  long frames = 0;
+  while( !sampler->process( nframes, L, R ) && frames < 1000000 )
+    frames += nframes;
+  
+  delete sampler;
   delete p;
+  return frames;
+}
+
+/// checks a sample kept at the rate of its file plays as long as one that was
+/// resampled when loading, is shared by instances at any rate, and that the
+/// converter thread makes a copy at the plugin rate
+static void test_sample_rate()
+{
+  const int native = SampleBuffer::SAMPLE_RATE_NATIVE;
+  Sample* conv = new Sample( 0, 22050, "Test", "test.wav" );
+  Sample* a = new Sample( 0, 22050, "Test", "test.wav", 0, false, native );
+  Sample* b = new Sample( 0, 96000, "Test", "test.wav", 0, false, native );
+  QUNIT_IS_EQUAL( conv->getRate(), 22050 );
+  QUNIT_IS_EQUAL( a->getRate(), 44100 );
+  QUNIT_IS_EQUAL( a->getTotalFrames(), 90229 );
+  QUNIT_IS_TRUE( a->getAudio(0) == b->getAudio(0) );
+  
+  // the same length in time, within a block
+  long convFrames = test_play_frames( conv, 22050 );
+  long nativeFrames = test_play_frames( a, 22050 );
+  QUNIT_IS_TRUE( labs( convFrames - nativeFrames ) <= 128 );
+  QUNIT_IS_TRUE( labs( test_play_frames( b, 96000 ) - 90229 * 96000l / 44100 ) <= 256 );
+  
+  SamplePool::startConverter();
+  Sample* bg = new Sample( 0, 22050, "Test", "test.wav", 0, false,
+                           SampleBuffer::SAMPLE_RATE_BACKGROUND );
+  QUNIT_IS_TRUE( bg->getAudio(0) == a->getAudio(0) );
+  for(int i = 0; i < 1000 && SamplePool::converterQueue(); i++)
+    usleep( 10000 );
+  const SampleBuffer* copy = bg->getBuffer()->playBuffer( 22050 );
+  QUNIT_IS_TRUE( copy != bg->getBuffer() );
+  QUNIT_IS_EQUAL( copy->getRate(), 22050 );
+  QUNIT_IS_EQUAL( copy->getFrames(), conv->getTotalFrames() );
+  QUNIT_IS_TRUE( bg->getBuffer()->playBuffer( 48000 ) == bg->getBuffer() );
+  QUNIT_IS_TRUE( labs( test_play_frames( bg, 22050 ) - convFrames ) <= 128 );
+  SamplePool::stopConverter();
+  
+  delete conv;
+  delete a;
+  delete b;
+  delete bg;
+}
+
+/// checks a buffer read from the SampleCache has the same audio as a decoded
+/// one, that entries are evicted over the size limit, and that an entry is not
+/// used after its source file changed
+static void test_sample_cache()
+{
+  SampleCache::directory( "test_cache" );
+  SampleCache::limit( 64 * 1048576 );
+  SampleCache::clear();
+  QUNIT_IS_EQUAL( SampleCache::usage(), 0 );
+  
+  for(int compact = 0; compact < 2; compact++)
+  {
+    SampleBuffer decoded( "test.wav", 22050, 0, compact );
+    SampleBuffer cached( "test.wav", 22050, 0, compact );
+    QUNIT_IS_TRUE( !decoded.isCached() );
+    QUNIT_IS_TRUE( cached.isCached() );
+    QUNIT_IS_EQUAL( cached.getFormat(), decoded.getFormat() );
+    QUNIT_IS_EQUAL( cached.getFrames(), decoded.getFrames() );
+    QUNIT_IS_EQUAL( cached.getRate(), 22050 );
+    
+    std::vector<float> a( decoded.getFrames() );
+    std::vector<float> b( decoded.getFrames() );
+    decoded.getFloat( 1, 0, a.size(), &a[0] );
+    cached.getFloat( 1, 0, b.size(), &b[0] );
+    QUNIT_IS_TRUE( a == b );
+  }
+  
+  // room for one more entry of the float size: the least recently used
+  // compact entry is evicted
+  const long f = SampleBuffer( "test.wav", 22050, 0, false ).getBytes();
+  const long c = SampleBuffer( "test.wav", 22050, 0, true  ).getBytes();
+  SampleCache::limit( 2 * f + c / 2 );
+  usleep( 50000 ); // file times have a coarse resolution
+  QUNIT_IS_TRUE( SampleBuffer( "test.wav", 22050, 0, false ).isCached() );
+  SampleBuffer other( "test.wav", 22050, 1000000, false );
+  QUNIT_IS_TRUE( !other.isCached() );
+  QUNIT_IS_EQUAL( SampleCache::usage(), 2 * f );
+  QUNIT_IS_TRUE( SampleBuffer( "test.wav", 22050, 0, false ).isCached() );
+  QUNIT_IS_TRUE( !SampleBuffer( "test.wav", 22050, 0, true ).isCached() );
+  
+  // a source file that changes gets a new entry
+  FILE* in  = fopen( "test.wav", "rb" );
+  FILE* out = fopen( "test_cache.wav", "wb" );
+  char buf[4096];
+  size_t n = 0;
+  while( in && out && (n = fread( buf, 1, sizeof(buf), in )) > 0 )
+    fwrite( buf, 1, n, out );
+  fclose( in );
+  fclose( out );
+  
+  SampleCache::limit( 64 * 1048576 );
+  SampleBuffer first( "test_cache.wav", 44100, 0, false );
+  QUNIT_IS_TRUE( SampleBuffer( "test_cache.wav", 44100, 0, false ).isCached() );
+  
+  // a damaged entry is not read: the rate after the magic and version is 0
+  const std::string e = SampleCache::entry( "test_cache.wav", 44100, 0, false, SRC_SINC_FASTEST );
+  FILE* damaged = fopen( e.c_str(), "r+b" );
+  const int32_t zero = 0;
+  QUNIT_IS_TRUE( damaged && fseek( damaged, 12, SEEK_SET ) == 0 &&
+                 fwrite( &zero, sizeof(zero), 1, damaged ) == 1 );
+  if( damaged )
+    fclose( damaged );
+  QUNIT_IS_TRUE( !SampleBuffer( "test_cache.wav", 44100, 0, false ).isCached() );
+  QUNIT_IS_TRUE( SampleBuffer( "test_cache.wav", 44100, 0, false ).isCached() );
+  
+  struct timeval changed[2] = { { 1000, 0 }, { 1000, 0 } };
+  utimes( "test_cache.wav", changed );
+  QUNIT_IS_TRUE( !SampleBuffer( "test_cache.wav", 44100, 0, false ).isCached() );
+  
+  SampleCache::clear();
+  SampleCache::limit( 0 );
+  QUNIT_IS_TRUE( SampleCache::entry( "test.wav", 44100, 0, false, 0 ).empty() );
+}
+
+/// returns the inode of a file, 0 if it doesn't exist
+static long test_inode( const char* path )
+{
+  struct stat st;
+  if( stat( path, &st ) != 0 )
+    return 0;
+  return st.st_ino;
+}
+
+/// checks a save only writes a file when no file holds the same audio, and
+/// links to files that do
+static void test_sample_save()
+{
+  unlink( "test_save_a.wav" );
+  unlink( "test_save_b.wav" );
+  unlink( "test_save_c.wav" );
+  
+  Sample* s = new Sample( 0, 44100, "Test", "test.wav" );
+  QUNIT_IS_EQUAL( s->save( "test_save_a.wav" ), Sample::SAVE_WRITTEN );
+  QUNIT_IS_EQUAL( s->save( "test_save_a.wav" ), Sample::SAVE_UNCHANGED );
+  QUNIT_IS_EQUAL( s->save( "test_save_b.wav" ), Sample::SAVE_LINKED );
+  QUNIT_IS_EQUAL( test_inode( "test_save_b.wav" ), test_inode( "test_save_a.wav" ) );
+  
+  // a 16 bit source is converted by write(), so it isn't linked to
+  QUNIT_IS_TRUE( test_inode( "test_save_a.wav" ) != test_inode( "test.wav" ) );
+  
+  // a deleted file is linked again to the file of the last save
+  unlink( "test_save_a.wav" );
+  QUNIT_IS_EQUAL( s->save( "test_save_a.wav" ), Sample::SAVE_LINKED );
+  
+  // a float file at the plugin rate holds the same audio as it would save
+  Sample* f = new Sample( 0, 44100, "Test", "test_save_b.wav" );
+  QUNIT_IS_EQUAL( f->save( "test_save_b.wav" ), Sample::SAVE_UNCHANGED );
+  QUNIT_IS_EQUAL( f->save( "test_save_c.wav" ), Sample::SAVE_LINKED );
+  QUNIT_IS_EQUAL( test_inode( "test_save_c.wav" ), test_inode( "test_save_b.wav" ) );
+  QUNIT_IS_TRUE( f->getGeneration() != s->getGeneration() );
+  
+  // resampled audio differs from its file. Writing replaces the link to the
+  // source, instead of writing through it
+  Sample* r = new Sample( 0, 48000, "Test", "test_save_b.wav" );
+  QUNIT_IS_EQUAL( r->save( "test_save_c.wav" ), Sample::SAVE_WRITTEN );
+  QUNIT_IS_TRUE( test_inode( "test_save_c.wav" ) != test_inode( "test_save_b.wav" ) );
+  QUNIT_IS_EQUAL( f->save( "test_save_b.wav" ), Sample::SAVE_UNCHANGED );
+  
+  // a streamed sample whose file is gone can't be written: the save fails,
+  // and the file already at the target is kept
+  unlink( "test_save_stream.wav" );
+  link( "test.wav", "test_save_stream.wav" );
+  Sample* d = new Sample( 0, 44100, "Test", "test_save_stream.wav", 1000 );
+  QUNIT_IS_TRUE( d->isStreaming() );
+  unlink( "test_save_stream.wav" );
+  const long old = test_inode( "test_save_c.wav" );
+  QUNIT_IS_EQUAL( d->save( "test_save_c.wav" ), Sample::SAVE_FAILED );
+  QUNIT_IS_EQUAL( test_inode( "test_save_c.wav" ), old );
+  QUNIT_IS_EQUAL( test_inode( "test_save_c.wav.tmp" ), 0 );
+  QUNIT_IS_EQUAL( r->save( "test_save_c.wav" ), Sample::SAVE_UNCHANGED );
+  
+  delete s;
+  delete f;
+  delete r;
+  delete d;
+}
+
+/// compares the saved settings of two kits
+static bool test_kit_equal( const KitState& a, const KitState& b )
+{
+  if( a.polyphony != b.polyphony || a.stealPolicy != b.stealPolicy ||
+      a.renderThreads != b.renderThreads || a.streamThreshold != b.streamThreshold ||
+      a.compactSamples != b.compactSamples || a.sampleRateMode != b.sampleRateMode ||
+      a.sampleCacheMB != b.sampleCacheMB )
+    return false;
+  for(int i = 0; i < 4; i++)
+    if( a.auxBusVol[i] != b.auxBusVol[i] )
+      return false;
+  for(int i = 0; i < 16; i++)
+    if( a.channelBank[i] != b.channelBank[i] )
+      return false;
+  
+  for(int bank = 0; bank < FABLA2_KIT_BANKS; bank++)
+  {
+    for(int p = 0; p < FABLA2_KIT_PADS; p++)
+    {
+      const PadState& x = a.pads[bank][p];
+      const PadState& y = b.pads[bank][p];
+      if( x.valid != y.valid || x.muteGroup != y.muteGroup ||
+          x.offGroup != y.offGroup || x.triggerMode != y.triggerMode ||
+          x.switchMode != y.switchMode || x.volume != y.volume ||
+          x.notes != y.notes || x.layers.size() != y.layers.size() )
+        return false;
+      for(int i = 0; i < 4; i++)
+        if( x.sends[i] != y.sends[i] )
+          return false;
+      
+      for(size_t l = 0; l < x.layers.size(); l++)
+      {
+        const LayerState& s = x.layers[l];
+        const LayerState& t = y.layers[l];
+        if( s.filename != t.filename || s.name != t.name ||
+            s.gain != t.gain || s.pan != t.pan || s.pitch != t.pitch ||
+            s.time != t.time || s.startPoint != t.startPoint ||
+            s.endPoint != t.endPoint || s.filterType != t.filterType ||
+            s.filterFrequency != t.filterFrequency ||
+            s.filterResonance != t.filterResonance ||
+            s.velLow != t.velLow || s.velHigh != t.velHigh ||
+            s.attack != t.attack || s.decay != t.decay ||
+            s.sustain != t.sustain || s.release != t.release )
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+/// round trips a full kit through the binary and JSON state, and prints how
+/// long saving and restoring each encoding takes
+static void test_kit_state()
+{
+  // values that are exact in float, and whole ADSR values as JSON keeps them
+  KitState kit;
+  kit.polyphony       = 48;
+  kit.stealPolicy     = 2;
+  kit.renderThreads   = 3;
+  kit.streamThreshold = 500000;
+  kit.compactSamples  = true;
+  kit.sampleRateMode  = 1;
+  kit.sampleCacheMB   = 256;
+  for(int i = 0; i < 4; i++)
+    kit.auxBusVol[i] = 0.25 * (i + 1);
+  for(int i = 0; i < 16; i++)
+    kit.channelBank[i] = i % 5 - 1;
   
-  return 0;
+  for(int b = 0; b < FABLA2_KIT_BANKS; b++)
+  {
+    for(int p = 0; p < FABLA2_KIT_PADS; p++)
+    {
+      PadState& pad = kit.pads[b][p];
+      pad.valid       = true;
+      pad.muteGroup   = p % 4;
+      pad.offGroup    = p % 3;
+      pad.triggerMode = p % 2;
+      pad.switchMode  = b;
+      pad.volume      = p / 16.f;
+      for(int i = 0; i < 4; i++)
+        pad.sends[i] = i / 8.f;
+      for(int n = 0; n < p % 3; n++)
+        pad.notes.push_back( 20 + b * 16 + p + n );
+      
+      pad.layers.resize( 4 );
+      for(int l = 0; l < 4; l++)
+      {
+        LayerState& s = pad.layers[l];
+        char name[64];
+        snprintf( name, sizeof(name), "pad%i_layer%i.wav", p, l );
+        s.filename   = name;
+        s.name       = "Kick \"drum\" " + std::string( name );
+        s.gain       = l / 4.f;
+        s.pitch      = p / 32.f;
+        s.startPoint = 0.125;
+        s.velLow     = l * 0.25;
+        s.velHigh    = (l + 1) * 0.25;
+        s.attack     = l % 2;
+        s.decay      = 0;
+      }
+    }
+  }
+  
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  std::vector<uint8_t> binary;
+  kit.encode( binary );
+  std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+  KitState fromBinary;
+  QUNIT_IS_TRUE( fromBinary.decode( &binary[0], binary.size() ) );
+  std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+  std::string json = kit.toJson();
+  std::chrono::steady_clock::time_point t3 = std::chrono::steady_clock::now();
+  KitState fromJson;
+  QUNIT_IS_TRUE( fromJson.fromJson( json.c_str() ) );
+  std::chrono::steady_clock::time_point t4 = std::chrono::steady_clock::now();
+  
+  printf("Kit state: binary %li bytes, save %.3f ms, restore %.3f ms\n",
+         (long)binary.size(),
+         std::chrono::duration<double, std::milli>( t1 - t0 ).count(),
+         std::chrono::duration<double, std::milli>( t2 - t1 ).count() );
+  printf("Kit state: JSON   %li bytes, save %.3f ms, restore %.3f ms\n",
+         (long)json.size(),
+         std::chrono::duration<double, std::milli>( t3 - t2 ).count(),
+         std::chrono::duration<double, std::milli>( t4 - t3 ).count() );
+  
+  QUNIT_IS_TRUE( test_kit_equal( kit, fromBinary ) );
+  QUNIT_IS_TRUE( test_kit_equal( kit, fromJson ) );
+  
+  // truncated data, other data and newer versions are rejected
+  KitState bad;
+  QUNIT_IS_FALSE( bad.decode( &binary[0], binary.size() - 1 ) );
+  QUNIT_IS_FALSE( bad.decode( (const uint8_t*)json.c_str(), json.size() ) );
+  std::vector<uint8_t> newer = binary;
+  newer[4]++;
+  QUNIT_IS_FALSE( bad.decode( &newer[0], newer.size() ) );
+  
+  // settings missing from older JSON keep their value, and pads missing from
+  // it are not valid
+  KitState old;
+  old.polyphony = 7;
+  QUNIT_IS_TRUE( old.fromJson( "{\"bank_A\":{\"pad_0\":{\"nLayers\":1,"
+                 "\"layer_0\":{\"filename\":\"pad0_layer0.wav\",\"attack\":1.5}}}}" ) );
+  QUNIT_IS_EQUAL( old.polyphony, 7 );
+  QUNIT_IS_TRUE( old.pads[0][0].valid );
+  QUNIT_IS_FALSE( old.pads[0][1].valid );
+  QUNIT_IS_FALSE( old.pads[1][0].valid );
+  QUNIT_IS_EQUAL( (int)old.pads[0][0].layers.size(), 1 );
+  QUNIT_IS_TRUE( old.pads[0][0].layers[0].attack == 1.f );
+  QUNIT_IS_TRUE( old.pads[0][0].layers[0].gain == 0.75f );
+  QUNIT_IS_TRUE( old.pads[0][0].layers[0].name == "pad0_layer0.wav" );
+  QUNIT_IS_FALSE( old.fromJson( "{\"bank_A\":" ) );
+  
+  // the fingerprint ignores the directory of the samples, not their names
+  KitState moved( kit );
+  moved.pads[1][2].layers[3].filename = "/other/dir/" + moved.pads[1][2].layers[3].filename;
+  QUNIT_IS_TRUE( moved.fingerprint() == kit.fingerprint() );
+  QUNIT_IS_TRUE( fromJson.fingerprint() == kit.fingerprint() );
+  moved.pads[1][2].layers[3].filename = "/other/dir/kick.wav";
+  QUNIT_IS_TRUE( moved.fingerprint() != kit.fingerprint() );
+  moved = kit;
+  moved.polyphony++;
+  QUNIT_IS_TRUE( moved.fingerprint() != kit.fingerprint() );
+}
+
+/// checks the default routing of MIDI notes is the one of older versions,
+/// and the routing of a kit: pads on notes of their own, and channels that
+/// play a single bank
+static void test_midi_map()
+{
+  MidiMap def;
+  int bank = -1;
+  int pad  = -1;
+  int wrong = 0;
+  for(int c = 0; c < 16; c++)
+  {
+    for(int n = 0; n < 128; n++)
+    {
+      const bool mapped = n >= 36 && n < 36 + 4 * 16;
+      if( def.lookup( c, n, bank, pad ) != mapped ||
+          ( mapped && ( bank != (n - 36) / 16 || pad != (n - 36) % 16 ) ) )
+        wrong++;
+    }
+  }
+  QUNIT_IS_EQUAL( wrong, 0 );
+  
+  KitState kit;
+  kit.channelBank[9] = 2;
+  kit.pads[0][0].notes.push_back( 35 );
+  kit.pads[0][0].notes.push_back( 36 );
+  kit.pads[0][1].notes.push_back( 40 );
+  kit.pads[2][5].notes.push_back( 60 );
+  kit.pads[3][15].notes.push_back( 200 );
+  MidiMap m;
+  m.build( kit );
+  
+  // two notes play pad 0, and pad 1 takes the default note of pad 4
+  QUNIT_IS_TRUE( m.lookup( 0, 35, bank, pad ) && bank == 0 && pad == 0 );
+  QUNIT_IS_TRUE( m.lookup( 0, 36, bank, pad ) && bank == 0 && pad == 0 );
+  QUNIT_IS_TRUE( m.lookup( 0, 40, bank, pad ) && bank == 0 && pad == 1 );
+  QUNIT_IS_FALSE( m.lookup( 0, 37, bank, pad ) );
+  QUNIT_IS_TRUE( m.lookup( 0, 41, bank, pad ) && bank == 0 && pad == 5 );
+  // notes out of range play nothing, and take nothing
+  QUNIT_IS_FALSE( m.lookup( 0, 99, bank, pad ) );
+  QUNIT_IS_TRUE( m.lookup( 0, 60, bank, pad ) && bank == 2 && pad == 5 );
+  
+  // channel 10 plays bank C from note 36
+  QUNIT_IS_TRUE( m.lookup( 9, 36, bank, pad ) && bank == 2 && pad == 0 );
+  QUNIT_IS_TRUE( m.lookup( 9, 51, bank, pad ) && bank == 2 && pad == 15 );
+  QUNIT_IS_TRUE( m.lookup( 9, 60, bank, pad ) && bank == 2 && pad == 5 );
+  QUNIT_IS_FALSE( m.lookup( 9, 41, bank, pad ) );
+  QUNIT_IS_FALSE( m.lookup( 9, 52, bank, pad ) );
+  QUNIT_IS_FALSE( m.lookup( 9, 35, bank, pad ) );
+  
+  // the routing is saved as it was restored
+  KitState saved;
+  m.store( saved );
+  QUNIT_IS_EQUAL( saved.channelBank[9], 2 );
+  QUNIT_IS_EQUAL( saved.channelBank[0], -1 );
+  QUNIT_IS_TRUE( saved.pads[0][0].notes == kit.pads[0][0].notes );
+  QUNIT_IS_TRUE( saved.pads[3][15].notes == kit.pads[3][15].notes );
+}
+
+namespace Fabla2
+{
+/// reads the voice pool of a Fabla2DSP, which the plugin keeps private
+class Fabla2DSPTest
+{
+  public:
+    /// the linked voices, oldest first
+    static std::vector<Voice*> active( Fabla2DSP* d )
+    {
+      std::vector<Voice*> v;
+      for( Voice* a = d->activeHead; a; a = a->activeNext )
+        v.push_back( a );
+      return v;
+    }
+    
+    static Voice* audition( Fabla2DSP* d ){return d->auditionVoice;}
+    
+    /// true when the off group bucket of og has the bit of voice v
+    static bool inBucket( Fabla2DSP* d, Voice* v, int og )
+    {
+      const int g = og % FABLA2_GROUP_BUCKETS;
+      return d->groupVoices[g][v->index / 64] & ( 1ULL << ( v->index % 64 ) );
+    }
+    
+    /// lets the render threads take as long as they need, so a loaded
+    /// machine doesn't drop voices
+    static void noDeadline( Fabla2DSP* d ){d->renderDeadline = 0;}
+};
+}; // Fabla2
+
+static LV2_URID test_capture_map( LV2_URID_Map_Handle h, const char* uri );
+
+/// a Fabla2DSP without the LV2 wrapper, so nothing is sent to a UI, with a
+/// Sample of sustain level sustain[i] loaded on pad i of bank A, for i up to
+/// pads
+static Fabla2DSP* test_dsp( URIs* uris, std::vector<float>* buffers,
+                            int polyphony, int pads, const float* sustain )
+{
+  static std::map<std::string, LV2_URID> ids;
+  LV2_URID_Map map = { &ids, test_capture_map };
+  mapUri( uris, &map );
+  
+  Fabla2DSP* d = new Fabla2DSP( 44100, uris );
+  for(int i = ATOM_OUT + 1; i < PORT_COUNT; i++)
+  {
+    buffers[i].assign( FABLA2_BLOCK_MAX, 0.f );
+    d->controlPorts[i] = &buffers[i][0];
+  }
+  *d->controlPorts[MASTER_VOL] = 1;
+  
+  d->polyphony( polyphony );
+  for(int i = 0; i < pads; i++)
+  {
+    Sample* s = new Sample( d, 44100, "Test", "test.wav" );
+    s->sustain = sustain[i];
+    d->getLibrary()->bank( 0 )->pad( i )->load( s );
+  }
+  return d;
+}
+
+/// plays pad p of bank A, with the default MIDI map
+static void test_note_on( Fabla2DSP* d, int p )
+{
+  uint8_t msg[3] = { 0x90, (uint8_t)(36 + p), 100 };
+  d->midi( 0, msg );
+}
+
+/// checks the pads of the linked voices, oldest first
+static bool test_voice_pads( Fabla2DSP* d, int n, const int* pads )
+{
+  std::vector<Voice*> v = Fabla2DSPTest::active( d );
+  if( (int)v.size() != n )
+    return false;
+  for(int i = 0; i < n; i++)
+  {
+    if( !v[i]->active() || !v[i]->matches( 0, pads[i] ) )
+      return false;
+  }
+  return true;
+}
+
+/// checks the voice each steal policy takes once all voices play, and that a
+/// voice that finished this block is reused before any is stolen
+static void test_voice_steal()
+{
+  URIs uris;
+  std::vector<float> buffers[PORT_COUNT];
+  const float sustain[4] = { 1.f, 0.2f, 0.6f, 1.f };
+  
+  // the oldest voice plays the new note, and becomes the newest
+  {
+    Fabla2DSP* d = test_dsp( &uris, buffers, 3, 4, sustain );
+    for(int i = 0; i < 3; i++)
+      test_note_on( d, i );
+    Voice* oldest = Fabla2DSPTest::active( d )[0];
+    test_note_on( d, 3 );
+    const int pads[] = { 1, 2, 3 };
+    QUNIT_IS_TRUE( test_voice_pads( d, 3, pads ) );
+    QUNIT_IS_TRUE( Fabla2DSPTest::active( d )[2] == oldest );
+    delete d;
+  }
+  
+  // the voice with the lowest envelope level, once the decays are done
+  {
+    Fabla2DSP* d = test_dsp( &uris, buffers, 3, 4, sustain );
+    d->stealPolicy( Fabla2DSP::STEAL_QUIETEST );
+    for(int i = 0; i < 3; i++)
+      test_note_on( d, i );
+    for(int b = 0; b < 16; b++)
+      d->process( 256 );
+    Voice* quietest = Fabla2DSPTest::active( d )[1];
+    QUNIT_IS_TRUE( quietest->level() < Fabla2DSPTest::active( d )[2]->level() );
+    test_note_on( d, 3 );
+    const int pads[] = { 0, 2, 3 };
+    QUNIT_IS_TRUE( test_voice_pads( d, 3, pads ) );
+    QUNIT_IS_TRUE( Fabla2DSPTest::active( d )[2] == quietest );
+    delete d;
+  }
+  
+  // a voice of the same pad, else the oldest
+  {
+    Fabla2DSP* d = test_dsp( &uris, buffers, 3, 4, sustain );
+    d->stealPolicy( Fabla2DSP::STEAL_SAME_PAD_FIRST );
+    for(int i = 0; i < 3; i++)
+      test_note_on( d, i );
+    test_note_on( d, 1 );
+    const int same[] = { 0, 2, 1 };
+    QUNIT_IS_TRUE( test_voice_pads( d, 3, same ) );
+    test_note_on( d, 3 );
+    const int oldest[] = { 2, 1, 3 };
+    QUNIT_IS_TRUE( test_voice_pads( d, 3, oldest ) );
+    delete d;
+  }
+  
+  // the sample of pad 1 is unloaded, which stops its voice in this block:
+  // that voice plays the next note, the oldest is not stolen
+  for(int policy = Fabla2DSP::STEAL_OLDEST; policy <= Fabla2DSP::STEAL_SAME_PAD_FIRST; policy++)
+  {
+    Fabla2DSP* d = test_dsp( &uris, buffers, 3, 4, sustain );
+    d->stealPolicy( policy );
+    for(int i = 0; i < 3; i++)
+      test_note_on( d, i );
+    d->process( 256 );
+    
+    Voice* finished = Fabla2DSPTest::active( d )[1];
+    Pad* p = d->getLibrary()->bank( 0 )->pad( 1 );
+    Sample* s = p->layer( 0 );
+    p->remove( s );
+    d->retire( s );
+    QUNIT_IS_FALSE( finished->active() );
+    QUNIT_IS_EQUAL( d->activeVoices(), 3 );
+    
+    test_note_on( d, 3 );
+    const int pads[] = { 0, 2, 3 };
+    QUNIT_IS_TRUE( test_voice_pads( d, 3, pads ) );
+    QUNIT_IS_TRUE( Fabla2DSPTest::active( d )[2] == finished );
+    delete d;
+  }
+}
+
+/// checks a note-on chokes only the voices of its mute group when two off
+/// groups share a bucket, and that the buckets follow an off group change
+static void test_voice_groups()
+{
+  URIs uris;
+  std::vector<float> buffers[PORT_COUNT];
+  const float sustain[4] = { 1.f, 1.f, 1.f, 1.f };
+  
+  // groups 1 and 17 share a bucket: each mute group chokes its own pad
+  {
+    Fabla2DSP* d = test_dsp( &uris, buffers, 8, 4, sustain );
+    Bank* a = d->getLibrary()->bank( 0 );
+    a->pad( 0 )->offGroup( 1 );
+    a->pad( 1 )->offGroup( 17 );
+    a->pad( 2 )->muteGroup( 1 );
+    a->pad( 3 )->muteGroup( 17 );
+    
+    test_note_on( d, 0 );
+    test_note_on( d, 1 );
+    std::vector<Voice*> v = Fabla2DSPTest::active( d );
+    QUNIT_IS_TRUE( Fabla2DSPTest::inBucket( d, v[0], 1 ) );
+    QUNIT_IS_TRUE( Fabla2DSPTest::inBucket( d, v[1], 17 ) );
+    
+    // the choked voice releases, and is freed once it is done
+    test_note_on( d, 2 );
+    for(int b = 0; b < 16; b++)
+      d->process( 256 );
+    const int first[] = { 1, 2 };
+    QUNIT_IS_TRUE( test_voice_pads( d, 2, first ) );
+    QUNIT_IS_FALSE( Fabla2DSPTest::inBucket( d, v[0], 1 ) );
+    
+    test_note_on( d, 3 );
+    for(int b = 0; b < 16; b++)
+      d->process( 256 );
+    const int second[] = { 2, 3 };
+    QUNIT_IS_TRUE( test_voice_pads( d, 2, second ) );
+    delete d;
+  }
+  
+  // the off group of a playing pad changes: its voice moves bucket
+  {
+    Fabla2DSP* d = test_dsp( &uris, buffers, 8, 4, sustain );
+    Bank* a = d->getLibrary()->bank( 0 );
+    a->pad( 1 )->muteGroup( 2 );
+    a->pad( 2 )->muteGroup( 3 );
+    
+    test_note_on( d, 0 );
+    Voice* v = Fabla2DSPTest::active( d )[0];
+    QUNIT_IS_FALSE( Fabla2DSPTest::inBucket( d, v, 2 ) );
+    
+    d->uiMessage( 0, 0, 0, uris.fabla2_PadOffGroup, 2 );
+    QUNIT_IS_TRUE( Fabla2DSPTest::inBucket( d, v, 2 ) );
+    d->uiMessage( 0, 0, 0, uris.fabla2_PadOffGroup, 3 );
+    QUNIT_IS_FALSE( Fabla2DSPTest::inBucket( d, v, 2 ) );
+    QUNIT_IS_TRUE( Fabla2DSPTest::inBucket( d, v, 3 ) );
+    
+    // the old group no longer chokes it, the new one does
+    test_note_on( d, 1 );
+    for(int b = 0; b < 16; b++)
+      d->process( 256 );
+    const int kept[] = { 0, 1 };
+    QUNIT_IS_TRUE( test_voice_pads( d, 2, kept ) );
+    
+    test_note_on( d, 2 );
+    for(int b = 0; b < 16; b++)
+      d->process( 256 );
+    const int choked[] = { 1, 2 };
+    QUNIT_IS_TRUE( test_voice_pads( d, 2, choked ) );
+    delete d;
+  }
+}
+
+/// sends a note off on channel 0
+static void test_note_off( Fabla2DSP* d, int note )
+{
+  uint8_t msg[3] = { 0x80, (uint8_t)note, 0 };
+  d->midi( 0, msg );
+}
+
+/// checks a note off stops the voice of its own note: with two notes on one
+/// pad, and after a kit swap to a map that doesn't route the note
+static void test_voice_note_off()
+{
+  URIs uris;
+  std::vector<float> buffers[PORT_COUNT];
+  const float sustain[4] = { 1.f, 1.f, 1.f, 1.f };
+  Fabla2DSP* d = test_dsp( &uris, buffers, 8, 1, sustain );
+  d->getLibrary()->bank( 0 )->pad( 0 )->triggerMode( Pad::TM_GATED );
+  
+  KitState kit;
+  kit.pads[0][0].notes.push_back( 36 );
+  kit.pads[0][0].notes.push_back( 60 );
+  d->getLibrary()->midiMap().build( kit );
+  
+  test_note_on( d, 0 );
+  uint8_t msg[3] = { 0x90, 60, 100 };
+  d->midi( 0, msg );
+  std::vector<Voice*> v = Fabla2DSPTest::active( d );
+  QUNIT_IS_EQUAL( (int)v.size(), 2 );
+  
+  // the second note is released, a repeat of its note off finds no voice
+  test_note_off( d, 60 );
+  test_note_off( d, 60 );
+  for(int b = 0; b < 16; b++)
+    d->process( 256 );
+  std::vector<Voice*> held = Fabla2DSPTest::active( d );
+  QUNIT_IS_EQUAL( (int)held.size(), 1 );
+  QUNIT_IS_TRUE( held.size() == 1 && held[0] == v[0] );
+  
+  // the new kit routes the note nowhere: its note off still stops the voice,
+  // so the old kit can be freed
+  Library* l = new Library( d, 44100 );
+  KitState other;
+  other.pads[0][0].notes.push_back( 40 );
+  l->midiMap().build( other );
+  d->swapLibrary( l );
+  d->process( 256 );
+  QUNIT_IS_TRUE( d->getLibrary() == l );
+  
+  test_note_off( d, 36 );
+  for(int b = 0; b < 16; b++)
+    d->process( 256 );
+  QUNIT_IS_EQUAL( d->activeVoices(), 0 );
+  QUNIT_IS_EQUAL( d->retirePending(), 0 );
+  
+  delete d;
+}
+
+/// checks voices rendered on helper threads mix to the same output as voices
+/// rendered on the audio thread, with notes starting inside blocks
+static void test_render_threads()
+{
+  URIs uris;
+  std::vector<float> serialBuf[PORT_COUNT];
+  std::vector<float> parallelBuf[PORT_COUNT];
+  const float sustain[4] = { 1.f, 0.5f, 0.8f, 0.2f };
+  Fabla2DSP* serial = test_dsp( &uris, serialBuf, 16, 4, sustain );
+  Fabla2DSP* parallel = test_dsp( &uris, parallelBuf, 16, 4, sustain );
+  parallel->renderThreads( 2 );
+  QUNIT_IS_EQUAL( parallel->renderThreads(), 2 );
+  Fabla2DSPTest::noDeadline( parallel );
+  
+  const int nframes = FABLA2_BLOCK_MAX;
+  int same = 1;
+  int voices = 0;
+  for(int b = 0; b < 24; b++)
+  {
+    if( b < 8 )
+    {
+      uint8_t msg[3] = { 0x90, (uint8_t)(36 + b % 4), (uint8_t)(40 + b * 10) };
+      serial->midi( b * 100, msg );
+      parallel->midi( b * 100, msg );
+    }
+    
+    serial->process( nframes );
+    parallel->process( nframes );
+    same = same && memcmp( &serialBuf[OUTPUT_L][0], &parallelBuf[OUTPUT_L][0], sizeof(float) * nframes ) == 0 &&
+                   memcmp( &serialBuf[OUTPUT_R][0], &parallelBuf[OUTPUT_R][0], sizeof(float) * nframes ) == 0;
+    voices = parallel->activeVoices() > voices ? parallel->activeVoices() : voices;
+  }
+  
+  // enough voices played for the helpers to take part
+  QUNIT_IS_TRUE( voices >= FABLA2_RENDER_MIN_VOICES );
+  QUNIT_IS_TRUE( same == 1 );
+  
+  delete serial;
+  delete parallel;
+}
+
+/// checks the streams of voices that stopped no longer point at their Sample:
+/// a retired sample is freed, and the streams are serviced after that
+static void test_stream_retire()
+{
+  URIs uris;
+  std::vector<float> buffers[PORT_COUNT];
+  Fabla2DSP* d = test_dsp( &uris, buffers, 4, 0, 0 );
+  Bank* a = d->getLibrary()->bank( 0 );
+  Sample* s[2];
+  for(int i = 0; i < 2; i++)
+  {
+    s[i] = new Sample( d, 44100, "Test", "test.wav", 1000 );
+    QUNIT_IS_TRUE( s[i]->isStreaming() );
+    a->pad( i )->load( s[i] );
+  }
+  
+  // audition pad 0, and play pad 1 with a short release
+  Voice* audition = Fabla2DSPTest::audition( d );
+  audition->playLayer( a->pad( 0 ), 0 );
+  test_note_on( d, 1 );
+  Voice* v = Fabla2DSPTest::active( d )[0];
+  for(int b = 0; b < 2; b++)
+    d->process( 256 );
+  QUNIT_IS_TRUE( audition->getStream()->getSample() == s[0] );
+  QUNIT_IS_TRUE( v->getStream()->getSample() == s[1] );
+  
+  // the voice released: its stream stops with it
+  uint8_t off[3] = { 0x80, 37, 0 };
+  d->midi( 0, off );
+  for(int b = 0; b < 16; b++)
+    d->process( 256 );
+  QUNIT_IS_EQUAL( d->activeVoices(), 1 );
+  QUNIT_IS_TRUE( v->getStream()->getSample() == 0 );
+  
+  // without a worker, the retired samples are freed by the next process()
+  for(int i = 0; i < 2; i++)
+  {
+    a->pad( i )->remove( s[i] );
+    d->retire( s[i] );
+  }
+  QUNIT_IS_FALSE( audition->active() );
+  QUNIT_IS_TRUE( audition->getStream()->getSample() == 0 );
+  for(int b = 0; b < 4; b++)
+    d->process( 256 );
+  QUNIT_IS_EQUAL( d->retirePending(), 0 );
+  QUNIT_IS_EQUAL( d->activeVoices(), 0 );
+  
+  delete d;
+}
+
+/// checks a swapped in Library brings its engine settings: the RT thread
+/// applies them, and voices that fit the new polyphony keep playing
+static void test_library_settings()
+{
+  URIs uris;
+  std::vector<float> buffers[PORT_COUNT];
+  const float sustain[4] = { 1.f, 1.f, 1.f, 1.f };
+  Fabla2DSP* d = test_dsp( &uris, buffers, 8, 4, sustain );
+  for(int i = 0; i < 8; i++)
+    test_note_on( d, i % 4 );
+  d->process( 256 );
+  QUNIT_IS_EQUAL( d->activeVoices(), 8 );
+  
+  Library* l = new Library( d, 44100 );
+  LibrarySettings& set = l->settings();
+  set.valid           = true;
+  set.polyphony       = 4;
+  set.stealPolicy     = Fabla2DSP::STEAL_QUIETEST;
+  set.renderThreads   = 2;
+  set.streamThreshold = 1000;
+  set.compactSamples  = true;
+  set.sampleRateMode  = SampleBuffer::SAMPLE_RATE_NATIVE;
+  set.auxBusVol[2]    = 0.5f;
+  d->swapLibrary( l );
+  
+  // nothing changes until the swap
+  QUNIT_IS_EQUAL( d->polyphony(), 8 );
+  QUNIT_IS_EQUAL( d->renderThreads(), 0 );
+  
+  d->process( 256 );
+  QUNIT_IS_TRUE( d->getLibrary() == l );
+  QUNIT_IS_EQUAL( d->polyphony(), 4 );
+  QUNIT_IS_EQUAL( d->stealPolicy(), Fabla2DSP::STEAL_QUIETEST );
+  QUNIT_IS_EQUAL( d->renderThreads(), 2 );
+  QUNIT_IS_TRUE( d->compactSamples() );
+  QUNIT_IS_EQUAL( d->sampleRateMode(), SampleBuffer::SAMPLE_RATE_NATIVE );
+  QUNIT_IS_EQUAL( d->auxBusVol[2], 0.5f );
+  QUNIT_IS_TRUE( set.renderPool == 0 );
+  
+  // the voices of the old kit ring out on the first four voices
+  std::vector<Voice*> v = Fabla2DSPTest::active( d );
+  QUNIT_IS_EQUAL( (int)v.size(), 4 );
+  int wrong = 0;
+  for(size_t i = 0; i < v.size(); i++)
+    wrong += !v[i]->active() || v[i]->index >= 4;
+  QUNIT_IS_EQUAL( wrong, 0 );
+  
+  // the old kit is kept while it plays, with the pool that ran before
+  d->panic();
+  for(int b = 0; b < 16; b++)
+    d->process( 256 );
+  QUNIT_IS_EQUAL( d->activeVoices(), 0 );
+  QUNIT_IS_EQUAL( d->retirePending(), 0 );
+  
+  delete d;
+}
+
+/// checks a Library only contains its own pads, and frees the Samples on its
+/// pads with it, as a kit that is swapped out is deleted
+static void test_library()
+{
+  const int before = SamplePool::size();
+  
+  Library* a = new Library( 0, 44100 );
+  Library* b = new Library( 0, 44100 );
+  
+  Pad* pa = a->bank( 2 )->pad( 5 );
+  Pad* pb = b->bank( 2 )->pad( 5 );
+  QUNIT_IS_TRUE( pa != 0 );
+  QUNIT_IS_EQUAL( pa->bank(), 2 );
+  QUNIT_IS_EQUAL( pa->ID(), 5 );
+  QUNIT_IS_TRUE( a->contains( pa ) );
+  QUNIT_IS_FALSE( a->contains( pb ) );
+  QUNIT_IS_TRUE( b->contains( pb ) );
+  QUNIT_IS_TRUE( a->bank( 4 ) == 0 );
+  QUNIT_IS_TRUE( a->bank( 3 )->pad( 16 ) == 0 );
+  
+  // rates no other test uses, so the buffers are only used by these Samples
+  pa->load( new Sample( 0, 11025, "Test", "test.wav" ) );
+  pa->load( new Sample( 0, 32000, "Test", "test.wav" ) );
+  QUNIT_IS_EQUAL( pa->nLayers(), 2 );
+  QUNIT_IS_TRUE( pa->loaded() );
+  QUNIT_IS_EQUAL( SamplePool::size(), before + 2 );
+  
+  delete a;
+  QUNIT_IS_EQUAL( SamplePool::size(), before );
+  delete b;
+}
+
+/// checks the worker only frees what was retired before the index it got, that
+/// a full queue leaves objects with the caller, and that no Sample leaks
+static void test_retire_queue()
+{
+  const long before = Sample::count();
+  
+  RetireQueue* q = new RetireQueue();
+  Sample* a = new Sample( 0, 44100, "Test", "test.wav" );
+  Sample* b = new Sample( 0, 44100, "Test", "test.wav" );
+  QUNIT_IS_EQUAL( Sample::count(), before + 2 );
+  
+  QUNIT_IS_TRUE( q->retire( a ) );
+  const uint64_t upto = q->queued();
+  QUNIT_IS_TRUE( q->retire( b ) );
+  QUNIT_IS_TRUE( q->retire( new Library( 0, 44100 ) ) );
+  QUNIT_IS_EQUAL( q->pending(), 3 );
+  
+  q->reclaim( upto );
+  QUNIT_IS_EQUAL( q->pending(), 2 );
+  QUNIT_IS_EQUAL( Sample::count(), before + 1 );
+  q->reclaim( q->queued() );
+  QUNIT_IS_EQUAL( q->pending(), 0 );
+  QUNIT_IS_EQUAL( Sample::count(), before );
+  
+  // a full queue refuses more, until the worker freed some
+  int queued = 0;
+  for(int i = 0; i < FABLA2_RETIRE_QUEUE_SIZE + 1; i++)
+  {
+    Sample* s = new Sample( 0, 44100, "Test", "test.wav" );
+    if( q->retire( s ) )
+      queued++;
+    else
+      delete s;
+  }
+  QUNIT_IS_EQUAL( queued, FABLA2_RETIRE_QUEUE_SIZE );
+  q->reclaim( q->queued() - 1 );
+  Sample* last = new Sample( 0, 44100, "Test", "test.wav" );
+  QUNIT_IS_TRUE( q->retire( last ) );
+  QUNIT_IS_EQUAL( q->pending(), 2 );
+  
+  // the queue frees what is left with it
+  delete q;
+  QUNIT_IS_EQUAL( Sample::count(), before );
+}
+
+/// checks messages come out of the RtLog in order, that a call site is rate
+/// limited per window, and that a full ring drops messages and counts them
+static void test_rt_log()
+{
+  RtLog* log = new RtLog();
+  RtLogSite a;
+  RtLogSite b;
+  int  level = -1;
+  char text[FABLA2_RT_LOG_LINE];
+  
+  QUNIT_IS_FALSE( log->read( level, text, FABLA2_RT_LOG_LINE ) );
+  QUNIT_IS_TRUE( log->write( a, RT_LOG_ERROR, "voice %i", 3 ) );
+  QUNIT_IS_TRUE( log->write( b, RT_LOG_TRACE, "%s done", "pad" ) );
+  QUNIT_IS_EQUAL( log->written(), 2 );
+  
+  QUNIT_IS_TRUE( log->read( level, text, FABLA2_RT_LOG_LINE ) );
+  QUNIT_IS_EQUAL( level, RT_LOG_ERROR );
+  QUNIT_IS_EQUAL( strcmp( text, "voice 3" ), 0 );
+  QUNIT_IS_TRUE( log->read( level, text, 6 ) );
+  QUNIT_IS_EQUAL( level, RT_LOG_TRACE );
+  QUNIT_IS_EQUAL( strcmp( text, "pad d" ), 0 );
+  QUNIT_IS_FALSE( log->read( level, text, FABLA2_RT_LOG_LINE ) );
+  
+  // a site that logs every block is cut off after a burst...
+  RtLogSite c;
+  int accepted = 0;
+  for(int i = 0; i < 10; i++)
+    accepted += log->write( c, RT_LOG_WARNING, "click" );
+  QUNIT_IS_EQUAL( accepted, FABLA2_RT_LOG_BURST );
+  while( log->read( level, text, FABLA2_RT_LOG_LINE ) ) {}
+  
+  // ...and reports what it suppressed in the next window
+  for(int i = 0; i < FABLA2_RT_LOG_WINDOW; i++)
+    log->tick();
+  QUNIT_IS_TRUE( log->write( c, RT_LOG_WARNING, "click" ) );
+  QUNIT_IS_TRUE( log->read( level, text, FABLA2_RT_LOG_LINE ) );
+  QUNIT_IS_EQUAL( strcmp( text, "(6 similar suppressed) click" ), 0 );
+  
+  // a full ring drops messages, until the reader made space
+  RtLogSite sites[FABLA2_RT_LOG_SIZE + 1];
+  accepted = 0;
+  for(int i = 0; i < FABLA2_RT_LOG_SIZE + 1; i++)
+    accepted += log->write( sites[i], RT_LOG_NOTE, "site %i", i );
+  QUNIT_IS_EQUAL( accepted, FABLA2_RT_LOG_SIZE );
+  QUNIT_IS_EQUAL( log->takeDropped(), 1 );
+  QUNIT_IS_EQUAL( log->takeDropped(), 0 );
+  QUNIT_IS_TRUE( log->read( level, text, FABLA2_RT_LOG_LINE ) );
+  QUNIT_IS_EQUAL( strcmp( text, "site 0" ), 0 );
+  QUNIT_IS_TRUE( log->write( sites[FABLA2_RT_LOG_SIZE], RT_LOG_NOTE, "last" ) );
+  
+  delete log;
+}
+
+/// checks a summary is made once per second of audio, and that a block that
+/// takes longer than its budget shows up as an overrun
+static void test_telemetry()
+{
+  // 100 blocks of 10 ms per second
+  Telemetry* t = new Telemetry( 10000 );
+  const Telemetry::Summary& s = t->summary();
+  
+  // blocks that weren't started are ignored
+  QUNIT_IS_FALSE( t->blockEnd( 100, 1 ) );
+  
+  int summaries = 0;
+  int summaryAt = -1;
+  for(int i = 0; i < 100; i++)
+  {
+    t->blockStart();
+    t->add( Telemetry::STAGE_FILTER, 2000 );
+    if( i == 10 )
+      usleep( 15000 );
+    t->stage( Telemetry::STAGE_RENDER );
+    if( t->blockEnd( 100, i % 4 ) )
+    {
+      summaries++;
+      summaryAt = i;
+    }
+  }
+  QUNIT_IS_EQUAL( summaries, 1 );
+  QUNIT_IS_EQUAL( summaryAt, 99 );
+  
+  QUNIT_IS_EQUAL( s.blocks, 100 );
+  QUNIT_IS_EQUAL( s.overruns, 1 );
+  QUNIT_IS_TRUE( s.loadWorst > 1 );
+  QUNIT_IS_TRUE( s.load < 1 );
+  QUNIT_IS_EQUAL( s.voicesMax, 3 );
+  QUNIT_IS_TRUE( fabsf( s.voices - 1.5 ) < 0.001 );
+  QUNIT_IS_TRUE( fabsf( s.stageUs[Telemetry::STAGE_FILTER] - 2 ) < 0.001 );
+  QUNIT_IS_TRUE( s.stageWorstUs[Telemetry::STAGE_RENDER] >= 15000 );
+  QUNIT_IS_TRUE( s.stageWorstUs[Telemetry::STAGE_BLOCK] >= s.stageWorstUs[Telemetry::STAGE_RENDER] );
+  QUNIT_IS_EQUAL( s.histogram[FABLA2_TELEMETRY_BUCKETS-1], 1 );
+  
+  int total = 0;
+  for(int i = 0; i < FABLA2_TELEMETRY_BUCKETS; i++)
+    total += s.histogram[i];
+  QUNIT_IS_EQUAL( total, 100 );
+  QUNIT_IS_EQUAL( t->histogram( FABLA2_TELEMETRY_BUCKETS-1 ), 1 );
+  
+  // the next second starts from scratch
+  t->blockStart();
+  t->blockEnd( 100, 0 );
+  QUNIT_IS_EQUAL( s.blocks, 100 );
+  
+  delete t;
+}
+
+static LV2_URID test_capture_map( LV2_URID_Map_Handle h, const char* uri )
+{
+  std::map<std::string, LV2_URID>* uris = (std::map<std::string, LV2_URID>*)h;
+  LV2_URID& id = (*uris)[uri];
+  if( !id )
+    id = uris->size() + 100;
+  return id;
+}
+
+static void test_capture()
+{
+  const char* path = "test_capture.trace";
+  std::map<std::string, LV2_URID> hostUris;
+  LV2_URID_Map hostMap = { &hostUris, test_capture_map };
+  
+  std::vector<float> buffers[PORT_COUNT];
+  float* ports[PORT_COUNT];
+  for(int i = 0; i < PORT_COUNT; i++)
+  {
+    buffers[i].resize( 64, 0.f );
+    ports[i] = &buffers[i][0];
+  }
+  for(int i = MASTER_VOL; i < PORT_COUNT; i++)
+    *ports[i] = i * 0.5f;
+  for(int i = 0; i < 64; i++)
+  {
+    ports[INPUT_L][i]  = i;
+    ports[INPUT_R][i]  = -i;
+    ports[OUTPUT_L][i] = i * 0.25f;
+  }
+  
+  // a sequence with one MIDI event
+  uint8_t seqData[64];
+  memset( seqData, 0, sizeof(seqData) );
+  LV2_Atom_Sequence* seq = (LV2_Atom_Sequence*)seqData;
+  LV2_Atom_Event* ev = (LV2_Atom_Event*)( seq + 1 );
+  ev->time.frames = 17;
+  ev->body.size = 3;
+  uint8_t* msg = (uint8_t*)( ev + 1 );
+  msg[0] = 0x90;
+  msg[1] = 36;
+  msg[2] = 100;
+  seq->atom.size = sizeof(LV2_Atom_Sequence_Body) + lv2_atom_pad_size( sizeof(LV2_Atom_Event) + 3 );
+  
+  uint64_t hash0 = 0;
+  {
+    Capture c( path, 44100, &hostMap );
+    QUNIT_IS_TRUE( c.ok() );
+    LV2_URID midi = c.map()->map( c.map()->handle, LV2_MIDI__MidiEvent );
+    ev->body.type = midi;
+    c.start();
+    
+    // without recording, no input audio
+    *ports[RECORD_OVER_LAST_PLAYED_PAD] = 0;
+    c.block( 64, seq, ports );
+    hash0 = Capture::hash( 64, ports[OUTPUT_L], ports[OUTPUT_R] );
+    c.blockEnd( 64, ports, 0 );
+    
+    *ports[RECORD_OVER_LAST_PLAYED_PAD] = 1;
+    c.response();
+    c.response();
+    c.block( 32, 0, ports );
+    ports[OUTPUT_R][0] = 1;
+    c.blockEnd( 32, ports, 1234 );
+  }
+  
+  CaptureReader r;
+  QUNIT_IS_TRUE( r.open( path ) );
+  QUNIT_IS_EQUAL( r.rate(), 44100 );
+  QUNIT_IS_EQUAL( r.uris().size(), 1 );
+  QUNIT_IS_EQUAL( r.uris().find( LV2_MIDI__MidiEvent )->second, ev->body.type );
+  
+  CaptureReader::Block b;
+  QUNIT_IS_TRUE( r.next( b ) );
+  QUNIT_IS_EQUAL( b.nframes, 64 );
+  QUNIT_IS_EQUAL( b.responses, 0 );
+  QUNIT_IS_EQUAL( b.controls[0], MASTER_VOL * 0.5f );
+  QUNIT_IS_EQUAL( b.controls[RECORD_OVER_LAST_PLAYED_PAD - MASTER_VOL], 0 );
+  QUNIT_IS_EQUAL( b.events.size(), seq->atom.size - sizeof(LV2_Atom_Sequence_Body) );
+  QUNIT_IS_TRUE( !memcmp( &b.events[0], ev, b.events.size() ) );
+  QUNIT_IS_TRUE( b.inL.empty() );
+  QUNIT_IS_TRUE( b.hash == hash0 );
+  QUNIT_IS_TRUE( b.kitFingerprint == 0 );
+  
+  QUNIT_IS_TRUE( r.next( b ) );
+  QUNIT_IS_EQUAL( b.nframes, 32 );
+  QUNIT_IS_EQUAL( b.responses, 2 );
+  QUNIT_IS_TRUE( b.events.empty() );
+  QUNIT_IS_EQUAL( b.inL.size(), 32 );
+  QUNIT_IS_EQUAL( b.inL[31], 31 );
+  QUNIT_IS_EQUAL( b.inR[31], -31 );
+  QUNIT_IS_TRUE( b.hash == Capture::hash( 32, ports[OUTPUT_L], ports[OUTPUT_R] ) );
+  QUNIT_IS_TRUE( b.hash != hash0 );
+  QUNIT_IS_TRUE( b.kitFingerprint == 1234 );
+  
+  QUNIT_IS_FALSE( r.next( b ) );
+  QUNIT_IS_EQUAL( r.end(), Capture::END_STOPPED );
+  
+  r.rewind();
+  QUNIT_IS_TRUE( r.next( b ) );
+  QUNIT_IS_EQUAL( b.nframes, 64 );
+  
+  unlink( path );
+}
+
+int main()
+{
+  printf("Fabla Testing Suite: %s\n", FABLA2_VERSION_STRING );
+
+  test_hermite_kernels();
+  test_hermite_pcm();
+  test_adsr_block();
+  test_mix_routes();
+  test_filter_svf();
+  test_filter_svf_stereo();
+  test_sampler();
+  test_sampler_budget();
+  test_sampler_stream();
+  test_sample_pool();
+  test_sample_compact();
+  test_sample_rate();
+  test_sample_cache();
+  test_sample_save();
+  test_kit_state();
+  test_midi_map();
+  test_voice_steal();
+  test_voice_groups();
+  test_voice_note_off();
+  test_render_threads();
+  test_stream_retire();
+  test_library_settings();
+  test_library();
+  test_retire_queue();
+  test_rt_log();
+  test_telemetry();
+  test_capture();
+
+  return qunit.errors();
 }
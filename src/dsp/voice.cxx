@@ -25,12 +25,15 @@
 #include <stdio.h>
 
 #include "fabla2.hxx"
+#include "rt_log.hxx"
+#include "telemetry.hxx"
 
 #include "pad.hxx"
 #include "sample.hxx"
 #include "sampler.hxx"
 
 #include "dsp_adsr.hxx"
+#include "dsp_mix.hxx"
 #include "dsp_filters_svf.hxx"
 
 #include "plotter.hxx"
@@ -38,23 +41,35 @@
 namespace Fabla2
 {
 
-int Voice::privateID = 0;
+std::atomic<int> Voice::privateID( 0 );
 
 Voice::Voice( Fabla2DSP* d, int r ) :
   ID( privateID++ ),
   dsp( d ),
+  rtLog( d ? d->rtLog() : 0 ),
   sr ( r ),
+  activeNext( 0 ),
+  activePrev( 0 ),
+  index( -1 ),
+  rendering( false ),
   pad_( 0 ),
+  activeCountdown( 0 ),
   active_( false ),
+  filterNs( 0 ),
+  mixPending_( false ),
+  nRoutes( 0 ),
   bankInt_( -1 ),
-  padInt_( -1 )
+  padInt_( -1 ),
+  channel_( -1 ),
+  note_( -1 )
 {
   adsr = new ADSR();
   sampler = new Sampler( d, r );
-  filterL = new FiltersSVF( r );
-  filterR = new FiltersSVF( r );
+  filter = new FiltersSVFStereo( r );
   
-  voiceBuffer.resize( 2048 );
+  // stereo interleaved, and the envelope of each frame
+  voiceBuffer.resize( FABLA2_BLOCK_MAX * 2 );
+  adsrBuffer.resize( FABLA2_BLOCK_MAX );
   
   adsr->setAttackRate  ( 0.001 * r );
   adsr->setDecayRate   ( 0.25 * r );
@@ -65,11 +80,31 @@ Voice::Voice( Fabla2DSP* d, int r ) :
   adsrOffCounter = releaseSamps;
 }
 
+float Voice::level()
+{
+  return adsr->getOutput();
+}
+
+void Voice::setStream( SampleStream* s )
+{
+  sampler->setStream( s );
+}
+
+SampleStream* Voice::getStream()
+{
+  return sampler->getStream();
+}
+
 bool Voice::matches( int bank, int pad )
 {
   return ( bank == bankInt_ && pad == padInt_ );
 }
 
+bool Voice::matchesNote( int channel, int note )
+{
+  return ( note_ != -1 && channel == channel_ && note == note_ );
+}
+
 void Voice::playLayer( Pad* p, int layer )
 {
   assert( p );
@@ -86,7 +121,7 @@ void Voice::playLayer( Pad* p, int layer )
   }
   else
   {
-    printf("Voice::playLayer() %i, sampler->play() returns NULL sample! Setting active to false\n", ID );
+    FABLA2_RT_LOG( rtLog, RT_LOG_WARNING, "Voice::playLayer() %i, sampler->play() returns NULL sample! Setting active to false\n", ID );
     // *hard* set the sample to not play: we don't have a sample!
     active_ = false;
     return;
@@ -107,8 +142,8 @@ void Voice::playLayer( Pad* p, int layer )
   else
     filterType = 0; // lowpass default
   
-  filterL->setType( filterType );
-  filterR->setType( filterType );
+  filter->setType( filterType );
+  filter->reset();
   
   // ADSR: add *minimal* attack / release to avoid clicks
   adsr->setAttackRate  ( (0.001+s->attack) * sr );
@@ -121,7 +156,8 @@ void Voice::playLayer( Pad* p, int layer )
   adsr->gate( true );
 }
 
-void Voice::play( int time, int bankInt, int padInt, Pad* p, float velocity )
+void Voice::play( int time, int bankInt, int padInt, Pad* p, float velocity,
+                  int channel, int note )
 {
   assert( p );
   
@@ -129,6 +165,10 @@ void Voice::play( int time, int bankInt, int padInt, Pad* p, float velocity )
   bankInt_ = bankInt;
   padInt_ = padInt;
   
+  // the note off of the note stops this voice
+  channel_ = channel;
+  note_ = note;
+  
   pad_ = p;
   
   active_ = true;
@@ -150,8 +190,10 @@ void Voice::play( int time, int bankInt, int padInt, Pad* p, float velocity )
     printf("Voice::play() %i, sampler->play() returns NULL sample! \
         Setting active to false\n", ID );
 #endif
-    // *hard* set the sample to not play: we don't have a sample!
+    // *hard* set the sample to not play: we don't have a sample! The voice
+    // stays linked until process(), so it keeps its pad
     active_ = false;
+    sampler->stop();
     return;
   }
   
@@ -170,8 +212,8 @@ void Voice::play( int time, int bankInt, int padInt, Pad* p, float velocity )
   else
     filterActive_ = false; // default: off
   
-  filterL->setType( filterType );
-  filterR->setType( filterType );
+  filter->setType( filterType );
+  filter->reset();
   
   // ADSR: add *minimal* attack / release to avoid clicks
   int attackSamps  = (0.005+s->attack ) * sr;
@@ -189,11 +231,11 @@ void Voice::play( int time, int bankInt, int padInt, Pad* p, float velocity )
     if( releaseSamps < 0.05 * sr )
     {
       releaseSamps = 0.05 * sr;
-      printf("too long: clipped release to %i : NOT OK YET\n", releaseSamps);
+      FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "too long: clipped release to %i : NOT OK YET\n", releaseSamps );
     }
     else
     {
-      printf("too long: clipped release to %i : now OK\n", releaseSamps);
+      FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "too long: clipped release to %i : now OK\n", releaseSamps );
     }
   }
   
@@ -206,11 +248,11 @@ void Voice::play( int time, int bankInt, int padInt, Pad* p, float velocity )
     if( decaySamps < 0.005 * sr )
     {
       decaySamps = 0.005 * sr;
-      printf("too long: clipped decay to %i : NOT OK YET\n", decaySamps);
+      FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "too long: clipped decay to %i : NOT OK YET\n", decaySamps );
     }
     else
     {
-      printf("too long: clipped decay to %i : now OK\n", decaySamps);
+      FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "too long: clipped decay to %i : now OK\n", decaySamps );
     }
   }
   
@@ -223,11 +265,11 @@ void Voice::play( int time, int bankInt, int padInt, Pad* p, float velocity )
     if( attackSamps < 0.005 * sr )
     {
       attackSamps = 0.005 * sr;
-      printf("too long: clipped attack to %i : NOT OK YET\n", attackSamps);
+      FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "too long: clipped attack to %i : NOT OK YET\n", attackSamps );
     }
     else
     {
-      printf("too long: clipped attack to %i : now OK\n", attackSamps);
+      FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "too long: clipped attack to %i : now OK\n", attackSamps );
     }
   }
   
@@ -287,7 +329,7 @@ void Voice::play( int time, int bankInt, int padInt, Pad* p, float velocity )
   
   
   adsrOffCounter = releaseSamps;
-  printf("voice playing with start-end %i,  adsrOffCounter %i\n", totalSamps, adsrOffCounter );
+  FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "voice playing with start-end %i,  adsrOffCounter %i\n", totalSamps, adsrOffCounter );
   
   adsr->setAttackRate  ( attackSamps );
   adsr->setDecayRate   ( decaySamps  );
@@ -328,11 +370,14 @@ void Voice::stopIfSample( Sample* s )
   {
     //printf("Voice::stopIfSample() %s : KILLED VOICE.\n", s->getName() );
     active_ = false;
+    sampler->stop();
   }
 }
 
 void Voice::stop()
 {
+  note_ = -1;
+  
   if( active_ )
   {
     if ( pad_->triggerMode() == Pad::TM_GATED )
@@ -347,8 +392,39 @@ void Voice::stop()
   }
 }
 
+void Voice::updateRoutes( int offset )
+{
+  nRoutes = 0;
+  
+  MixRoute& master = routes[nRoutes++];
+  master.L    = &dsp->controlPorts[OUTPUT_L][offset];
+  master.R    = &dsp->controlPorts[OUTPUT_R][offset];
+  master.gain = 1.f;
+  
+  // aux bus outputs are only written when the host connected them
+  if( !dsp->auxbusEnabled() )
+    return;
+  
+  for(int i = 0; i < 4; i++)
+  {
+    MixRoute& aux = routes[nRoutes++];
+    aux.L    = &dsp->controlPorts[AUXBUS1_L + i * 2][offset];
+    aux.R    = &dsp->controlPorts[AUXBUS1_R + i * 2][offset];
+    aux.gain = pad_->sends[i] * dsp->auxBusVol[i];
+  }
+}
+
 void Voice::process()
 {
+  render();
+  mix();
+}
+
+void Voice::render()
+{
+  mixPending_ = false;
+  filterNs = 0;
+  
   if( !active_ )
   {
     return;
@@ -358,7 +434,7 @@ void Voice::process()
   if( activeCountdown )
   {
     nframes = nframes - activeCountdown;
-    printf("process() with activeCountdown = %i\n", activeCountdown ); 
+    FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "process() with activeCountdown = %i\n", activeCountdown );
   }
   
   // check if we need to trigger ADSR off
@@ -366,7 +442,7 @@ void Voice::process()
   {
     if( adsr->getState() != ADSR::ENV_RELEASE )
     {
-      printf("remaining frames + nframes < adsrOffCounter : ADSR OFF\n");
+      FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "remaining frames + nframes < adsrOffCounter : ADSR OFF\n" );
       adsr->gate( false );
     }
   }
@@ -375,102 +451,99 @@ void Voice::process()
       &voiceBuffer[0+activeCountdown],
       &voiceBuffer[dsp->nframes+activeCountdown] );
   
-  float adsrVal = adsr->process();
+  // render the envelope for the whole block, it is applied when mixing
+  adsr->processBlock( &adsrBuffer[activeCountdown], nframes );
   
   /// set filter state
   Sample* s = sampler->getSample();
   
   if( !s )
   {
-    printf("Fabla2 DSP: Voice process() with invalid Sample* : WARNING!");
+    FABLA2_RT_LOG( rtLog, RT_LOG_WARNING, "Fabla2 DSP: Voice process() with invalid Sample*\n" );
   }
   
-  if( done || adsr->getState() == ADSR::ENV_IDLE )
+  if( done )
   {
-    printf("Voice done\n");
-    active_ = false;
-    pad_ = 0;
+    FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "Voice done\n" );
+    finish();
     return;
   }
   
   // filter details setup in play()
   if( filterActive_ )
   {
-    filterL->setResonance( ( s->filterResonance) );
-    filterR->setResonance( ( s->filterResonance) );
+    const uint64_t start = Telemetry::now();
+    filter->setResonance( ( s->filterResonance) );
+    filter->setValue( ( s->filterFrequency + 0.3) );
     
-    filterL->setValue( ( s->filterFrequency + 0.3) );
-    filterR->setValue( ( s->filterFrequency + 0.3) );
-    
-    filterL->process( nframes,
+    filter->process( nframes,
         &voiceBuffer[0+activeCountdown],
-        &voiceBuffer[0+activeCountdown] );
-    
-    filterR->process( nframes,
         &voiceBuffer[dsp->nframes+activeCountdown],
+        &voiceBuffer[0+activeCountdown],
         &voiceBuffer[dsp->nframes+activeCountdown] );
+    filterNs = Telemetry::now() - start;
   }
   
-  float* outL = dsp->controlPorts[OUTPUT_L];
-  float* outR = dsp->controlPorts[OUTPUT_R];
-  
-  float aux1s = pad_->sends[0] * dsp->auxBusVol[0];
-  float* aux1L = dsp->controlPorts[AUXBUS1_L];
-  float* aux1R = dsp->controlPorts[AUXBUS1_R];
+  // apply the envelope, the voice buffer is then ready to be mixed
+  mix_apply_gain( &adsrBuffer[activeCountdown], nframes,
+                  &voiceBuffer[0+activeCountdown],
+                  &voiceBuffer[dsp->nframes+activeCountdown] );
   
-  float aux2s = pad_->sends[1] * dsp->auxBusVol[1];
-  float* aux2L = dsp->controlPorts[AUXBUS2_L];
-  float* aux2R = dsp->controlPorts[AUXBUS2_R];
-  
-  float aux3s = pad_->sends[2] * dsp->auxBusVol[2];
-  float* aux3L = dsp->controlPorts[AUXBUS3_L];
-  float* aux3R = dsp->controlPorts[AUXBUS3_R];
-  
-  float aux4s = pad_->sends[3] * dsp->auxBusVol[3];
-  float* aux4L = dsp->controlPorts[AUXBUS4_L];
-  float* aux4R = dsp->controlPorts[AUXBUS4_R];
-  
-  for(int i = activeCountdown; i < dsp->nframes; i++ )
+  updateRoutes( activeCountdown );
+  mixPending_ = true;
+}
+
+void Voice::discard()
+{
+  mixPending_ = false;
+  activeCountdown = 0;
+  finish();
+}
+
+void Voice::mix()
+{
+  if( !mixPending_ )
   {
-    float pfL = voiceBuffer[             i] * adsrVal;
-    float pfR = voiceBuffer[dsp->nframes+i] * adsrVal;
-    
-    aux1L[i] += pfL * aux1s;
-    aux1R[i] += pfR * aux1s;
-    
-    aux2L[i] += pfL * aux2s;
-    aux2R[i] += pfR * aux2s;
-    
-    aux3L[i] += pfL * aux3s;
-    aux3R[i] += pfR * aux3s;
-    
-    aux4L[i] += pfL * aux4s;
-    aux4R[i] += pfR * aux4s;
-    
-    outL[i] += pfL;
-    outR[i] += pfR;
-    
-    // ADSR processes first sample *before* the filter set section.
-    adsrVal = adsr->process();
+    return;
   }
+  mixPending_ = false;
   
+  // accumulate the voice into each bus it is routed to
+  mix_routes( &voiceBuffer[0+activeCountdown],
+              &voiceBuffer[dsp->nframes+activeCountdown],
+              dsp->nframes - activeCountdown, routes, nRoutes );
   
+#ifdef FABLA2_COMPONENT_TEST
   // for testing sample-accurate voice note-on
   if( activeCountdown )
   {
     Plotter::plot( "active.dat", dsp->nframes, dsp->controlPorts[OUTPUT_L] );
   }
+#endif
   
   
   activeCountdown = 0;
+  
+  // the release finished during this block: its tail has been mixed above
+  if( adsr->getState() == ADSR::ENV_IDLE )
+  {
+    FABLA2_RT_LOG( rtLog, RT_LOG_TRACE, "Voice done\n" );
+    finish();
+  }
+}
+
+void Voice::finish()
+{
+  active_ = false;
+  pad_ = 0;
+  sampler->stop();
 }
 
 Voice::~Voice()
 {
   delete adsr;
   delete sampler;
-  delete filterL;
-  delete filterR;
+  delete filter;
 }
 
 
@@ -22,9 +22,13 @@
 #define OPENAV_FABLA2_VOICE_HXX
 
 #include "dsp_adsr.hxx"
+#include "dsp_mix.hxx"
 
+#include <atomic>
 #include <vector>
 
+#include <stdint.h>
+
 namespace Fabla2
 {
 
@@ -32,9 +36,11 @@ class Pad;
 class FxUnit;
 class Sample;
 class Sampler;
-class FiltersSVF;
+class SampleStream;
+class FiltersSVFStereo;
 
 class Fabla2DSP;
+class RtLog;
 
 /** Voice
  * The Voice class is a currently active sound-sample / synth object that is
@@ -55,11 +61,18 @@ class Voice
     
     bool active(){return active_;}
     
-    /// start playing a sample on this voice
-    void play( int time, int bank, int pad, Pad*, float velocity );
+    /// start playing a sample on this voice, for the MIDI note on channel.
+    /// A voice without a note never matches a note off
+    void play( int time, int bank, int pad, Pad*, float velocity,
+               int channel = -1, int note = -1 );
     
+    /// releases the voice, and its note: later note offs of the note are for
+    /// other voices
     void stop();
     void stopIfSample( Sample* s );
+    /// stops playing at once, without a release: the voice is inactive, and
+    /// its stream stopped
+    void finish();
     
     /// used to audition samples from UI
     void playLayer( Pad* p, int layer );
@@ -68,23 +81,58 @@ class Voice
     /// audio buffers etc from there: no need to pass them around.
     void process();
     
+    /// process() in two steps. render() produces the voice audio in the voice
+    /// buffer and only touches this voice, so voices can render in parallel.
+    /// mix() adds it to the output buses, and must be called in a fixed voice
+    /// order from one thread so the output is deterministic.
+    void render();
+    void mix();
+    /// drops the audio of a render() that wasn't mixed, as its block has
+    /// been played already, and stops the voice at once
+    void discard();
+    /// the time the last render() spent in the filter, in nanoseconds
+    uint64_t filterTime(){return filterNs;}
+    
     /// checks if the bank/pad match to that which the voice was play()-ed with.
     /// Useful for mute-groups and note-off events
     bool matches( int bank, int pad );
+    /// checks if the voice plays the note on channel, and has not been
+    /// released. Note offs use this, so they find their voice whatever the
+    /// MIDI map of the current kit is
+    bool matchesNote( int channel, int note );
     
     Pad* getPad(){return pad_;}
     
     float* getVoiceBuffer(){return &voiceBuffer[0];}
+    
+    /// the current envelope level, used to find the quietest voice to steal
+    float level();
+    
+    /// the stream for samples that play from disk, owned by Fabla2DSP
+    void          setStream( SampleStream* s );
+    SampleStream* getStream();
+    
+    /// links in the Fabla2DSP active voice list, owned by Fabla2DSP
+    Voice* activeNext;
+    Voice* activePrev;
+    /// position in the Fabla2DSP voice pool, -1 for the audition voice
+    int index;
+    /// set while a RenderPool thread may render the voice: no other thread
+    /// touches it until the render thread clears it
+    std::atomic<bool> rendering;
   
   private:
-    static int privateID;
+    static std::atomic<int> privateID;
     int ID;
     
     Fabla2DSP* dsp;
+    RtLog* rtLog;
     int sr;
     
     int bankInt_;
     int padInt_;
+    int channel_;
+    int note_;
     Pad* pad_;
     
     /// a counter to count down frames until note-on event
@@ -95,13 +143,23 @@ class Voice
     
     bool active_;
     bool filterActive_;
+    uint64_t filterNs;
+    /// true when render() left audio in voiceBuffer for mix() to output
+    bool mixPending_;
     
     ADSR*       adsr;
     Sampler*    sampler;
-    FiltersSVF* filterL;
-    FiltersSVF* filterR;
+    FiltersSVFStereo* filter;
+    
+    /// the buses this voice is mixed into, and the gain for each bus
+    MixRoute routes[FABLA2_MIX_ROUTES_MAX];
+    int nRoutes;
+    /// fills in routes with the master and aux bus buffers from offset
+    void updateRoutes( int offset );
     
     std::vector<float> voiceBuffer;
+    /// ADSR envelope for the current block, applied when mixing the voice
+    std::vector<float> adsrBuffer;
     
 };
 
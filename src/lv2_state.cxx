@@ -20,18 +20,25 @@
 
 #include "lv2_state.hxx"
 
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
+#include <vector>
 #include <sstream>
 #include <assert.h>
 
 #include "dsp.hxx"
-#include "picojson.hxx"
 
 #include "dsp/fabla2.hxx"
 #include "dsp/pad.hxx"
 #include "dsp/bank.hxx"
 #include "dsp/sample.hxx"
 #include "dsp/library.hxx"
+#include "dsp/kit_state.hxx"
+
+/// most threads that decode samples in parallel during restore
+#define FABLA2_RESTORE_THREADS_MAX 8
 
 using namespace Fabla2;
 
@@ -73,104 +80,114 @@ fabla2_save(LV2_Handle                 instance,
     return LV2_STATE_ERR_NO_FEATURE;
   }
   
-  Library* library = self->dsp->getLibrary();
+  // a kit restored before the RT thread swapped it in is saved as restored
+  Library* library = self->dsp->getLatestLibrary();
+  
+  KitState kit;
   
-  picojson::object pjAll;
+  // counts of the Sample::SAVE_RESULT of each layer
+  int saveResults[Sample::SAVE_FAILED + 1] = { 0 };
   
   for(int i = 0; i < 4; i++ )
   {
-    picojson::object pjBank;
-    
     Bank* bank = library->bank( i );
     
-    /// write Bank specific stuff
-    // Is there any? Keep "bank" concept anyway, for loading banks seperate
-    // from an entire session.
-    
-    pjBank["name"]      = picojson::value( "bank name test" );
-    pjBank["auxbus1vol"]= picojson::value( self->dsp->auxBusVol[0] );
-    pjBank["auxbus2vol"]= picojson::value( self->dsp->auxBusVol[1] );
-    pjBank["auxbus3vol"]= picojson::value( self->dsp->auxBusVol[2] );
-    pjBank["auxbus4vol"]= picojson::value( self->dsp->auxBusVol[3] );
-    
     for(int p = 0; p < 16; p++ )
     {
-      picojson::object pjPad;
-      
       Pad* pad = bank->pad( p );
+      PadState& padState = kit.pads[i][p];
       
       /// write Pad specific things
-      pjPad["muteGroup"]     = picojson::value( (double)pad->muteGroup() );
-      pjPad["offGroup"]      = picojson::value( (double)pad->offGroup() );
-      pjPad["triggerMode"]   = picojson::value( (double)pad->triggerMode() );
-      pjPad["switchMode"]    = picojson::value( (double)pad->switchSystem() );
-      pjPad["volume"]        = picojson::value( (double)pad->volume );
-      
-      pjPad["auxbus1"]        = picojson::value( (double)pad->sends[0] );
-      pjPad["auxbus2"]        = picojson::value( (double)pad->sends[1] );
-      pjPad["auxbus3"]        = picojson::value( (double)pad->sends[2] );
-      pjPad["auxbus4"]        = picojson::value( (double)pad->sends[3] );
-      
-      pjPad["nLayers"]    = picojson::value( (double)pad->nLayers() );
+      padState.valid       = true;
+      padState.muteGroup   = pad->muteGroup();
+      padState.offGroup    = pad->offGroup();
+      padState.triggerMode = pad->triggerMode();
+      padState.switchMode  = pad->switchSystem();
+      padState.volume      = pad->volume;
+      for(int a = 0; a < 4; a++)
+        padState.sends[a] = pad->sends[a];
       
+      padState.layers.resize( pad->nLayers() );
       for(int l = 0; l < pad->nLayers(); l++ )
       {
-        picojson::object pjLayer;
+        LayerState& layer = padState.layers[l];
         Sample* s = pad->layer( l );
         
         /// write Layer / Sample specific things
-        pjLayer["name"            ] = picojson::value( s->getName() );
+        layer.name = s->getName();
         
         // save Sample audio data as <pad_num>_<layer_num>.wav
         std::stringstream padName;
         padName << "pad" << p << "_layer" << l << ".wav";
+        // only written if the audio changed since the file was saved or loaded
         char* savePath = make_path->path(make_path->handle, padName.str().c_str() );
-        s->write( savePath );
+        saveResults[ s->save( savePath ) ]++;
         free( savePath );
-        // write the portable <padX_layerY.wav> form to the JSON
-        pjLayer["filename"        ] = picojson::value( padName.str().c_str() );
-        
-        pjLayer["gain"            ] = picojson::value( (double)s->gain );
-        pjLayer["pan"             ] = picojson::value( (double)s->pan );
-        
-        pjLayer["pitch"           ] = picojson::value( (double)s->pitch );
-        pjLayer["time"            ] = picojson::value( (double)s->time );
-        
-        pjLayer["startPoint"      ] = picojson::value( (double)s->startPoint );
-        pjLayer["endPoint"        ] = picojson::value( (double)s->endPoint );
+        // write the portable <padX_layerY.wav> form to the state
+        layer.filename = padName.str();
         
-        pjLayer["filterType"      ] = picojson::value( (double)s->filterType );
-        pjLayer["filterFrequency" ] = picojson::value( (double)s->filterFrequency );
-        pjLayer["filterResonance" ] = picojson::value( (double)s->filterResonance );
-        
-        pjLayer["velLow"          ] = picojson::value( (double)s->velLow );
-        pjLayer["velHigh"         ] = picojson::value( (double)s->velHigh );
-        
-        pjLayer["attack"          ] = picojson::value( (double)s->attack );
-        pjLayer["decay"           ] = picojson::value( (double)s->decay );
-        pjLayer["sustain"         ] = picojson::value( (double)s->sustain );
-        pjLayer["release"         ] = picojson::value( (double)s->release );
-        
-        std::stringstream layer;
-        layer << "layer_" << l;
-        pjPad[ layer.str() ] = picojson::value( pjLayer );
+        layer.gain            = s->gain;
+        layer.pan             = s->pan;
+        layer.pitch           = s->pitch;
+        layer.time            = s->time;
+        layer.startPoint      = s->startPoint;
+        layer.endPoint        = s->endPoint;
+        layer.filterType      = s->filterType;
+        layer.filterFrequency = s->filterFrequency;
+        layer.filterResonance = s->filterResonance;
+        layer.velLow          = s->velLow;
+        layer.velHigh         = s->velHigh;
+        layer.attack          = s->attack;
+        layer.decay           = s->decay;
+        layer.sustain         = s->sustain;
+        layer.release         = s->release;
       } // Layers
-      
-      // finally add the current bank to the whole JSON
-      std::stringstream padStream;
-      padStream << "pad_" << p;
-      pjBank[ padStream.str() ] = picojson::value( pjPad );
     } // pads
-    
-    
-    // finally add the current bank to the whole JSON
-    std::stringstream bankStr;
-    bankStr << "bank_" << char('A' + i); // hack to bank letters
-    pjAll[ bankStr.str() ] = picojson::value( pjBank );
   } // banks
   
+  for(int a = 0; a < 4; a++)
+    kit.auxBusVol[a] = self->dsp->auxBusVol[a];
+  library->midiMap().store( kit );
+  
+  kit.polyphony       = self->dsp->polyphony();
+  kit.stealPolicy     = self->dsp->stealPolicy();
+  kit.renderThreads   = self->dsp->renderThreads();
+  kit.streamThreshold = self->dsp->streamThreshold();
+  kit.compactSamples  = self->dsp->compactSamples();
+  kit.sampleRateMode  = self->dsp->sampleRateMode();
+  kit.sampleCacheMB   = self->dsp->sampleCacheSize();
+  
+  // the settings of the restored kit apply once it is swapped in
+  const LibrarySettings& set = library->settings();
+  if( set.valid && library != self->dsp->getLibrary() )
+  {
+    kit.polyphony       = set.polyphony;
+    kit.stealPolicy     = set.stealPolicy;
+    kit.renderThreads   = set.renderThreads;
+    kit.streamThreshold = self->schedule ? set.streamThreshold : 0;
+    kit.compactSamples  = set.compactSamples;
+    kit.sampleRateMode  = set.sampleRateMode;
+    for(int a = 0; a < 4; a++)
+      kit.auxBusVol[a] = set.auxBusVol[a];
+  }
+  
+  lv2_log_note( &self->logger, "Fabla2: saved samples: %i unchanged, %i linked, %i written, %i failed\n",
+                saveResults[Sample::SAVE_UNCHANGED], saveResults[Sample::SAVE_LINKED],
+                saveResults[Sample::SAVE_WRITTEN], saveResults[Sample::SAVE_FAILED] );
+  
+  // the binary state is restored by this version, the JSON by older ones
+  std::vector<uint8_t> binary;
+  kit.encode( binary );
+  
+  store(handle,
+        self->uris.fabla2_StateBinary,
+        &binary[0],
+        binary.size(),
+        self->uris.atom_Chunk,
+        LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+  
   // serialize the whole JSON string
-  string str = picojson::value( pjAll ).serialize();
+  string str = kit.toJson();
   printf( "Lv2:State content = %s\n" ,  str.c_str() );
   
   store(handle,
@@ -184,6 +201,76 @@ fabla2_save(LV2_Handle                 instance,
 }
 
 
+/// a layer of the save file: the restore threads load its Sample
+struct RestoreLayer
+{
+  int pad;
+  int layer;
+  Pad* target;
+  std::string name;
+  std::string path;
+  const LayerState* state;
+  
+  /// the loaded Sample, or 0 if it failed to load, and the load time
+  Sample* sample;
+  double  ms;
+};
+
+/// writes the saved parameters of a layer directly to its Sample
+static void fabla2_restore_params( Sample* s, const LayerState& layer )
+{
+  s->gain            = layer.gain;
+  s->pan             = layer.pan;
+  
+  s->pitch           = layer.pitch;
+  s->time            = layer.time;
+  
+  s->startPoint      = layer.startPoint;
+  s->endPoint        = layer.endPoint;
+  
+  s->filterType      = layer.filterType;
+  s->filterFrequency = layer.filterFrequency;
+  s->filterResonance = layer.filterResonance;
+  
+  s->velLow          = layer.velLow;
+  s->velHigh         = layer.velHigh;
+  
+  s->attack          = layer.attack;
+  s->decay           = layer.decay;
+  s->sustain         = layer.sustain;
+  s->release         = layer.release;
+}
+
+/// loads layers until none are left, run by each restore thread. The layers
+/// are only read, and each thread writes the sample of the layers it took
+static void fabla2_restore_decode( FablaLV2* self, std::vector<RestoreLayer>* layers,
+                                   const LibrarySettings* set, std::atomic<int>* next )
+{
+  // streaming needs the worker, as in Fabla2DSP::streamThreshold()
+  const long threshold = self->schedule ? set->streamThreshold : 0;
+  
+  for( int i = (*next)++; i < (int)layers->size(); i = (*next)++ )
+  {
+    RestoreLayer& l = layers->at( i );
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    Sample* s = new Sample( self->dsp, self->dsp->sr, l.name.c_str(), l.path,
+                            threshold, set->compactSamples, set->sampleRateMode );
+    if( s->getFrames() <= 0 )
+    {
+      delete s;
+      s = 0;
+    }
+    else
+    {
+      fabla2_restore_params( s, *l.state );
+    }
+    
+    l.sample = s;
+    l.ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+  }
+}
+
 LV2_State_Status
 fabla2_restore(LV2_Handle                  instance,
                LV2_State_Retrieve_Function retrieve,
@@ -211,216 +298,167 @@ fabla2_restore(LV2_Handle                  instance,
     return LV2_STATE_ERR_NO_FEATURE;
   }
   
-  Library* library = self->dsp->getLibrary();
+  // settings the state doesn't have keep their current value
+  KitState kit;
+  kit.polyphony       = self->dsp->polyphony();
+  kit.stealPolicy     = self->dsp->stealPolicy();
+  kit.renderThreads   = self->dsp->renderThreads();
+  kit.streamThreshold = self->dsp->streamThreshold();
+  kit.compactSamples  = self->dsp->compactSamples();
+  kit.sampleRateMode  = self->dsp->sampleRateMode();
+  kit.sampleCacheMB   = self->dsp->sampleCacheSize();
+  for(int a = 0; a < 4; a++)
+    kit.auxBusVol[a] = self->dsp->auxBusVol[a];
   
   size_t   size = 0;
   uint32_t type = 0;
   uint32_t flgs = 0;
   
-  // get the JSON description file
-  const char* jsonSource = (const char*)retrieve(handle,
-			self->uris.fabla2_StateStringJSON, &size, &type, &flgs );
+  // prefer the binary state, and read the JSON of older versions
+  const uint8_t* binary = (const uint8_t*)retrieve(handle,
+			self->uris.fabla2_StateBinary, &size, &type, &flgs );
+  bool loaded = false;
+  if( binary && type == self->uris.atom_Chunk )
+  {
+    // decode() fails part way through: the JSON is read into the kit with
+    // only the current settings in it, or its pads would get layers twice
+    KitState decoded( kit );
+    loaded = decoded.decode( binary, size );
+    if( loaded )
+      kit = decoded;
+    else
+      printf("Fabla2:State() Warning, invalid binary state : trying JSON.\n" );
+  }
   
-  if( jsonSource )
+  if( !loaded )
   {
-    //printf("\n\n%s\n\n", jsonSource );
-    
-    char* json = (char*)malloc(strlen(jsonSource)+1);
-    strcpy(json, jsonSource);
-    
-    picojson::value pjAll;
-    string err = picojson::parse( pjAll, json, json + strlen(json));
-    if( err.size() > 0 )
+    // get the JSON description file
+    const char* jsonSource = (const char*)retrieve(handle,
+        self->uris.fabla2_StateStringJSON, &size, &type, &flgs );
+    if( !jsonSource )
     {
-      printf( "PicoJSON Parser Error! %s\n", err.c_str() );
-      return LV2_STATE_ERR_UNKNOWN;
+      printf("Fabla2:State() Warning, no JSON : not loading preset.\n" );
+      return LV2_STATE_SUCCESS;
     }
     
-    //try
+    // the JSON may not be terminated when the host doesn't keep it
+    std::string json( jsonSource, strnlen( jsonSource, size ) );
+    if( !kit.fromJson( json.c_str() ) )
+      return LV2_STATE_ERR_UNKNOWN;
+  }
+  
+  // the cache is shared by all instances, and locked
+  self->dsp->sampleCacheSize( kit.sampleCacheMB );
+  
+  // the kit is built without touching the one that plays, and swapped in by
+  // the RT thread after loading all samples. The RT thread applies the
+  // settings of the engine with it, so restore can run alongside run()
+  Library* library = new Library( self->dsp, self->dsp->sr );
+  library->fingerprint( kit.fingerprint() );
+  library->midiMap().build( kit );
+  
+  LibrarySettings& set = library->settings();
+  set.valid           = true;
+  set.polyphony       = kit.polyphony;
+  set.stealPolicy     = kit.stealPolicy;
+  set.renderThreads   = kit.renderThreads;
+  set.streamThreshold = kit.streamThreshold;
+  set.compactSamples  = kit.compactSamples;
+  set.sampleRateMode  = kit.sampleRateMode;
+  for(int a = 0; a < 4; a++)
+    set.auxBusVol[a] = kit.auxBusVol[a];
+  
+  // the layers of all pads, in the order they are added to their pad
+  std::vector<RestoreLayer> layers;
+  std::chrono::steady_clock::time_point restoreStart = std::chrono::steady_clock::now();
+  
+  for(int b = 0; b < 4; b++ )
+  {
+    Bank* bank = library->bank( b );
+    
+    for(int p = 0; p < 16; p ++)
     {
-      for(int b = 0; b < 4; b++ )
+      Pad* pad = bank->pad( p );
+      const PadState& padState = kit.pads[b][p];
+      if( !padState.valid )
+        continue;
+      
+      pad->muteGroup   ( padState.muteGroup );
+      pad->offGroup    ( padState.offGroup );
+      pad->triggerMode ( (Fabla2::Pad::TRIGGER_MODE)padState.triggerMode );
+      pad->switchSystem( (Fabla2::Pad::SAMPLE_SWITCH_SYSTEM)padState.switchMode );
+      pad->volume = padState.volume;
+      for(int a = 0; a < 4; a++)
+        pad->sends[a] = padState.sends[a];
+      
+      for(size_t i = 0; i < padState.layers.size(); i++)
       {
-        Bank* bank = library->bank( b );
+        const LayerState& layer = padState.layers[i];
         
-        //printf("Bank %i\n", b );
+        // map the short filename to the full path
+        char* absolute = map_path->absolute_path(map_path->handle, layer.filename.c_str() );
+        std::string path = absolute;
+        free( absolute );
         
-        std::stringstream bankStr;
-        bankStr << "bank_" << char('A' + b);
+        // strip the file:// from the start
+        if( path.compare( 0, 7, "file://" ) == 0 )
+          path = path.substr( 7 );
         
-        picojson::value pjBanks = pjAll.get( bankStr.str() );
-        
-        bool pjBankOk = pjBanks.is<picojson::object>();
-        if( !pjBankOk )
-        {
-          printf( "Fabla2 : Lv2 State Restore() : PjBanks is object not valid.\
-							Corrupt save file? Check letter X in \"bank_X\" of the save file.\n" );
-          continue;
-        }
-        
-        // set auxbus values - TODO split values to each bank and load/restore
-        if( pjBanks.get("auxbus1vol").get<double>() )
-          self->dsp->auxBusVol[0] = (float)pjBanks.get("auxbus1vol").get<double>();
-        if( pjBanks.get("auxbus2vol").get<double>() )
-          self->dsp->auxBusVol[1] = (float)pjBanks.get("auxbus2vol").get<double>();
-        if( pjBanks.get("auxbus3vol").get<double>() )
-          self->dsp->auxBusVol[2] = (float)pjBanks.get("auxbus3vol").get<double>();
-        if( pjBanks.get("auxbus4vol").get<double>() )
-          self->dsp->auxBusVol[3] = (float)pjBanks.get("auxbus4vol").get<double>();
-          
-        for(int p = 0; p < 16; p ++)
-        {
-          Pad* pad = bank->pad( p );
-          //printf("Pad %i\n", p );
-          
-          // kick all state out
-          pad->clearAllSamples();
-          
-          std::stringstream padStr;
-          padStr << "pad_" << p;
-          picojson::value pjPad = pjBanks.get( padStr.str() );
-          
-          bool pjPadOk = pjPad.is<picojson::object>();
-          if( !pjPadOk )
-          {
-            printf( "Fabla2 : Lv2 State Restore() : pjPad is object not valid.\
-								Corrupt save file? Check number X in \"pad_X\" of the save file.\n" );
-            continue;
-          }
-          
-          if( pjPad.get("muteGroup").is<double>() )
-            pad->muteGroup   ( (int)pjPad.get("muteGroup").get<double>() );
-          
-          if( pjPad.get("offGroup").is<double>() )
-            pad->offGroup    ( (int)pjPad.get("offGroup" ).get<double>() );
-          
-          if( pjPad.get("triggerMode").is<double>() )
-            pad->triggerMode ( (Fabla2::Pad::TRIGGER_MODE)pjPad.get("triggerMode").get<double>() );
-          
-          if( pjPad.get("switchMode").is<double>() )
-            pad->switchSystem( (Fabla2::Pad::SAMPLE_SWITCH_SYSTEM)pjPad.get("switchMode" ).get<double>() );
-          
-          if( pjPad.get("volume").is<double>() )
-            pad->volume = pjPad.get("volume").get<double>();
-          
-          if( pjPad.get("auxbus1").is<double>() )
-            pad->sends[0] = pjPad.get("auxbus1").get<double>();
-          if( pjPad.get("auxbus2").is<double>() )
-            pad->sends[1] = pjPad.get("auxbus2").get<double>();
-          if( pjPad.get("auxbus3").is<double>() )
-            pad->sends[2] = pjPad.get("auxbus3").get<double>();
-          if( pjPad.get("auxbus4").is<double>() )
-            pad->sends[3] = pjPad.get("auxbus4").get<double>();
-          
-          int nLayers = 0;
-          if( pjPad.get("nLayers").is<double>() )
-            nLayers= (int)pjPad.get("nLayers").get<double>();
-          
-          for(int i = 0; i < nLayers; i++)
-          {
-            std::stringstream layerStr;
-            layerStr << "layer_" << i;
-            
-            //printf("Sample %i, %s\n", i, layerStr.str().c_str() );
-            
-            picojson::value pjLayer = pjPad.get( layerStr.str() );
-            
-            std::string filename;
-            if( pjLayer.get("filename").is<std::string>() )
-            {
-              filename = pjLayer.get("filename").get<std::string>();
-            }
-            else
-            {
-              printf("Fabla2UI: Pad %i : Sample %i : no filename in save file, skipping sample.\n", p, i );
-              continue;
-            }
-            
-            std::string name;
-            if( !pjLayer.get("name").is<std::string>() )
-            {
-              std::stringstream padName;
-              padName << "pad" << p << "_layer" << i << ".wav";
-              name = padName.str();
-            }
-            else
-            {
-              name = pjLayer.get("name").get<std::string>();
-            }
-            
-            // map the short filename to the full path
-            std::string path = map_path->absolute_path(map_path->handle, filename.c_str() );
-            
-            // strip the file:// from the start
-            path = path.substr( 7 );
-            
-            //printf("Loading %s\n", path.c_str() );
-            Sample* s = new Sample( self->dsp, self->dsp->sr, name.c_str(), path );
-            if( s->getFrames() <= 0 )
-            {
-              delete s;
-              // error loading this sample!
-              printf("Error Loading %s : Pad %i : Sample %i : Frames == 0, ignoring this sample!\n", path.c_str(), p, i );
-              continue;
-            }
-            else
-            {
-              // write directly to Sample*
-              if( pjLayer.get("gain").is<double>() )
-                s->gain            = (float)pjLayer.get("gain").get<double>();
-              if( pjLayer.get("pan").is<double>() )
-                s->pan             = (float)pjLayer.get("pan").get<double>();
-              
-              if( pjLayer.get("pitch").is<double>() )
-                s->pitch           = (float)pjLayer.get("pitch").get<double>();
-              if( pjLayer.get("time").is<double>() )
-                s->time            = (float)pjLayer.get("time").get<double>();
-              
-              if( pjLayer.get("startPoint").is<double>() )
-                s->startPoint      = (float)pjLayer.get("startPoint").get<double>();
-              if( pjLayer.get("endPoint").is<double>() )
-                s->endPoint        = (float)pjLayer.get("endPoint").get<double>();
-              
-              if( pjLayer.get("filterType").is<double>() )
-                s->filterType      = (float)pjLayer.get("filterType").get<double>();
-              if( pjLayer.get("filterFrequency").is<double>() )
-                s->filterFrequency = (float)pjLayer.get("filterFrequency").get<double>();
-              if( pjLayer.get("filterResonance").is<double>() )
-                s->filterResonance = (float)pjLayer.get("filterResonance").get<double>();
-              
-              if( pjLayer.get("velLow").is<double>() )
-                s->velLow          = pjLayer.get("velLow").get<double>();
-              if( pjLayer.get("velHigh").is<double>() )
-                s->velHigh         = pjLayer.get("velHigh").get<double>();
-              
-              if( pjLayer.get("attack").is<double>() )
-                s->attack          = (int)pjLayer.get("attack").get<double>();
-              if( pjLayer.get("decay").is<double>() )
-                s->decay           = (int)pjLayer.get("decay").get<double>();
-              if( pjLayer.get("sustain").is<double>() )
-                s->sustain         = (int)pjLayer.get("sustain").get<double>();
-              if( pjLayer.get("release").is<double>() )
-                s->release         = (int)pjLayer.get("release").get<double>();
-              
-              // add the sample to the Pad
-              pad->add( s );
-            }
-          }
-        }
-        
-      } // banks
-    
+        // loaded in parallel after all pads are read, see below
+        RestoreLayer l;
+        l.pad    = p;
+        l.layer  = i;
+        l.target = pad;
+        l.name   = layer.name;
+        l.path   = path;
+        l.state  = &layer;
+        l.sample = 0;
+        l.ms     = 0;
+        layers.push_back( l );
+      }
     }
-    //catch( std::exception& e )
+  } // banks
+  
+  // decode and resample on a bounded pool of threads, this one included
+  int threads = std::thread::hardware_concurrency();
+  if( threads < 1 )
+    threads = 1;
+  if( threads > FABLA2_RESTORE_THREADS_MAX )
+    threads = FABLA2_RESTORE_THREADS_MAX;
+  if( threads > (int)layers.size() )
+    threads = layers.size();
+  
+  std::atomic<int> next( 0 );
+  std::vector<std::thread> pool;
+  for(int t = 1; t < threads; t++)
+    pool.push_back( std::thread( fabla2_restore_decode, self, &layers, &set, &next ) );
+  fabla2_restore_decode( self, &layers, &set, &next );
+  for(size_t t = 0; t < pool.size(); t++)
+    pool[t].join();
+  
+  // publish in save file order, so layer indices match the save
+  for(size_t i = 0; i < layers.size(); i++)
+  {
+    RestoreLayer& l = layers[i];
+    if( !l.sample )
     {
-      //printf("Fabla2 : LV2 State restore() Runtime exception thrown. Please send the preset you attempted to load to harryhaaren@gmail.com so I can fix a bug in Fabla2! Thanks, -Harry. PicoJSON says: %s\n", e.what() );
+      // error loading this sample!
+      printf("Error Loading %s : Pad %i : Sample %i : Frames == 0, ignoring this sample!\n", l.path.c_str(), l.pad, l.layer );
+      continue;
     }
     
+    lv2_log_note( &self->logger, "Fabla2: restore loaded %s in %.1f ms\n",
+                  l.path.c_str(), l.ms );
+    l.target->load( l.sample );
   }
-  else
-  {
-    printf("Fabla2:State() Warning, no JSON : not loading preset.\n" );
-  }
+  
+  self->dsp->swapLibrary( library );
+  
+  double ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - restoreStart ).count();
+  lv2_log_note( &self->logger, "Fabla2: restored %i samples in %.1f ms, using %i threads, from %s state\n",
+                (int)layers.size(), ms, threads, loaded ? "binary" : "JSON" );
+  
+  SamplePool::report();
   
   return LV2_STATE_SUCCESS;
 }
-
@@ -9,6 +9,8 @@
 #include "dsp/bank.hxx"
 #include "dsp/pad.hxx"
 #include "dsp/sample.hxx"
+#include "dsp/sample_stream.hxx"
+#include "dsp/capture.hxx"
 #include "lv2_messaging.hxx"
 
 
@@ -81,7 +83,42 @@ fabla2_work( LV2_Handle                  instance,
   FablaLV2* self = (FablaLV2*)instance;
   
   const LV2_Atom* atom = (const LV2_Atom*)data;
-  if( atom->type == self->uris.patch_Set )
+  if( atom->type == self->uris.fabla2_StreamRefill )
+  {
+    // a voice streaming from disk needs the next frames: nothing is sent back,
+    // the stream makes the frames available to the RT thread itself
+    const StreamRefill* msg = (const StreamRefill*)data;
+    msg->stream->refill();
+  }
+  else if( atom->type == self->uris.fabla2_Reclaim )
+  {
+    // objects the RT thread is done with: the worker handles messages in
+    // order, so refills for streams that played them are done by now
+    const Reclaim* msg = (const Reclaim*)data;
+    self->dsp->reclaim( msg->upto );
+  }
+  else if( atom->type == self->uris.fabla2_LogDrain )
+  {
+    // messages the audio thread logged, printed here as it can't block
+    self->dsp->logDrain();
+  }
+  else if( atom->type == self->uris.fabla2_SampleRecord )
+  {
+    // the audio thread stopped recording: create the Sample here, so it
+    // doesn't allocate
+    const SampleRecord* rec = (const SampleRecord*)data;
+    
+    SampleLoadUnload msg;
+    msg.atom.size = sizeof(SampleLoadUnload*);
+    msg.atom.type = self->uris.fabla2_SampleRecord;
+    msg.bank   = rec->bank;
+    msg.pad    = rec->pad;
+    msg.sample = self->dsp->recordedSample( rec->size );
+    
+    if( respond( handle, sizeof(msg), &msg ) != LV2_WORKER_SUCCESS )
+      delete msg.sample;
+  }
+  else if( atom->type == self->uris.patch_Set )
   {
     
   }
@@ -101,13 +138,18 @@ fabla2_work( LV2_Handle                  instance,
     }
     
     std::string file = (const char*)LV2_ATOM_BODY_CONST(file_path);
-    Fabla2::Sample* s = new Fabla2::Sample( self->dsp, 44100, "LoadedSample", file );
+    Fabla2::Sample* s = new Fabla2::Sample( self->dsp, self->dsp->sr, "LoadedSample", file,
+                                            self->dsp->streamThreshold(),
+                                            self->dsp->compactSamples(),
+                                            self->dsp->sampleRateMode() );
     
     lv2_log_note(&self->logger,"Work() - B: %i, P %i: Loading %s: Sample() has %i frames\n",
         bank, pad, file.c_str(), s->getFrames() );
     
     if ( s && s->getFrames() )
     {
+      Fabla2::SamplePool::report();
+      
       SampleLoadUnload msg;
       msg.atom.size = sizeof(SampleLoadUnload*);
       msg.atom.type = self->uris.fabla2_SampleLoad;
@@ -137,6 +179,10 @@ fabla2_work_response(LV2_Handle  instance,
 {
   FablaLV2* self = (FablaLV2*)instance;
   
+  // a replay delivers the response before the same block
+  if( self->capture )
+    self->capture->response();
+  
   const LV2_Atom* atom = (const LV2_Atom*)data;
   
   //printf("Work:resonse() Got type : %s\n", self->unmap->unmap( self->unmap->handle, atom->type ) );
@@ -153,12 +199,19 @@ fabla2_work_response(LV2_Handle  instance,
     int bank = msg->bank;
     int pad  = msg->pad;
     
-    if(bank < 0 || bank >=  4){ delete msg->sample; return LV2_WORKER_ERR_UNKNOWN; }
-    if(pad  < 0 || pad  >= 16){ delete msg->sample; return LV2_WORKER_ERR_UNKNOWN; }
+    // the sample is freed by the worker, never here on the RT thread
+    if(bank < 0 || bank >=  4){ self->dsp->retire( msg->sample ); return LV2_WORKER_ERR_UNKNOWN; }
+    if(pad  < 0 || pad  >= 16){ self->dsp->retire( msg->sample ); return LV2_WORKER_ERR_UNKNOWN; }
     
     // add() of pad writes LV2 update: we don't have layer information here yet.
     self->dsp->getLibrary()->bank( bank )->pad( pad )->add( msg->sample );
   }
+  else if( atom->type == self->uris.fabla2_SampleRecord )
+  {
+    // a recording replaces the samples on its pad
+    const SampleLoadUnload* msg = (const SampleLoadUnload*)data;
+    self->dsp->recorded( msg->bank, msg->pad, msg->sample );
+  }
   
   
   return LV2_WORKER_SUCCESS;
@@ -27,6 +27,7 @@
 namespace Fabla2
 {
   class Sample;
+  class SampleStream;
 };
 
 /// definitions of the Work:schedule LV2 extension functions
@@ -52,4 +53,28 @@ typedef struct
   Fabla2::Sample*  sample;
 } SampleLoadUnload;
 
+/// asks the worker to read ahead for a voice that streams a sample from disk
+typedef struct
+{
+  LV2_Atom atom;
+  Fabla2::SampleStream* stream;
+} StreamRefill;
+
+/// asks the worker to free the objects in the RetireQueue before upto
+typedef struct
+{
+  LV2_Atom atom;
+  uint64_t upto;
+} Reclaim;
+
+/// asks the worker to create the Sample of a recording of size floats, for a
+/// pad: the response is a SampleLoadUnload of the same type
+typedef struct
+{
+  LV2_Atom atom;
+  int  bank;
+  int  pad;
+  long size;
+} SampleRecord;
+
 #endif // OPENAV_FABLA2_LV2_WORK_HXX
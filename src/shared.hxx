@@ -43,6 +43,7 @@
 
 /// Atom Event types
 #define FABLA2_StateStringJSON      FABLA2_URI "#StateStringJSON"
+#define FABLA2_StateBinary          FABLA2_URI "#StateBinary"
 
 #define FABLA2_Panic                FABLA2_URI "#Panic"
 
@@ -86,7 +87,12 @@
 #define FABLA2_SampleVelEndPnt      FABLA2_URI "#SampleVelEndPnt"
 #define FABLA2_SampleLoad           FABLA2_URI "#SampleLoad"
 #define FABLA2_SampleUnload         FABLA2_URI "#SampleUnload"
+#define FABLA2_StreamRefill         FABLA2_URI "#StreamRefill"
+#define FABLA2_Reclaim              FABLA2_URI "#Reclaim"
+#define FABLA2_SampleRecord         FABLA2_URI "#SampleRecord"
+#define FABLA2_LogDrain             FABLA2_URI "#LogDrain"
 #define FABLA2_SampleAudioData      FABLA2_URI "#SampleAudioData"
+#define FABLA2_Telemetry            FABLA2_URI "#Telemetry"
 
 /// "Inside Atoms" data types
 #define FABLA2_name                 FABLA2_URI "#name"
@@ -97,6 +103,14 @@
 #define FABLA2_velocity             FABLA2_URI "#velocity"
 #define FABLA2_value                FABLA2_URI "#value"
 #define FABLA2_audioData            FABLA2_URI "#audioData"
+#define FABLA2_load                 FABLA2_URI "#load"
+#define FABLA2_loadWorst            FABLA2_URI "#loadWorst"
+#define FABLA2_overruns             FABLA2_URI "#overruns"
+#define FABLA2_voices               FABLA2_URI "#voices"
+#define FABLA2_voicesMax            FABLA2_URI "#voicesMax"
+#define FABLA2_stageTime            FABLA2_URI "#stageTime"
+#define FABLA2_stageTimeWorst       FABLA2_URI "#stageTimeWorst"
+#define FABLA2_loadHistogram        FABLA2_URI "#loadHistogram"
 
 
 typedef struct {
@@ -105,6 +119,7 @@ typedef struct {
   LV2_URID atom_Int;
   LV2_URID atom_Float;
   LV2_URID atom_String;
+  LV2_URID atom_Chunk;
   LV2_URID atom_Vector;
   LV2_URID atom_Resource;
   LV2_URID atom_Sequence;
@@ -118,6 +133,7 @@ typedef struct {
   LV2_URID patch_value;
   
   LV2_URID fabla2_StateStringJSON;
+  LV2_URID fabla2_StateBinary;
   
   LV2_URID fabla2_Panic;
   
@@ -162,7 +178,12 @@ typedef struct {
   LV2_URID fabla2_SampleVelEndPnt;
   LV2_URID fabla2_SampleLoad;
   LV2_URID fabla2_SampleUnload;
+  LV2_URID fabla2_StreamRefill;
+  LV2_URID fabla2_Reclaim;
+  LV2_URID fabla2_SampleRecord;
+  LV2_URID fabla2_LogDrain;
   LV2_URID fabla2_SampleAudioData;
+  LV2_URID fabla2_Telemetry;
   
   LV2_URID fabla2_name;
   LV2_URID fabla2_sample;
@@ -172,6 +193,14 @@ typedef struct {
   LV2_URID fabla2_layer;
   LV2_URID fabla2_value;
   LV2_URID fabla2_audioData;
+  LV2_URID fabla2_load;
+  LV2_URID fabla2_loadWorst;
+  LV2_URID fabla2_overruns;
+  LV2_URID fabla2_voices;
+  LV2_URID fabla2_voicesMax;
+  LV2_URID fabla2_stageTime;
+  LV2_URID fabla2_stageTimeWorst;
+  LV2_URID fabla2_loadHistogram;
 } URIs;
 
 static void mapUri( URIs* uris, LV2_URID_Map* map )
@@ -181,6 +210,7 @@ static void mapUri( URIs* uris, LV2_URID_Map* map )
   uris->atom_Int                    = map->map(map->handle, LV2_ATOM__Int);
   uris->atom_Float                  = map->map(map->handle, LV2_ATOM__Float);
   uris->atom_String                 = map->map(map->handle, LV2_ATOM__String);
+  uris->atom_Chunk                  = map->map(map->handle, LV2_ATOM__Chunk);
   uris->atom_Vector                 = map->map(map->handle, LV2_ATOM__Vector);
   uris->atom_Resource               = map->map(map->handle, LV2_ATOM__Resource);
   uris->atom_Sequence               = map->map(map->handle, LV2_ATOM__Sequence);
@@ -194,6 +224,7 @@ static void mapUri( URIs* uris, LV2_URID_Map* map )
   uris->patch_value                 = map->map(map->handle, LV2_PATCH__value);
   
   uris->fabla2_StateStringJSON      = map->map(map->handle, FABLA2_StateStringJSON);
+  uris->fabla2_StateBinary          = map->map(map->handle, FABLA2_StateBinary);
   
   uris->fabla2_Panic                = map->map(map->handle, FABLA2_Panic);
   
@@ -239,7 +270,12 @@ static void mapUri( URIs* uris, LV2_URID_Map* map )
   uris->fabla2_SampleVelEndPnt      = map->map(map->handle, FABLA2_SampleVelEndPnt);
   uris->fabla2_SampleLoad           = map->map(map->handle, FABLA2_SampleLoad);
   uris->fabla2_SampleUnload         = map->map(map->handle, FABLA2_SampleUnload);
+  uris->fabla2_StreamRefill         = map->map(map->handle, FABLA2_StreamRefill);
+  uris->fabla2_Reclaim              = map->map(map->handle, FABLA2_Reclaim);
+  uris->fabla2_SampleRecord         = map->map(map->handle, FABLA2_SampleRecord);
+  uris->fabla2_LogDrain             = map->map(map->handle, FABLA2_LogDrain);
   uris->fabla2_SampleAudioData      = map->map(map->handle, FABLA2_SampleAudioData);
+  uris->fabla2_Telemetry            = map->map(map->handle, FABLA2_Telemetry);
   
   uris->fabla2_sample               = map->map(map->handle, FABLA2_sample);
   uris->fabla2_name                 = map->map(map->handle, FABLA2_name);
@@ -249,6 +285,14 @@ static void mapUri( URIs* uris, LV2_URID_Map* map )
   uris->fabla2_layer                = map->map(map->handle, FABLA2_layer);
   uris->fabla2_value                = map->map(map->handle, FABLA2_value);
   uris->fabla2_audioData            = map->map(map->handle, FABLA2_audioData);
+  uris->fabla2_load                 = map->map(map->handle, FABLA2_load);
+  uris->fabla2_loadWorst            = map->map(map->handle, FABLA2_loadWorst);
+  uris->fabla2_overruns             = map->map(map->handle, FABLA2_overruns);
+  uris->fabla2_voices               = map->map(map->handle, FABLA2_voices);
+  uris->fabla2_voicesMax            = map->map(map->handle, FABLA2_voicesMax);
+  uris->fabla2_stageTime            = map->map(map->handle, FABLA2_stageTime);
+  uris->fabla2_stageTimeWorst       = map->map(map->handle, FABLA2_stageTimeWorst);
+  uris->fabla2_loadHistogram        = map->map(map->handle, FABLA2_loadHistogram);
 }
 
 #endif // OPENAV_FABLA2_SHARED_HXX
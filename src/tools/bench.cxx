@@ -0,0 +1,339 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+// fabla2bench: runs Fabla2DSP without an LV2 host, playing note patterns
+// through a kit for each combination of the sample rates, block sizes and
+// polyphony given. Prints one JSON object per combination to stdout.
+
+#include "offline_host.hxx"
+
+#include "../dsp/fabla2.hxx"
+#include "../dsp/kit_state.hxx"
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <new>
+
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Fabla2;
+
+/// allocations made while a block is processed, by any thread
+static std::atomic<bool> counting( false );
+static std::atomic<long> allocations( 0 );
+
+void* operator new( size_t size )
+{
+  if( counting.load() )
+    allocations++;
+  void* p = malloc( size ? size : 1 );
+  if( !p )
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[]( size_t size )
+{
+  return operator new( size );
+}
+
+void operator delete( void* p ) noexcept
+{
+  free( p );
+}
+
+void operator delete[]( void* p ) noexcept
+{
+  free( p );
+}
+
+void operator delete( void* p, size_t ) noexcept
+{
+  free( p );
+}
+
+void operator delete[]( void* p, size_t ) noexcept
+{
+  free( p );
+}
+
+static uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct Options
+{
+  Options() :
+    kit( "" ),
+    sample( "test.wav" ),
+    pattern( "random" ),
+    notesPerSecond( 32 ),
+    seconds( 10 ),
+    threads( 0 ),
+    seed( 1 )
+  {
+    rates.push_back( 48000 );
+    blocks.push_back( 128 );
+    polyphony.push_back( 16 );
+  }
+
+  std::string kit;
+  std::string sample;
+  std::string pattern;
+  std::vector<int> rates;
+  std::vector<int> blocks;
+  std::vector<int> polyphony;
+  float notesPerSecond;
+  float seconds;
+  int   threads;
+  unsigned seed;
+};
+
+static std::vector<int> parseList( const char* s )
+{
+  std::vector<int> v;
+  while( *s )
+  {
+    v.push_back( atoi( s ) );
+    const char* comma = strchr( s, ',' );
+    if( !comma )
+      break;
+    s = comma + 1;
+  }
+  return v;
+}
+
+/// a number, or NAN when s isn't one
+static double parseNumber( const char* s )
+{
+  char* end = 0;
+  const double d = strtod( s, &end );
+  return end == s || *end ? NAN : d;
+}
+
+static void usage()
+{
+  fprintf( stderr,
+    "usage: fabla2bench [options]\n"
+    "  --kit file.json       Fabla2 state JSON to play, samples relative to it\n"
+    "  --sample file.wav     else, this sample on the 16 pads of bank A (test.wav)\n"
+    "  --rates 44100,48000   sample rates (48000)\n"
+    "  --blocks 64,256       block sizes in frames, up to %i (128)\n"
+    "  --polyphony 16,64     voices (16)\n"
+    "  --pattern name        random, roll or chord (random)\n"
+    "  --notes n             notes per second (32)\n"
+    "  --seconds s           audio to render per combination (10)\n"
+    "  --threads n           render helper threads (0)\n"
+    "  --seed n              seed of the random pattern (1)\n",
+    FABLA2_BLOCK_MAX );
+}
+
+/// queues the notes of the pattern that start in the block at frame
+static void pattern( OfflineHost& host, const Options& o, unsigned& seed,
+                     long frame, int nframes )
+{
+  // notesPerSecond notes on a grid: rolls and chords on the grid points,
+  // random notes anywhere in the block of their grid point
+  const double spacing = host.rate() / o.notesPerSecond;
+  const bool   chord   = o.pattern == "chord";
+  const double grid    = chord ? spacing * 16 : spacing;
+
+  long first = (long)ceil( frame / grid );
+  for( long n = first; n * grid < frame + nframes; n++ )
+  {
+    int offset = (int)( n * grid - frame );
+
+    if( o.pattern == "roll" )
+    {
+      uint8_t msg[3] = { 0x90, 36, 100 };
+      host.midi( offset, msg, 3 );
+    }
+    else if( chord )
+    {
+      for(int p = 0; p < 16; p++)
+      {
+        uint8_t msg[3] = { 0x90, (uint8_t)(36 + p), 100 };
+        host.midi( offset, msg, 3 );
+      }
+    }
+    else
+    {
+      uint8_t msg[3] = { 0x90, (uint8_t)(36 + rand_r( &seed ) % 16),
+                         (uint8_t)(1 + rand_r( &seed ) % 127) };
+      offset = rand_r( &seed ) % nframes;
+      host.midi( offset, msg, 3 );
+    }
+  }
+}
+
+static std::string defaultKit( const Options& o )
+{
+  KitState kit;
+  for(int p = 0; p < FABLA2_KIT_PADS; p++)
+  {
+    LayerState l;
+    l.filename = o.sample;
+    l.name     = o.sample;
+    kit.pads[0][p].valid = true;
+    kit.pads[0][p].layers.push_back( l );
+  }
+  return kit.toJson();
+}
+
+static bool bench( const Options& o, int rate, int nframes, int voices )
+{
+  OfflineHost host( rate, nframes );
+
+  bool loaded = o.kit.empty() ? host.restore( defaultKit( o ), "." )
+                              : host.restoreFile( o.kit.c_str() );
+  if( !loaded )
+    return false;
+
+  // swap the kit in, and let the worker free the empty one. The settings of
+  // the kit apply with the swap, the options after it
+  for(int i = 0; i < 4; i++)
+    host.run( nframes );
+  host.dsp()->polyphony( voices );
+  host.dsp()->renderThreads( o.threads );
+
+  const long nBlocks = (long)( o.seconds * rate / nframes );
+  std::vector<uint64_t> times;
+  times.reserve( nBlocks );
+  long allocs    = 0;
+  long allocsMax = 0;
+  unsigned seed  = o.seed;
+
+  for(long b = 0; b < nBlocks; b++)
+  {
+    pattern( host, o, seed, b * nframes, nframes );
+    host.prepare( nframes );
+
+    const long a = allocations.load();
+    counting.store( true );
+    const uint64_t start = now();
+    host.process( nframes );
+    times.push_back( now() - start );
+    counting.store( false );
+
+    const long n = allocations.load() - a;
+    allocs += n;
+    allocsMax = std::max( allocsMax, n );
+
+    host.work();
+  }
+
+  uint64_t total = 0;
+  for(long i = 0; i < nBlocks; i++)
+    total += times[i];
+  std::sort( times.begin(), times.end() );
+
+  const double budget = nframes * 1000000. / rate;
+  const double mean   = total / 1000. / nBlocks;
+
+  printf( "{\"format\":1,\"version\":\"%s\",\"rate\":%i,\"block\":%i,"
+          "\"polyphony\":%i,\"threads\":%i,\"pattern\":\"%s\",\"notes_per_second\":%g,"
+          "\"blocks\":%li,\"budget_us\":%.3f,\"realtime_factor\":%.3f,"
+          "\"block_us\":{\"min\":%.3f,\"mean\":%.3f,\"p99\":%.3f,\"max\":%.3f},"
+          "\"allocs_per_block\":%.4f,\"allocs_max\":%li}\n",
+          FABLA2_VERSION_STRING, rate, nframes, voices, o.threads,
+          o.pattern.c_str(), o.notesPerSecond, nBlocks, budget, budget / mean,
+          times.front() / 1000., mean, times[ (nBlocks - 1) * 99 / 100 ] / 1000.,
+          times.back() / 1000., double(allocs) / nBlocks, allocsMax );
+  fflush( stdout );
+  return true;
+}
+
+int main( int argc, char** argv )
+{
+  Options o;
+
+  for(int i = 1; i < argc; i++)
+  {
+    const char* a = argv[i];
+    const char* v = i + 1 < argc ? argv[i+1] : 0;
+    if( !strcmp( a, "--help" ) || !v )
+    {
+      usage();
+      return strcmp( a, "--help" ) ? 1 : 0;
+    }
+
+    if(      !strcmp( a, "--kit"       ) ) o.kit = v;
+    else if( !strcmp( a, "--sample"    ) ) o.sample = v;
+    else if( !strcmp( a, "--rates"     ) ) o.rates = parseList( v );
+    else if( !strcmp( a, "--blocks"    ) ) o.blocks = parseList( v );
+    else if( !strcmp( a, "--polyphony" ) ) o.polyphony = parseList( v );
+    else if( !strcmp( a, "--pattern"   ) ) o.pattern = v;
+    else if( !strcmp( a, "--notes"     ) ) o.notesPerSecond = parseNumber( v );
+    else if( !strcmp( a, "--seconds"   ) ) o.seconds = atof( v );
+    else if( !strcmp( a, "--threads"   ) ) o.threads = atoi( v );
+    else if( !strcmp( a, "--seed"      ) ) o.seed = atoi( v );
+    else
+    {
+      usage();
+      return 1;
+    }
+    i++;
+  }
+
+  // the notes are spaced rate / notesPerSecond frames apart
+  if( ( o.pattern != "random" && o.pattern != "roll" && o.pattern != "chord" ) ||
+      !( o.notesPerSecond > 0 ) || !isfinite( o.notesPerSecond ) )
+  {
+    usage();
+    return 1;
+  }
+
+  // all combinations are checked first, so none is left out of the results
+  for(size_t r = 0; r < o.rates.size(); r++)
+  {
+    for(size_t b = 0; b < o.blocks.size(); b++)
+    {
+      if( o.blocks[b] < 1 || o.blocks[b] > FABLA2_BLOCK_MAX ||
+          o.blocks[b] > o.rates[r] || o.seconds * o.rates[r] < o.blocks[b] )
+      {
+        fprintf( stderr, "fabla2bench: invalid block size %i, up to %i frames are supported\n",
+                 o.blocks[b], FABLA2_BLOCK_MAX );
+        return 1;
+      }
+    }
+  }
+
+  for(size_t r = 0; r < o.rates.size(); r++)
+    for(size_t b = 0; b < o.blocks.size(); b++)
+      for(size_t p = 0; p < o.polyphony.size(); p++)
+      {
+        if( !bench( o, o.rates[r], o.blocks[b], o.polyphony[p] ) )
+        {
+          fprintf( stderr, "fabla2bench: failed to load the kit\n" );
+          return 1;
+        }
+      }
+
+  return 0;
+}
@@ -0,0 +1,250 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "midi_file.hxx"
+
+#include <algorithm>
+
+#include <stdio.h>
+#include <string.h>
+
+namespace Fabla2
+{
+
+static uint32_t fabla2_be32( const uint8_t* p )
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint16_t fabla2_be16( const uint8_t* p )
+{
+  return (uint16_t)( p[0] << 8 | p[1] );
+}
+
+/// reads a variable length quantity, returns false when it runs past end
+static bool fabla2_vlq( const uint8_t*& p, const uint8_t* end, long& v )
+{
+  v = 0;
+  for(int i = 0; i < 4; i++)
+  {
+    if( p >= end )
+      return false;
+    uint8_t b = *p++;
+    v = ( v << 7 ) | ( b & 0x7f );
+    if( !( b & 0x80 ) )
+      return true;
+  }
+  return false;
+}
+
+MidiFile::MidiFile()
+{
+}
+
+double MidiFile::length()
+{
+  return events_.empty() ? 0 : events_.back().time;
+}
+
+bool MidiFile::track( const uint8_t* p, long size, std::vector<TickEvent>& ticks,
+                      std::vector<Tempo>& tempos )
+{
+  const uint8_t* end = p + size;
+  long tick = 0;
+  uint8_t status = 0;
+
+  while( p < end )
+  {
+    long delta;
+    if( !fabla2_vlq( p, end, delta ) || p >= end )
+      return false;
+    tick += delta;
+
+    if( *p == 0xff )
+    {
+      // meta event: only the tempo matters
+      if( end - p < 2 )
+        return false;
+      uint8_t type = p[1];
+      p += 2;
+      long len;
+      if( !fabla2_vlq( p, end, len ) || end - p < len )
+        return false;
+      if( type == 0x51 && len == 3 )
+      {
+        Tempo t;
+        t.tick = tick;
+        t.usPerQuarter = p[0] << 16 | p[1] << 8 | p[2];
+        tempos.push_back( t );
+      }
+      p += len;
+      if( type == 0x2f )
+        return true;
+      continue;
+    }
+
+    if( *p == 0xf0 || *p == 0xf7 )
+    {
+      // SysEx, cancels running status
+      p++;
+      status = 0;
+      long len;
+      if( !fabla2_vlq( p, end, len ) || end - p < len )
+        return false;
+      p += len;
+      continue;
+    }
+
+    if( *p & 0x80 )
+      status = *p++;
+    else if( !status )
+      return false;
+
+    // program change and channel pressure have one data byte
+    const int type = status & 0xf0;
+    const int size = ( type == 0xc0 || type == 0xd0 ) ? 2 : 3;
+    if( end - p < size - 1 )
+      return false;
+
+    TickEvent e;
+    e.tick = tick;
+    e.e.time = 0;
+    e.e.size = size;
+    e.e.msg[0] = status;
+    e.e.msg[1] = p[0];
+    e.e.msg[2] = size == 3 ? p[1] : 0;
+    p += size - 1;
+
+    // a note on with velocity 0 is a note off
+    if( type == 0x90 && e.e.msg[2] == 0 )
+      e.e.msg[0] = 0x80 | ( status & 0x0f );
+
+    ticks.push_back( e );
+  }
+
+  return true;
+}
+
+bool MidiFile::load( const char* path )
+{
+  events_.clear();
+
+  FILE* f = fopen( path, "rb" );
+  if( !f )
+  {
+    fprintf( stderr, "Fabla2 MIDI file: can't open %s\n", path );
+    return false;
+  }
+
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t n;
+  while( ( n = fread( buf, 1, sizeof(buf), f ) ) > 0 )
+    data.insert( data.end(), buf, buf + n );
+  fclose( f );
+
+  if( data.size() < 14 || memcmp( &data[0], "MThd", 4 ) || fabla2_be32( &data[4] ) < 6 )
+  {
+    fprintf( stderr, "Fabla2 MIDI file: %s is not a Standard MIDI File\n", path );
+    return false;
+  }
+
+  const int format   = fabla2_be16( &data[8] );
+  const int nTracks  = fabla2_be16( &data[10] );
+  const int division = fabla2_be16( &data[12] );
+  if( format > 1 )
+  {
+    fprintf( stderr, "Fabla2 MIDI file: %s is format %i, only 0 and 1 are supported\n", path, format );
+    return false;
+  }
+
+  std::vector<TickEvent> ticks;
+  std::vector<Tempo> tempos;
+
+  size_t pos = 8 + fabla2_be32( &data[4] );
+  int tracks = 0;
+  while( tracks < nTracks && pos + 8 <= data.size() )
+  {
+    const uint32_t len = fabla2_be32( &data[pos + 4] );
+    if( len > data.size() - pos - 8 )
+      break;
+
+    // chunks other than tracks are skipped
+    if( !memcmp( &data[pos], "MTrk", 4 ) )
+    {
+      if( !track( &data[pos + 8], len, ticks, tempos ) )
+      {
+        fprintf( stderr, "Fabla2 MIDI file: %s has a broken track %i\n", path, tracks );
+        return false;
+      }
+      tracks++;
+    }
+    pos += 8 + len;
+  }
+
+  if( tracks < nTracks )
+  {
+    fprintf( stderr, "Fabla2 MIDI file: %s is truncated, %i of %i tracks\n", path, tracks, nTracks );
+    return false;
+  }
+
+  // merge the tracks: the sort is stable, so a track's order is kept
+  std::stable_sort( ticks.begin(), ticks.end(), before );
+  std::stable_sort( tempos.begin(), tempos.end(), tempoBefore );
+
+  events_.reserve( ticks.size() );
+
+  if( division & 0x8000 )
+  {
+    // SMPTE: frames per second, and ticks per frame
+    const int fps = -(int8_t)( division >> 8 );
+    const int tpf = division & 0xff;
+    const double secondsPerTick = fps > 0 && tpf > 0 ? 1. / ( fps * tpf ) : 0;
+    for(size_t i = 0; i < ticks.size(); i++)
+    {
+      ticks[i].e.time = ticks[i].tick * secondsPerTick;
+      events_.push_back( ticks[i].e );
+    }
+    return true;
+  }
+
+  // ticks per quarter note: walk the tempo map, 120 BPM until the first change
+  const int ppq = division ? division : 1;
+  long   usPerQuarter = 500000;
+  long   tempoTick = 0;
+  double tempoTime = 0;
+  size_t t = 0;
+  for(size_t i = 0; i < ticks.size(); i++)
+  {
+    while( t < tempos.size() && tempos[t].tick <= ticks[i].tick )
+    {
+      tempoTime += ( tempos[t].tick - tempoTick ) * usPerQuarter / 1000000. / ppq;
+      tempoTick = tempos[t].tick;
+      usPerQuarter = tempos[t].usPerQuarter;
+      t++;
+    }
+    ticks[i].e.time = tempoTime + ( ticks[i].tick - tempoTick ) * usPerQuarter / 1000000. / ppq;
+    events_.push_back( ticks[i].e );
+  }
+
+  return true;
+}
+
+}; // Fabla2
@@ -0,0 +1,82 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_MIDI_FILE_HXX
+#define OPENAV_FABLA2_MIDI_FILE_HXX
+
+#include <vector>
+
+#include <stdint.h>
+
+namespace Fabla2
+{
+
+/** MidiFile
+ * Reads the channel messages of a Standard MIDI File, format 0 or 1. The
+ * tracks are merged and the ticks converted to seconds through the tempo map,
+ * or the SMPTE time base. SysEx and meta events other than tempo are skipped.
+ */
+class MidiFile
+{
+  public:
+    struct Event
+    {
+      double  time; ///< seconds from the start of the file
+      uint8_t msg[3];
+      int     size;
+    };
+
+    MidiFile();
+
+    /// returns false, and prints why, when the file can't be read
+    bool load( const char* path );
+
+    /// the channel messages, in time order: messages at the same time are in
+    /// file order, track by track
+    const std::vector<Event>& events(){return events_;}
+    /// time of the last event in seconds
+    double length();
+
+  private:
+    std::vector<Event> events_;
+
+    /// a tempo change, in ticks and microseconds per quarter note
+    struct Tempo
+    {
+      long tick;
+      long usPerQuarter;
+    };
+
+    /// an event before the tempo map is applied
+    struct TickEvent
+    {
+      long  tick;
+      Event e;
+    };
+    static bool before( const TickEvent& a, const TickEvent& b ){return a.tick < b.tick;}
+    static bool tempoBefore( const Tempo& a, const Tempo& b ){return a.tick < b.tick;}
+
+    bool track( const uint8_t* data, long size, std::vector<TickEvent>& ticks,
+                std::vector<Tempo>& tempos );
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_MIDI_FILE_HXX
@@ -0,0 +1,392 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include "offline_host.hxx"
+
+#include "../dsp.hxx"
+#include "../dsp/fabla2.hxx"
+
+#include "lv2/lv2plug.in/ns/ext/state/state.h"
+
+#include <algorithm>
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <string.h>
+
+/// bytes of worker jobs, and of responses, that can wait for the next work()
+#define FABLA2_OFFLINE_WORKER_SIZE (1 << 20)
+/// bytes of the atom port sequences
+#define FABLA2_OFFLINE_ATOM_SIZE   (1 << 18)
+
+extern "C" const LV2_Descriptor* lv2_descriptor( uint32_t index );
+
+namespace Fabla2
+{
+
+OfflineHost::OfflineHost( int rate, int mb, const std::map<std::string, LV2_URID>* urids ) :
+  sr( rate ),
+  maxBlock( mb ),
+  verbose_( false ),
+  hold( false ),
+  handle( 0 ),
+  lv2( 0 ),
+  worker( 0 ),
+  jobsSize( 0 ),
+  responsesSize( 0 ),
+  responsesRead( 0 )
+{
+  // the plugin renders voices into buffers of FABLA2_BLOCK_MAX frames
+  assert( mb <= FABLA2_BLOCK_MAX );
+  
+  urisById.push_back( "" );
+  
+  // other URIs are mapped after the highest URID given
+  if( urids )
+  {
+    std::map<std::string, LV2_URID>::const_iterator it;
+    for( it = urids->begin(); it != urids->end(); ++it )
+    {
+      if( it->second >= urisById.size() )
+        urisById.resize( it->second + 1 );
+      urisById[it->second] = it->first;
+      uris[it->first] = it->second;
+    }
+  }
+
+  mapFeature.handle   = this;
+  mapFeature.map      = mapUri;
+  unmapFeature.handle = this;
+  unmapFeature.unmap  = unmapUri;
+  scheduleFeature.handle        = this;
+  scheduleFeature.schedule_work = schedule;
+  logFeature.handle   = this;
+  logFeature.printf   = logPrintf;
+  logFeature.vprintf  = logVprintf;
+
+  LV2_Feature fMap      = { LV2_URID__map       , &mapFeature      };
+  LV2_Feature fUnmap    = { LV2_URID__unmap     , &unmapFeature    };
+  LV2_Feature fSchedule = { LV2_WORKER__schedule, &scheduleFeature };
+  LV2_Feature fLog      = { LV2_LOG__log        , &logFeature      };
+  const LV2_Feature* features[] = { &fMap, &fUnmap, &fSchedule, &fLog, 0 };
+
+  jobs.resize( FABLA2_OFFLINE_WORKER_SIZE );
+  responses.resize( FABLA2_OFFLINE_WORKER_SIZE );
+
+  descriptor = lv2_descriptor( 0 );
+  handle = descriptor->instantiate( descriptor, rate, "", features );
+  lv2 = (FablaLV2*)handle;
+  worker = (const LV2_Worker_Interface*)descriptor->extension_data( LV2_WORKER__interface );
+
+  atomIn .resize( FABLA2_OFFLINE_ATOM_SIZE );
+  atomOut.resize( FABLA2_OFFLINE_ATOM_SIZE );
+  descriptor->connect_port( handle, ATOM_IN , &atomIn [0] );
+  descriptor->connect_port( handle, ATOM_OUT, &atomOut[0] );
+
+  for(int i = INPUT_L; i < PORT_COUNT; i++)
+  {
+    // control ports have a single value, audio ports a block
+    buffers[i].resize( i < MASTER_VOL ? maxBlock : 1, 0.f );
+    descriptor->connect_port( handle, i, &buffers[i][0] );
+  }
+  buffers[MASTER_VOL][0] = 0.5;
+
+  if( descriptor->activate )
+    descriptor->activate( handle );
+}
+
+Fabla2DSP* OfflineHost::dsp()
+{
+  return lv2->dsp;
+}
+
+LV2_URID OfflineHost::map( const char* uri )
+{
+  std::map<std::string, LV2_URID>::iterator it = uris.find( uri );
+  if( it != uris.end() )
+    return it->second;
+
+  LV2_URID id = urisById.size();
+  uris[uri] = id;
+  urisById.push_back( uri );
+  return id;
+}
+
+const char* OfflineHost::unmap( LV2_URID urid )
+{
+  if( urid >= urisById.size() )
+    return 0;
+  return urisById[urid].c_str();
+}
+
+LV2_URID OfflineHost::mapUri( LV2_URID_Map_Handle h, const char* uri )
+{
+  return ((OfflineHost*)h)->map( uri );
+}
+
+const char* OfflineHost::unmapUri( LV2_URID_Unmap_Handle h, LV2_URID urid )
+{
+  return ((OfflineHost*)h)->unmap( urid );
+}
+
+int OfflineHost::logVprintf( LV2_Log_Handle h, LV2_URID type, const char* fmt, va_list ap )
+{
+  OfflineHost* self = (OfflineHost*)h;
+  const char* t = self->unmap( type );
+  if( !self->verbose_ && t &&
+      ( !strcmp( t, LV2_LOG__Trace ) || !strcmp( t, LV2_LOG__Note ) ) )
+    return 0;
+  return vfprintf( stderr, fmt, ap );
+}
+
+int OfflineHost::logPrintf( LV2_Log_Handle h, LV2_URID type, const char* fmt, ... )
+{
+  va_list args;
+  va_start( args, fmt );
+  int ret = logVprintf( h, type, fmt, args );
+  va_end( args );
+  return ret;
+}
+
+bool OfflineHost::push( std::vector<uint8_t>& queue, size_t& used, uint32_t size, const void* data )
+{
+  if( used + sizeof(uint32_t) + size > queue.size() )
+    return false;
+  memcpy( &queue[used], &size, sizeof(uint32_t) );
+  memcpy( &queue[used + sizeof(uint32_t)], data, size );
+  used += sizeof(uint32_t) + size;
+  return true;
+}
+
+LV2_Worker_Status OfflineHost::schedule( LV2_Worker_Schedule_Handle h, uint32_t size, const void* data )
+{
+  OfflineHost* self = (OfflineHost*)h;
+  if( !push( self->jobs, self->jobsSize, size, data ) )
+    return LV2_WORKER_ERR_NO_SPACE;
+  return LV2_WORKER_SUCCESS;
+}
+
+LV2_Worker_Status OfflineHost::respond( LV2_Worker_Respond_Handle h, uint32_t size, const void* data )
+{
+  OfflineHost* self = (OfflineHost*)h;
+  if( !push( self->responses, self->responsesSize, size, data ) )
+    return LV2_WORKER_ERR_NO_SPACE;
+  return LV2_WORKER_SUCCESS;
+}
+
+void OfflineHost::work()
+{
+  // jobs may schedule more jobs: take the current ones first
+  std::vector<uint8_t> current( jobs.begin(), jobs.begin() + jobsSize );
+  jobsSize = 0;
+
+  size_t i = 0;
+  while( i < current.size() )
+  {
+    uint32_t size;
+    memcpy( &size, &current[i], sizeof(uint32_t) );
+    worker->work( handle, respond, this, size, &current[i + sizeof(uint32_t)] );
+    i += sizeof(uint32_t) + size;
+  }
+}
+
+void OfflineHost::control( int port, float value )
+{
+  if( port >= MASTER_VOL && port < PORT_COUNT )
+    buffers[port][0] = value;
+}
+
+void OfflineHost::atom( int frame, const LV2_Atom* a )
+{
+  Event e;
+  e.frame = frame;
+  e.atom.assign( (const uint8_t*)a, (const uint8_t*)a + sizeof(LV2_Atom) + a->size );
+  events.push_back( e );
+}
+
+void OfflineHost::midi( int frame, const uint8_t* msg, int size )
+{
+  Event e;
+  e.frame = frame;
+  e.atom.resize( sizeof(LV2_Atom) + size );
+  LV2_Atom* a = (LV2_Atom*)&e.atom[0];
+  a->size = size;
+  a->type = map( LV2_MIDI__MidiEvent );
+  memcpy( &e.atom[sizeof(LV2_Atom)], msg, size );
+  events.push_back( e );
+}
+
+void OfflineHost::prepare( int nframes )
+{
+  // the input sequence, events in frame order
+  std::stable_sort( events.begin(), events.end(), before );
+
+  LV2_Atom_Sequence* seq = (LV2_Atom_Sequence*)&atomIn[0];
+  seq->atom.type = map( LV2_ATOM__Sequence );
+  seq->atom.size = sizeof(LV2_Atom_Sequence_Body);
+  seq->body.unit = 0;
+  seq->body.pad  = 0;
+
+  for(size_t i = 0; i < events.size(); i++)
+  {
+    const LV2_Atom* a = (const LV2_Atom*)&events[i].atom[0];
+    const uint32_t evSize = sizeof(LV2_Atom_Event) + a->size;
+    if( sizeof(LV2_Atom) + seq->atom.size + lv2_atom_pad_size( evSize ) > atomIn.size() )
+    {
+      fprintf( stderr, "Fabla2 offline host: too many events in a block, dropping the rest\n" );
+      break;
+    }
+
+    LV2_Atom_Event* ev = (LV2_Atom_Event*)( (uint8_t*)&seq->body + lv2_atom_pad_size( seq->atom.size ) );
+    ev->time.frames = std::min( std::max( events[i].frame, 0 ), nframes - 1 );
+    memcpy( &ev->body, a, sizeof(LV2_Atom) + a->size );
+    seq->atom.size += lv2_atom_pad_size( evSize );
+  }
+  events.clear();
+
+  // the plugin writes its notifications into the space the host provides
+  LV2_Atom_Sequence* out = (LV2_Atom_Sequence*)&atomOut[0];
+  out->atom.type = 0;
+  out->atom.size = atomOut.size() - sizeof(LV2_Atom);
+}
+
+void OfflineHost::process( int nframes )
+{
+  assert( nframes <= maxBlock );
+  descriptor->run( handle, nframes );
+
+  // a host delivers the responses of the worker after run()
+  if( !hold )
+    deliver( -1 );
+}
+
+int OfflineHost::deliver( int count )
+{
+  int n = 0;
+  while( responsesRead < responsesSize && n != count )
+  {
+    uint32_t size;
+    memcpy( &size, &responses[responsesRead], sizeof(uint32_t) );
+    worker->work_response( handle, size, &responses[responsesRead + sizeof(uint32_t)] );
+    responsesRead += sizeof(uint32_t) + size;
+    n++;
+  }
+  
+  // the held responses move to the front
+  memmove( &responses[0], &responses[responsesRead], responsesSize - responsesRead );
+  responsesSize -= responsesRead;
+  responsesRead = 0;
+  return n;
+}
+
+void OfflineHost::run( int nframes )
+{
+  assert( nframes <= maxBlock );
+  prepare( nframes );
+  process( nframes );
+  work();
+}
+
+/// the state restore() reads: only the JSON
+struct OfflineState
+{
+  OfflineHost* host;
+  const std::string* json;
+};
+
+static const void* fabla2_offline_retrieve( LV2_State_Handle h, uint32_t key, size_t* size,
+                                            uint32_t* type, uint32_t* flags )
+{
+  OfflineState* s = (OfflineState*)h;
+  if( key != s->host->map( FABLA2_StateStringJSON ) )
+    return 0;
+
+  *size  = s->json->size() + 1;
+  *type  = s->host->map( LV2_ATOM__String );
+  *flags = 0;
+  return s->json->c_str();
+}
+
+static char* fabla2_offline_absolute_path( LV2_State_Map_Path_Handle h, const char* path )
+{
+  const std::string* dir = (const std::string*)h;
+  std::string abs = path;
+  if( path[0] != '/' && !dir->empty() )
+    abs = *dir + "/" + path;
+  return strdup( abs.c_str() );
+}
+
+static char* fabla2_offline_abstract_path( LV2_State_Map_Path_Handle h, const char* path )
+{
+  return strdup( path );
+}
+
+bool OfflineHost::restore( const std::string& json, const std::string& dir )
+{
+  const LV2_State_Interface* state =
+      (const LV2_State_Interface*)descriptor->extension_data( LV2_STATE__interface );
+
+  LV2_State_Map_Path mapPath;
+  mapPath.handle        = (LV2_State_Map_Path_Handle)&dir;
+  mapPath.abstract_path = fabla2_offline_abstract_path;
+  mapPath.absolute_path = fabla2_offline_absolute_path;
+  LV2_Feature fMapPath = { LV2_STATE__mapPath, &mapPath };
+  const LV2_Feature* features[] = { &fMapPath, 0 };
+
+  OfflineState s;
+  s.host = this;
+  s.json = &json;
+  LV2_State_Status ret = state->restore( handle, fabla2_offline_retrieve, &s, 0, features );
+
+  return ret == LV2_STATE_SUCCESS;
+}
+
+bool OfflineHost::restoreFile( const char* path )
+{
+  FILE* f = fopen( path, "rb" );
+  if( !f )
+  {
+    fprintf( stderr, "Fabla2 offline host: can't open kit %s\n", path );
+    return false;
+  }
+
+  std::string json;
+  char buf[4096];
+  size_t n;
+  while( ( n = fread( buf, 1, sizeof(buf), f ) ) > 0 )
+    json.append( buf, n );
+  fclose( f );
+
+  std::string dir = path;
+  size_t slash = dir.rfind( '/' );
+  dir = slash == std::string::npos ? "." : dir.substr( 0, slash );
+
+  return restore( json, dir );
+}
+
+OfflineHost::~OfflineHost()
+{
+  if( descriptor->deactivate )
+    descriptor->deactivate( handle );
+  descriptor->cleanup( handle );
+}
+
+}; // Fabla2
@@ -0,0 +1,152 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef OPENAV_FABLA2_OFFLINE_HOST_HXX
+#define OPENAV_FABLA2_OFFLINE_HOST_HXX
+
+#include "../shared.hxx"
+#include "../dsp/ports.hxx"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+class FablaLV2;
+
+namespace Fabla2
+{
+
+class Fabla2DSP;
+
+/** OfflineHost
+ * A minimal LV2 host for the offline tools: it instantiates the plugin
+ * without audio hardware, and provides the URID map, a worker, the log and
+ * the port buffers. The worker runs between blocks in the calling thread, so
+ * a run is deterministic and its cost is kept out of block timings.
+ */
+class OfflineHost
+{
+  public:
+    /// blocks can be up to maxBlock frames, at most FABLA2_BLOCK_MAX. URIs
+    /// in urids are mapped to the URID given, to replay events with the
+    /// URIDs of another host
+    OfflineHost( int rate, int maxBlock,
+                 const std::map<std::string, LV2_URID>* urids = 0 );
+    ~OfflineHost();
+
+    FablaLV2*  plugin(){return lv2;}
+    Fabla2DSP* dsp();
+    int        rate(){return sr;}
+
+    /// restores a kit from the Fabla2 state JSON: relative sample paths are
+    /// relative to dir. The kit plays after the next block
+    bool restore( const std::string& json, const std::string& dir );
+    /// restores a kit from a JSON file, with the samples relative to it
+    bool restoreFile( const char* path );
+
+    /// sets a control port, values start at the defaults of the ttl
+    void control( int port, float value );
+
+    /// queues a MIDI message for the next block, at frame offset frame
+    void midi( int frame, const uint8_t* msg, int size );
+    /// queues an Atom event for the next block, as the UI would send it
+    void atom( int frame, const LV2_Atom* a );
+
+    /// runs a block of nframes: prepare() writes the queued events to the
+    /// input port, process() runs the plugin and delivers worker responses,
+    /// work() runs the jobs the plugin scheduled
+    void prepare( int nframes );
+    void process( int nframes );
+    void work();
+    void run( int nframes );
+
+    /// output buffers, by Fabla2Ports index
+    const float* output( int port ){return &buffers[port][0];}
+    /// input buffers, to write the audio of the next block
+    float* input( int port ){return &buffers[port][0];}
+    
+    /// when true, process() keeps the worker responses for deliver()
+    void holdResponses( bool h ){hold = h;}
+    /// delivers up to count held responses in order, returns how many
+    int deliver( int count );
+
+    /// when true, trace and note messages of the plugin are printed too
+    void verbose( bool v ){verbose_ = v;}
+
+    /// URID map shared with the plugin
+    LV2_URID map( const char* uri );
+    const char* unmap( LV2_URID urid );
+
+  private:
+    int sr;
+    int maxBlock;
+    bool verbose_;
+    bool hold;
+
+    const LV2_Descriptor* descriptor;
+    LV2_Handle handle;
+    FablaLV2*  lv2;
+    const LV2_Worker_Interface* worker;
+
+    std::map<std::string, LV2_URID> uris;
+    std::vector<std::string> urisById;
+
+    LV2_URID_Map        mapFeature;
+    LV2_URID_Unmap      unmapFeature;
+    LV2_Worker_Schedule scheduleFeature;
+    LV2_Log_Log         logFeature;
+
+    /// port buffers, the atom ports are sequences
+    std::vector<float> buffers[PORT_COUNT];
+    std::vector<uint8_t> atomIn;
+    std::vector<uint8_t> atomOut;
+
+    /// events for the next block, ordered by frame when written
+    struct Event
+    {
+      int frame;
+      std::vector<uint8_t> atom;
+    };
+    std::vector<Event> events;
+    static bool before( const Event& a, const Event& b ){return a.frame < b.frame;}
+
+    /// worker jobs and responses: fixed size, so scheduling doesn't allocate
+    std::vector<uint8_t> jobs;
+    size_t jobsSize;
+    std::vector<uint8_t> responses;
+    size_t responsesSize;
+    /// responses before this offset were delivered
+    size_t responsesRead;
+
+    static LV2_URID    mapUri  ( LV2_URID_Map_Handle h, const char* uri );
+    static const char* unmapUri( LV2_URID_Unmap_Handle h, LV2_URID urid );
+    static LV2_Worker_Status schedule( LV2_Worker_Schedule_Handle h, uint32_t size, const void* data );
+    static LV2_Worker_Status respond ( LV2_Worker_Respond_Handle h, uint32_t size, const void* data );
+    static int logPrintf ( LV2_Log_Handle h, LV2_URID type, const char* fmt, ... );
+    static int logVprintf( LV2_Log_Handle h, LV2_URID type, const char* fmt, va_list ap );
+
+    static bool push( std::vector<uint8_t>& queue, size_t& used, uint32_t size, const void* data );
+};
+
+}; // Fabla2
+
+#endif // OPENAV_FABLA2_OFFLINE_HOST_HXX
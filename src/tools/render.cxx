@@ -0,0 +1,317 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+// fabla2render: renders Standard MIDI Files through a saved Fabla2 kit, as
+// fast as the CPU allows, writing the master and each aux bus to a stem WAV.
+// Several files render in parallel, each with its own plugin instance.
+
+#include "offline_host.hxx"
+#include "midi_file.hxx"
+
+#include "../dsp/fabla2.hxx"
+
+#include <sndfile.h>
+
+#include <set>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Fabla2;
+
+struct Options
+{
+  Options() :
+    out( "." ),
+    rate( 48000 ),
+    block( 512 ),
+    polyphony( 0 ),
+    jobs( 0 ),
+    tail( 10 ),
+    format( SF_FORMAT_WAV | SF_FORMAT_FLOAT ),
+    masterOnly( false )
+  {
+  }
+
+  std::string kit;
+  std::string out;
+  std::vector<std::string> files;
+  int   rate;
+  int   block;
+  int   polyphony;
+  int   jobs;
+  float tail;
+  int   format;
+  bool  masterOnly;
+};
+
+/// the stems: output port pairs, and the suffix of their file
+static const struct { int port; const char* name; } stems[] = {
+  { OUTPUT_L , "master" },
+  { AUXBUS1_L, "aux1"   },
+  { AUXBUS2_L, "aux2"   },
+  { AUXBUS3_L, "aux3"   },
+  { AUXBUS4_L, "aux4"   },
+};
+#define FABLA2_RENDER_STEMS 5
+
+static uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage()
+{
+  fprintf( stderr,
+    "usage: fabla2render --kit file.json [options] file.mid...\n"
+    "  --kit file.json       Fabla2 state JSON, samples relative to it\n"
+    "  --out dir             directory of the stems (.)\n"
+    "  --rate n              sample rate (48000)\n"
+    "  --block n             frames per block, up to %i (512)\n"
+    "  --polyphony n         voices, else the default of the plugin\n"
+    "  --jobs n              files rendered in parallel (one per core)\n"
+    "  --tail s              most seconds rendered after the last event,\n"
+    "                        while voices still play (10)\n"
+    "  --format name         float, 24 or 16 bit WAV (float)\n"
+    "  --master-only         write the master stem only\n"
+    "Each file.mid is written to <out>/<file>_master.wav, and _aux1 to _aux4.\n",
+    FABLA2_BLOCK_MAX );
+}
+
+/// file name without its directory and extension
+static std::string baseName( const std::string& path )
+{
+  size_t slash = path.rfind( '/' );
+  std::string name = slash == std::string::npos ? path : path.substr( slash + 1 );
+  size_t dot = name.rfind( '.' );
+  return dot == std::string::npos || dot == 0 ? name : name.substr( 0, dot );
+}
+
+static bool render( const Options& o, const std::string& path )
+{
+  MidiFile midi;
+  if( !midi.load( path.c_str() ) )
+    return false;
+
+  const uint64_t start = now();
+
+  OfflineHost host( o.rate, o.block );
+  if( !host.restoreFile( o.kit.c_str() ) )
+    return false;
+
+  // swap the kit in, and let the worker free the empty one. The settings of
+  // the kit apply with the swap, the options after it
+  for(int i = 0; i < 4; i++)
+    host.run( o.block );
+  if( o.polyphony > 0 )
+    host.dsp()->polyphony( o.polyphony );
+
+  const int nStems = o.masterOnly ? 1 : FABLA2_RENDER_STEMS;
+  const std::string base = o.out + "/" + baseName( path );
+  SNDFILE* files[FABLA2_RENDER_STEMS] = { 0 };
+  bool ok = true;
+  for(int s = 0; s < nStems && ok; s++)
+  {
+    std::string name = base + "_" + stems[s].name + ".wav";
+    SF_INFO info;
+    memset( &info, 0, sizeof(info) );
+    info.samplerate = o.rate;
+    info.channels   = 2;
+    info.format     = o.format;
+    files[s] = sf_open( name.c_str(), SFM_WRITE, &info );
+    if( !files[s] )
+    {
+      fprintf( stderr, "fabla2render: can't write %s: %s\n", name.c_str(), sf_strerror( 0 ) );
+      ok = false;
+    }
+  }
+
+  // events to frames: rounding to the nearest frame keeps them sample accurate
+  const std::vector<MidiFile::Event>& events = midi.events();
+  std::vector<long> frames( events.size() );
+  for(size_t i = 0; i < events.size(); i++)
+    frames[i] = lrint( events[i].time * o.rate );
+
+  const long last    = events.empty() ? 0 : frames.back();
+  const long tailEnd = last + (long)( o.tail * o.rate );
+
+  std::vector<float> interleaved( o.block * 2 );
+  size_t next = 0;
+  long frame = 0;
+
+  while( ok )
+  {
+    for( ; next < events.size() && frames[next] < frame + o.block; next++ )
+      host.midi( frames[next] - frame, events[next].msg, events[next].size );
+
+    host.run( o.block );
+
+    for(int s = 0; s < nStems; s++)
+    {
+      const float* L = host.output( stems[s].port );
+      const float* R = host.output( stems[s].port + 1 );
+      for(int i = 0; i < o.block; i++)
+      {
+        interleaved[i*2  ] = L[i];
+        interleaved[i*2+1] = R[i];
+      }
+      if( sf_writef_float( files[s], &interleaved[0], o.block ) != o.block )
+      {
+        fprintf( stderr, "fabla2render: writing %s failed: %s\n", path.c_str(), sf_strerror( files[s] ) );
+        ok = false;
+      }
+    }
+    frame += o.block;
+
+    // done when the last event played and its voices finished
+    if( next == events.size() && frame > last &&
+        ( host.dsp()->activeVoices() == 0 || frame >= tailEnd ) )
+      break;
+  }
+
+  for(int s = 0; s < nStems; s++)
+    if( files[s] )
+      sf_close( files[s] );
+  if( !ok )
+    return false;
+
+  const double seconds = ( now() - start ) / 1000000000.;
+  const double audio   = double(frame) / o.rate;
+  printf( "fabla2render: %s, %zu events, %.1f s of audio in %.2f s (%.0fx realtime)\n",
+          path.c_str(), events.size(), audio, seconds, audio / seconds );
+  return true;
+}
+
+/// renders files until none are left to take, run by each job thread
+static void renderFiles( const Options* o, std::atomic<int>* next, std::atomic<int>* failed )
+{
+  for(;;)
+  {
+    const int i = (*next)++;
+    if( i >= (int)o->files.size() )
+      return;
+    if( !render( *o, o->files[i] ) )
+      (*failed)++;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  Options o;
+
+  for(int i = 1; i < argc; i++)
+  {
+    const char* a = argv[i];
+    if( !strcmp( a, "--help" ) )
+    {
+      usage();
+      return 0;
+    }
+    if( !strcmp( a, "--master-only" ) )
+    {
+      o.masterOnly = true;
+      continue;
+    }
+    if( strncmp( a, "--", 2 ) )
+    {
+      o.files.push_back( a );
+      continue;
+    }
+
+    const char* v = i + 1 < argc ? argv[i+1] : 0;
+    if( !v )
+    {
+      usage();
+      return 1;
+    }
+
+    if(      !strcmp( a, "--kit"       ) ) o.kit = v;
+    else if( !strcmp( a, "--out"       ) ) o.out = v;
+    else if( !strcmp( a, "--rate"      ) ) o.rate = atoi( v );
+    else if( !strcmp( a, "--block"     ) ) o.block = atoi( v );
+    else if( !strcmp( a, "--polyphony" ) ) o.polyphony = atoi( v );
+    else if( !strcmp( a, "--jobs"      ) ) o.jobs = atoi( v );
+    else if( !strcmp( a, "--tail"      ) ) o.tail = atof( v );
+    else if( !strcmp( a, "--format"    ) )
+    {
+      if(      !strcmp( v, "float" ) ) o.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+      else if( !strcmp( v, "24"    ) ) o.format = SF_FORMAT_WAV | SF_FORMAT_PCM_24;
+      else if( !strcmp( v, "16"    ) ) o.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+      else
+      {
+        usage();
+        return 1;
+      }
+    }
+    else
+    {
+      usage();
+      return 1;
+    }
+    i++;
+  }
+
+  if( o.kit.empty() || o.files.empty() || o.rate < 1 ||
+      o.block < 1 || o.block > FABLA2_BLOCK_MAX )
+  {
+    usage();
+    return 1;
+  }
+
+  // stems are named after their file: two files of the same name would write
+  // to the same stems
+  std::set<std::string> names;
+  for(size_t i = 0; i < o.files.size(); i++)
+  {
+    if( !names.insert( baseName( o.files[i] ) ).second )
+    {
+      fprintf( stderr, "fabla2render: more than one file named %s\n", baseName( o.files[i] ).c_str() );
+      return 1;
+    }
+  }
+
+  int jobs = o.jobs > 0 ? o.jobs : std::thread::hardware_concurrency();
+  if( jobs < 1 )
+    jobs = 1;
+  if( jobs > (int)o.files.size() )
+    jobs = o.files.size();
+
+  std::atomic<int> next( 0 );
+  std::atomic<int> failed( 0 );
+  std::vector<std::thread> pool;
+  for(int t = 1; t < jobs; t++)
+    pool.push_back( std::thread( renderFiles, &o, &next, &failed ) );
+  renderFiles( &o, &next, &failed );
+  for(size_t t = 0; t < pool.size(); t++)
+    pool[t].join();
+
+  if( failed )
+    fprintf( stderr, "fabla2render: %i of %zu files failed\n", failed.load(), o.files.size() );
+  return failed ? 1 : 0;
+}
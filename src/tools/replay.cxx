@@ -0,0 +1,361 @@
+/*
+ * Author: Harry van Haaren 2014
+ *         harryhaaren@gmail.com
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+// fabla2replay: plays a trace captured with FABLA2_CAPTURE through a new
+// plugin instance, block by block as the host ran it, and checks that the
+// output is the same. Bugs seen live can be debugged and profiled offline.
+
+#include "offline_host.hxx"
+
+#include "../dsp/fabla2.hxx"
+#include "../dsp/capture.hxx"
+#include "../dsp/kit_state.hxx"
+
+#include <lv2/lv2plug.in/ns/ext/atom/util.h>
+
+#include <sndfile.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Fabla2;
+
+struct Options
+{
+  Options() :
+    repeat( 1 ),
+    quiet( false )
+  {
+  }
+
+  std::string trace;
+  std::string kit;
+  std::string out;
+  int  repeat;
+  bool quiet;
+};
+
+static uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage()
+{
+  fprintf( stderr,
+    "usage: fabla2replay [options] file.trace\n"
+    "  --kit file.json       Fabla2 state JSON of the kit that played, samples\n"
+    "                        relative to it\n"
+    "  --out file.wav        write the master output of the replay\n"
+    "  --repeat n            replay n times, to profile (1)\n"
+    "  --quiet               don't print the timing of the blocks\n"
+    "Traces are written to the directory in FABLA2_CAPTURE, one per instance.\n"
+    "Exits with 0 when the replay is exact, 2 when a block differs.\n" );
+}
+
+/// the fingerprint the plugin gives the kit when it restores the JSON
+static bool kitFingerprint( OfflineHost& host, const char* path, uint64_t& fingerprint )
+{
+  FILE* f = fopen( path, "rb" );
+  if( !f )
+  {
+    fprintf( stderr, "fabla2replay: can't open kit %s\n", path );
+    return false;
+  }
+  std::string json;
+  char buf[4096];
+  size_t n;
+  while( ( n = fread( buf, 1, sizeof(buf), f ) ) > 0 )
+    json.append( buf, n );
+  fclose( f );
+
+  // settings the JSON doesn't have keep the values of the instance, as
+  // restore() does
+  Fabla2DSP* dsp = host.dsp();
+  KitState kit;
+  kit.polyphony       = dsp->polyphony();
+  kit.stealPolicy     = dsp->stealPolicy();
+  kit.renderThreads   = dsp->renderThreads();
+  kit.streamThreshold = dsp->streamThreshold();
+  kit.compactSamples  = dsp->compactSamples();
+  kit.sampleRateMode  = dsp->sampleRateMode();
+  kit.sampleCacheMB   = dsp->sampleCacheSize();
+  for(int a = 0; a < 4; a++)
+    kit.auxBusVol[a] = dsp->auxBusVol[a];
+
+  if( !kit.fromJson( json.c_str() ) )
+  {
+    fprintf( stderr, "fabla2replay: %s is not a Fabla2 kit\n", path );
+    return false;
+  }
+  fingerprint = kit.fingerprint();
+  return true;
+}
+
+/// replays the trace once, adding the time of each block to times. Returns
+/// 0 when exact, 2 when not, 1 on errors
+static int replay( const Options& o, CaptureReader& trace, bool report,
+                   std::vector<uint64_t>& times )
+{
+  OfflineHost host( trace.rate(), FABLA2_BLOCK_MAX, &trace.uris() );
+  host.holdResponses( true );
+
+  // the kit is restored before the first block that played it
+  long kitBlock = -1;
+  if( !o.kit.empty() )
+  {
+    uint64_t fingerprint = 0;
+    if( !kitFingerprint( host, o.kit.c_str(), fingerprint ) )
+      return 1;
+
+    CaptureReader::Block b;
+    long firstKit = -1;
+    for(long i = 0; trace.next( b ); i++)
+    {
+      if( b.kitFingerprint == fingerprint )
+      {
+        kitBlock = i;
+        break;
+      }
+      if( firstKit < 0 && b.kitFingerprint )
+        firstKit = i;
+    }
+    trace.rewind();
+
+    if( kitBlock < 0 )
+    {
+      // the kit was changed since: play it where the first kit played
+      kitBlock = firstKit < 0 ? 0 : firstKit;
+      if( report )
+        fprintf( stderr, "fabla2replay: %s is not the kit in the trace, the replay won't be exact\n",
+                 o.kit.c_str() );
+    }
+  }
+
+  SNDFILE* wav = 0;
+  if( !o.out.empty() && report )
+  {
+    SF_INFO info;
+    memset( &info, 0, sizeof(info) );
+    info.samplerate = trace.rate();
+    info.channels   = 2;
+    info.format     = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+    wav = sf_open( o.out.c_str(), SFM_WRITE, &info );
+    if( !wav )
+    {
+      fprintf( stderr, "fabla2replay: can't write %s: %s\n", o.out.c_str(), sf_strerror( 0 ) );
+      return 1;
+    }
+  }
+
+  CaptureReader::Block b;
+  std::vector<float> interleaved;
+  long blocks   = 0;
+  long frames   = 0;
+  long mismatch = -1;
+  long mismatchFrame = 0;
+  long mismatches = 0;
+  int  ret = 0;
+
+  while( trace.next( b ) )
+  {
+    if( b.nframes < 1 || b.nframes > FABLA2_BLOCK_MAX )
+    {
+      fprintf( stderr, "fabla2replay: block %li has %i frames, up to %i are supported\n",
+               blocks, b.nframes, FABLA2_BLOCK_MAX );
+      ret = 1;
+      break;
+    }
+
+    if( blocks == kitBlock && !host.restoreFile( o.kit.c_str() ) )
+    {
+      ret = 1;
+      break;
+    }
+
+    // the responses the host delivered before the block
+    const int delivered = host.deliver( b.responses );
+    if( delivered != b.responses && report && mismatch < 0 )
+      fprintf( stderr, "fabla2replay: block %li had %i worker responses, the replay has %i\n",
+               blocks, b.responses, delivered );
+
+    for(int i = 0; i < FABLA2_CAPTURE_CONTROLS; i++)
+      host.control( MASTER_VOL + i, b.controls[i] );
+
+    if( !b.inL.empty() )
+    {
+      memcpy( host.input( INPUT_L ), &b.inL[0], sizeof(float) * b.nframes );
+      memcpy( host.input( INPUT_R ), &b.inR[0], sizeof(float) * b.nframes );
+    }
+
+    // the events of the sequence, with the URIDs of the capture
+    size_t at = 0;
+    while( at + sizeof(LV2_Atom_Event) <= b.events.size() )
+    {
+      const LV2_Atom_Event* ev = (const LV2_Atom_Event*)&b.events[at];
+      const size_t size = sizeof(LV2_Atom_Event) + ev->body.size;
+      if( at + size > b.events.size() )
+        break;
+      host.atom( ev->time.frames, &ev->body );
+      at += lv2_atom_pad_size( size );
+    }
+
+    host.prepare( b.nframes );
+    const uint64_t start = now();
+    host.process( b.nframes );
+    times.push_back( now() - start );
+    host.work();
+
+    const float* L = host.output( OUTPUT_L );
+    const float* R = host.output( OUTPUT_R );
+    if( Capture::hash( b.nframes, L, R ) != b.hash )
+    {
+      if( mismatch < 0 )
+      {
+        mismatch = blocks;
+        mismatchFrame = frames;
+      }
+      mismatches++;
+    }
+
+    if( wav )
+    {
+      interleaved.resize( b.nframes * 2 );
+      for(int i = 0; i < b.nframes; i++)
+      {
+        interleaved[i*2  ] = L[i];
+        interleaved[i*2+1] = R[i];
+      }
+      sf_writef_float( wav, &interleaved[0], b.nframes );
+    }
+
+    blocks++;
+    frames += b.nframes;
+  }
+
+  if( wav )
+    sf_close( wav );
+  if( ret )
+    return ret;
+
+  if( report )
+  {
+    if( trace.end() < 0 )
+      fprintf( stderr, "fabla2replay: the trace is truncated, the capture didn't stop\n" );
+    else if( trace.end() == Capture::END_OVERFLOW )
+      fprintf( stderr, "fabla2replay: the capture overflowed, the trace stops there\n" );
+
+    if( mismatch < 0 )
+      printf( "fabla2replay: exact, %li blocks\n", blocks );
+    else
+      printf( "fabla2replay: %li of %li blocks differ, the first is block %li (frame %li)\n",
+              mismatches, blocks, mismatch, mismatchFrame );
+  }
+
+  return mismatch < 0 ? 0 : 2;
+}
+
+int main( int argc, char** argv )
+{
+  Options o;
+
+  for(int i = 1; i < argc; i++)
+  {
+    const char* a = argv[i];
+    if( !strcmp( a, "--help" ) )
+    {
+      usage();
+      return 0;
+    }
+    if( !strcmp( a, "--quiet" ) )
+    {
+      o.quiet = true;
+      continue;
+    }
+    if( strncmp( a, "--", 2 ) )
+    {
+      if( !o.trace.empty() )
+      {
+        usage();
+        return 1;
+      }
+      o.trace = a;
+      continue;
+    }
+
+    const char* v = i + 1 < argc ? argv[i+1] : 0;
+    if( !v )
+    {
+      usage();
+      return 1;
+    }
+
+    if(      !strcmp( a, "--kit"    ) ) o.kit = v;
+    else if( !strcmp( a, "--out"    ) ) o.out = v;
+    else if( !strcmp( a, "--repeat" ) ) o.repeat = atoi( v );
+    else
+    {
+      usage();
+      return 1;
+    }
+    i++;
+  }
+
+  if( o.trace.empty() || o.repeat < 1 )
+  {
+    usage();
+    return 1;
+  }
+
+  CaptureReader trace;
+  if( !trace.open( o.trace.c_str() ) )
+    return 1;
+
+  // the first replay reports, all of them are timed
+  std::vector<uint64_t> times;
+  int ret = 0;
+  for(int r = 0; r < o.repeat && ret != 1; r++)
+  {
+    trace.rewind();
+    int result = replay( o, trace, r == 0, times );
+    if( r == 0 || result == 1 )
+      ret = result;
+  }
+
+  if( !o.quiet && !times.empty() )
+  {
+    uint64_t total = 0;
+    for(size_t i = 0; i < times.size(); i++)
+      total += times[i];
+    std::sort( times.begin(), times.end() );
+    printf( "fabla2replay: %zu blocks timed, block us mean %.3f p99 %.3f max %.3f\n",
+            times.size(), total / 1000. / times.size(),
+            times[ (times.size() - 1) * 99 / 100 ] / 1000., times.back() / 1000. );
+  }
+  return ret;
+}
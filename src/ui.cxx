@@ -171,6 +171,33 @@ static void fabla2_port_event(LV2UI_Handle handle,
       ui->waveform->show( FABLA2_UI_WAVEFORM_PX, data );
       ui->redraw();
     }
+    else if( obj->body.otype == ui->uris.fabla2_Telemetry )
+    {
+      const LV2_Atom* load      = 0;
+      const LV2_Atom* loadWorst = 0;
+      const LV2_Atom* voices    = 0;
+      lv2_atom_object_get( obj,
+          ui->uris.fabla2_load     , &load,
+          ui->uris.fabla2_loadWorst, &loadWorst,
+          ui->uris.fabla2_voices   , &voices,
+          NULL);
+      
+      if( !load      || load->type      != ui->uris.atom_Float ||
+          !loadWorst || loadWorst->type != ui->uris.atom_Float ||
+          !voices    || voices->type    != ui->uris.atom_Float )
+      {
+        fprintf(stderr, "Fabla2 UI error: Corrupt telemetry message\n");
+        return;
+      }
+      
+      char text[64];
+      snprintf( text, 64, "DSP %.0f%% (max %.0f%%) %.1f voices",
+                ((const LV2_Atom_Float*)load)->body * 100,
+                ((const LV2_Atom_Float*)loadWorst)->body * 100,
+                ((const LV2_Atom_Float*)voices)->body );
+      ui->dspLoad->label( text );
+      ui->redraw();
+    }
     else if( obj->body.otype == ui->uris.fabla2_PadRefreshLayers )
     {
       const LV2_Atom* bank = 0;
@@ -49,6 +49,8 @@ TestUI::TestUI( PuglNativeWindow parent ):
   headerImage = new Avtk::Image( this, w()-130, 0, 130, 36, "Header Image - OpenAV" );
   headerImage->load( header_openav.pixel_data );
   
+  dspLoad = new Avtk::Text( this, w()-130-150, 14, 140, 14, "DSP -" );
+  
   int s = 32;
   bankBtns[0] = new Avtk::Button( this, 5      , 43    , s, s, "A" );
   
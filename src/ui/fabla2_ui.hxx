@@ -67,6 +67,9 @@ class TestUI : public Avtk::UI
     // sample info
     Avtk::Text* sampleName;
     
+    /// DSP load and voices of the last second, from the Telemetry message
+    Avtk::Text* dspLoad;
+    
     // delete layer dialog
     Avtk::Dialog* deleteLayer;
     